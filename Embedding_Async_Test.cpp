@@ -0,0 +1,110 @@
+#include "kvstore.h"
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// 异步 embedding：put 立即返回，sync_embeddings 之后向量全部进入索引，查询结果与同步写入相同；
+// 覆盖写入以最后一次为准，向量算好之前删除的 key 不会变得可查 (需要 embedding 模型)
+
+const std::string DIR = "./embedding_async_data";
+const int TOTAL = 64;
+const int K = 3;
+
+using Results = std::vector<std::vector<std::pair<uint64_t, std::string>>>;
+
+std::string make_text(int i) {
+  static const char *topics[] = {"storage engines", "graph search", "sea turtles", "baking bread"};
+  return "Document " + std::to_string(i) + " is a short note about " + topics[i % 4] + ", revision " +
+         std::to_string(i * 7 % 13) + ".";
+}
+
+// 写入 0..TOTAL-1，把 key 5 覆盖为另一段文本，写入后立即删除 key TOTAL，返回每段文本的精确查询结果
+Results run(KVStore &store) {
+  store.reset();
+  for (int i = 0; i < TOTAL; i++) {
+    store.put(i, make_text(i));
+  }
+  store.put(5, make_text(TOTAL + 5));
+  store.put(TOTAL, make_text(TOTAL));
+  store.del(TOTAL);
+  store.sync_embeddings();
+
+  Results results;
+  for (int i = 0; i <= TOTAL + 5; i++) {
+    results.push_back(store.search_knn(make_text(i), K));
+  }
+  return results;
+}
+
+int main() {
+  std::filesystem::create_directories(DIR);
+  bool pass = true;
+
+  Results expected;
+  {
+    KVStore store(DIR);
+    expected = run(store);
+  }
+
+  HNSWOptions options;
+  options.async_embedding = true;
+  options.embedding_batch_size = 8;
+  options.embedding_cache_entries = 0; // 每段文本都经过后台推理
+  KVStore store(DIR, "", options);
+  Results results = run(store);
+
+  if (store.pending_embeddings() != 0) {
+    std::cout << "Error: " << store.pending_embeddings() << " embeddings pending after sync" << std::endl;
+    pass = false;
+  }
+  for (int i = 0; i < TOTAL; i++) {
+    if (!store.is_vector_searchable(i)) {
+      std::cout << "Error: key " << i << " not searchable after sync" << std::endl;
+      pass = false;
+    }
+  }
+  if (store.is_vector_searchable(TOTAL)) {
+    std::cout << "Error: key deleted before its embedding was applied is searchable" << std::endl;
+    pass = false;
+  }
+  if (results != expected) {
+    std::cout << "Error: asynchronous embedding changed search results" << std::endl;
+    pass = false;
+  }
+  for (const auto &result : results) {
+    for (const auto &item : result) {
+      if (item.first == static_cast<uint64_t>(TOTAL)) {
+        std::cout << "Error: deleted key returned" << std::endl;
+        pass = false;
+      }
+    }
+  }
+  // 覆盖写入的 key 5 只能通过新文本找到
+  const auto &rewritten = results[TOTAL + 5];
+  if (rewritten.empty() || rewritten[0].first != 5 || rewritten[0].second != make_text(TOTAL + 5)) {
+    std::cout << "Error: key 5 does not carry its latest text and vector" << std::endl;
+    pass = false;
+  }
+
+  // put 之后立即查询：向量要么已进入索引，要么仍在排队
+  store.put(TOTAL + 1, make_text(TOTAL + 1));
+  if (!store.is_vector_searchable(TOTAL + 1) && store.pending_embeddings() == 0) {
+    std::cout << "Error: key neither searchable nor pending after put" << std::endl;
+    pass = false;
+  }
+  store.sync_embeddings();
+  if (!store.is_vector_searchable(TOTAL + 1)) {
+    std::cout << "Error: key not searchable after sync" << std::endl;
+    pass = false;
+  }
+  store.reset();
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include "kvstore.h"
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// del 超过 consolidate_ratio 后在后台整理墓碑：整理期间搜索照常进行，删除的 key 不会出现在结果中，
+// 整理完成后 (下一次写入或显式调用) 节点真正移出图，召回率与精确 search_knn 相比不下降
+
+const std::string DIR = "./hnsw_consolidate_data";
+const int DIM = 768;
+
+std::vector<float> make_vector(std::mt19937 &rng) {
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vec(DIM);
+  for (float &v : vec) {
+    v = dist(rng);
+  }
+  return vec;
+}
+
+// 真实 embedding 的本征维度远低于 768：向量落在 32 个簇中心附近
+std::vector<float> make_clustered_vector(std::mt19937 &rng, const std::vector<std::vector<float>> &centers) {
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vec = centers[rng() % centers.size()];
+  for (float &v : vec) {
+    v += noise(rng);
+  }
+  return vec;
+}
+
+// HNSW 前 k 个结果在精确结果中的比例；结果里出现已删除的 key 时计入 deleted_hits
+double recall_at_k(KVStore &store, const std::vector<std::vector<float>> &queries, int k,
+                   const std::set<uint64_t> &deleted, int &deleted_hits) {
+  size_t found = 0, expected = 0;
+  for (const auto &query : queries) {
+    std::set<uint64_t> exact;
+    for (const auto &item : store.search_knn(query, k)) {
+      exact.insert(item.first);
+    }
+    for (const auto &item : store.search_knn_hnsw(query, k)) {
+      found += exact.count(item.first);
+      deleted_hits += deleted.count(item.first);
+    }
+    expected += exact.size();
+  }
+  return expected == 0 ? 0.0 : static_cast<double>(found) / expected;
+}
+
+int main() {
+  std::filesystem::create_directories(DIR);
+  const int total = 2000;
+  const int k = 10;
+  std::mt19937 rng(11);
+
+  HNSWOptions options;
+  options.consolidate_ratio = 0.1;
+  KVStore store(DIR, "", options);
+  store.reset();
+
+  std::vector<std::vector<float>> centers;
+  for (int i = 0; i < 32; i++) {
+    centers.push_back(make_vector(rng));
+  }
+  std::vector<std::vector<float>> vecs(total);
+  for (int i = 0; i < total; i++) {
+    vecs[i] = make_clustered_vector(rng, centers);
+    store.put_with_precomputed_embedding(i, "v" + std::to_string(i), vecs[i]);
+  }
+  std::vector<std::vector<float>> queries;
+  for (int i = 0; i < 50; i++) {
+    queries.push_back(make_clustered_vector(rng, centers));
+  }
+
+  bool pass = true;
+  // 删除 20% 的 key (del 只认得 memtable 中的 key，值很短，全部留在 memtable)；
+  // 第 200 次 del 启动后台整理，之后每次 del 都穿插一次搜索，与整理线程并发
+  std::set<uint64_t> deleted;
+  int deleted_hits = 0;
+  for (int i = 0; i < total; i += 5) {
+    if (!store.del(i)) {
+      std::cout << "Error: del(" << i << ") failed" << std::endl;
+      pass = false;
+    }
+    deleted.insert(i);
+    for (const auto &item : store.search_knn_hnsw(vecs[i], k)) {
+      deleted_hits += deleted.count(item.first);
+    }
+  }
+  double recall_during = recall_at_k(store, queries, k, deleted, deleted_hits);
+
+  // 后台整理移除的节点和剩余的墓碑一起计入返回值
+  size_t removed = store.consolidate_hnsw_deletions();
+  if (removed != deleted.size()) {
+    std::cout << "Error: consolidated " << removed << " nodes, expected " << deleted.size() << std::endl;
+    pass = false;
+  }
+  if (store.consolidate_hnsw_deletions() != 0) {
+    std::cout << "Error: second consolidation found tombstones" << std::endl;
+    pass = false;
+  }
+  double recall_after = recall_at_k(store, queries, k, deleted, deleted_hits);
+
+  // 新写入复用被释放的 label，仍能被搜到
+  int missing = 0;
+  for (int i = total; i < total + 200; i++) {
+    std::vector<float> vec = make_clustered_vector(rng, centers);
+    store.put_with_precomputed_embedding(i, "v" + std::to_string(i), vec);
+    auto result = store.search_knn_hnsw(vec, 1);
+    if (result.empty() || result[0].first != static_cast<uint64_t>(i)) {
+      missing++;
+    }
+  }
+
+  std::cout << "recall@" << k << " with tombstones " << recall_during << ", after consolidation " << recall_after
+            << std::endl;
+  if (deleted_hits > 0) {
+    std::cout << "Error: deleted keys returned " << deleted_hits << " times" << std::endl;
+    pass = false;
+  }
+  if (recall_during < 0.9 || recall_after < 0.9) {
+    std::cout << "Error: recall dropped below 0.9" << std::endl;
+    pass = false;
+  }
+  if (missing > 0) {
+    std::cout << "Error: " << missing << " keys inserted after consolidation not found" << std::endl;
+    pass = false;
+  }
+  store.reset();
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+#include "kvstore.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// 过滤搜索只返回满足条件的 key，召回率与对满足条件的 key 做精确计算相比不低于 0.9；
+// 条件宽松时谓词只对遍历到的节点调用，条件苛刻时改为暴力计算，结果是精确的
+
+const std::string DIR = "./hnsw_filter_data";
+const int DIM = 768;
+const int TOTAL = 3000;
+const int K = 10;
+
+std::vector<float> make_vector(std::mt19937 &rng) {
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vec(DIM);
+  for (float &v : vec) {
+    v = dist(rng);
+  }
+  return vec;
+}
+
+std::vector<float> make_clustered_vector(std::mt19937 &rng, const std::vector<std::vector<float>> &centers) {
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vec = centers[rng() % centers.size()];
+  for (float &v : vec) {
+    v += noise(rng);
+  }
+  return vec;
+}
+
+float cosine_distance(const std::vector<float> &a, const std::vector<float> &b) {
+  double dot = 0, na = 0, nb = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    dot += a[i] * b[i];
+    na += a[i] * a[i];
+    nb += b[i] * b[i];
+  }
+  return static_cast<float>(1.0 - dot / std::sqrt(na * nb));
+}
+
+// 满足 filter 且未删除的 key 中最近的 k 个
+std::set<uint64_t> exact_filtered(const std::vector<std::vector<float>> &vecs, const std::vector<float> &query,
+                                  const std::function<bool(uint64_t)> &filter, const std::set<uint64_t> &deleted) {
+  std::vector<std::pair<float, uint64_t>> scored;
+  for (uint64_t key = 0; key < vecs.size(); key++) {
+    if (filter(key) && !deleted.count(key)) {
+      scored.push_back({cosine_distance(query, vecs[key]), key});
+    }
+  }
+  size_t keep = std::min<size_t>(K, scored.size());
+  std::partial_sort(scored.begin(), scored.begin() + keep, scored.end());
+  std::set<uint64_t> keys;
+  for (size_t i = 0; i < keep; i++) {
+    keys.insert(scored[i].second);
+  }
+  return keys;
+}
+
+// 检查一组查询的结果：全部满足 filter、没有已删除的 key，返回召回率
+double check_queries(const std::string &name, const std::vector<std::vector<float>> &vecs,
+                     const std::vector<std::vector<float>> &queries, const std::function<bool(uint64_t)> &filter,
+                     const std::set<uint64_t> &deleted,
+                     const std::function<std::vector<std::pair<uint64_t, std::string>>(const std::vector<float> &)> &search,
+                     bool &pass) {
+  size_t found = 0, expected = 0;
+  for (const auto &query : queries) {
+    std::set<uint64_t> exact = exact_filtered(vecs, query, filter, deleted);
+    auto result = search(query);
+    if (result.size() != exact.size()) {
+      std::cout << "Error: " << name << " returned " << result.size() << " results, expected " << exact.size()
+                << std::endl;
+      pass = false;
+    }
+    for (const auto &item : result) {
+      if (!filter(item.first) || deleted.count(item.first)) {
+        std::cout << "Error: " << name << " returned key " << item.first << std::endl;
+        pass = false;
+      }
+      if (item.second != "v" + std::to_string(item.first)) {
+        std::cout << "Error: " << name << " returned a wrong value for key " << item.first << std::endl;
+        pass = false;
+      }
+      found += exact.count(item.first);
+    }
+    expected += exact.size();
+  }
+  double recall = expected == 0 ? 1.0 : static_cast<double>(found) / expected;
+  std::cout << name << ": recall@" << K << " " << recall << std::endl;
+  return recall;
+}
+
+int main() {
+  std::filesystem::create_directories(DIR);
+  std::mt19937 rng(5);
+
+  HNSWOptions options;
+  options.consolidate_ratio = 0; // 删除的节点留作墓碑
+  KVStore store(DIR, "", options);
+  store.reset();
+
+  std::vector<std::vector<float>> centers;
+  for (int i = 0; i < 32; i++) {
+    centers.push_back(make_vector(rng));
+  }
+  std::vector<std::vector<float>> vecs(TOTAL);
+  for (int i = 0; i < TOTAL; i++) {
+    vecs[i] = make_clustered_vector(rng, centers);
+    store.put_with_precomputed_embedding(i, "v" + std::to_string(i), vecs[i]);
+  }
+  std::set<uint64_t> deleted;
+  for (int i = 0; i < TOTAL; i += 14) {
+    store.del(i);
+    deleted.insert(i);
+  }
+  std::vector<std::vector<float>> queries;
+  for (int i = 0; i < 40; i++) {
+    queries.push_back(make_clustered_vector(rng, centers));
+  }
+
+  bool pass = true;
+
+  // 一半的 key 满足条件：走图搜索，谓词调用次数应远小于节点数
+  size_t calls = 0;
+  std::function<bool(uint64_t)> even = [](uint64_t key) { return key % 2 == 0; };
+  HNSWKeyFilter counted_even = [&calls](uint64_t key) {
+    calls++;
+    return key % 2 == 0;
+  };
+  double recall = check_queries(
+      "even keys", vecs, queries, even, deleted,
+      [&](const std::vector<float> &q) { return store.search_knn_hnsw_filtered(q, K, counted_even); }, pass);
+  if (recall < 0.9) {
+    std::cout << "Error: recall for even keys below 0.9" << std::endl;
+    pass = false;
+  }
+  size_t calls_per_query = calls / queries.size();
+  std::cout << "predicate calls per query: " << calls_per_query << " of " << TOTAL << " nodes" << std::endl;
+  if (calls_per_query >= TOTAL / 2) {
+    std::cout << "Error: predicate evaluated for most nodes" << std::endl;
+    pass = false;
+  }
+
+  // 1% 的 key 满足条件：暴力计算，结果精确
+  std::function<bool(uint64_t)> rare = [](uint64_t key) { return key % 100 == 3; };
+  recall = check_queries(
+      "rare keys", vecs, queries, rare, deleted,
+      [&](const std::vector<float> &q) { return store.search_knn_hnsw_filtered(q, K, rare); }, pass);
+  if (recall < 1.0) {
+    std::cout << "Error: brute-force filtered search is not exact" << std::endl;
+    pass = false;
+  }
+
+  // key 区间
+  std::function<bool(uint64_t)> in_range = [](uint64_t key) { return key >= 1000 && key <= 1999; };
+  recall = check_queries(
+      "key range", vecs, queries, in_range, deleted,
+      [&](const std::vector<float> &q) { return store.search_knn_hnsw_filtered(q, K, 1000, 1999); }, pass);
+  if (recall < 0.9) {
+    std::cout << "Error: recall for key range below 0.9" << std::endl;
+    pass = false;
+  }
+
+  // 没有 key 满足条件
+  if (!store.search_knn_hnsw_filtered(queries[0], K, [](uint64_t) { return false; }).empty()) {
+    std::cout << "Error: filter rejecting every key returned results" << std::endl;
+    pass = false;
+  }
+  store.reset();
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,398 @@
+#include "hnsw_delta_log.h"
+#include "hnsw_index_file.h"
+#include "kvstore.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// HNSW 索引的持久化：单文件索引 (hnsw_index.bin) 保存后重新打开，图与参数不变，查询结果完全相同；
+// 墓碑节点保存在删除段中；增量日志 (hnsw_delta.log) 只回放完整提交的批次；
+// 按 BFS 顺序重排 label 之后图不变 (不需要 embedding 模型)
+
+const std::string DIR = "./hnsw_persistence_data";
+const std::string INDEX_DIR = "./hnsw_persistence_index";
+const int DIM = 768;
+const int TOTAL = 2000;
+const int K = 10;
+
+using Results = std::vector<std::vector<std::pair<uint64_t, std::string>>>;
+
+std::vector<float> make_vector(std::mt19937 &rng) {
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vec(DIM);
+  for (float &v : vec) {
+    v = dist(rng);
+  }
+  return vec;
+}
+
+std::vector<float> make_clustered_vector(std::mt19937 &rng, const std::vector<std::vector<float>> &centers) {
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vec = centers[rng() % centers.size()];
+  for (float &v : vec) {
+    v += noise(rng);
+  }
+  return vec;
+}
+
+float cosine_distance(const float *a, const float *b) {
+  double dot = 0, na = 0, nb = 0;
+  for (int i = 0; i < DIM; i++) {
+    dot += a[i] * b[i];
+    na += a[i] * a[i];
+    nb += b[i] * b[i];
+  }
+  return static_cast<float>(1.0 - dot / std::sqrt(na * nb));
+}
+
+struct Dataset {
+  std::vector<uint64_t> keys;
+  std::vector<std::string> values;
+  std::vector<std::vector<float>> vecs;
+  std::vector<std::vector<float>> queries;
+};
+
+Dataset make_dataset(uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<std::vector<float>> centers;
+  for (int i = 0; i < 32; i++) {
+    centers.push_back(make_vector(rng));
+  }
+  Dataset data;
+  for (int i = 0; i < TOTAL; i++) {
+    data.keys.push_back(i);
+    data.values.push_back("v" + std::to_string(i));
+    data.vecs.push_back(make_clustered_vector(rng, centers));
+  }
+  for (int i = 0; i < 30; i++) {
+    data.queries.push_back(make_clustered_vector(rng, centers));
+  }
+  return data;
+}
+
+Results search_all(KVStore &store, const Dataset &data) {
+  Results results;
+  for (const auto &query : data.queries) {
+    results.push_back(store.search_knn_hnsw(query, K));
+  }
+  return results;
+}
+
+// 保存后用默认参数重新打开：M / M_max 以文件为准，查询结果与保存前相同；
+// 文件头、label 表和向量段与写入的数据一致
+bool test_index_file(const Dataset &data) {
+  bool pass = true;
+  HNSWOptions options;
+  options.M = 8;
+  options.M_max = 16;
+  options.ef_construction = 64;
+  options.index_vectors = true;
+  Results before;
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+    before = search_all(store, data);
+    store.save_hnsw_index_to_disk(INDEX_DIR);
+  }
+
+  HNSWIndexFile file;
+  if (!file.open(INDEX_DIR + "/" + HNSW_INDEX_FILE_NAME)) {
+    std::cout << "Error: saved index file could not be opened" << std::endl;
+    return false;
+  }
+  const HNSWIndexFileHeader &header = file.header();
+  if (header.dim != DIM || header.M != 8 || header.M_max != 16 || header.efConstruction != 64 ||
+      header.num_nodes != TOTAL || !(header.flags & HNSW_INDEX_FLAG_VECTORS) || header.checkpoint_id == 0) {
+    std::cout << "Error: unexpected index header (dim=" << header.dim << " M=" << header.M
+              << " nodes=" << header.num_nodes << " flags=" << header.flags << ")" << std::endl;
+    pass = false;
+  }
+  size_t bad_vectors = 0;
+  for (size_t label = 0; label < header.num_labels; label++) {
+    if (!file.has_node(label)) {
+      continue;
+    }
+    uint64_t key = file.entry(label).key;
+    const float *vec = file.vector(label);
+    if (key >= static_cast<uint64_t>(TOTAL) || vec == nullptr ||
+        cosine_distance(vec, data.vecs[key].data()) > 1e-5f) {
+      bad_vectors++;
+    }
+  }
+  if (bad_vectors > 0) {
+    std::cout << "Error: " << bad_vectors << " labels with a wrong key or vector in the index file" << std::endl;
+    pass = false;
+  }
+  file.close();
+
+  {
+    KVStore store(DIR, INDEX_DIR);
+    HNSWOptions effective = store.get_hnsw_options();
+    if (effective.M != 8 || effective.M_max != 16) {
+      std::cout << "Error: reopened index uses M=" << effective.M << " M_max=" << effective.M_max << std::endl;
+      pass = false;
+    }
+    if (search_all(store, data) != before) {
+      std::cout << "Error: search results changed after reloading hnsw_index.bin" << std::endl;
+      pass = false;
+    }
+  }
+  std::cout << "index file round trip: " << (pass ? "ok" : "failed") << std::endl;
+  return pass;
+}
+
+// 打开 INDEX_DIR 中的索引 (先把 log 写成 hnsw_delta.log)，返回查询结果与回放后的日志大小
+Results reopen_with_log(const Dataset &data, const std::string &log, uint64_t &log_size) {
+  std::string log_path = INDEX_DIR + "/" + HNSW_DELTA_FILE_NAME;
+  std::ofstream(log_path, std::ios::binary | std::ios::trunc) << log;
+  KVStore store(DIR, INDEX_DIR);
+  log_size = std::filesystem::exists(log_path) ? std::filesystem::file_size(log_path) : 0;
+  return search_all(store, data);
+}
+
+// 检查点之后的两批变更 (插入与删除) 追加到增量日志：完整的日志回放后与保存前一致；
+// 末尾批次写了一半或校验和错误时只回放第一批并截掉尾部；属于其它检查点的日志被丢弃
+bool test_delta_log(const Dataset &data) {
+  bool pass = true;
+  HNSWOptions options;
+  options.consolidate_ratio = 0;          // 删除的节点以墓碑的形式写入日志
+  options.delta_checkpoint_ratio = 100.0; // 不折叠成新的检查点
+  const int BASE = TOTAL / 2, FIRST = TOTAL * 3 / 4;
+  std::string log_path = INDEX_DIR + "/" + HNSW_DELTA_FILE_NAME;
+  Results after_first, after_second;
+  uint64_t first_size = 0, second_size = 0;
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    std::filesystem::remove_all(INDEX_DIR);
+    store.put_batch_with_precomputed_embedding(
+        std::vector<uint64_t>(data.keys.begin(), data.keys.begin() + BASE),
+        std::vector<std::string>(data.values.begin(), data.values.begin() + BASE),
+        std::vector<std::vector<float>>(data.vecs.begin(), data.vecs.begin() + BASE));
+    store.save_hnsw_index_to_disk(INDEX_DIR);
+
+    for (int i = BASE; i < FIRST; i++) {
+      store.put_with_precomputed_embedding(data.keys[i], data.values[i], data.vecs[i]);
+    }
+    for (int i = 0; i < BASE; i += 10) {
+      if (!store.del(data.keys[i])) {
+        std::cout << "Error: failed to delete key " << data.keys[i] << std::endl;
+        pass = false;
+      }
+    }
+    store.save_hnsw_delta(INDEX_DIR);
+    after_first = search_all(store, data);
+    first_size = std::filesystem::file_size(log_path);
+
+    for (int i = FIRST; i < TOTAL; i++) {
+      store.put_with_precomputed_embedding(data.keys[i], data.values[i], data.vecs[i]);
+    }
+    store.save_hnsw_delta(INDEX_DIR);
+    after_second = search_all(store, data);
+    second_size = std::filesystem::file_size(log_path);
+  }
+  if (!std::filesystem::exists(INDEX_DIR + "/" + HNSW_INDEX_FILE_NAME) || second_size <= first_size) {
+    std::cout << "Error: save_hnsw_delta did not append to " << HNSW_DELTA_FILE_NAME << std::endl;
+    return false;
+  }
+  std::string log;
+  {
+    std::ifstream in(log_path, std::ios::binary);
+    log.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  uint64_t size = 0;
+  if (reopen_with_log(data, log, size) != after_second || size != second_size) {
+    std::cout << "Error: replaying the complete delta log did not restore the graph" << std::endl;
+    pass = false;
+  }
+
+  // 第二批只写了一半
+  std::string torn = log.substr(0, first_size + (second_size - first_size) / 2);
+  if (reopen_with_log(data, torn, size) != after_first || size != first_size) {
+    std::cout << "Error: torn tail not discarded (log size " << size << ", expected " << first_size << ")"
+              << std::endl;
+    pass = false;
+  }
+
+  // 第二批的提交记录 (ENTRY) 被改写，校验和不匹配
+  std::string corrupted = log;
+  corrupted.back() ^= 0x5a;
+  if (reopen_with_log(data, corrupted, size) != after_first || size != first_size) {
+    std::cout << "Error: batch with a bad checksum not discarded (log size " << size << ", expected " << first_size
+              << ")" << std::endl;
+    pass = false;
+  }
+
+  // 文件头中的 checkpoint_id 位于 magic[8] 与 version / reserved 之后
+  std::string foreign = log;
+  foreign[16] ^= 0x01;
+  // 只剩检查点中的图：之后插入的 key 不在图中
+  bool replayed = false;
+  for (const auto &result : reopen_with_log(data, foreign, size)) {
+    for (const auto &item : result) {
+      replayed = replayed || item.first >= static_cast<uint64_t>(BASE);
+    }
+  }
+  if (replayed || size != 0) {
+    std::cout << "Error: delta log of another checkpoint was replayed" << std::endl;
+    pass = false;
+  }
+  std::cout << "delta log replay: " << (pass ? "ok" : "failed") << std::endl;
+  return pass;
+}
+
+// 未整理的墓碑写入删除段 (升序 label)，重新打开后仍是墓碑：不出现在结果中，整理时才被移除
+bool test_tombstones(const Dataset &data) {
+  bool pass = true;
+  HNSWOptions options;
+  options.consolidate_ratio = 0;
+  std::set<uint64_t> deleted;
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    std::filesystem::remove_all(INDEX_DIR);
+    store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+    for (int i = 3; i < TOTAL; i += 7) {
+      if (store.del(data.keys[i])) {
+        deleted.insert(data.keys[i]);
+      }
+    }
+    store.save_hnsw_index_to_disk(INDEX_DIR);
+  }
+
+  HNSWIndexFile file;
+  if (!file.open(INDEX_DIR + "/" + HNSW_INDEX_FILE_NAME)) {
+    std::cout << "Error: saved index file could not be opened" << std::endl;
+    return false;
+  }
+  const HNSWIndexFileHeader &header = file.header();
+  if (deleted.empty() || header.num_deleted != deleted.size() || header.num_nodes != TOTAL) {
+    std::cout << "Error: index file has " << header.num_deleted << " deleted of " << header.num_nodes
+              << " nodes, expected " << deleted.size() << " of " << TOTAL << std::endl;
+    pass = false;
+  }
+  const uint32_t *labels = file.deleted_labels();
+  for (size_t i = 0; i < header.num_deleted; i++) {
+    if ((i > 0 && labels[i] <= labels[i - 1]) || !file.has_node(labels[i]) ||
+        !deleted.count(file.entry(labels[i]).key)) {
+      std::cout << "Error: deleted label " << labels[i] << " out of order or not a deleted key" << std::endl;
+      pass = false;
+      break;
+    }
+  }
+  file.close();
+
+  {
+    KVStore store(DIR, INDEX_DIR, options);
+    for (uint64_t key : deleted) {
+      for (const auto &item : store.search_knn_hnsw(data.vecs[key], K)) {
+        if (deleted.count(item.first)) {
+          std::cout << "Error: deleted key " << item.first << " returned after reload" << std::endl;
+          pass = false;
+        }
+      }
+    }
+    size_t removed = store.consolidate_hnsw_deletions();
+    if (removed != deleted.size()) {
+      std::cout << "Error: consolidation after reload removed " << removed << " nodes, expected " << deleted.size()
+                << std::endl;
+      pass = false;
+    }
+  }
+  std::cout << "tombstones after reload: " << (pass ? "ok" : "failed") << std::endl;
+  return pass;
+}
+
+// reorder_on_save：保存前按 BFS 重排，整理删除后空出的 label 被回收，入口点成为 label 0；
+// 重排前后以及重新打开之后查询结果相同
+bool test_reorder(const Dataset &data) {
+  bool pass = true;
+  HNSWOptions options;
+  options.consolidate_ratio = 0;
+  options.reorder_on_save = true;
+  Results before;
+  size_t live = 0;
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    std::filesystem::remove_all(INDEX_DIR);
+    store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+    size_t deleted = 0;
+    for (int i = 0; i < TOTAL; i += 5) {
+      deleted += store.del(data.keys[i]) ? 1 : 0;
+    }
+    live = TOTAL - store.consolidate_hnsw_deletions();
+    if (deleted == 0 || live != TOTAL - deleted) {
+      std::cout << "Error: consolidation removed " << TOTAL - live << " of " << deleted << " deleted nodes" << std::endl;
+      pass = false;
+    }
+    before = search_all(store, data);
+    store.save_hnsw_index_to_disk(INDEX_DIR);
+    if (search_all(store, data) != before) {
+      std::cout << "Error: search results changed after reordering on save" << std::endl;
+      pass = false;
+    }
+  }
+
+  HNSWIndexFile file;
+  if (!file.open(INDEX_DIR + "/" + HNSW_INDEX_FILE_NAME)) {
+    std::cout << "Error: saved index file could not be opened" << std::endl;
+    return false;
+  }
+  const HNSWIndexFileHeader &header = file.header();
+  if (header.num_nodes != live || header.num_labels != live || header.entry_point_label != 0) {
+    std::cout << "Error: reordered index has " << header.num_nodes << " nodes in " << header.num_labels
+              << " labels, entry point " << header.entry_point_label << std::endl;
+    pass = false;
+  }
+  file.close();
+
+  {
+    KVStore store(DIR, INDEX_DIR, options);
+    if (search_all(store, data) != before) {
+      std::cout << "Error: search results changed after reloading the reordered index" << std::endl;
+      pass = false;
+    }
+    // 已经是 BFS 顺序，再排一次不改变结果
+    size_t reordered = store.reorder_hnsw_graph();
+    if (reordered != live || search_all(store, data) != before) {
+      std::cout << "Error: explicit reorder moved " << reordered << " nodes or changed results" << std::endl;
+      pass = false;
+    }
+  }
+  std::cout << "BFS reorder: " << (pass ? "ok" : "failed") << std::endl;
+  return pass;
+}
+
+int main() {
+  std::filesystem::create_directories(DIR);
+  std::filesystem::remove_all(INDEX_DIR);
+  Dataset data = make_dataset(29);
+
+  bool pass = test_index_file(data);
+  pass = test_delta_log(data) && pass;
+  pass = test_tombstones(data) && pass;
+  pass = test_reorder(data) && pass;
+
+  {
+    KVStore store(DIR);
+    store.reset();
+  }
+  std::filesystem::remove_all(INDEX_DIR);
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+
+  return pass ? 0 : 1;
+}
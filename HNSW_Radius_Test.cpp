@@ -0,0 +1,129 @@
+#include "kvstore.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// search_radius 与扫描全部向量的 search_radius_exact 相比召回率不低于 0.9，返回的点都在半径内且按距离升序，
+// max_results 限制结果数。Matryoshka 前缀搜索时同样按完整维度的距离判断
+
+const std::string DIR = "./hnsw_radius_data";
+const int DIM = 768;
+const int TOTAL = 3000;
+
+std::vector<float> make_vector(std::mt19937 &rng) {
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vec(DIM);
+  for (float &v : vec) {
+    v = dist(rng);
+  }
+  return vec;
+}
+
+std::vector<float> make_clustered_vector(std::mt19937 &rng, const std::vector<std::vector<float>> &centers) {
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vec = centers[rng() % centers.size()];
+  for (float &v : vec) {
+    v += noise(rng);
+  }
+  return vec;
+}
+
+float cosine_distance(const std::vector<float> &a, const std::vector<float> &b) {
+  double dot = 0, na = 0, nb = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    dot += a[i] * b[i];
+    na += a[i] * a[i];
+    nb += b[i] * b[i];
+  }
+  return static_cast<float>(1.0 - dot / std::sqrt(na * nb));
+}
+
+bool run(const std::string &name, size_t prefix_dim) {
+  std::mt19937 rng(23);
+  HNSWOptions options;
+  options.search_prefix_dim = prefix_dim;
+  KVStore store(DIR, "", options);
+  store.reset();
+
+  std::vector<std::vector<float>> centers;
+  for (int i = 0; i < 32; i++) {
+    centers.push_back(make_vector(rng));
+  }
+  std::vector<std::vector<float>> vecs(TOTAL);
+  for (int i = 0; i < TOTAL; i++) {
+    vecs[i] = make_clustered_vector(rng, centers);
+    store.put_with_precomputed_embedding(i, "v" + std::to_string(i), vecs[i]);
+  }
+
+  bool pass = true;
+  size_t found = 0, expected = 0;
+  for (int q = 0; q < 30; q++) {
+    std::vector<float> query = make_clustered_vector(rng, centers);
+    // 半径取第 40 近的点的距离，半径内约 40 个点
+    std::vector<float> dists;
+    for (const auto &vec : vecs) {
+      dists.push_back(cosine_distance(query, vec));
+    }
+    std::nth_element(dists.begin(), dists.begin() + 39, dists.end());
+    float radius = dists[39];
+
+    auto exact = store.search_radius_exact(query, radius);
+    std::set<uint64_t> exact_keys;
+    for (const auto &item : exact) {
+      exact_keys.insert(item.first);
+    }
+    auto result = store.search_radius(query, radius);
+    float last = -1.0f;
+    for (const auto &item : result) {
+      float dist = cosine_distance(query, vecs[item.first]);
+      if (dist > radius + 1e-4f || dist < last - 1e-4f) {
+        std::cout << "Error: " << name << " key " << item.first << " at distance " << dist << " outside radius "
+                  << radius << " or out of order" << std::endl;
+        pass = false;
+      }
+      last = dist;
+      found += exact_keys.count(item.first);
+    }
+    expected += exact_keys.size();
+
+    // 结果数达到 max_results 后停止，但仍然都在半径内
+    auto limited = store.search_radius(query, radius, 10);
+    if (limited.size() != std::min<size_t>(10, exact.size())) {
+      std::cout << "Error: " << name << " max_results=10 returned " << limited.size() << " results" << std::endl;
+      pass = false;
+    }
+    for (const auto &item : limited) {
+      if (!exact_keys.count(item.first)) {
+        std::cout << "Error: " << name << " max_results returned key " << item.first << " outside radius" << std::endl;
+        pass = false;
+      }
+    }
+  }
+  double recall = expected == 0 ? 0.0 : static_cast<double>(found) / expected;
+  std::cout << name << ": recall " << recall << " (" << expected << " points within radius)" << std::endl;
+  if (recall < 0.9) {
+    std::cout << "Error: " << name << " recall below 0.9" << std::endl;
+    pass = false;
+  }
+  store.reset();
+  return pass;
+}
+
+int main() {
+  std::filesystem::create_directories(DIR);
+  bool pass = run("full dimension", 0);
+  pass = run("256-dim prefix", 256) && pass;
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+
+  return pass ? 0 : 1;
+}
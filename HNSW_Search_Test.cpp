@@ -0,0 +1,501 @@
+#include "hnsw_index_file.h"
+#include "kvstore.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// HNSW 建图与查询接口的结果检查：召回率以精确的 search_knn 为基准 (不需要 embedding 模型)
+
+const std::string DIR = "./hnsw_search_data";
+const int DIM = 768;
+const int TOTAL = 3000;
+const int K = 10;
+
+std::vector<float> make_vector(std::mt19937 &rng) {
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vec(DIM);
+  for (float &v : vec) {
+    v = dist(rng);
+  }
+  return vec;
+}
+
+float cosine_distance(const std::vector<float> &a, const std::vector<float> &b) {
+  double dot = 0, na = 0, nb = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    dot += a[i] * b[i];
+    na += a[i] * a[i];
+    nb += b[i] * b[i];
+  }
+  return static_cast<float>(1.0 - dot / std::sqrt(na * nb));
+}
+
+// 度量对应的距离 (只需与 store 中的距离单调一致)：L2 取平方和，内积取负值
+double metric_distance(DistanceMetric metric, const std::vector<float> &a, const std::vector<float> &b) {
+  double dot = 0, l2 = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    dot += a[i] * b[i];
+    l2 += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return metric == DistanceMetric::L2 ? l2 : -dot;
+}
+
+// 真实 embedding 的本征维度远低于 768：向量落在 32 个簇中心附近
+std::vector<float> make_clustered_vector(std::mt19937 &rng, const std::vector<std::vector<float>> &centers) {
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vec = centers[rng() % centers.size()];
+  for (float &v : vec) {
+    v += noise(rng);
+  }
+  return vec;
+}
+
+struct Dataset {
+  std::vector<uint64_t> keys;
+  std::vector<std::string> values;
+  std::vector<std::vector<float>> vecs;
+  std::vector<std::vector<float>> queries;
+};
+
+Dataset make_dataset(uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<std::vector<float>> centers;
+  for (int i = 0; i < 32; i++) {
+    centers.push_back(make_vector(rng));
+  }
+  Dataset data;
+  for (int i = 0; i < TOTAL; i++) {
+    data.keys.push_back(i);
+    data.values.push_back("v" + std::to_string(i));
+    data.vecs.push_back(make_clustered_vector(rng, centers));
+  }
+  for (int i = 0; i < 50; i++) {
+    data.queries.push_back(make_clustered_vector(rng, centers));
+  }
+  return data;
+}
+
+using Results = std::vector<std::vector<std::pair<uint64_t, std::string>>>;
+
+// 近似结果的前 k 个在精确结果中的比例
+double recall(KVStore &store, const std::vector<std::vector<float>> &queries, const Results &approx) {
+  size_t found = 0, expected = 0;
+  for (size_t q = 0; q < queries.size(); q++) {
+    std::set<uint64_t> exact;
+    for (const auto &item : store.search_knn(queries[q], K)) {
+      exact.insert(item.first);
+    }
+    for (const auto &item : approx[q]) {
+      found += exact.count(item.first);
+    }
+    expected += exact.size();
+  }
+  return expected == 0 ? 0.0 : static_cast<double>(found) / expected;
+}
+
+double hnsw_recall(KVStore &store, const std::vector<std::vector<float>> &queries, int ef = 0) {
+  Results approx;
+  for (const auto &query : queries) {
+    approx.push_back(store.search_knn_hnsw(query, K, ef));
+  }
+  return recall(store, queries, approx);
+}
+
+// 并行建图：批量导入与重新打开时从向量块重建都用多个线程连边，图的质量不应下降
+bool test_parallel_build(const Dataset &data) {
+  bool pass = true;
+  HNSWOptions options;
+  options.build_threads = 4;
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+    double r = hnsw_recall(store, data.queries);
+    std::cout << "parallel bulk load: recall@" << K << " " << r << std::endl;
+    if (r < 0.9) {
+      std::cout << "Error: recall after parallel bulk load below 0.9" << std::endl;
+      pass = false;
+    }
+    int missing = 0;
+    for (int i = 0; i < TOTAL; i += 10) {
+      auto result = store.search_knn_hnsw(data.vecs[i], 1);
+      if (result.empty() || result[0].first != data.keys[i] || result[0].second != data.values[i]) {
+        missing++;
+      }
+    }
+    if (missing > 0) {
+      std::cout << "Error: " << missing << " keys not found by their own vector" << std::endl;
+      pass = false;
+    }
+  }
+  {
+    // 没有索引路径：构造时用加载的向量并行重建
+    KVStore store(DIR, "", options);
+    double r = hnsw_recall(store, data.queries);
+    std::cout << "parallel rebuild on open: recall@" << K << " " << r << std::endl;
+    if (r < 0.9) {
+      std::cout << "Error: recall after parallel rebuild below 0.9" << std::endl;
+      pass = false;
+    }
+  }
+  return pass;
+}
+
+// 批量查询与逐条查询的结果一致 (同一张图上搜索是确定的)
+bool test_batch(const Dataset &data) {
+  bool pass = true;
+  HNSWOptions options;
+  options.search_threads = 4;
+  KVStore store(DIR, "", options);
+  store.reset();
+  store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+
+  auto batch = store.search_knn_hnsw_batch(data.queries, K);
+  if (batch.size() != data.queries.size()) {
+    std::cout << "Error: batch returned " << batch.size() << " result lists for " << data.queries.size()
+              << " queries" << std::endl;
+    return false;
+  }
+  for (size_t q = 0; q < data.queries.size(); q++) {
+    if (batch[q] != store.search_knn_hnsw(data.queries[q], K)) {
+      std::cout << "Error: batch result " << q << " differs from a single query" << std::endl;
+      pass = false;
+    }
+  }
+  double r = recall(store, data.queries, batch);
+  std::cout << "batch search: recall@" << K << " " << r << std::endl;
+  if (r < 0.9) {
+    std::cout << "Error: batch recall below 0.9" << std::endl;
+    pass = false;
+  }
+  if (!store.search_knn_hnsw_batch({}, K).empty()) {
+    std::cout << "Error: empty batch returned results" << std::endl;
+    pass = false;
+  }
+  return pass;
+}
+
+// 运行时参数：非法值按规则回退，单次查询的 ef 越大召回越高，ef 小于 k 时按 k 计算
+bool test_search_options(const Dataset &data) {
+  bool pass = true;
+  HNSWOptions invalid;
+  invalid.M = 1;
+  invalid.M_max = 4;
+  invalid.ef_construction = 2;
+  {
+    KVStore store(DIR, "", invalid);
+    HNSWOptions effective = store.get_hnsw_options();
+    HNSWOptions defaults;
+    if (effective.M != defaults.M || effective.M_max != 2 * defaults.M || effective.ef_construction != defaults.M) {
+      std::cout << "Error: invalid options became M=" << effective.M << " M_max=" << effective.M_max
+                << " ef_construction=" << effective.ef_construction << std::endl;
+      pass = false;
+    }
+  }
+
+  HNSWOptions options;
+  options.M = 8;
+  options.M_max = 16;
+  options.ef_construction = 64;
+  options.ef_search = 12;
+  KVStore store(DIR, "", options);
+  store.reset();
+  store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+  HNSWOptions effective = store.get_hnsw_options();
+  if (effective.M != 8 || effective.M_max != 16 || effective.ef_construction != 64 || effective.ef_search != 12) {
+    std::cout << "Error: options not applied" << std::endl;
+    pass = false;
+  }
+
+  double narrow = hnsw_recall(store, data.queries);      // ef_search = 12
+  double wide = hnsw_recall(store, data.queries, 400);   // 单次查询覆盖
+  std::cout << "recall@" << K << " with ef 12: " << narrow << ", ef 400: " << wide << std::endl;
+  if (wide < 0.95 || wide < narrow) {
+    std::cout << "Error: a wider ef did not raise recall to 0.95" << std::endl;
+    pass = false;
+  }
+  if (store.search_knn_hnsw(data.queries[0], K, 1).size() != static_cast<size_t>(K)) {
+    std::cout << "Error: ef smaller than k did not return k results" << std::endl;
+    pass = false;
+  }
+  return pass;
+}
+
+// 精确查询与测试中逐个计算的结果一致：向量数超过单线程扫描的阈值 (分段并行)，并包含删除与覆盖写入
+bool test_exact_knn() {
+  const int EXACT_TOTAL = 12000;
+  bool pass = true;
+  std::mt19937 rng(41);
+  std::vector<std::vector<float>> centers;
+  for (int i = 0; i < 32; i++) {
+    centers.push_back(make_vector(rng));
+  }
+  std::vector<uint64_t> keys;
+  std::vector<std::string> values;
+  std::vector<std::vector<float>> vecs;
+  for (int i = 0; i < EXACT_TOTAL; i++) {
+    keys.push_back(i);
+    values.push_back("v" + std::to_string(i));
+    vecs.push_back(make_clustered_vector(rng, centers));
+  }
+  HNSWOptions options;
+  options.search_threads = 4;
+  KVStore store(DIR, "", options);
+  store.reset();
+  store.put_batch_with_precomputed_embedding(keys, values, vecs);
+  std::vector<bool> live(EXACT_TOTAL, true);
+  size_t deleted = 0;
+  for (int i = 0; i < EXACT_TOTAL; i += 9) {
+    live[i] = !store.del(i);
+    deleted += !live[i];
+  }
+  if (deleted == 0) {
+    std::cout << "Error: no key could be deleted" << std::endl;
+    pass = false;
+  }
+  for (int i = 5; i < EXACT_TOTAL; i += 13) {
+    if (live[i]) {
+      values[i] = "w" + std::to_string(i);
+      vecs[i] = make_clustered_vector(rng, centers);
+      store.put_with_precomputed_embedding(i, values[i], vecs[i]);
+    }
+  }
+
+  for (int q = 0; q < 20; q++) {
+    std::vector<float> query = make_clustered_vector(rng, centers);
+    std::vector<float> dists;
+    for (int i = 0; i < EXACT_TOTAL; i++) {
+      if (live[i]) {
+        dists.push_back(cosine_distance(query, vecs[i]));
+      }
+    }
+    std::nth_element(dists.begin(), dists.begin() + (K - 1), dists.end());
+    float kth = dists[K - 1];
+
+    auto result = store.search_knn(query, K);
+    if (result.size() != static_cast<size_t>(K)) {
+      std::cout << "Error: exact search returned " << result.size() << " results" << std::endl;
+      pass = false;
+      continue;
+    }
+    float last = -1.0f;
+    for (const auto &item : result) {
+      // 与逐个计算的第 k 近距离相比，只容许浮点误差
+      float dist = cosine_distance(query, vecs[item.first]);
+      if (!live[item.first] || item.second != values[item.first] || dist > kth + 1e-5f || dist < last - 1e-5f) {
+        std::cout << "Error: exact search returned key " << item.first << " (" << item.second << ") at distance "
+                  << dist << ", k-th distance " << kth << std::endl;
+        pass = false;
+      }
+      last = dist;
+    }
+  }
+  if (!store.search_knn(vecs[1], 0).empty()) {
+    std::cout << "Error: k = 0 returned results" << std::endl;
+    pass = false;
+  }
+  std::cout << "exact search over " << EXACT_TOTAL << " vectors (" << deleted << " deleted): " << (pass ? "ok" : "failed")
+            << std::endl;
+  return pass;
+}
+
+// Matryoshka 前缀搜索：图只用前 256 维，候选用完整维度重排，召回率仍以完整维度的精确结果为准；
+// 前缀不短于向量时按完整维度搜索，结果与不设前缀相同
+bool test_prefix_search(const Dataset &data) {
+  bool pass = true;
+  // 单线程建图，两次建出的图相同
+  HNSWOptions serial;
+  serial.build_threads = 1;
+  Results full;
+  {
+    KVStore store(DIR, "", serial);
+    store.reset();
+    store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+    for (const auto &query : data.queries) {
+      full.push_back(store.search_knn_hnsw(query, K));
+    }
+  }
+  HNSWOptions too_long = serial;
+  too_long.search_prefix_dim = DIM;
+  {
+    KVStore store(DIR, "", too_long);
+    store.reset();
+    store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+    for (size_t q = 0; q < data.queries.size(); q++) {
+      if (store.search_knn_hnsw(data.queries[q], K) != full[q]) {
+        std::cout << "Error: prefix as long as the vector changed the results" << std::endl;
+        pass = false;
+        break;
+      }
+    }
+  }
+
+  HNSWOptions options;
+  options.search_prefix_dim = 256;
+  KVStore store(DIR, "", options);
+  store.reset();
+  store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+  Results prefix;
+  for (const auto &query : data.queries) {
+    auto result = store.search_knn_hnsw(query, K);
+    // 重排之后按完整维度的距离升序
+    for (size_t i = 1; i < result.size(); i++) {
+      if (cosine_distance(query, data.vecs[result[i].first]) < cosine_distance(query, data.vecs[result[i - 1].first]) - 1e-5f) {
+        std::cout << "Error: prefix search results not ordered by full-dimension distance" << std::endl;
+        pass = false;
+        break;
+      }
+    }
+    prefix.push_back(result);
+  }
+  double r = recall(store, data.queries, prefix);
+  std::cout << "256-dim prefix search: recall@" << K << " " << r << std::endl;
+  if (r < 0.9) {
+    std::cout << "Error: prefix search recall below 0.9" << std::endl;
+    pass = false;
+  }
+  return pass;
+}
+
+// 邻居选择的三种组合 (直接取最近的 M 个、扩展候选、补足被淘汰的候选) 都生效并建出可用的图；
+// 直接取最近的 M 个时聚簇之间缺少长边，召回率要求放宽到 0.8
+bool test_neighbor_selection(const Dataset &data) {
+  bool pass = true;
+  struct Variant {
+    const char *name;
+    bool heuristic, extend, keep_pruned;
+    double min_recall;
+  };
+  for (const Variant &variant : {Variant{"closest M", false, false, false, 0.8},
+                                 Variant{"extended candidates", true, true, false, 0.9},
+                                 Variant{"kept pruned connections", true, false, true, 0.9}}) {
+    HNSWOptions options;
+    options.neighbor_heuristic = variant.heuristic;
+    options.extend_candidates = variant.extend;
+    options.keep_pruned_connections = variant.keep_pruned;
+    KVStore store(DIR, "", options);
+    store.reset();
+    store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+    HNSWOptions effective = store.get_hnsw_options();
+    double r = hnsw_recall(store, data.queries);
+    std::cout << variant.name << ": recall@" << K << " " << r << std::endl;
+    if (effective.neighbor_heuristic != variant.heuristic || effective.extend_candidates != variant.extend ||
+        effective.keep_pruned_connections != variant.keep_pruned || r < variant.min_recall) {
+      std::cout << "Error: " << variant.name << " not applied or recall below " << variant.min_recall << std::endl;
+      pass = false;
+    }
+  }
+  return pass;
+}
+
+// 预取只影响内存访问的时机：同一张图上预取距离不同，结果完全相同
+bool test_prefetch(const Dataset &data) {
+  Results baseline;
+  for (int distance : {0, 1, 4, 16}) {
+    HNSWOptions options;
+    options.build_threads = 1;
+    options.prefetch_distance = distance;
+    KVStore store(DIR, "", options);
+    store.reset();
+    store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+    Results results;
+    for (const auto &query : data.queries) {
+      results.push_back(store.search_knn_hnsw(query, K));
+    }
+    if (distance == 0) {
+      baseline = results;
+    } else if (results != baseline) {
+      std::cout << "Error: prefetch distance " << distance << " changed the results" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// L2 与内积：精确查询与逐个计算一致，HNSW 召回率不低于 0.9；度量写入索引文件，重新打开时以文件为准
+bool test_metric(const Dataset &data, DistanceMetric metric) {
+  const std::string index_dir = "./hnsw_search_index";
+  const std::string name = distance_metric_name(metric);
+  bool pass = true;
+  HNSWOptions options;
+  options.metric = metric;
+  std::filesystem::remove_all(index_dir);
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    store.put_batch_with_precomputed_embedding(data.keys, data.values, data.vecs);
+    for (const auto &query : data.queries) {
+      std::vector<double> dists;
+      for (const auto &vec : data.vecs) {
+        dists.push_back(metric_distance(metric, query, vec));
+      }
+      std::nth_element(dists.begin(), dists.begin() + (K - 1), dists.end());
+      double kth = dists[K - 1];
+      for (const auto &item : store.search_knn(query, K)) {
+        double dist = metric_distance(metric, query, data.vecs[item.first]);
+        if (dist > kth + 1e-4 * std::fabs(kth)) {
+          std::cout << "Error: " << name << " exact search returned key " << item.first << " at " << dist
+                    << ", k-th distance " << kth << std::endl;
+          pass = false;
+        }
+      }
+    }
+    double r = hnsw_recall(store, data.queries);
+    std::cout << name << ": recall@" << K << " " << r << std::endl;
+    if (r < 0.9) {
+      std::cout << "Error: " << name << " recall below 0.9" << std::endl;
+      pass = false;
+    }
+    store.save_hnsw_index_to_disk(index_dir);
+  }
+
+  HNSWIndexFile file;
+  if (!file.open(index_dir + "/" + HNSW_INDEX_FILE_NAME) ||
+      ((file.header().flags & HNSW_INDEX_METRIC_MASK) >> HNSW_INDEX_METRIC_SHIFT) != static_cast<uint32_t>(metric)) {
+    std::cout << "Error: " << name << " not recorded in the index file" << std::endl;
+    pass = false;
+  }
+  file.close();
+  {
+    KVStore store(DIR, index_dir); // 默认余弦
+    if (store.get_hnsw_options().metric != metric || hnsw_recall(store, data.queries) < 0.9) {
+      std::cout << "Error: reopened " << name << " index does not use the saved metric" << std::endl;
+      pass = false;
+    }
+  }
+  std::filesystem::remove_all(index_dir);
+  return pass;
+}
+
+int main() {
+  std::filesystem::create_directories(DIR);
+  Dataset data = make_dataset(17);
+
+  bool pass = test_parallel_build(data);
+  pass = test_batch(data) && pass;
+  pass = test_search_options(data) && pass;
+  pass = test_exact_knn() && pass;
+  pass = test_prefix_search(data) && pass;
+  pass = test_neighbor_selection(data) && pass;
+  pass = test_prefetch(data) && pass;
+  pass = test_metric(data, DistanceMetric::L2) && pass;
+  pass = test_metric(data, DistanceMetric::InnerProduct) && pass;
+
+  {
+    KVStore store(DIR);
+    store.reset();
+  }
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+#include "kvstore.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// IVF 引擎：search_knn_ivf 与精确的 search_knn 相比召回率不低于 0.9，扫描全部倒排表时结果精确；
+// 已删除的 key 不出现在结果中，重新打开时用向量块重建索引，其它度量回退到余弦 (不需要 embedding 模型)
+
+const std::string DIR = "./ivf_search_data";
+const int DIM = 768;
+const int TOTAL = 3000;
+const int K = 10;
+
+std::vector<float> make_vector(std::mt19937 &rng) {
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vec(DIM);
+  for (float &v : vec) {
+    v = dist(rng);
+  }
+  return vec;
+}
+
+std::vector<float> make_clustered_vector(std::mt19937 &rng, const std::vector<std::vector<float>> &centers) {
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vec = centers[rng() % centers.size()];
+  for (float &v : vec) {
+    v += noise(rng);
+  }
+  return vec;
+}
+
+// nprobe 个倒排表上的召回率，同时检查结果中没有 deleted 中的 key
+double ivf_recall(KVStore &store, const std::vector<std::vector<float>> &queries, int nprobe,
+                  const std::set<uint64_t> &deleted, bool &pass) {
+  size_t found = 0, expected = 0;
+  for (const auto &query : queries) {
+    std::set<uint64_t> exact;
+    for (const auto &item : store.search_knn(query, K)) {
+      exact.insert(item.first);
+    }
+    for (const auto &item : store.search_knn_ivf(query, K, nprobe)) {
+      if (deleted.count(item.first) || item.second != "v" + std::to_string(item.first)) {
+        std::cout << "Error: IVF returned deleted key or wrong value for key " << item.first << std::endl;
+        pass = false;
+      }
+      found += exact.count(item.first);
+    }
+    expected += exact.size();
+  }
+  return expected == 0 ? 0.0 : static_cast<double>(found) / expected;
+}
+
+int main() {
+  std::filesystem::create_directories(DIR);
+  std::mt19937 rng(37);
+  std::vector<std::vector<float>> centers;
+  for (int i = 0; i < 32; i++) {
+    centers.push_back(make_vector(rng));
+  }
+  std::vector<std::vector<float>> queries;
+  for (int i = 0; i < 40; i++) {
+    queries.push_back(make_clustered_vector(rng, centers));
+  }
+
+  bool pass = true;
+  HNSWOptions options;
+  options.index_type = VectorIndexType::IVF;
+  options.ivf_train_size = 1000; // 插入过程中自动训练
+  options.metric = DistanceMetric::L2;
+  std::set<uint64_t> deleted;
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    if (store.get_hnsw_options().metric != DistanceMetric::Cosine) {
+      std::cout << "Error: IVF engine kept a non-cosine metric" << std::endl;
+      pass = false;
+    }
+    for (int i = 0; i < TOTAL; i++) {
+      store.put_with_precomputed_embedding(i, "v" + std::to_string(i), make_clustered_vector(rng, centers));
+    }
+    for (int i = 0; i < TOTAL; i += 11) {
+      if (store.del(i)) {
+        deleted.insert(i);
+      }
+    }
+
+    double probed = ivf_recall(store, queries, 0, deleted, pass); // 默认 ivf_nprobe = 8
+    double full = ivf_recall(store, queries, TOTAL, deleted, pass);
+    std::cout << "auto-trained IVF: recall@" << K << " " << probed << " with nprobe 8, " << full
+              << " with every list" << std::endl;
+    if (probed < 0.9 || full < 1.0) {
+      std::cout << "Error: IVF recall too low after automatic training" << std::endl;
+      pass = false;
+    }
+
+    // 显式重新训练为更少的表，默认 nprobe 覆盖更大比例的向量
+    store.train_ivf_index(8);
+    double retrained = ivf_recall(store, queries, 0, deleted, pass);
+    std::cout << "retrained IVF with 8 lists: recall@" << K << " " << retrained << std::endl;
+    if (retrained < 1.0) {
+      std::cout << "Error: probing every list after retraining is not exact" << std::endl;
+      pass = false;
+    }
+    if (!store.search_knn_hnsw(queries[0], K).empty()) {
+      std::cout << "Error: IVF store answered an HNSW query" << std::endl;
+      pass = false;
+    }
+  }
+  if (deleted.empty()) {
+    std::cout << "Error: no key could be deleted" << std::endl;
+    pass = false;
+  }
+
+  {
+    // 重新打开：从 SSTable 向量块重建并训练
+    KVStore store(DIR, "", options);
+    double reopened = ivf_recall(store, queries, 0, deleted, pass);
+    std::cout << "reopened IVF: recall@" << K << " " << reopened << std::endl;
+    if (reopened < 0.9) {
+      std::cout << "Error: IVF recall below 0.9 after reopening" << std::endl;
+      pass = false;
+    }
+    store.reset();
+  }
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+
+  return pass ? 0 : 1;
+}
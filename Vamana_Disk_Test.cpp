@@ -0,0 +1,154 @@
+#include "kvstore.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// 磁盘 Vamana 索引：search_knn_disk 与精确的 search_knn 相比召回率不低于 0.9，search_L 越大召回越高；
+// 索引是构建时刻的快照 (之后插入的 key 查不到，删除的 key 被过滤)，重新打开后结果不变 (不需要 embedding 模型)
+
+const std::string DIR = "./vamana_disk_data";
+const std::string INDEX_PATH = "./vamana_disk_index.bin";
+const int DIM = 768;
+const int TOTAL = 3000;
+const int K = 10;
+
+using Results = std::vector<std::vector<std::pair<uint64_t, std::string>>>;
+
+std::vector<float> make_vector(std::mt19937 &rng) {
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vec(DIM);
+  for (float &v : vec) {
+    v = dist(rng);
+  }
+  return vec;
+}
+
+std::vector<float> make_clustered_vector(std::mt19937 &rng, const std::vector<std::vector<float>> &centers) {
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vec = centers[rng() % centers.size()];
+  for (float &v : vec) {
+    v += noise(rng);
+  }
+  return vec;
+}
+
+double recall(KVStore &store, const std::vector<std::vector<float>> &queries, const Results &approx) {
+  size_t found = 0, expected = 0;
+  for (size_t q = 0; q < queries.size(); q++) {
+    std::set<uint64_t> exact;
+    for (const auto &item : store.search_knn(queries[q], K)) {
+      exact.insert(item.first);
+    }
+    for (const auto &item : approx[q]) {
+      found += exact.count(item.first);
+    }
+    expected += exact.size();
+  }
+  return expected == 0 ? 0.0 : static_cast<double>(found) / expected;
+}
+
+Results search_all(KVStore &store, const std::vector<std::vector<float>> &queries, int search_L = 0) {
+  Results results;
+  for (const auto &query : queries) {
+    results.push_back(store.search_knn_disk(query, K, search_L));
+  }
+  return results;
+}
+
+int main() {
+  std::filesystem::create_directories(DIR);
+  std::filesystem::remove(INDEX_PATH);
+  std::mt19937 rng(43);
+  std::vector<std::vector<float>> centers;
+  for (int i = 0; i < 32; i++) {
+    centers.push_back(make_vector(rng));
+  }
+  std::vector<std::vector<float>> vecs, queries;
+  for (int i = 0; i < TOTAL; i++) {
+    vecs.push_back(make_clustered_vector(rng, centers));
+  }
+  for (int i = 0; i < 40; i++) {
+    queries.push_back(make_clustered_vector(rng, centers));
+  }
+
+  bool pass = true;
+  VamanaOptions options;
+  options.R = 32;
+  options.build_L = 64;
+  Results before;
+  {
+    KVStore store(DIR);
+    store.reset();
+    if (!store.search_knn_disk(queries[0], K).empty() || store.open_disk_index(INDEX_PATH, options)) {
+      std::cout << "Error: search or open succeeded without a disk index" << std::endl;
+      pass = false;
+    }
+    for (int i = 0; i < TOTAL; i++) {
+      store.put_with_precomputed_embedding(i, "v" + std::to_string(i), vecs[i]);
+    }
+    if (!store.build_disk_index(INDEX_PATH, options)) {
+      std::cout << "Error: build_disk_index failed" << std::endl;
+      return 1;
+    }
+
+    before = search_all(store, queries);
+    double r = recall(store, queries, before);
+    double wide = recall(store, queries, search_all(store, queries, 200));
+    std::cout << "disk index: recall@" << K << " " << r << " with search_L " << options.search_L << ", " << wide
+              << " with search_L 200" << std::endl;
+    if (r < 0.9 || wide < r) {
+      std::cout << "Error: disk index recall below 0.9 or not improved by a longer list" << std::endl;
+      pass = false;
+    }
+
+    // 快照之后删除的 key 被过滤，插入的 key 要重新构建才能查到
+    std::set<uint64_t> deleted;
+    for (const auto &item : before[0]) {
+      if (store.del(item.first)) {
+        deleted.insert(item.first);
+      }
+    }
+    store.put_with_precomputed_embedding(TOTAL, "v" + std::to_string(TOTAL), queries[1]);
+    for (const auto &item : store.search_knn_disk(queries[0], K)) {
+      if (deleted.count(item.first)) {
+        std::cout << "Error: deleted key " << item.first << " returned by the disk index" << std::endl;
+        pass = false;
+      }
+    }
+    auto nearest = store.search_knn_disk(queries[1], 1);
+    if (nearest.empty() || nearest[0].first == static_cast<uint64_t>(TOTAL)) {
+      std::cout << "Error: key inserted after the build found in the snapshot" << std::endl;
+      pass = false;
+    }
+    store.del(TOTAL);
+    for (uint64_t key : deleted) {
+      store.put_with_precomputed_embedding(key, "v" + std::to_string(key), vecs[key]);
+    }
+  }
+
+  {
+    KVStore store(DIR);
+    if (!store.open_disk_index(INDEX_PATH, options)) {
+      std::cout << "Error: open_disk_index failed" << std::endl;
+      pass = false;
+    } else if (search_all(store, queries) != before) {
+      std::cout << "Error: results changed after reopening the disk index" << std::endl;
+      pass = false;
+    }
+    store.reset();
+  }
+  std::filesystem::remove(INDEX_PATH);
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,395 @@
+#include "kvstore.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// 合并把向量块和值一起收缩：数据推进到 Level 2 之后，被覆盖和删除的旧向量不再留在磁盘上，
+// 重新打开后每个存活的 key 仍然带着最新的向量。另外检查向量块本身的读写，以及旧版本 (没有向量块、
+// 向量在 embeddings.bin 中) 的数据目录在打开时被迁移，fp16 / bf16 向量块记录自己的精度
+
+const std::string DIR = "./vector_compaction_data";
+const int DIM = 768;
+
+std::vector<float> make_vector(std::mt19937 &rng) {
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vec(DIM);
+  for (float &v : vec) {
+    v = dist(rng);
+  }
+  return vec;
+}
+
+// 一层中各 SSTable 的向量记录数；同一个 key 在这一层出现多次时计入 duplicates
+uint64_t count_vectors(int level, uint64_t &duplicates) {
+  uint64_t total = 0;
+  std::set<uint64_t> seen;
+  std::string path = DIR + "/level-" + std::to_string(level);
+  if (!std::filesystem::exists(path)) {
+    return 0;
+  }
+  for (const auto &entry : std::filesystem::directory_iterator(path)) {
+    uint32_t dim = 0;
+    VectorPrecision precision;
+    std::vector<uint64_t> keys;
+    std::vector<char> vecs;
+    if (sstable::loadVectorBlock(entry.path().string().c_str(), dim, precision, keys, vecs)) {
+      total += keys.size();
+      for (uint64_t key : keys) {
+        if (!seen.insert(key).second) {
+          duplicates++;
+        }
+      }
+    }
+  }
+  return total;
+}
+
+// 去掉文件末尾的向量块，得到与没有向量块的旧版 SSTable 相同的文件
+void strip_vector_block(const std::string &path) {
+  uint32_t dim = 0;
+  VectorPrecision precision;
+  std::vector<uint64_t> keys;
+  std::vector<char> vecs;
+  if (!sstable::loadVectorBlock(path.c_str(), dim, precision, keys, vecs)) {
+    return;
+  }
+  uint64_t block_bytes = keys.size() * sizeof(uint64_t) + vecs.size() + sizeof(VectorBlockFooter);
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - block_bytes);
+}
+
+// 来源表没有向量块时，合并用内存中的向量补上，不能让 key 悄悄失去向量
+bool test_table_without_vector_block(const HNSWOptions &options) {
+  const int total = 3000;
+  const std::string padding(4000, 'x');
+  std::mt19937 rng(7);
+  std::vector<std::vector<float>> vecs(total);
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    for (int i = 0; i < 1000; i++) {
+      vecs[i] = make_vector(rng);
+      store.put_with_precomputed_embedding(i, std::to_string(i) + padding, vecs[i]);
+    }
+    for (const auto &entry : std::filesystem::directory_iterator(DIR + "/level-0")) {
+      strip_vector_block(entry.path().string());
+    }
+    for (int i = 1000; i < total; i++) {
+      vecs[i] = make_vector(rng);
+      store.put_with_precomputed_embedding(i, std::to_string(i) + padding, vecs[i]);
+    }
+  }
+
+  KVStore store(DIR, "", options);
+  int missing = 0;
+  for (int i = 0; i < total; i += 5) {
+    std::vector<std::pair<std::uint64_t, std::string>> result = store.search_knn(vecs[i], 1);
+    if (result.empty() || result[0].first != static_cast<uint64_t>(i)) {
+      missing++;
+    }
+  }
+  store.reset();
+  if (missing > 0) {
+    std::cout << "Error: " << missing << " keys lost their vector in compaction" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// memtable 落盘时写出的向量块：按 key 升序，逐字节等于写入的向量，不含已删除的 key
+bool test_vector_block_round_trip(const HNSWOptions &options) {
+  const int total = 500;
+  std::mt19937 rng(11);
+  std::vector<std::vector<float>> vecs(total);
+  std::set<uint64_t> deleted;
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    for (int i = 0; i < total; i++) {
+      vecs[i] = make_vector(rng);
+      store.put_with_precomputed_embedding(i, "v" + std::to_string(i), vecs[i]);
+    }
+    for (int i = 0; i < total; i += 9) {
+      if (store.del(i)) {
+        deleted.insert(i);
+      }
+    }
+  }
+
+  bool pass = !deleted.empty();
+  std::set<uint64_t> stored;
+  for (const auto &entry : std::filesystem::directory_iterator(DIR + "/level-0")) {
+    uint32_t dim = 0;
+    VectorPrecision precision;
+    std::vector<uint64_t> keys;
+    std::vector<char> block;
+    if (!sstable::loadVectorBlock(entry.path().string().c_str(), dim, precision, keys, block)) {
+      std::cout << "Error: " << entry.path() << " has no vector block" << std::endl;
+      pass = false;
+      continue;
+    }
+    if (dim != DIM || precision != VectorPrecision::Float32 || block.size() != keys.size() * DIM * sizeof(float)) {
+      std::cout << "Error: vector block with dim " << dim << " and " << block.size() << " bytes for " << keys.size()
+                << " keys" << std::endl;
+      pass = false;
+      continue;
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+      if ((i > 0 && keys[i] <= keys[i - 1]) || keys[i] >= static_cast<uint64_t>(total) || deleted.count(keys[i]) ||
+          std::memcmp(block.data() + i * DIM * sizeof(float), vecs[keys[i]].data(), DIM * sizeof(float)) != 0) {
+        std::cout << "Error: vector block entry for key " << keys[i] << " out of order, deleted or modified"
+                  << std::endl;
+        pass = false;
+        break;
+      }
+      stored.insert(keys[i]);
+    }
+  }
+  if (stored.size() + deleted.size() != static_cast<size_t>(total)) {
+    std::cout << "Error: vector blocks hold " << stored.size() << " keys, expected " << total - deleted.size()
+              << std::endl;
+    pass = false;
+  }
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+  }
+  return pass;
+}
+
+// 旧版本的数据目录：SSTable 没有向量块，向量追加在 embeddings.bin 里 (同一个 key 以最后一条为准)。
+// 打开时补写向量块并删除 embeddings.bin，之后的打开直接从向量块读取
+bool test_legacy_migration(const HNSWOptions &options) {
+  const int total = 500;
+  std::mt19937 rng(13);
+  std::vector<std::vector<float>> vecs(total);
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    for (int i = 0; i < total; i++) {
+      vecs[i] = make_vector(rng);
+      store.put_with_precomputed_embedding(i, "v" + std::to_string(i), vecs[i]);
+    }
+  }
+  for (int level = 0; level < 15; ++level) {
+    std::string path = DIR + "/level-" + std::to_string(level);
+    if (std::filesystem::exists(path)) {
+      for (const auto &entry : std::filesystem::directory_iterator(path)) {
+        strip_vector_block(entry.path().string());
+      }
+    }
+  }
+  {
+    // 格式：uint64 维度，然后是 {uint64 key, float[dim]}；前 50 个 key 先写一条过时的向量
+    std::ofstream out(DIR + "/embeddings.bin", std::ios::binary | std::ios::trunc);
+    uint64_t dim = DIM;
+    out.write(reinterpret_cast<const char *>(&dim), sizeof(dim));
+    auto write_record = [&out](uint64_t key, const std::vector<float> &vec) {
+      out.write(reinterpret_cast<const char *>(&key), sizeof(key));
+      out.write(reinterpret_cast<const char *>(vec.data()), vec.size() * sizeof(float));
+    };
+    for (int i = 0; i < 50; i++) {
+      write_record(i, make_vector(rng));
+    }
+    for (int i = 0; i < total; i++) {
+      write_record(i, vecs[i]);
+    }
+  }
+
+  bool pass = true;
+  for (int round = 0; round < 2; round++) {
+    KVStore store(DIR, "", options);
+    if (std::filesystem::exists(DIR + "/embeddings.bin")) {
+      std::cout << "Error: embeddings.bin left in place after migration" << std::endl;
+      pass = false;
+    }
+    int missing = 0;
+    for (int i = 0; i < total; i++) {
+      std::vector<std::pair<std::uint64_t, std::string>> result = store.search_knn(vecs[i], 1);
+      if (result.empty() || result[0].first != static_cast<uint64_t>(i)) {
+        missing++;
+      }
+    }
+    if (missing > 0) {
+      std::cout << "Error: " << missing << " keys without their vector after " << (round == 0 ? "migration" : "reopening")
+                << std::endl;
+      pass = false;
+    }
+    if (round == 1) {
+      store.reset();
+    }
+  }
+  return pass;
+}
+
+// fp16 / bf16 存储：向量块尾部记录精度，分量是 2 字节且与原向量的误差在该精度范围内；
+// 之后改用 fp32 打开时按记录的精度读入并转换，每个 key 仍能用自己的向量查到
+bool test_half_precision_blocks(VectorPrecision half, float tolerance) {
+  const int total = 500;
+  std::mt19937 rng(17);
+  std::vector<std::vector<float>> vecs(total);
+  HNSWOptions options;
+  options.vector_precision = half;
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    for (int i = 0; i < total; i++) {
+      vecs[i] = make_vector(rng);
+      store.put_with_precomputed_embedding(i, "v" + std::to_string(i), vecs[i]);
+    }
+  }
+
+  bool pass = true;
+  const std::string name = vector_precision_name(half);
+  size_t stored = 0;
+  for (const auto &entry : std::filesystem::directory_iterator(DIR + "/level-0")) {
+    uint32_t dim = 0;
+    VectorPrecision precision;
+    std::vector<uint64_t> keys;
+    std::vector<char> block;
+    if (!sstable::loadVectorBlock(entry.path().string().c_str(), dim, precision, keys, block) || dim != DIM ||
+        precision != half || block.size() != keys.size() * DIM * 2) {
+      std::cout << "Error: " << name << " vector block missing or recorded with the wrong precision" << std::endl;
+      pass = false;
+      continue;
+    }
+    std::vector<float> decoded(DIM);
+    for (size_t i = 0; i < keys.size(); i++) {
+      convert_vector(block.data() + i * DIM * 2, precision, decoded.data(), VectorPrecision::Float32, DIM);
+      float worst = 0.0f;
+      for (int d = 0; d < DIM; d++) {
+        worst = std::max(worst, std::fabs(decoded[d] - vecs[keys[i]][d]) / std::max(1.0f, std::fabs(vecs[keys[i]][d])));
+      }
+      if (worst > tolerance) {
+        std::cout << "Error: " << name << " vector of key " << keys[i] << " off by " << worst << std::endl;
+        pass = false;
+        break;
+      }
+    }
+    stored += keys.size();
+  }
+  if (stored != static_cast<size_t>(total)) {
+    std::cout << "Error: " << name << " vector blocks hold " << stored << " keys" << std::endl;
+    pass = false;
+  }
+
+  KVStore store(DIR); // 默认 fp32
+  int missing = 0;
+  for (int i = 0; i < total; i++) {
+    std::vector<std::pair<std::uint64_t, std::string>> exact = store.search_knn(vecs[i], 1);
+    std::vector<std::pair<std::uint64_t, std::string>> approx = store.search_knn_hnsw(vecs[i], 1);
+    if (exact.empty() || exact[0].first != static_cast<uint64_t>(i) || approx.empty() ||
+        approx[0].first != static_cast<uint64_t>(i)) {
+      missing++;
+    }
+  }
+  if (missing > 0) {
+    std::cout << "Error: " << missing << " keys not found by their own vector after reading " << name << " blocks"
+              << std::endl;
+    pass = false;
+  }
+  store.reset();
+  return pass;
+}
+
+int main() {
+  std::filesystem::create_directories(DIR);
+  const int total = 6000;
+  const std::string padding(4000, 'x');
+  std::mt19937 rng(42);
+  std::vector<std::vector<float>> latest(total);
+  std::vector<std::string> values(total);
+  std::vector<bool> deleted(total, false);
+
+  HNSWOptions options;
+  options.index_type = VectorIndexType::IVF; // 只关心 LSM 中的向量，插入越便宜越好
+  {
+    KVStore store(DIR, "", options);
+    store.reset();
+    for (int i = 0; i < total; i++) {
+      latest[i] = make_vector(rng);
+      values[i] = std::to_string(i) + padding;
+      store.put_with_precomputed_embedding(i, values[i], latest[i]);
+    }
+    // 覆盖一半 key；其中每 10 个刚写入就删除 (del 只认得 memtable 中的 key)
+    for (int i = 0; i < total; i += 2) {
+      latest[i] = make_vector(rng);
+      values[i] = "v2-" + std::to_string(i) + padding;
+      store.put_with_precomputed_embedding(i, values[i], latest[i]);
+      if (i % 10 == 0) {
+        store.del(i);
+        deleted[i] = true;
+      }
+    }
+  }
+
+  bool pass = true;
+  int live = 0;
+  for (bool d : deleted) {
+    live += d ? 0 : 1;
+  }
+  if (!std::filesystem::exists(DIR + "/level-2")) {
+    std::cout << "Error: data never reached level 2" << std::endl;
+    pass = false;
+  }
+  // Level 1 及以下每层的表互不重叠，被覆盖的版本在合并时连同向量一起丢弃
+  uint64_t on_disk = 0;
+  for (int level = 0; level < 15; ++level) {
+    uint64_t duplicates = 0;
+    on_disk += count_vectors(level, duplicates);
+    if (level > 0 && duplicates > 0) {
+      std::cout << "Error: " << duplicates << " stale vectors kept in level " << level << std::endl;
+      pass = false;
+    }
+  }
+  std::cout << on_disk << " vectors on disk for " << live << " live keys after " << total + total / 2 << " puts"
+            << std::endl;
+
+  {
+    KVStore store(DIR, "", options);
+    int wrong = 0;
+    for (int i = 0; i < total; i += 7) {
+      std::vector<std::pair<std::uint64_t, std::string>> result = store.search_knn(latest[i], 1);
+      bool found = !result.empty() && result[0].first == static_cast<uint64_t>(i);
+      if (found == deleted[i]) {
+        wrong++;
+      }
+      if (store.get(i) != (deleted[i] ? "" : values[i])) {
+        wrong++;
+      }
+    }
+    if (wrong > 0) {
+      std::cout << "Error: " << wrong << " keys came back with a wrong vector or value" << std::endl;
+      pass = false;
+    }
+    store.reset();
+  }
+
+  if (!test_table_without_vector_block(options)) {
+    pass = false;
+  }
+  if (!test_vector_block_round_trip(options)) {
+    pass = false;
+  }
+  if (!test_legacy_migration(options)) {
+    pass = false;
+  }
+  if (!test_half_precision_blocks(VectorPrecision::Float16, 1e-3f) ||
+      !test_half_precision_blocks(VectorPrecision::BFloat16, 1e-2f)) {
+    pass = false;
+  }
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+
+  return pass ? 0 : 1;
+}
@@ -1,5 +1,9 @@
 #include "embedding.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
 
 #if defined(_MSC_VER)
 #pragma warning(disable : 4244 4267)  // possible loss of data
@@ -15,15 +19,24 @@ const int CONTEXT_SIZE = 2048;
 const int BATCH_SIZE = 2048;
 const int ROPE_SCALING_YARN = 1;
 const float ROPE_FREQ_SCALE = 0.75;
+const int MAX_SEQ_PER_BATCH = 64;  // 一次 decode 中的最大序列数 (n_seq_max)
 
 // 添加全局变量，用于跟踪模型加载状态
 static bool model_initialized = false;
-static std::unique_ptr<llama_model_params> g_model_params;
+// 一个 llama_model 由多个 llama_context 共享：每个上下文同一时间只能被一个线程使用，
+// 调用方从池中借出一个上下文推理，用完归还。g_model_mutex 保护模型加载 / 释放和池本身
+static std::mutex g_model_mutex;
+static std::condition_variable g_ctx_returned;
+static size_t g_pool_size = 1;     // 上下文个数上限，按需创建
+static int g_n_threads = 0;        // 每个上下文的推理线程数，0 表示 llama.cpp 默认值
+static std::vector<llama_context*> g_ctx_all;
+static std::vector<llama_context*> g_ctx_idle;
 static std::unique_ptr<llama_context_params> g_ctx_params;
+static std::atomic<size_t> g_active_decodes(0); // 正在 decode 的上下文数
+static std::atomic<size_t> g_peak_decodes(0);
 static std::unique_ptr<llama_model, void(*)(llama_model*)> g_model(nullptr, [](llama_model* m) { if(m) llama_model_free(m); });
-static std::unique_ptr<llama_context, void(*)(llama_context*)> g_ctx(nullptr, [](llama_context* c) { if(c) llama_free(c); });
 
-// 初始化模型，只在第一次调用时执行
+// 初始化模型，只在第一次调用时执行 (调用方持有 g_model_mutex)
 static bool initialize_model() {
     if (model_initialized) {
         return true;
@@ -40,38 +53,121 @@ static bool initialize_model() {
     params.rope_freq_scale = ROPE_FREQ_SCALE;
     params.embedding = true;
     params.n_ubatch = params.n_batch;
+    params.n_parallel = MAX_SEQ_PER_BATCH;
     params.verbose_prompt = GGML_LOG_LEVEL_ERROR;
+    if (g_n_threads > 0) {
+        params.cpuparams.n_threads = g_n_threads;
+        params.cpuparams_batch.n_threads = g_n_threads;
+    }
     
     llama_backend_init();
     llama_numa_init(params.numa);
     
     common_init_result llama_init = common_init_from_params(params);
     
-    if (!llama_init.model) {
+    if (!llama_init.model || !llama_init.context) {
         LOG_ERR("%s: unable to load model\n", __func__);
         return false;
     }
     
-    // 保存模型和上下文
+    // 保存模型；common_init 创建的上下文作为池中的第一个，之后的上下文用同样的参数创建
     g_model.reset(llama_init.model.release());
-    g_ctx.reset(llama_init.context.release());
+    g_ctx_params = std::make_unique<llama_context_params>(common_context_params_to_llama(params));
+    g_ctx_all.push_back(llama_init.context.release());
+    g_ctx_idle.push_back(g_ctx_all.back());
     
     model_initialized = true;
     std::cout << "Embedding model initialized successfully" << std::endl;
     return true;
 }
 
-// 在程序退出时释放资源
-static void cleanup_model() {
-    g_ctx.reset();
+// 借出一个空闲上下文：没有空闲且未达上限时新建一个，否则等待归还
+static llama_context* acquire_context() {
+    std::unique_lock<std::mutex> lock(g_model_mutex);
+    if (!initialize_model()) {
+        return nullptr;
+    }
+    while (g_ctx_idle.empty()) {
+        if (g_ctx_all.size() < g_pool_size) {
+            llama_context* ctx = llama_init_from_model(g_model.get(), *g_ctx_params);
+            if (ctx) {
+                g_ctx_all.push_back(ctx);
+                g_ctx_idle.push_back(ctx);
+                break;
+            }
+            LOG_WRN("%s: failed to create extra llama context, pool stays at %zu\n", __func__, g_ctx_all.size());
+            g_pool_size = g_ctx_all.size();
+        }
+        g_ctx_returned.wait(lock);
+    }
+    llama_context* ctx = g_ctx_idle.back();
+    g_ctx_idle.pop_back();
+    if (g_n_threads > 0) {
+        llama_set_n_threads(ctx, g_n_threads, g_n_threads);
+    }
+    return ctx;
+}
+
+static void release_context(llama_context* ctx) {
+    {
+        std::lock_guard<std::mutex> lock(g_model_mutex);
+        // 池缩小后多出来的上下文直接释放
+        if (g_ctx_all.size() > g_pool_size) {
+            g_ctx_all.erase(std::find(g_ctx_all.begin(), g_ctx_all.end(), ctx));
+            llama_free(ctx);
+        } else {
+            g_ctx_idle.push_back(ctx);
+        }
+    }
+    g_ctx_returned.notify_one();
+}
+
+// 借用期间独占一个上下文，离开作用域时归还
+struct ContextLease {
+    llama_context* ctx = acquire_context();
+    ~ContextLease() {
+        if (ctx) release_context(ctx);
+    }
+};
+
+// 在程序退出时释放资源 (调用方持有 g_model_mutex 的 unique_lock)
+static void cleanup_model(std::unique_lock<std::mutex>& lock) {
+    g_ctx_returned.wait(lock, [] { return g_ctx_idle.size() == g_ctx_all.size(); });
+    for (llama_context* ctx : g_ctx_all) {
+        llama_free(ctx);
+    }
+    g_ctx_all.clear();
+    g_ctx_idle.clear();
+    g_ctx_params.reset();
     g_model.reset();
-    llama_backend_free();
+    if (model_initialized) {
+        llama_backend_free();
+    }
     model_initialized = false;
 }
 
 // 实现清理函数，供外部调用
 void embedding_cleanup() {
-    cleanup_model();
+    std::unique_lock<std::mutex> lock(g_model_mutex);
+    cleanup_model(lock);
+}
+
+size_t embedding_peak_concurrent_decodes() {
+    return g_peak_decodes.load();
+}
+
+void embedding_configure(size_t num_contexts, int n_threads) {
+    std::lock_guard<std::mutex> lock(g_model_mutex);
+    g_pool_size = std::max<size_t>(1, num_contexts);
+    g_n_threads = std::max(0, n_threads);
+    g_peak_decodes = 0;
+    // 空闲的多余上下文立即释放，借出中的在归还时释放
+    while (g_ctx_all.size() > g_pool_size && !g_ctx_idle.empty()) {
+        llama_context* ctx = g_ctx_idle.back();
+        g_ctx_idle.pop_back();
+        g_ctx_all.erase(std::find(g_ctx_all.begin(), g_ctx_all.end(), ctx));
+        llama_free(ctx);
+    }
 }
 
 std::string join(const std::vector<std::string>& vec,
@@ -115,6 +211,11 @@ static void batch_decode(llama_context* ctx, llama_batch& batch, float* output,
   const enum llama_pooling_type pooling_type = llama_pooling_type(ctx);
   const struct llama_model* model = llama_get_model(ctx);
 
+  size_t active = ++g_active_decodes;
+  size_t peak = g_peak_decodes.load();
+  while (active > peak && !g_peak_decodes.compare_exchange_weak(peak, active)) {
+  }
+
   // clear previous kv_cache values (irrelevant for embeddings)
   llama_kv_self_clear(ctx);
 
@@ -133,6 +234,8 @@ static void batch_decode(llama_context* ctx, llama_batch& batch, float* output,
     }
   }
 
+  g_active_decodes--;
+
   for (int i = 0; i < batch.n_tokens; i++) {
     if (!batch.logits[i]) {
       continue;
@@ -159,18 +262,20 @@ static void batch_decode(llama_context* ctx, llama_batch& batch, float* output,
   }
 }
 
-int embedding_utils(const std::string& prompt, std::vector<float>& embeddings,
-                    int& n_embd, int& n_prompts) {
+static int embedding_prompts(const std::vector<std::string>& prompts,
+                             std::vector<float>& embeddings, int& n_embd,
+                             int& n_prompts) {
   // 暂停错误日志输出，减少控制台输出
   common_log_pause(common_log_main());
   
-  // 初始化模型（如果尚未初始化）
-  if (!initialize_model()) {
+  // 借一个上下文 (必要时先初始化模型)，可与其他线程的推理并行
+  ContextLease lease;
+  if (!lease.ctx) {
     return 1;
   }
   
   llama_model* model = g_model.get();
-  llama_context* ctx = g_ctx.get();
+  llama_context* ctx = lease.ctx;
 
   const llama_vocab* vocab = llama_model_get_vocab(model);
 
@@ -201,9 +306,6 @@ int embedding_utils(const std::string& prompt, std::vector<float>& embeddings,
   params.n_ctx = CONTEXT_SIZE;
   params.embedding = true;
 
-  // split the prompt into lines
-  std::vector<std::string> prompts = split_lines(prompt, params.embd_sep);
-
   // max batch size
   const uint64_t n_batch = params.n_batch;
   GGML_ASSERT(params.n_batch >= params.n_ctx);
@@ -264,7 +366,7 @@ int embedding_utils(const std::string& prompt, std::vector<float>& embeddings,
     const uint64_t n_toks = inp.size();
 
     // encode if at capacity
-    if (batch.n_tokens + n_toks > n_batch) {
+    if (batch.n_tokens + n_toks > n_batch || s >= MAX_SEQ_PER_BATCH) {
       float* out = emb + e * n_embd;
       batch_decode(ctx, batch, out, s, n_embd, params.embd_normalize);
       e += pooling_type == LLAMA_POOLING_TYPE_NONE ? batch.n_tokens : s;
@@ -288,6 +390,13 @@ int embedding_utils(const std::string& prompt, std::vector<float>& embeddings,
   return 0;
 }
 
+int embedding_utils(const std::string& prompt, std::vector<float>& embeddings,
+                    int& n_embd, int& n_prompts) {
+  // split the prompt into lines
+  return embedding_prompts(split_lines(prompt, common_params().embd_sep),
+                           embeddings, n_embd, n_prompts);
+}
+
 std::vector<std::vector<float>> embedding(const std::string& prompt) {
   int n_embd = 0;
   int n_prompts = 0;
@@ -345,3 +454,35 @@ std::vector<std::vector<float>> embedding_batch(const std::string& prompts) {
   
   return results;
 }
+
+std::vector<std::vector<float>> embedding_texts(
+    const std::vector<std::string>& texts) {
+  std::vector<std::vector<float>> results(texts.size());
+  std::vector<std::string> prompts;
+  std::vector<size_t> positions;
+  for (size_t i = 0; i < texts.size(); i++) {
+    if (!texts[i].empty()) {
+      prompts.push_back(texts[i]);
+      positions.push_back(i);
+    }
+  }
+  if (prompts.empty()) {
+    return results;
+  }
+
+  // 所有文本放进同一个 llama_batch (超过 n_batch 个 token 时由
+  // embedding_prompts 分成多次 decode)
+  int n_embd = 0;
+  int n_prompts = 0;
+  std::vector<float> embeddings;
+  if (embedding_prompts(prompts, embeddings, n_embd, n_prompts) != 0 ||
+      embeddings.size() < positions.size() * n_embd) {
+    LOG_ERR("%s: failed to embed %zu texts\n", __func__, prompts.size());
+    return results;
+  }
+  for (size_t i = 0; i < positions.size(); i++) {
+    results[positions[i]].assign(embeddings.begin() + i * n_embd,
+                                 embeddings.begin() + (i + 1) * n_embd);
+  }
+  return results;
+}
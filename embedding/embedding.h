@@ -19,5 +19,15 @@ std::vector<float> embedding_single(const std::string& prompt);
 
 std::vector<std::vector<float>> embedding_batch(const std::string& prompts);
 
+// 一次批量推理计算多条文本 (文本可以包含换行)，结果与 texts 一一对应，空文本对应空向量
+std::vector<std::vector<float>> embedding_texts(const std::vector<std::string>& texts);
+
 // 添加函数用于释放模型资源
 void embedding_cleanup();
+
+// 设置上下文池：最多 num_contexts 个 llama_context 共享同一个模型并行推理，每个使用 n_threads 个线程
+// (0 表示 llama.cpp 默认值)。可在任何时候调用，新上下文按需创建
+void embedding_configure(size_t num_contexts, int n_threads);
+
+// 自上次 embedding_configure 以来同时在 decode 的上下文数的最大值，用于确认上下文池确实在并行推理
+size_t embedding_peak_concurrent_decodes();
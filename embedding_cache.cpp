@@ -0,0 +1,168 @@
+#include "embedding_cache.h"
+#include "MurmurHash3.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+EmbeddingCache::Hash128 EmbeddingCache::hash_text(const std::string &text) {
+    uint64_t out[2] = {0, 0};
+    MurmurHash3_x64_128(text.data(), static_cast<int>(text.size()), 1, out);
+    return {out[0], out[1]};
+}
+
+void EmbeddingCache::set_capacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    while (lru_.size() > capacity_) {
+        index_.erase(lru_.back().hash);
+        lru_.pop_back();
+    }
+}
+
+bool EmbeddingCache::lookup(const std::string &text, std::vector<float> &out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0)
+        return false;
+    auto it = index_.find(hash_text(text));
+    if (it == index_.end()) {
+        ++misses_;
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    out = it->second->embedding;
+    ++hits_;
+    return true;
+}
+
+void EmbeddingCache::insert(const std::string &text, const std::vector<float> &embedding) {
+    if (embedding.empty())
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0)
+        return;
+    insert_locked(hash_text(text), embedding);
+    dirty_ = true;
+}
+
+void EmbeddingCache::insert_locked(const Hash128 &hash, std::vector<float> embedding) {
+    auto it = index_.find(hash);
+    if (it != index_.end()) {
+        it->second->embedding = std::move(embedding);
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+    lru_.push_front({hash, std::move(embedding)});
+    index_[hash] = lru_.begin();
+    if (lru_.size() > capacity_) {
+        index_.erase(lru_.back().hash);
+        lru_.pop_back();
+    }
+}
+
+void EmbeddingCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+    index_.clear();
+    dirty_ = false;
+}
+
+size_t EmbeddingCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+size_t EmbeddingCache::capacity() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_;
+}
+
+uint64_t EmbeddingCache::hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t EmbeddingCache::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+bool EmbeddingCache::load(const std::string &path, size_t dim) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        return false;
+    EmbeddingCacheFileHeader header{};
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, EMBEDDING_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != EMBEDDING_CACHE_VERSION || header.dim == 0) {
+        std::cerr << "[WARN] Ignoring invalid embedding cache file: " << path << std::endl;
+        return false;
+    }
+    if (dim != 0 && header.dim != dim) {
+        std::cerr << "[WARN] Embedding cache dimension " << header.dim << " does not match " << dim
+                  << ", ignoring " << path << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t loaded = 0;
+    for (uint64_t i = 0; i < header.count && capacity_ > 0; ++i) {
+        Hash128 hash{};
+        std::vector<float> embedding(header.dim);
+        if (!in.read(reinterpret_cast<char *>(&hash.h1), sizeof(hash.h1)) ||
+            !in.read(reinterpret_cast<char *>(&hash.h2), sizeof(hash.h2)) ||
+            !in.read(reinterpret_cast<char *>(embedding.data()), embedding.size() * sizeof(float))) {
+            std::cerr << "[WARN] Embedding cache file truncated after " << loaded << " entries: " << path << std::endl;
+            break;
+        }
+        insert_locked(hash, std::move(embedding)); // 文件从旧到新，逐条插入后最新的在表头
+        ++loaded;
+    }
+    dirty_ = false;
+    std::cout << "[INFO] Loaded " << loaded << " cached embeddings from " << path << std::endl;
+    return true;
+}
+
+bool EmbeddingCache::save(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!dirty_ || lru_.empty())
+        return true;
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "[ERROR] Failed to open embedding cache file for writing: " << tmp_path << std::endl;
+        return false;
+    }
+    EmbeddingCacheFileHeader header{};
+    std::memcpy(header.magic, EMBEDDING_CACHE_MAGIC, sizeof(header.magic));
+    header.version = EMBEDDING_CACHE_VERSION;
+    header.dim     = static_cast<uint32_t>(lru_.front().embedding.size());
+    header.count   = 0;
+    for (const Entry &entry : lru_) {
+        if (entry.embedding.size() == header.dim)
+            ++header.count;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (auto it = lru_.rbegin(); it != lru_.rend(); ++it) {
+        if (it->embedding.size() != header.dim)
+            continue;
+        out.write(reinterpret_cast<const char *>(&it->hash.h1), sizeof(it->hash.h1));
+        out.write(reinterpret_cast<const char *>(&it->hash.h2), sizeof(it->hash.h2));
+        out.write(reinterpret_cast<const char *>(it->embedding.data()), it->embedding.size() * sizeof(float));
+    }
+    out.close();
+    if (!out) {
+        std::cerr << "[ERROR] Failed to write embedding cache file: " << tmp_path << std::endl;
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "[ERROR] Failed to rename " << tmp_path << " to " << path << ": " << ec.message() << std::endl;
+        return false;
+    }
+    dirty_ = false;
+    return true;
+}
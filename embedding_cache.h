@@ -0,0 +1,80 @@
+#ifndef LSM_KV_EMBEDDING_CACHE_H
+#define LSM_KV_EMBEDDING_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 文本内容 -> embedding 的 LRU 缓存，以 128 位 MurmurHash3 作为键 (不保存原文)。
+// 重复写入相同的 value、重复的查询文本都不必再跑一遍模型推理。
+// 所有方法都加锁，可被并发的查询线程调用。save / load 用于跨重启保留缓存:
+//
+//   [EmbeddingCacheFileHeader] 之后是 count 条 {h1, h2, float[dim]}，按最近使用从旧到新排列
+
+constexpr char EMBEDDING_CACHE_MAGIC[8]          = {'L', 'S', 'M', 'E', 'C', 'A', 'C', 'H'};
+constexpr uint32_t EMBEDDING_CACHE_VERSION       = 1;
+constexpr const char *EMBEDDING_CACHE_FILE_NAME  = "embedding_cache.bin";
+
+struct EmbeddingCacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    uint64_t count;
+};
+
+class EmbeddingCache {
+public:
+    explicit EmbeddingCache(size_t capacity = 0) : capacity_(capacity) {}
+
+    // 容量为 0 表示禁用；缩小容量时淘汰最旧的条目
+    void set_capacity(size_t capacity);
+
+    // 命中时写入 out 并返回 true
+    bool lookup(const std::string &text, std::vector<float> &out);
+    void insert(const std::string &text, const std::vector<float> &embedding);
+    void clear();
+
+    // 维度与 dim 不符的缓存文件直接丢弃 (dim 为 0 时接受文件里的维度)
+    bool load(const std::string &path, size_t dim);
+    bool save(const std::string &path);
+
+    size_t size() const;
+    size_t capacity() const;
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    struct Hash128 {
+        uint64_t h1;
+        uint64_t h2;
+        bool operator==(const Hash128 &other) const {
+            return h1 == other.h1 && h2 == other.h2;
+        }
+    };
+    struct Hash128Hasher {
+        size_t operator()(const Hash128 &h) const {
+            return static_cast<size_t>(h.h1);
+        }
+    };
+    struct Entry {
+        Hash128 hash;
+        std::vector<float> embedding;
+    };
+
+    static Hash128 hash_text(const std::string &text);
+    void insert_locked(const Hash128 &hash, std::vector<float> embedding);
+
+    mutable std::mutex mutex_;
+    size_t capacity_;
+    std::list<Entry> lru_; // 表头为最近使用
+    std::unordered_map<Hash128, std::list<Entry>::iterator, Hash128Hasher> index_;
+    uint64_t hits_   = 0;
+    uint64_t misses_ = 0;
+    bool dirty_      = false; // 上次 load / save 之后有新条目
+};
+
+#endif // LSM_KV_EMBEDDING_CACHE_H
@@ -0,0 +1,107 @@
+#include "embedding_pipeline.h"
+
+#include <algorithm>
+#include <iostream>
+
+EmbeddingPipeline::EmbeddingPipeline(size_t batch_size, std::chrono::milliseconds max_delay, EmbedBatchFn embed_fn,
+                                     size_t num_workers)
+    : batch_size_(std::max<size_t>(1, batch_size)), max_delay_(max_delay), embed_fn_(std::move(embed_fn)) {
+    for (size_t i = 0; i < std::max<size_t>(1, num_workers); ++i)
+        workers_.emplace_back(&EmbeddingPipeline::worker_loop, this);
+}
+
+EmbeddingPipeline::~EmbeddingPipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (std::thread &worker : workers_)
+        worker.join();
+}
+
+void EmbeddingPipeline::submit(uint64_t key, uint64_t seq, std::string text) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back({key, seq, std::move(text)});
+    }
+    work_cv_.notify_one();
+}
+
+std::vector<EmbeddingPipeline::Result> EmbeddingPipeline::take_ready() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Result> results;
+    results.swap(ready_);
+    return results;
+}
+
+void EmbeddingPipeline::wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queue_.empty() && in_flight_ == 0)
+        return;
+    flush_ = true; // 不必等满 max_delay
+    work_cv_.notify_all();
+    idle_cv_.wait(lock, [this]() { return queue_.empty() && in_flight_ == 0; });
+}
+
+size_t EmbeddingPipeline::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size() + in_flight_ + ready_.size();
+}
+
+void EmbeddingPipeline::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+        if (queue_.empty())
+            return; // stop_ 且没有剩余任务
+
+        // 第一条到达后最多再等 max_delay，凑满一批或被 wait_idle / 析构催促时提前开始
+        auto deadline = std::chrono::steady_clock::now() + max_delay_;
+        work_cv_.wait_until(lock, deadline, [this]() { return stop_ || flush_ || queue_.size() >= batch_size_; });
+        if (queue_.empty())
+            continue; // 等待期间被其他线程取走了
+
+        size_t count = std::min(batch_size_, queue_.size());
+        std::vector<Job> jobs(std::make_move_iterator(queue_.begin()),
+                              std::make_move_iterator(queue_.begin() + count));
+        queue_.erase(queue_.begin(), queue_.begin() + count);
+        in_flight_ += count;
+        lock.unlock();
+
+        std::vector<std::string> texts;
+        texts.reserve(jobs.size());
+        for (Job &job : jobs)
+            texts.push_back(std::move(job.text));
+        // 推理抛出的异常不能离开工作线程 (会终止进程，in_flight_ 也不会归零使 wait_idle 永远等待)：
+        // 这一批全部按空向量返回
+        std::vector<std::vector<float>> embeddings;
+        bool failed = false;
+        try {
+            embeddings = embed_fn_(texts);
+        } catch (const std::exception &e) {
+            std::cerr << "[ERROR] Embedding batch of " << jobs.size() << " texts failed: " << e.what() << std::endl;
+            failed = true;
+        } catch (...) {
+            std::cerr << "[ERROR] Embedding batch of " << jobs.size() << " texts failed with an unknown exception."
+                      << std::endl;
+            failed = true;
+        }
+        if (failed) {
+            embeddings.assign(jobs.size(), std::vector<float>());
+        } else if (embeddings.size() != jobs.size()) {
+            std::cerr << "[ERROR] Embedding batch returned " << embeddings.size() << " vectors for " << jobs.size()
+                      << " texts." << std::endl;
+            embeddings.resize(jobs.size());
+        }
+
+        lock.lock();
+        for (size_t i = 0; i < jobs.size(); ++i)
+            ready_.push_back({jobs[i].key, jobs[i].seq, std::move(embeddings[i])});
+        in_flight_ -= jobs.size();
+        if (queue_.empty() && in_flight_ == 0) {
+            flush_ = false;
+            idle_cv_.notify_all();
+        }
+    }
+}
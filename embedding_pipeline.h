@@ -0,0 +1,71 @@
+#ifndef LSM_KV_EMBEDDING_PIPELINE_H
+#define LSM_KV_EMBEDDING_PIPELINE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 异步批量 embedding：put 把文本放进队列立即返回，后台线程凑够 batch_size 条或等满 max_delay
+// 后一次性调用 embed_fn (一次批量推理)，结果放进完成队列，由调用方在自己的线程里取走并应用。
+// 这样写入吞吐取决于模型的批量吞吐，而不是单条推理延迟；向量表 / HNSW 仍只在调用方线程里修改。
+// num_workers 个后台线程各自取批次，配合 embedding_configure 的上下文池可以同时推理多批
+class EmbeddingPipeline {
+public:
+    using EmbedBatchFn = std::function<std::vector<std::vector<float>>(const std::vector<std::string> &)>;
+
+    struct Result {
+        uint64_t key;
+        uint64_t seq; // submit 时的序号，用来丢弃被后续写入覆盖的结果
+        std::vector<float> embedding;
+    };
+
+    EmbeddingPipeline(size_t batch_size, std::chrono::milliseconds max_delay, EmbedBatchFn embed_fn,
+                      size_t num_workers = 1);
+    ~EmbeddingPipeline(); // 处理完已提交的文本后退出
+
+    EmbeddingPipeline(const EmbeddingPipeline &)            = delete;
+    EmbeddingPipeline &operator=(const EmbeddingPipeline &) = delete;
+
+    void submit(uint64_t key, uint64_t seq, std::string text);
+
+    // 取走所有已算好的结果
+    std::vector<Result> take_ready();
+
+    // 阻塞到已提交的文本全部算完
+    void wait_idle();
+
+    // 已提交但还没被 take_ready 取走的条数
+    size_t pending() const;
+
+private:
+    struct Job {
+        uint64_t key;
+        uint64_t seq;
+        std::string text;
+    };
+
+    void worker_loop();
+
+    const size_t batch_size_;
+    const std::chrono::milliseconds max_delay_;
+    EmbedBatchFn embed_fn_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<Job> queue_;
+    std::vector<Result> ready_;
+    size_t in_flight_ = 0; // 正在推理的条数
+    bool flush_       = false; // wait_idle 等待中，凑批不再等 max_delay
+    bool stop_        = false;
+    std::vector<std::thread> workers_;
+};
+
+#endif // LSM_KV_EMBEDDING_PIPELINE_H
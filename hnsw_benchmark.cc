@@ -0,0 +1,386 @@
+// HNSW 召回率 / 吞吐基准：载入向量，用精确 search_knn 求真值，扫描 M 与 ef 的组合，
+// 以 JSON 输出 recall@k、QPS、p50/p99 延迟、每次查询的距离计算次数和建图时间。
+//
+// 用法: hnsw_benchmark [--data=synthetic|fvecs:<path>|txt:<path>] [--queries-file=fvecs:<path>|txt:<path>]
+//                      [--n=10000] [--dim=768] [--queries=200] [--k=10] [--M=8,16] [--ef-construction=100]
+//                      [--ef=16,32,64,128] [--build-threads=0] [--dir=./hnsw_bench_data] [--out=result.json]
+//                      [--neighbor-heuristic=1] [--extend-candidates=0] [--keep-pruned=0] [--prefetch-distance=4]
+//                      [--reorder=0] [--metric=cosine|l2|ip]
+//   synthetic  按固定种子生成的聚簇高斯向量 (dim 维)
+//   fvecs      TEXMEX 格式：每条为 int32 维度 + float[dim]
+//   txt        embedding_100k.txt 格式：每行一个 "[x1, x2, ...]"
+// --reorder=1 在建图后按 BFS 顺序重排 label (reorder_hnsw_graph)，用于比较内存布局对查询的影响。
+// 没有单独的查询文件时，取数据集末尾 queries 条作为查询，不参与建图。--dir 必须是相对路径
+
+#include "kvstore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+struct BenchmarkConfig {
+    std::string data          = "synthetic";
+    std::string queries_file;
+    size_t n                  = 10000;
+    size_t dim                = 768;
+    size_t queries            = 200;
+    int k                     = 10;
+    std::vector<int> M        = {8, 16};
+    int ef_construction       = 100;
+    std::vector<int> ef       = {16, 32, 64, 128};
+    size_t build_threads      = 0;
+    bool neighbor_heuristic   = true;
+    bool extend_candidates    = false;
+    bool keep_pruned          = false;
+    int prefetch_distance     = 4;
+    bool reorder              = false;
+    DistanceMetric metric     = DistanceMetric::Cosine;
+    std::string dir           = "./hnsw_bench_data";
+    std::string out;
+};
+
+std::vector<int> parse_int_list(const std::string &text) {
+    std::vector<int> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(std::atoi(item.c_str()));
+        }
+    }
+    return values;
+}
+
+bool parse_args(int argc, char *argv[], BenchmarkConfig &config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq       = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            std::cerr << "[ERROR] Unrecognized argument: " << arg << std::endl;
+            return false;
+        }
+        std::string name  = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "data") {
+            config.data = value;
+        } else if (name == "queries-file") {
+            config.queries_file = value;
+        } else if (name == "n") {
+            config.n = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "dim") {
+            config.dim = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "queries") {
+            config.queries = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "k") {
+            config.k = std::atoi(value.c_str());
+        } else if (name == "M") {
+            config.M = parse_int_list(value);
+        } else if (name == "ef-construction") {
+            config.ef_construction = std::atoi(value.c_str());
+        } else if (name == "ef") {
+            config.ef = parse_int_list(value);
+        } else if (name == "build-threads") {
+            config.build_threads = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "neighbor-heuristic") {
+            config.neighbor_heuristic = std::atoi(value.c_str()) != 0;
+        } else if (name == "extend-candidates") {
+            config.extend_candidates = std::atoi(value.c_str()) != 0;
+        } else if (name == "keep-pruned") {
+            config.keep_pruned = std::atoi(value.c_str()) != 0;
+        } else if (name == "prefetch-distance") {
+            config.prefetch_distance = std::atoi(value.c_str());
+        } else if (name == "reorder") {
+            config.reorder = std::atoi(value.c_str()) != 0;
+        } else if (name == "metric") {
+            if (value == "cosine") {
+                config.metric = DistanceMetric::Cosine;
+            } else if (value == "l2") {
+                config.metric = DistanceMetric::L2;
+            } else if (value == "ip") {
+                config.metric = DistanceMetric::InnerProduct;
+            } else {
+                std::cerr << "[ERROR] Unknown metric: " << value << std::endl;
+                return false;
+            }
+        } else if (name == "dir") {
+            config.dir = value;
+        } else if (name == "out") {
+            config.out = value;
+        } else {
+            std::cerr << "[ERROR] Unknown option: --" << name << std::endl;
+            return false;
+        }
+    }
+    if (config.k <= 0 || config.M.empty() || config.ef.empty() || config.queries == 0) {
+        std::cerr << "[ERROR] k, --M, --ef and --queries must be non-empty / positive." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 100 个簇中心加噪声，比均匀随机向量更接近真实 embedding 的近邻结构
+std::vector<std::vector<float>> generate_synthetic(size_t count, size_t dim) {
+    std::mt19937 rng(42);
+    std::normal_distribution<float> gauss;
+    std::vector<std::vector<float>> centers(100, std::vector<float>(dim));
+    for (auto &center : centers) {
+        for (float &x : center) {
+            x = gauss(rng);
+        }
+    }
+    std::vector<std::vector<float>> vectors(count, std::vector<float>(dim));
+    for (auto &vec : vectors) {
+        const std::vector<float> &center = centers[rng() % centers.size()];
+        for (size_t d = 0; d < dim; ++d) {
+            vec[d] = center[d] + 0.6f * gauss(rng);
+        }
+    }
+    return vectors;
+}
+
+bool load_fvecs(const std::string &path, size_t limit, std::vector<std::vector<float>> &out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "[ERROR] Could not open fvecs file: " << path << std::endl;
+        return false;
+    }
+    int32_t dim = 0;
+    while (out.size() < limit && in.read(reinterpret_cast<char *>(&dim), sizeof(dim))) {
+        if (dim <= 0 || (!out.empty() && static_cast<size_t>(dim) != out.front().size())) {
+            std::cerr << "[ERROR] Invalid dimension " << dim << " in " << path << std::endl;
+            return false;
+        }
+        std::vector<float> vec(dim);
+        if (!in.read(reinterpret_cast<char *>(vec.data()), dim * sizeof(float))) {
+            break;
+        }
+        out.push_back(std::move(vec));
+    }
+    return !out.empty();
+}
+
+// "[x1, x2, ...]" 每行一条，与 phase5_large_data_test.cc 读取的格式相同
+bool load_txt(const std::string &path, size_t limit, std::vector<std::vector<float>> &out) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "[ERROR] Could not open embedding text file: " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (out.size() < limit && std::getline(in, line)) {
+        size_t begin = line.find('[');
+        size_t end   = line.rfind(']');
+        if (begin == std::string::npos || end == std::string::npos || end <= begin) {
+            continue;
+        }
+        std::vector<float> vec;
+        const char *p    = line.c_str() + begin + 1;
+        const char *stop = line.c_str() + end;
+        while (p < stop) {
+            char *next = nullptr;
+            float x    = std::strtof(p, &next);
+            if (next == p) {
+                ++p; // 跳过逗号与空白
+                continue;
+            }
+            vec.push_back(x);
+            p = next;
+        }
+        if (vec.empty() || (!out.empty() && vec.size() != out.front().size())) {
+            std::cerr << "[WARN] Skipping malformed embedding line " << out.size() + 1 << std::endl;
+            continue;
+        }
+        out.push_back(std::move(vec));
+    }
+    return !out.empty();
+}
+
+bool load_vectors(const std::string &source, size_t limit, size_t dim, std::vector<std::vector<float>> &out) {
+    if (source == "synthetic") {
+        out = generate_synthetic(limit, dim);
+        return true;
+    }
+    if (source.rfind("fvecs:", 0) == 0) {
+        return load_fvecs(source.substr(6), limit, out);
+    }
+    if (source.rfind("txt:", 0) == 0) {
+        return load_txt(source.substr(4), limit, out);
+    }
+    std::cerr << "[ERROR] Unknown data source: " << source << std::endl;
+    return false;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+std::string json_escape(const std::string &text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    BenchmarkConfig config;
+    if (!parse_args(argc, argv, config)) {
+        return 1;
+    }
+
+    // 1. 载入数据与查询
+    std::vector<std::vector<float>> base;
+    std::vector<std::vector<float>> queries;
+    const size_t base_limit = config.queries_file.empty() ? config.n + config.queries : config.n;
+    if (!load_vectors(config.data, base_limit, config.dim, base)) {
+        return 1;
+    }
+    if (!config.queries_file.empty()) {
+        if (!load_vectors(config.queries_file, config.queries, config.dim, queries)) {
+            return 1;
+        }
+    } else {
+        size_t held_out = std::min(config.queries, base.size() / 2);
+        queries.assign(base.end() - held_out, base.end());
+        base.resize(base.size() - held_out);
+    }
+    if (queries.empty() || queries.front().size() != base.front().size()) {
+        std::cerr << "[ERROR] Query vectors are missing or their dimension does not match the data." << std::endl;
+        return 1;
+    }
+    std::cout << "[INFO] Benchmark data: " << base.size() << " vectors, " << queries.size() << " queries, dim "
+              << base.front().size() << std::endl;
+
+    std::vector<uint64_t> keys(base.size());
+    std::vector<std::string> values(base.size());
+    for (size_t i = 0; i < base.size(); ++i) {
+        keys[i]   = i;
+        values[i] = "v" + std::to_string(i);
+    }
+
+    std::vector<std::unordered_set<uint64_t>> truth;
+    std::ostringstream runs;
+    bool first_run = true;
+    for (int M : config.M) {
+        std::string dir = config.dir + "/M" + std::to_string(M);
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+
+        HNSWOptions options;
+        options.M                       = M;
+        options.M_max                   = 2 * M;
+        options.ef_construction         = config.ef_construction;
+        options.build_threads           = config.build_threads;
+        options.neighbor_heuristic      = config.neighbor_heuristic;
+        options.extend_candidates       = config.extend_candidates;
+        options.keep_pruned_connections = config.keep_pruned;
+        options.prefetch_distance       = config.prefetch_distance;
+        options.metric                  = config.metric;
+        KVStore store(dir, "", options);
+
+        // 2. 建图
+        auto build_start = std::chrono::steady_clock::now();
+        store.put_batch_with_precomputed_embedding(keys, values, base);
+        double build_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+        std::cout << "[INFO] M=" << M << " built in " << build_seconds << " s" << std::endl;
+        if (config.reorder) {
+            store.reorder_hnsw_graph(); // 不计入建图时间
+        }
+
+        // 3. 真值 (与 M 无关，只算一次)
+        if (truth.empty()) {
+            auto truth_start = std::chrono::steady_clock::now();
+            truth.resize(queries.size());
+            for (size_t q = 0; q < queries.size(); ++q) {
+                for (const auto &result : store.search_knn(queries[q], config.k)) {
+                    truth[q].insert(result.first);
+                }
+            }
+            std::cout << "[INFO] Ground truth computed in "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - truth_start).count()
+                      << " s" << std::endl;
+        }
+
+        // 4. 扫描 ef，查询逐条串行执行以得到单次延迟
+        for (int ef : config.ef) {
+            std::vector<double> latencies_us;
+            latencies_us.reserve(queries.size());
+            size_t hits               = 0;
+            size_t expected           = 0;
+            uint64_t distances_before = KVStore::distance_computations();
+            auto sweep_start          = std::chrono::steady_clock::now();
+            for (size_t q = 0; q < queries.size(); ++q) {
+                auto query_start = std::chrono::steady_clock::now();
+                auto results     = store.search_knn_hnsw(queries[q], config.k, ef);
+                latencies_us.push_back(
+                    std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - query_start).count());
+                for (const auto &result : results) {
+                    hits += truth[q].count(result.first);
+                }
+                expected += truth[q].size();
+            }
+            double sweep_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - sweep_start).count();
+            uint64_t distances   = KVStore::distance_computations() - distances_before;
+
+            double recall = expected ? static_cast<double>(hits) / expected : 0.0;
+            double qps    = sweep_seconds > 0 ? queries.size() / sweep_seconds : 0.0;
+            std::cout << "[INFO] M=" << M << " ef=" << ef << " recall@" << config.k << "=" << recall << " QPS=" << qps
+                      << std::endl;
+
+            runs << (first_run ? "" : ",\n") << std::fixed << std::setprecision(4) << "    {\"M\": " << M
+                 << ", \"ef_construction\": " << config.ef_construction << ", \"ef\": " << ef
+                 << ", \"recall\": " << recall << ", \"qps\": " << std::setprecision(1) << qps
+                 << ", \"latency_p50_us\": " << percentile(latencies_us, 0.50)
+                 << ", \"latency_p99_us\": " << percentile(latencies_us, 0.99)
+                 << ", \"distances_per_query\": " << static_cast<double>(distances) / queries.size()
+                 << ", \"build_seconds\": " << std::setprecision(3) << build_seconds << "}";
+            first_run = false;
+        }
+    }
+    std::filesystem::remove_all(config.dir);
+
+    std::ostringstream json;
+    json << "{\n  \"dataset\": \"" << json_escape(config.data) << "\", \"num_vectors\": " << base.size()
+         << ", \"num_queries\": " << queries.size() << ", \"dim\": " << base.front().size()
+         << ", \"k\": " << config.k << ",\n  \"neighbor_heuristic\": " << std::boolalpha << config.neighbor_heuristic
+         << ", \"extend_candidates\": " << config.extend_candidates << ", \"keep_pruned\": " << config.keep_pruned
+         << ", \"prefetch_distance\": " << config.prefetch_distance << ", \"reorder\": " << config.reorder
+         << ", \"metric\": \"" << distance_metric_name(config.metric) << "\""
+         << ",\n  \"runs\": [\n"
+         << runs.str() << "\n  ]\n}\n";
+    if (config.out.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream out(config.out);
+        out << json.str();
+        if (!out) {
+            std::cerr << "[ERROR] Failed to write benchmark results to " << config.out << std::endl;
+            return 1;
+        }
+        std::cout << "[INFO] Benchmark results written to " << config.out << std::endl;
+    }
+    return 0;
+}
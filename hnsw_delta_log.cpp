@@ -0,0 +1,218 @@
+#include "hnsw_delta_log.h"
+#include "mapped_file.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+struct HNSWDeltaFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t checkpoint_id;
+};
+
+constexpr size_t RECORD_HEADER_SIZE = sizeof(uint32_t) * 2 + sizeof(uint8_t);
+
+uint32_t fnv1a(const char *data, size_t len, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+void put(std::string &buf, T value) {
+    buf.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+bool get(const char *&p, const char *end, T &value) {
+    if (static_cast<size_t>(end - p) < sizeof(T))
+        return false;
+    std::memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+bool read_header(const std::string &path, HNSWDeltaFileHeader &header) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+    return std::memcmp(header.magic, HNSW_DELTA_MAGIC, sizeof(HNSW_DELTA_MAGIC)) == 0 &&
+           header.version == HNSW_DELTA_VERSION;
+}
+
+} // namespace
+
+bool HNSWDeltaLogWriter::open(const std::string &path, uint64_t checkpoint_id) {
+    std::error_code ec;
+    uint64_t existing = std::filesystem::exists(path, ec) ? std::filesystem::file_size(path, ec) : 0;
+    if (existing >= sizeof(HNSWDeltaFileHeader)) {
+        HNSWDeltaFileHeader header;
+        if (!read_header(path, header)) {
+            std::cerr << "[ERROR] Unrecognized HNSW delta log: " << path << std::endl;
+            return false;
+        }
+        if (header.checkpoint_id != checkpoint_id) {
+            std::cerr << "[ERROR] HNSW delta log " << path << " belongs to another checkpoint." << std::endl;
+            return false;
+        }
+        out_.open(path, std::ios::binary | std::ios::app);
+        size_ = existing;
+    } else {
+        out_.open(path, std::ios::binary | std::ios::trunc);
+        HNSWDeltaFileHeader header{};
+        std::memcpy(header.magic, HNSW_DELTA_MAGIC, sizeof(header.magic));
+        header.version       = HNSW_DELTA_VERSION;
+        header.checkpoint_id = checkpoint_id;
+        out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        size_ = sizeof(header);
+    }
+    if (!out_.is_open()) {
+        std::cerr << "[ERROR] Failed to open HNSW delta log for writing: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool HNSWDeltaLogWriter::close() {
+    out_.flush();
+    bool ok = static_cast<bool>(out_);
+    out_.close();
+    return ok;
+}
+
+void HNSWDeltaLogWriter::append_record(HNSWDeltaType type, const std::string &payload) {
+    uint8_t type_byte = static_cast<uint8_t>(type);
+    uint32_t checksum = fnv1a(payload.data(), payload.size(), fnv1a(reinterpret_cast<const char *>(&type_byte), 1));
+    std::string record;
+    record.reserve(RECORD_HEADER_SIZE + payload.size());
+    put(record, static_cast<uint32_t>(payload.size()));
+    put(record, checksum);
+    put(record, type_byte);
+    record += payload;
+    out_.write(record.data(), static_cast<std::streamsize>(record.size()));
+    size_ += record.size();
+}
+
+void HNSWDeltaLogWriter::append_node(uint64_t label, uint64_t key, int32_t max_level) {
+    std::string payload;
+    put(payload, label);
+    put(payload, key);
+    put(payload, max_level);
+    append_record(HNSWDeltaType::NODE, payload);
+}
+
+void HNSWDeltaLogWriter::append_links(uint64_t label, int32_t level, const std::vector<size_t> &links) {
+    std::string payload;
+    payload.reserve(sizeof(uint64_t) + sizeof(int32_t) + sizeof(uint32_t) * (links.size() + 1));
+    put(payload, label);
+    put(payload, level);
+    put(payload, static_cast<uint32_t>(links.size()));
+    for (size_t link : links)
+        put(payload, static_cast<uint32_t>(link));
+    append_record(HNSWDeltaType::LINKS, payload);
+}
+
+void HNSWDeltaLogWriter::append_delete(uint64_t label) {
+    std::string payload;
+    put(payload, label);
+    append_record(HNSWDeltaType::DELETE, payload);
+}
+
+void HNSWDeltaLogWriter::append_tombstone(uint64_t label) {
+    std::string payload;
+    put(payload, label);
+    append_record(HNSWDeltaType::TOMBSTONE, payload);
+}
+
+void HNSWDeltaLogWriter::append_entry(uint64_t entry_point, int32_t max_level, uint64_t next_label) {
+    std::string payload;
+    put(payload, entry_point);
+    put(payload, max_level);
+    put(payload, next_label);
+    append_record(HNSWDeltaType::ENTRY, payload);
+}
+
+bool read_hnsw_delta_log(const std::string &path, uint64_t checkpoint_id, std::vector<HNSWDeltaRecord> &records,
+                         uint64_t &valid_size, bool &checkpoint_matches) {
+    records.clear();
+    valid_size         = 0;
+    checkpoint_matches = false;
+
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+    if (file.size() < sizeof(HNSWDeltaFileHeader))
+        return true; // 只有残缺的文件头，视为空日志
+
+    HNSWDeltaFileHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, HNSW_DELTA_MAGIC, sizeof(HNSW_DELTA_MAGIC)) != 0 ||
+        header.version != HNSW_DELTA_VERSION) {
+        std::cerr << "[ERROR] Unrecognized HNSW delta log: " << path << std::endl;
+        return true;
+    }
+    if (header.checkpoint_id != checkpoint_id)
+        return true;
+    checkpoint_matches = true;
+    valid_size         = sizeof(HNSWDeltaFileHeader);
+
+    const char *begin = file.data();
+    const char *p     = begin + sizeof(HNSWDeltaFileHeader);
+    const char *end   = begin + file.size();
+    size_t committed  = 0; // records 中已提交的记录数
+    while (p < end) {
+        uint32_t payload_len = 0, checksum = 0;
+        uint8_t type_byte = 0;
+        if (!get(p, end, payload_len) || !get(p, end, checksum) || !get(p, end, type_byte) ||
+            static_cast<size_t>(end - p) < payload_len)
+            break;
+        if (fnv1a(p, payload_len, fnv1a(reinterpret_cast<const char *>(&type_byte), 1)) != checksum)
+            break;
+
+        const char *q       = p;
+        const char *rec_end = p + payload_len;
+        p                   = rec_end;
+
+        HNSWDeltaRecord record;
+        record.type = static_cast<HNSWDeltaType>(type_byte);
+        bool ok     = false;
+        switch (record.type) {
+        case HNSWDeltaType::NODE:
+            ok = get(q, rec_end, record.label) && get(q, rec_end, record.key) && get(q, rec_end, record.level);
+            break;
+        case HNSWDeltaType::LINKS: {
+            uint32_t count = 0;
+            ok = get(q, rec_end, record.label) && get(q, rec_end, record.level) && get(q, rec_end, count) &&
+                 static_cast<size_t>(rec_end - q) == count * sizeof(uint32_t);
+            if (ok) {
+                record.links.resize(count);
+                std::memcpy(record.links.data(), q, count * sizeof(uint32_t));
+            }
+            break;
+        }
+        case HNSWDeltaType::DELETE:
+        case HNSWDeltaType::TOMBSTONE:
+            ok = get(q, rec_end, record.label);
+            break;
+        case HNSWDeltaType::ENTRY:
+            ok = get(q, rec_end, record.label) && get(q, rec_end, record.level) && get(q, rec_end, record.next_label);
+            break;
+        }
+        if (!ok)
+            break;
+
+        records.push_back(std::move(record));
+        if (records.back().type == HNSWDeltaType::ENTRY) {
+            committed  = records.size();
+            valid_size = static_cast<uint64_t>(p - begin);
+        }
+    }
+    records.resize(committed); // 丢弃未提交的尾部批次
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef LSM_KV_HNSW_DELTA_LOG_H
+#define LSM_KV_HNSW_DELTA_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// HNSW 增量日志 (hnsw_delta.log)：追加写在单文件索引 (检查点) 之后的图变更。
+//
+//   文件头: magic[8] | version u32 | reserved u32 | checkpoint_id u64 (对应 hnsw_index.bin 的 checkpoint_id)
+//   记录:   payload_len u32 | checksum u32 (FNV-1a, 覆盖 type + payload) | type u8 | payload
+//
+// 一次 save_hnsw_delta 写出的一组记录以 ENTRY 结尾，ENTRY 同时充当提交标记：
+// 回放时只应用完整提交的批次，末尾不完整或校验失败的记录被丢弃。
+
+constexpr char HNSW_DELTA_MAGIC[8]          = {'L', 'S', 'M', 'H', 'D', 'L', 'O', 'G'};
+constexpr uint32_t HNSW_DELTA_VERSION       = 1;
+constexpr const char *HNSW_DELTA_FILE_NAME  = "hnsw_delta.log";
+
+enum class HNSWDeltaType : uint8_t {
+    NODE      = 1, // 新节点或 label 被重新分配 (清除删除标记): label, key, max_level
+    LINKS     = 2, // 替换某层邻居表: label, level, count, labels...
+    DELETE    = 3, // 节点已从图中移除: label
+    ENTRY     = 4, // 入口点与 label 上界，同时是批次的提交标记: entry_point, max_level, next_label
+    TOMBSTONE = 5, // 节点被标记删除，仍留在图中: label
+};
+
+struct HNSWDeltaRecord {
+    HNSWDeltaType type;
+    uint64_t label      = 0;
+    uint64_t key        = 0; // NODE
+    int32_t level       = 0; // NODE: max_level, LINKS: level, ENTRY: max_level
+    uint64_t next_label = 0; // ENTRY
+    std::vector<uint32_t> links;
+};
+
+class HNSWDeltaLogWriter {
+public:
+    // 打开 (必要时创建) 日志用于追加。已有日志的 checkpoint_id 不匹配时返回 false
+    bool open(const std::string &path, uint64_t checkpoint_id);
+    bool close(); // 刷盘，返回写入是否成功
+
+    void append_node(uint64_t label, uint64_t key, int32_t max_level);
+    void append_links(uint64_t label, int32_t level, const std::vector<size_t> &links);
+    void append_delete(uint64_t label);
+    void append_tombstone(uint64_t label);
+    void append_entry(uint64_t entry_point, int32_t max_level, uint64_t next_label);
+
+    uint64_t size() const {
+        return size_;
+    }
+
+private:
+    void append_record(HNSWDeltaType type, const std::string &payload);
+
+    std::ofstream out_;
+    uint64_t size_ = 0;
+};
+
+// 读取日志中所有已提交批次的记录。valid_size 为最后一个完整批次结束处的偏移，
+// 调用方可据此截掉损坏的尾部。文件不存在返回 false；checkpoint_id 不匹配时 checkpoint_matches 为 false
+bool read_hnsw_delta_log(const std::string &path, uint64_t checkpoint_id, std::vector<HNSWDeltaRecord> &records,
+                         uint64_t &valid_size, bool &checkpoint_matches);
+
+#endif // LSM_KV_HNSW_DELTA_LOG_H
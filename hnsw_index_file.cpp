@@ -0,0 +1,106 @@
+#include "hnsw_index_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+void hnsw_index_layout(HNSWIndexFileHeader &header) {
+    uint64_t offset           = hnsw_index_align(sizeof(HNSWIndexFileHeader));
+    header.label_table_offset = offset;
+    offset += header.num_labels * sizeof(HNSWIndexLabelEntry);
+
+    offset               = hnsw_index_align(offset);
+    header.level0_offset = offset;
+    offset += header.num_labels * header.stride * sizeof(uint32_t);
+
+    offset              = hnsw_index_align(offset);
+    header.upper_offset = offset;
+    offset += header.upper_blocks * header.stride * sizeof(uint32_t);
+
+    if (header.flags & HNSW_INDEX_FLAG_VECTORS) {
+        offset               = hnsw_index_align(offset);
+        header.vector_offset = offset;
+        offset += header.num_labels * header.dim * sizeof(float);
+    } else {
+        header.vector_offset = 0;
+    }
+
+    offset                = hnsw_index_align(offset);
+    header.deleted_offset = offset;
+    offset += header.num_deleted * sizeof(uint32_t);
+    header.file_size = offset;
+}
+
+bool HNSWIndexFile::open(const std::string &path) {
+    close();
+    if (!file_.open(path)) {
+        std::cerr << "[ERROR] Failed to open HNSW index file: " << path << std::endl;
+        return false;
+    }
+    if (file_.size() < sizeof(HNSWIndexFileHeader)) {
+        std::cerr << "[ERROR] HNSW index file too small: " << path << std::endl;
+        file_.close();
+        return false;
+    }
+
+    const auto *header = reinterpret_cast<const HNSWIndexFileHeader *>(file_.data());
+    if (std::memcmp(header->magic, HNSW_INDEX_MAGIC, sizeof(HNSW_INDEX_MAGIC)) != 0 ||
+        header->version != HNSW_INDEX_VERSION) {
+        std::cerr << "[ERROR] Unrecognized HNSW index file (bad magic or version): " << path << std::endl;
+        file_.close();
+        return false;
+    }
+
+    // 按头部参数重新计算布局，与文件中记录的偏移和实际大小逐一核对
+    HNSWIndexFileHeader expected = *header;
+    hnsw_index_layout(expected);
+    if (header->stride < 1 || expected.label_table_offset != header->label_table_offset ||
+        expected.level0_offset != header->level0_offset || expected.upper_offset != header->upper_offset ||
+        expected.vector_offset != header->vector_offset || expected.deleted_offset != header->deleted_offset ||
+        expected.file_size != header->file_size ||
+        header->file_size > file_.size()) {
+        std::cerr << "[ERROR] Corrupted HNSW index file (layout mismatch): " << path << std::endl;
+        file_.close();
+        return false;
+    }
+
+    header_  = header;
+    labels_  = reinterpret_cast<const HNSWIndexLabelEntry *>(file_.data() + header->label_table_offset);
+    level0_  = reinterpret_cast<const uint32_t *>(file_.data() + header->level0_offset);
+    upper_   = reinterpret_cast<const uint32_t *>(file_.data() + header->upper_offset);
+    vectors_ = header->vector_offset ? reinterpret_cast<const float *>(file_.data() + header->vector_offset) : nullptr;
+    deleted_ = reinterpret_cast<const uint32_t *>(file_.data() + header->deleted_offset);
+    return true;
+}
+
+void HNSWIndexFile::close() {
+    file_.close();
+    header_  = nullptr;
+    labels_  = nullptr;
+    level0_  = nullptr;
+    upper_   = nullptr;
+    vectors_ = nullptr;
+    deleted_ = nullptr;
+}
+
+const uint32_t *HNSWIndexFile::neighbors(size_t label, int level, uint32_t &count) const {
+    const uint32_t *block = nullptr;
+    if (level == 0) {
+        block = level0_ + label * header_->stride;
+    } else {
+        uint64_t index = labels_[label].upper_offset + static_cast<uint64_t>(level - 1);
+        if (index >= header_->upper_blocks) {
+            count = 0;
+            return nullptr;
+        }
+        block = upper_ + index * header_->stride;
+    }
+    count = std::min<uint32_t>(block[0], header_->stride - 1);
+    return block + 1;
+}
+
+const float *HNSWIndexFile::vector(size_t label) const {
+    if (!vectors_)
+        return nullptr;
+    return vectors_ + label * header_->dim;
+}
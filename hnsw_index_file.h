@@ -0,0 +1,112 @@
+#ifndef LSM_KV_HNSW_INDEX_FILE_H
+#define LSM_KV_HNSW_INDEX_FILE_H
+
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 单文件 HNSW 索引 (hnsw_index.bin)。所有段按 64 字节对齐，按 label 直接寻址，可 mmap 后原地读取:
+//
+//   [HNSWIndexFileHeader]
+//   [label 表]   num_labels 个 HNSWIndexLabelEntry，第 i 项对应 label i (max_level < 0 表示空位)
+//   [第 0 层]    num_labels * stride 个 uint32：{邻居数, 邻居 label...}，stride = M_max + 1
+//   [高层]       upper_blocks * stride 个 uint32，label 的第 l 层 (l >= 1) 位于 upper_offset + (l - 1)
+//   [向量段]     可选，num_labels * dim 个 float (flags & HNSW_INDEX_FLAG_VECTORS)
+//   [删除段]     num_deleted 个升序 uint32，已删除但仍留在图中的节点 label (取代旧的 deleted_nodes.bin)
+
+constexpr char HNSW_INDEX_MAGIC[8]          = {'L', 'S', 'M', 'H', 'N', 'S', 'W', '\0'};
+constexpr uint32_t HNSW_INDEX_VERSION       = 2;
+constexpr uint32_t HNSW_INDEX_FLAG_VECTORS  = 1u << 0;
+constexpr uint32_t HNSW_INDEX_METRIC_SHIFT  = 8;            // flags 的 8..15 位：DistanceMetric (早期文件为 0，即余弦)
+constexpr uint32_t HNSW_INDEX_METRIC_MASK   = 0xffu << HNSW_INDEX_METRIC_SHIFT;
+constexpr uint64_t HNSW_INDEX_ALIGNMENT     = 64;
+constexpr const char *HNSW_INDEX_FILE_NAME  = "hnsw_index.bin";
+
+struct HNSWIndexFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t dim;
+    uint32_t M;
+    uint32_t M_max;
+    uint32_t efConstruction;
+    int32_t max_level;          // current_max_level_
+    uint32_t stride;            // 每个邻居块的 uint32 个数 (M_max + 1)
+    uint64_t entry_point_label;
+    uint64_t num_labels;        // label 上界 (next_label_)
+    uint64_t num_nodes;         // 节点数 (含已删除节点)
+    uint64_t upper_blocks;      // 高层邻居块总数
+    uint64_t label_table_offset;
+    uint64_t level0_offset;
+    uint64_t upper_offset;
+    uint64_t vector_offset;     // 无向量段时为 0
+    uint64_t file_size;
+    uint64_t checkpoint_id;     // 每次完整保存生成，增量日志据此确认自己对应的检查点
+    uint64_t num_deleted;
+    uint64_t deleted_offset;
+};
+
+struct HNSWIndexLabelEntry {
+    uint64_t key;
+    int32_t max_level;          // -1 表示该 label 没有节点
+    uint32_t reserved;
+    uint64_t upper_offset;      // 高层第一个块的序号
+};
+
+inline uint64_t hnsw_index_align(uint64_t offset) {
+    return (offset + HNSW_INDEX_ALIGNMENT - 1) / HNSW_INDEX_ALIGNMENT * HNSW_INDEX_ALIGNMENT;
+}
+
+// 根据 num_labels / stride / upper_blocks / dim / flags / num_deleted 计算各段偏移
+void hnsw_index_layout(HNSWIndexFileHeader &header);
+
+// 索引文件的只读视图，open 之后直接在映射内存上访问
+class HNSWIndexFile {
+public:
+    bool open(const std::string &path);
+    void close();
+
+    bool is_open() const {
+        return header_ != nullptr;
+    }
+
+    bool is_mapped() const {
+        return file_.is_mapped();
+    }
+
+    const HNSWIndexFileHeader &header() const {
+        return *header_;
+    }
+
+    bool has_node(size_t label) const {
+        return label < header_->num_labels && labels_[label].max_level >= 0;
+    }
+
+    const HNSWIndexLabelEntry &entry(size_t label) const {
+        return labels_[label];
+    }
+
+    // 返回邻居数组，count 为邻居个数
+    const uint32_t *neighbors(size_t label, int level, uint32_t &count) const;
+
+    // 无向量段时返回 nullptr
+    const float *vector(size_t label) const;
+
+    // 已删除节点的 label 列表 (升序)，个数为 header().num_deleted
+    const uint32_t *deleted_labels() const {
+        return deleted_;
+    }
+
+private:
+    MappedFile file_;
+    const HNSWIndexFileHeader *header_ = nullptr;
+    const HNSWIndexLabelEntry *labels_ = nullptr;
+    const uint32_t *level0_            = nullptr;
+    const uint32_t *upper_             = nullptr;
+    const float *vectors_              = nullptr;
+    const uint32_t *deleted_           = nullptr;
+};
+
+#endif // LSM_KV_HNSW_INDEX_FILE_H
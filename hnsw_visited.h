@@ -0,0 +1,123 @@
+#ifndef LSM_KV_HNSW_VISITED_H
+#define LSM_KV_HNSW_VISITED_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "vector_distance.h"
+
+// HNSW 搜索用的访问表：每个 label 一个 tag，tags[label] == epoch 表示本轮已访问。
+// 新一轮搜索只需把 epoch 加一，不需要清空数组，也不会在搜索循环里分配内存。
+class VisitedList {
+public:
+    using tag_t = uint16_t;
+
+    explicit VisitedList(size_t capacity) : tags(capacity, 0) {}
+
+    // 开始新一轮搜索。capacity 为当前 label 上界 (next_label_)，数组只增不减
+    void reset(size_t capacity) {
+        if (tags.size() < capacity) {
+            tags.resize(capacity, 0);
+        }
+        if (++epoch == 0) { // epoch 回绕：整体清零一次，0 永远表示"未访问"
+            std::fill(tags.begin(), tags.end(), 0);
+            epoch = 1;
+        }
+    }
+
+    size_t capacity() const {
+        return tags.size();
+    }
+
+    bool visited(size_t label) const {
+        return tags[label] == epoch;
+    }
+
+    void mark(size_t label) {
+        tags[label] = epoch;
+    }
+
+    // 预取 label 的 tag (随机 label 的 tag 通常不在缓存中)
+    void prefetch(size_t label) const {
+        if (label < tags.size())
+            hnsw_prefetch(tags.data() + label);
+    }
+
+    // 未访问则标记并返回 true；已访问返回 false
+    bool try_visit(size_t label) {
+        if (tags[label] == epoch)
+            return false;
+        tags[label] = epoch;
+        return true;
+    }
+
+private:
+    std::vector<tag_t> tags;
+    tag_t epoch = 0;
+};
+
+// 访问表池：并发搜索各自借出一个私有的 VisitedList，用完归还复用
+class VisitedListPool {
+public:
+    class Handle {
+    public:
+        Handle(VisitedListPool *pool, std::unique_ptr<VisitedList> list) : pool(pool), list(std::move(list)) {}
+
+        Handle(const Handle &)            = delete;
+        Handle &operator=(const Handle &) = delete;
+
+        ~Handle() {
+            if (list)
+                pool->release(std::move(list));
+        }
+
+        VisitedList *operator->() const {
+            return list.get();
+        }
+
+        VisitedList &operator*() const {
+            return *list;
+        }
+
+    private:
+        VisitedListPool *pool;
+        std::unique_ptr<VisitedList> list;
+    };
+
+    // 借出一个已 reset 的访问表，保证可容纳 [0, capacity) 的 label
+    Handle acquire(size_t capacity) {
+        std::unique_ptr<VisitedList> list;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!free_lists.empty()) {
+                list = std::move(free_lists.back());
+                free_lists.pop_back();
+            }
+        }
+        if (!list)
+            list = std::make_unique<VisitedList>(capacity);
+        list->reset(capacity);
+        return Handle(this, std::move(list));
+    }
+
+    // reset() 时丢弃所有缓存的访问表
+    void clear() {
+        std::lock_guard<std::mutex> lock(mtx);
+        free_lists.clear();
+    }
+
+private:
+    void release(std::unique_ptr<VisitedList> list) {
+        std::lock_guard<std::mutex> lock(mtx);
+        free_lists.push_back(std::move(list));
+    }
+
+    std::mutex mtx;
+    std::vector<std::unique_ptr<VisitedList>> free_lists;
+};
+
+#endif // LSM_KV_HNSW_VISITED_H
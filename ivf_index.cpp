@@ -0,0 +1,229 @@
+#include "ivf_index.h"
+#include "parallel_for.h"
+#include "vector_distance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+
+namespace {
+
+constexpr size_t KMEANS_ITERATIONS    = 10;
+constexpr size_t KMEANS_SAMPLE_FACTOR = 64;   // 每个质心至多抽样的向量数
+constexpr size_t PARALLEL_MIN_CHUNK   = 1024; // 每个线程至少处理的向量数
+
+void normalize(float *vec, size_t dim) {
+    float norm = std::sqrt(vec_dot(vec, vec, dim));
+    if (norm > 1e-12f) {
+        for (size_t i = 0; i < dim; ++i)
+            vec[i] /= norm;
+    }
+}
+
+// 与 centroids 中内积最大的质心下标
+size_t argmax_dot(const float *vec, const std::vector<float> &centroids, size_t dim) {
+    size_t best     = 0;
+    float best_dot  = -std::numeric_limits<float>::max();
+    size_t num_cent = centroids.size() / dim;
+    for (size_t c = 0; c < num_cent; ++c) {
+        float dot = vec_dot(vec, centroids.data() + c * dim, dim);
+        if (dot > best_dot) {
+            best_dot = dot;
+            best     = c;
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+void IVFIndex::reset(size_t dim) {
+    dim_ = dim;
+    centroids_.clear();
+    lists_.assign(1, InvertedList());
+    positions_.clear();
+}
+
+// 质心已归一化，向量本身的长度不影响内积最大的是哪个，不必归一化
+size_t IVFIndex::nearest_list(const StoredVector &vec) const {
+    return centroids_.empty() ? 0 : argmax_dot(vec.to_floats().data(), centroids_, dim_);
+}
+
+void IVFIndex::add(uint64_t key, const StoredVector *vec) {
+    if (lists_.empty())
+        lists_.assign(1, InvertedList());
+    remove(key);
+
+    size_t list_id     = nearest_list(*vec);
+    InvertedList &list = lists_[list_id];
+    positions_[key]    = {static_cast<uint32_t>(list_id), static_cast<uint32_t>(list.keys.size())};
+    list.keys.push_back(key);
+    list.vectors.push_back(vec);
+}
+
+// 用表尾元素填补空位，表内顺序不重要
+bool IVFIndex::remove(uint64_t key) {
+    auto it = positions_.find(key);
+    if (it == positions_.end())
+        return false;
+    InvertedList &list = lists_[it->second.first];
+    size_t pos         = it->second.second;
+    size_t last        = list.keys.size() - 1;
+    if (pos != last) {
+        list.keys[pos]    = list.keys[last];
+        list.vectors[pos] = list.vectors[last];
+        positions_[list.keys[pos]].second = static_cast<uint32_t>(pos);
+    }
+    list.keys.pop_back();
+    list.vectors.pop_back();
+    positions_.erase(it);
+    return true;
+}
+
+void IVFIndex::train(size_t nlist, uint32_t seed) {
+    std::vector<uint64_t> keys;
+    std::vector<const StoredVector *> vectors;
+    keys.reserve(size());
+    vectors.reserve(size());
+    for (const InvertedList &list : lists_) {
+        keys.insert(keys.end(), list.keys.begin(), list.keys.end());
+        vectors.insert(vectors.end(), list.vectors.begin(), list.vectors.end());
+    }
+    const size_t n = keys.size();
+    nlist          = std::min(nlist, n);
+    if (nlist <= 1 || dim_ == 0) {
+        return; // 向量太少，保持单表
+    }
+
+    std::mt19937 rng(seed);
+    std::vector<size_t> sample(n);
+    std::iota(sample.begin(), sample.end(), 0);
+    std::shuffle(sample.begin(), sample.end(), rng);
+    sample.resize(std::min(n, nlist * KMEANS_SAMPLE_FACTOR));
+
+    // 只把样本解码、归一化到连续的 data 中 (第 i 行为 sample[i])，k-means 在这份副本上迭代
+    std::vector<float> data(sample.size() * dim_);
+    parallel_for(sample.size(), PARALLEL_MIN_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            vectors[sample[i]]->decode(data.data() + i * dim_);
+            normalize(data.data() + i * dim_, dim_);
+        }
+    });
+
+    // 以前 nlist 个样本为初始质心
+    std::vector<float> centroids(data.begin(), data.begin() + nlist * dim_);
+
+    std::vector<uint32_t> assign(sample.size());
+    for (size_t iter = 0; iter < KMEANS_ITERATIONS; ++iter) {
+        parallel_for(sample.size(), PARALLEL_MIN_CHUNK, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                assign[i] = static_cast<uint32_t>(argmax_dot(data.data() + i * dim_, centroids, dim_));
+        });
+
+        std::vector<double> sums(nlist * dim_, 0.0);
+        std::vector<size_t> counts(nlist, 0);
+        for (size_t i = 0; i < sample.size(); ++i) {
+            const float *vec = data.data() + i * dim_;
+            double *sum      = sums.data() + assign[i] * dim_;
+            for (size_t d = 0; d < dim_; ++d)
+                sum[d] += vec[d];
+            counts[assign[i]]++;
+        }
+        size_t largest = std::max_element(counts.begin(), counts.end()) - counts.begin();
+        for (size_t c = 0; c < nlist; ++c) {
+            float *centroid = centroids.data() + c * dim_;
+            if (counts[c] == 0) {
+                // 空簇：从最大的簇里随机取一个样本作为新质心，把它拆开
+                std::vector<size_t> members;
+                for (size_t i = 0; i < sample.size(); ++i)
+                    if (assign[i] == largest)
+                        members.push_back(i);
+                std::copy_n(data.begin() + members[rng() % members.size()] * dim_, dim_, centroid);
+                continue;
+            }
+            for (size_t d = 0; d < dim_; ++d)
+                centroid[d] = static_cast<float>(sums[c * dim_ + d]);
+            normalize(centroid, dim_);
+        }
+    }
+
+    // 用新质心重新分配全部向量
+    std::vector<uint32_t> list_of(n);
+    parallel_for(n, PARALLEL_MIN_CHUNK, [&](size_t begin, size_t end) {
+        std::vector<float> vec(dim_);
+        for (size_t i = begin; i < end; ++i) {
+            vectors[i]->decode(vec.data());
+            list_of[i] = static_cast<uint32_t>(argmax_dot(vec.data(), centroids, dim_));
+        }
+    });
+    centroids_.swap(centroids);
+    lists_.assign(nlist, InvertedList());
+    positions_.clear();
+    for (size_t i = 0; i < n; ++i) {
+        InvertedList &list = lists_[list_of[i]];
+        positions_[keys[i]] = {list_of[i], static_cast<uint32_t>(list.keys.size())};
+        list.keys.push_back(keys[i]);
+        list.vectors.push_back(vectors[i]);
+    }
+
+    size_t max_list = 0;
+    for (const InvertedList &list : lists_)
+        max_list = std::max(max_list, list.keys.size());
+    std::cout << "[INFO] Trained IVF index: " << nlist << " lists over " << n << " vectors (sample " << sample.size()
+              << ", largest list " << max_list << ")." << std::endl;
+}
+
+std::vector<IVFIndex::ScoredKey> IVFIndex::search(const float *query, size_t m, size_t nprobe) const {
+    std::vector<ScoredKey> results;
+    if (m == 0 || positions_.empty())
+        return results;
+
+    std::vector<float> q(query, query + dim_);
+    normalize(q.data(), dim_);
+
+    // 选出内积最大的 nprobe 个质心
+    std::vector<size_t> probes;
+    if (centroids_.empty()) {
+        probes.push_back(0);
+    } else {
+        std::vector<ScoredKey> by_centroid(lists_.size());
+        for (size_t c = 0; c < lists_.size(); ++c)
+            by_centroid[c] = {vec_dot(q.data(), centroids_.data() + c * dim_, dim_), c};
+        nprobe = std::clamp<size_t>(nprobe, 1, lists_.size());
+        std::partial_sort(by_centroid.begin(), by_centroid.begin() + nprobe, by_centroid.end(),
+                          [](const ScoredKey &a, const ScoredKey &b) { return a.first > b.first; });
+        for (size_t i = 0; i < nprobe; ++i)
+            probes.push_back(by_centroid[i].second);
+    }
+
+    // 有界堆：堆顶是当前 m 个里最差的
+    auto better = [](const ScoredKey &a, const ScoredKey &b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    };
+    results.reserve(m + 1);
+    for (size_t list_id : probes) {
+        const InvertedList &list = lists_[list_id];
+        for (size_t i = 0; i < list.keys.size(); ++i) {
+            // 向量散落在各自的 map 节点里，提前预取下一个
+            if (i + 1 < list.keys.size())
+                list.vectors[i + 1]->prefetch(dim_);
+            float dot, norm;
+            list.vectors[i]->dot_and_norm(q.data(), dot, norm);
+            norm = std::sqrt(norm);
+            ScoredKey scored{norm > 1e-12f ? dot / norm : dot, list.keys[i]};
+            if (results.size() < m) {
+                results.push_back(scored);
+                std::push_heap(results.begin(), results.end(), better);
+            } else if (better(scored, results.front())) {
+                std::pop_heap(results.begin(), results.end(), better);
+                results.back() = scored;
+                std::push_heap(results.begin(), results.end(), better);
+            }
+        }
+    }
+    std::sort_heap(results.begin(), results.end(), better);
+    return results;
+}
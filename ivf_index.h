@@ -0,0 +1,63 @@
+#ifndef LSM_KV_IVF_INDEX_H
+#define LSM_KV_IVF_INDEX_H
+
+#include "stored_vector.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// IVF-Flat 倒排索引 (余弦相似度)：k-means 质心把向量划分到 nlist 个倒排表，查询只扫描最近的 nprobe 个表。
+// 倒排表只存 key 和指向调用方向量 (KVStore 的 embeddings) 的指针，不另存一份；相似度为与归一化查询的内积
+// 除以向量长度。插入只需与 nlist 个质心比较。训练前所有向量都在同一个表里，查询退化为精确扫描。
+// search 为 const，可与其它 search 并发；add / remove / train 需要独占访问
+class IVFIndex {
+public:
+    using ScoredKey = std::pair<float, uint64_t>; // {similarity, key}
+
+    // 清空并设置维度
+    void reset(size_t dim);
+
+    // 在已存的向量中抽样 (至多 nlist * 64 个) 跑球面 k-means，然后把所有向量重新分配到新的倒排表
+    void train(size_t nlist, uint32_t seed);
+
+    // 插入或替换 key 对应的向量 (长度为 dim)。只保存指针，vec 在 remove / reset 之前必须保持有效
+    void add(uint64_t key, const StoredVector *vec);
+    bool remove(uint64_t key);
+
+    // 返回相似度最高的至多 m 个 {similarity, key}，按相似度降序；nprobe 为扫描的倒排表个数
+    std::vector<ScoredKey> search(const float *query, size_t m, size_t nprobe) const;
+
+    bool trained() const {
+        return !centroids_.empty();
+    }
+
+    size_t size() const {
+        return positions_.size();
+    }
+
+    size_t dim() const {
+        return dim_;
+    }
+
+    size_t nlist() const {
+        return lists_.size();
+    }
+
+private:
+    struct InvertedList {
+        std::vector<uint64_t> keys;
+        std::vector<const StoredVector *> vectors; // 与 keys 一一对应
+    };
+
+    size_t nearest_list(const StoredVector &vec) const;
+
+    size_t dim_ = 0;
+    std::vector<float> centroids_; // nlist * dim_，归一化；未训练时为空
+    std::vector<InvertedList> lists_;
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> positions_; // key -> {表, 表内位置}
+};
+
+#endif // LSM_KV_IVF_INDEX_H
@@ -4,6 +4,11 @@
 #include "sstable.h"
 #include "utils.h"
 #include "embedding.h"
+#include "hnsw_index_file.h"
+#include "hnsw_delta_log.h"
+#include "vector_distance.h"
+#include "mapped_file.h"
+#include "parallel_for.h"
 
 #include <algorithm>
 #include <cstdlib>
@@ -22,8 +27,9 @@
 #include <chrono>
 #include <random>
 #include <cstdint> // 确保包含
+#include <cstring> // For std::memcpy
 #include <iomanip> // For std::fixed and std::setprecision in debug output
-#include <cmath>   // For std::fabs in compare_float_vectors
+#include <cmath>
 
 // Needed for ThreadPool and parallel save
 #include <thread>
@@ -31,6 +37,9 @@
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <latch>
+#include <optional>
+#include <unordered_set>
 // #include <queue> // Already included via other headers or kvstore.h indirectly
 
 // --- BEGIN THREADPOOL CLASS DEFINITION (FROM PHASE5.MD) ---
@@ -93,6 +102,7 @@ private:
 
 static const std::string DEL = "~DELETED~";
 const uint32_t MAXSIZE       = 2 * 1024 * 1024;
+const size_t HNSW_FILTER_SAMPLE = 256; // 过滤搜索估计谓词选择率时抽样的节点数
 
 // 全局 HNSW 头信息
 struct HNSWGlobalHeader {
@@ -141,29 +151,11 @@ struct cmpPoi {
 // Helper function to convert string to vector (remains unchanged)
 // ...
 
-bool KVStore::compare_float_vectors(const std::vector<float>& v1, const std::vector<float>& v2, float epsilon) {
-    if (v1.size() != v2.size()) {
-        // std::cout << "[DEBUG_COMPARE_VEC] Size mismatch: " << v1.size() << " vs " << v2.size() << std::endl;
-        return false;
-    }
-    for (size_t i = 0; i < v1.size(); ++i) {
-        if (std::fabs(v1[i] - v2[i]) > epsilon) {
-            // Optional: Log the first differing element for debugging, but can be verbose
-            // std::cout << "[DEBUG_COMPARE_VEC] Element mismatch at index " << i 
-            //           << ": v1[" << i << "]=" << std::fixed << std::setprecision(8) << v1[i] 
-            //           << ", v2[" << i << "]=" << std::fixed << std::setprecision(8) << v2[i] 
-            //           << " (diff: " << std::fixed << std::setprecision(8) << std::fabs(v1[i] - v2[i]) 
-            //           << ") epsilon: " << epsilon << std::endl; // MODIFIED LOG
-            return false;
-        }
-    }
-    return true;
-}
-
-
-KVStore::KVStore(const std::string &dir, const std::string &hnsw_index_path) :
+KVStore::KVStore(const std::string &dir, const std::string &hnsw_index_path, const HNSWOptions &hnsw_options) :
     KVStoreAPI(dir), dir_(dir) // Added dir_(dir) to initializer list
 {
+    apply_hnsw_options(hnsw_options);
+
     for (totalLevel = 0;; ++totalLevel) {
         std::string path = dir_ + "/level-" + std::to_string(totalLevel) + "/";
         std::vector<std::string> files;
@@ -183,21 +175,52 @@ KVStore::KVStore(const std::string &dir, const std::string &hnsw_index_path) :
 
     // --- HNSW 初始化 ---
     embedding_dimension_ = 768; // 预设维度，会被加载函数覆盖或验证
+    refresh_distance_kernel();
     current_max_level_ = -1;
     entry_point_label_ = 0;
     next_label_ = 0;
     hnsw_nodes_.clear();
     key_to_label_.clear();
     label_to_key_.clear();
+    hnsw_label_vectors_.clear();
     embeddings.clear(); // 确保开始时内存为空
     // rng_ 已经在头文件中初始化
     // --------------------
 
-    // --- 修改：加载 Embeddings --- (调用函数名)
+    // --- 加载 Embeddings：向量保存在各 SSTable 的向量块中 ---
     std::cout << "[INFO] Attempting to load embeddings from disk..." << std::endl;
-    load_embedding_from_disk(dir); // This uses the KVStore's main data directory for embeddings.bin
+    migrate_legacy_embeddings();
+    load_sstable_embeddings();
     // ---------------------------
-    hnsw_vectors_to_persist_as_deleted_.clear(); // Initialize
+    if (hnsw_options.embedding_cache_entries > 0) {
+        embedding_cache_.load(dir_ + "/" + EMBEDDING_CACHE_FILE_NAME, embedding_dimension_);
+    }
+    #ifndef DISABLE_EMBEDDING_FOR_TESTS
+    embedding_configure(embedding_contexts_, embedding_threads_);
+    #endif
+    if (async_embedding_) {
+        embedding_pipeline_ = std::make_unique<EmbeddingPipeline>(
+            embedding_batch_size_, std::chrono::milliseconds(embedding_batch_delay_ms_),
+            [this](const std::vector<std::string>& texts) { return get_embeddings(texts); }, embedding_contexts_);
+    }
+
+    if (vector_index_type_ == VectorIndexType::IVF) {
+        // IVF 不落盘：插入和训练都很便宜，打开时用上面从各 SSTable 向量块加载的 embeddings 重建
+        if (!hnsw_index_path.empty()) {
+            std::cout << "[INFO] IVF engine selected, ignoring HNSW index path: " << hnsw_index_path << std::endl;
+        }
+        ivf_index_.reset(embedding_dimension_);
+        for (const auto& pair : embeddings) {
+            if (pair.second.size() == embedding_dimension_) {
+                ivf_index_.add(pair.first, &pair.second);
+            }
+        }
+        if (ivf_index_.size() >= ivf_train_size_) {
+            train_ivf_index();
+        }
+        std::cout << "[INFO] Built IVF index from " << ivf_index_.size() << " embeddings." << std::endl;
+        return;
+    }
 
     // --- 新增：加载 HNSW 索引 (now conditional) ---
     if (!hnsw_index_path.empty()) {
@@ -220,15 +243,20 @@ KVStore::KVStore(const std::string &dir, const std::string &hnsw_index_path) :
        entry_point_label_ = 0;
        key_to_label_.clear(); // 清空映射，因为 hnsw_insert 会重新建立
        label_to_key_.clear();
+       hnsw_label_vectors_.clear();
+       hnsw_free_labels_.clear();
 
+       std::vector<std::pair<uint64_t, const StoredVector*>> rebuild_items;
+       rebuild_items.reserve(embeddings.size());
        for (const auto& pair : embeddings) {
            // 检查向量有效性，避免插入空向量或错误维度的向量
            if (!pair.second.empty() && pair.second.size() == embedding_dimension_) {
-               hnsw_insert(pair.first, pair.second); // 重新插入以构建 HNSW 图
+               rebuild_items.emplace_back(pair.first, &pair.second);
            } else {
                 std::cerr << "[WARN] Skipping rebuild for key " << pair.first << " due to invalid embedding vector." << std::endl;
            }
        }
+       hnsw_build_parallel(rebuild_items); // 多线程重新构建 HNSW 图
        std::cout << "[INFO] Finished rebuilding HNSW index from " << embeddings.size() << " embeddings." << std::endl;
     } else if (!hnsw_nodes_.empty()) {
         std::cout << "[INFO] HNSW index successfully loaded from disk." << std::endl;
@@ -236,6 +264,13 @@ KVStore::KVStore(const std::string &dir, const std::string &hnsw_index_path) :
 }
 
 KVStore::~KVStore() {
+    // 先让排队中的向量全部落到 embeddings，下面才能一起保存
+    if (embedding_pipeline_) {
+        sync_embeddings();
+        embedding_pipeline_.reset();
+    }
+    finish_hnsw_consolidation();
+
     // --- 第一步：保存 Memtable 中剩余数据到 SSTable ---
     if (s->getCnt() > 1) { // 假设 getCnt() 返回节点数，>1 表示有有效数据
         std::cout << "[INFO] Saving final Memtable state to SSTable during destruction..." << std::endl;
@@ -257,6 +292,7 @@ KVStore::~KVStore() {
 
              // 检查 ss 是否真的有内容，避免创建空 sstable (虽然 s->getCnt() 应该保证了)
              if (ss.getCnt() > 0) {
+                 attach_memtable_vectors(ss);
                  ss.putFile(full_sstable_path.data()); // MODIFIED: Use full_sstable_path
                  addsstable(ss, 0);                  // 将其头信息加入内存 Level 0 索引
                  std::cout << "[INFO] Saved Memtable to SSTable: " << full_sstable_path << std::endl; // MODIFIED
@@ -273,38 +309,15 @@ KVStore::~KVStore() {
     }
     // --- SSTable 保存结束 ---
 
-    // --- 第二步：保存 Embeddings Map ---
-    if (!embeddings.empty() && embedding_dimension_ > 0) {
-        std::cout << "[INFO] Saving embeddings map to disk during KVStore destruction..." << std::endl;
-        const std::string embedding_file_path = dir_ + "/embeddings.bin"; // NEW
-        std::ofstream embed_file(embedding_file_path, std::ios::binary | std::ios::app);
-
-        if (embed_file.is_open()) {
-            embed_file.seekp(0, std::ios::end);
-            if (embed_file.tellp() == 0) {
-                 uint64_t dim_to_write = embedding_dimension_;
-                 embed_file.write(reinterpret_cast<const char*>(&dim_to_write), sizeof(dim_to_write));
-                 std::cout << "[INFO] Writing embedding dimension (" << dim_to_write << ") to new embedding file." << std::endl;
-            }
-            for (const auto& pair : embeddings) {
-                uint64_t current_key = pair.first;
-                const std::vector<float>& vec = pair.second;
-                if (vec.size() == embedding_dimension_) {
-                    embed_file.write(reinterpret_cast<const char*>(&current_key), sizeof(current_key));
-                    embed_file.write(reinterpret_cast<const char*>(vec.data()), vec.size() * sizeof(float));
-                } else {
-                     std::cerr << "[WARN] Embedding dimension mismatch for key " << current_key << " during destructor save. Skipping." << std::endl;
-                }
-            }
-            embed_file.close();
-             std::cout << "[INFO] Finished saving " << embeddings.size() << " embeddings from map." << std::endl;
-        } else {
-            std::cerr << "[ERROR] Failed to open embedding file for writing during destruction: " << embedding_file_path << std::endl;
+    if (embedding_cache_.size() > 0) {
+        if (utils::dirExists(dir_)) {
+            embedding_cache_.save(dir_ + "/" + EMBEDDING_CACHE_FILE_NAME);
         }
-    } else {
-         std::cout << "[INFO] Embeddings map empty or dimension unknown, skipping embedding save during destruction." << std::endl;
+        std::cout << "[INFO] Embedding cache: " << embedding_cache_.hits() << " hits, " << embedding_cache_.misses()
+                  << " misses, " << embedding_cache_.size() << " entries." << std::endl;
     }
-    // --- Embedding 保存结束 ---
+
+    // Embeddings 已随上面的 memtable 写入各 SSTable 的向量块，不再单独保存
 
     // --- 新增：保存 HNSW 索引 --- (修改：在析构函数中移除自动保存)
     // std::string hnsw_save_path = "./hnsw_data"; // 定义保存路径
@@ -321,11 +334,12 @@ KVStore::~KVStore() {
  * No return values for simplicity.
  */
 void KVStore::put(uint64_t key, const std::string &s_val) { // Renamed string param to s_val to avoid conflict
+    finish_hnsw_consolidation();
     // --- ADDED: Log initial state of embeddings[key] if it exists ---
     if (auto it = embeddings.find(key); it != embeddings.end()) { 
         const auto& existing_vec_in_map = it->second;
         std::cout << "[DEBUG_KV_PUT_INIT_STATE] Key " << key << " in embeddings. 1st_Elem: "
-                  << (existing_vec_in_map.empty() ? "EMPTY" : std::to_string(existing_vec_in_map[0]))
+                  << (existing_vec_in_map.empty() ? "EMPTY" : std::to_string(existing_vec_in_map.at(0)))
                   << " Size: " << existing_vec_in_map.size() 
                   << " Addr: " << (void*)&existing_vec_in_map << std::endl;
     } else {
@@ -337,19 +351,26 @@ void KVStore::put(uint64_t key, const std::string &s_val) { // Renamed string pa
     if (!utils::dirExists(dir_)) {
         utils::mkdir(dir_.data());
     }
-    std::vector<float> emb_vec;
-
-    // 1. Determine embedding and dimension
-    if (embedding_dimension_ == 0 && !s_val.empty() && s_val != DEL) { //MODIFIED: DEL_MARKER_STRING -> DEL
-        std::vector<float> temp_emb_for_dim = get_embedding(s_val);
-        if (!temp_emb_for_dim.empty()) {
-            embedding_dimension_ = temp_emb_for_dim.size();
-            std::cout << "[INFO_KV_PUT] Embedding dimension determined: " << embedding_dimension_ << " from key " << key << std::endl;
-        }
+    apply_ready_embeddings();
+    if (embedding_pipeline_ && !s_val.empty() && s_val != DEL) {
+        // 异步模式：先写 LSM，向量由后台批量计算，之后再进入向量表与索引
+        memtable_put(key, s_val);
+        uint64_t seq = ++embedding_seq_;
+        pending_embedding_keys_[key] = seq;
+        embedding_pipeline_->submit(key, seq, s_val);
+        return;
     }
+    pending_embedding_keys_.erase(key); // 排队中的旧向量作废
 
+    std::vector<float> emb_vec;
+
+    // 1. Determine embedding and dimension (维度未知时由第一次得到的向量确定，不再为此单独推理一次)
     if (!s_val.empty() && s_val != DEL) { //MODIFIED: DEL_MARKER_STRING -> DEL
         emb_vec = get_embedding(s_val);
+        if (embedding_dimension_ == 0 && !emb_vec.empty()) {
+            embedding_dimension_ = emb_vec.size();
+            std::cout << "[INFO_KV_PUT] Embedding dimension determined: " << embedding_dimension_ << " from key " << key << std::endl;
+        }
         if (emb_vec.empty() && embedding_dimension_ > 0) {
             std::cerr << "[WARN_KV_PUT] get_embedding for key " << key << " -> empty vector, but dim=" << embedding_dimension_ << ". Storing zero vector." << std::endl;
             emb_vec.assign(embedding_dimension_, 0.0f);
@@ -372,103 +393,20 @@ void KVStore::put(uint64_t key, const std::string &s_val) { // Renamed string pa
     }
 
     bool is_update = this->embeddings.count(key);
-    std::vector<float> old_vector_copy;
-
-    if (is_update) {
-        // std::cout << "[DEBUG_KV_PUT_UPDATE] Updating existing key: " << key << std::endl;
-        const auto& old_vector_ref_in_map = this->embeddings[key]; // Get ref before it's potentially changed by new emb_vec assignment below
-        old_vector_copy = old_vector_ref_in_map; 
-
-        // std::cout << "[DEBUG_KV_PUT_UPDATE] OLD_VEC for key " << key << " (copied). Addr_copy: " << (void*)&old_vector_copy 
-        //           << " Addr_orig_in_map: " << (void*)&old_vector_ref_in_map 
-        //           << " 1st_Elem: " << (old_vector_copy.empty() ? -999.0f : old_vector_copy[0]) 
-        //           << " Size: " << old_vector_copy.size() << std::endl;
-
-        bool old_vec_is_del_marker_vector = false;
-        if (!old_vector_copy.empty() && old_vector_copy.size() == embedding_dimension_ && embedding_dimension_ > 0) {
-            old_vec_is_del_marker_vector = true;
-            for(float v_val : old_vector_copy) if (v_val != std::numeric_limits<float>::max()) { old_vec_is_del_marker_vector = false; break; }
-        }
-        if (old_vec_is_del_marker_vector) {
-            std::cout << "[DEBUG_KV_PUT_UPDATE] Key " << key << ": Old vector in map WAS a delete marker vector." << std::endl;
-        }
-
-        if (!old_vector_copy.empty() && !old_vec_is_del_marker_vector) {
-            bool found_in_loaded = false;
-            int loaded_idx = 0;
-            for (const auto& v_loaded : loaded_deleted_vectors_) {
-                if (compare_float_vectors(old_vector_copy, v_loaded)) {
-                    std::cout << "[DEBUG_KV_PUT_UPDATE] Key " << key << ": OLD_VEC MATCHED LOADED_VEC[" << loaded_idx << "] with tolerance." << std::endl;
-                    found_in_loaded = true;
-                    break;
-                }
-                loaded_idx++;
-            }
-
-            if (!found_in_loaded) {
-                bool found_in_persist = false;
-                int persist_idx = 0;
-                for (const auto& v_persist : hnsw_vectors_to_persist_as_deleted_) {
-                    if (compare_float_vectors(old_vector_copy, v_persist)) {
-                        std::cout << "[DEBUG_KV_PUT_UPDATE] Key " << key << ": OLD_VEC MATCHED hnsw_vectors_to_persist_as_deleted_[" << persist_idx << "] with tolerance." << std::endl;
-                        found_in_persist = true;
-                        break;
-                    }
-                    persist_idx++;
-                }
-                if (!found_in_persist) {
-                    // DETAILED LOGGING FOR COMPARISON FAILURE START
-                    // std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL] Key " << key << ": OLD_VEC NOT FOUND in loaded_deleted_vectors_ NOR hnsw_vectors_to_persist_as_deleted_." << std::endl;
-                    // std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]   OLD_VEC (key " << key << ", size " << old_vector_copy.size() << ") First 3 elems: ";
-                    // for(int i=0; i<std::min((size_t)3, old_vector_copy.size()); ++i) std::cout << std::fixed << std::setprecision(8) << old_vector_copy[i] << " ";
-                    // std::cout << std::endl;
-
-                    // if (loaded_deleted_vectors_.empty()) {
-                    //     std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]   loaded_deleted_vectors_ is EMPTY." << std::endl;
-                    // } else {
-                    //     std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]   Comparing with loaded_deleted_vectors_ (showing first few):" << std::endl;
-                    //     int c = 0;
-                    //     for (const auto& v_l : loaded_deleted_vectors_) {
-                    //         if (c >= 3 && loaded_deleted_vectors_.size() > 5) { std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]     ... and " << (loaded_deleted_vectors_.size() - c) << " more." << std::endl; break;}
-                    //         std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]     LoadedVec[" << c << "] (size " << v_l.size() << ") First 3 elems: ";
-                    //         for(int i=0; i<std::min((size_t)3, v_l.size()); ++i) std::cout << std::fixed << std::setprecision(8) << v_l[i] << " ";
-                    //         std::cout << std::endl;
-                    //         // Explicitly call compare_float_vectors here again FOR LOGGING THE FAILURE POINT if it's this vector
-                    //         if (!compare_float_vectors(old_vector_copy, v_l)) {
-                    //             // std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]       Above comparison with LoadedVec[" << c << "] failed inside compare_float_vectors (see details above/below this line if logged)." << std::endl;
-                    //         }
-                    //         c++;
-                    //     }
-                    // }
-                    // if (hnsw_vectors_to_persist_as_deleted_.empty()) {
-                    //     std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]   hnsw_vectors_to_persist_as_deleted_ is EMPTY." << std::endl;
-                    // } else {
-                    //     std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]   Comparing with hnsw_vectors_to_persist_as_deleted_ (showing first few):" << std::endl;
-                    //     int c = 0;
-                    //     for (const auto& v_p : hnsw_vectors_to_persist_as_deleted_) {
-                    //         if (c >= 3 && hnsw_vectors_to_persist_as_deleted_.size() > 5) { std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]     ... and " << (hnsw_vectors_to_persist_as_deleted_.size() - c) << " more." << std::endl; break;}
-                    //         std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]     PersistVec[" << c << "] (size " << v_p.size() << ") First 3 elems: ";
-                    //         for(int i=0; i<std::min((size_t)3, v_p.size()); ++i) std::cout << std::fixed << std::setprecision(8) << v_p[i] << " ";
-                    //         std::cout << std::endl;
-                    //         // Explicitly call compare_float_vectors here again FOR LOGGING THE FAILURE POINT if it's this vector
-                    //         if (!compare_float_vectors(old_vector_copy, v_p)) {
-                    //              // std::cout << "[DEBUG_KV_PUT_COMPARE_FAIL]       Above comparison with PersistVec[" << c << "] failed inside compare_float_vectors (see details above/below this line if logged)." << std::endl;
-                    //         }
-                    //         c++;
-                    //     }
-                    // }
-                    // DETAILED LOGGING FOR COMPARISON FAILURE END
-                    // std::cout << "[DEBUG_KV_PUT_UPDATE] Added OLD vector for key " << key << " to hnsw_vectors_to_persist_as_deleted_." << std::endl;
-                    hnsw_vectors_to_persist_as_deleted_.push_back(old_vector_copy); // Keep this: old vector from an update should be persisted as deleted
-                }
-            }
-        }
-    }
 
     // 2. Update in-memory embeddings map
-    this->embeddings[key] = emb_vec;
+    this->embeddings[key].assign(emb_vec, vector_precision_);
 
     // 3. LSM Memtable PUT operation (Reinstated logic)
+    memtable_put(key, s_val);
+
+    // 4. HNSW Update/Insert
+    index_embedding(key, emb_vec, is_update);
+    // --------- End of Reconstructed Put Method ---------
+}
+
+// LSM 写入：memtable 将满时先把它 (连同其中 key 的向量) 刷成 SSTable
+void KVStore::memtable_put(uint64_t key, const std::string &s_val) {
     uint32_t current_memtable_bytes = this->s->getBytes();
     uint32_t new_val_bytes = s_val.length();
     uint32_t key_bytes_overhead = 12; 
@@ -481,46 +419,12 @@ void KVStore::put(uint64_t key, const std::string &s_val) { // Renamed string pa
         estimated_new_total_bytes = current_memtable_bytes + key_bytes_overhead + new_val_bytes;
     }
     
-    if (estimated_new_total_bytes + 10240 + 32 > MAXSIZE && this->s->getCnt() > 0) {
+    uint64_t new_cnt = this->s->getCnt() + (existing_val_in_memtable.empty() ? 1 : 0);
+    if (estimated_new_total_bytes + 10240 + 32 + memtable_vector_bytes(new_cnt) > MAXSIZE && this->s->getCnt() > 0) {
         std::cout << "[INFO_KV_PUT] Memtable full. Flushing before putting key " << key << std::endl;
         sstable ss_to_flush(this->s); 
 
-        // Persist embeddings for the memtable being flushed
-        const std::string embedding_file_path = dir_ + "/embeddings.bin";
-        std::ofstream embed_file(embedding_file_path, std::ios::binary | std::ios::app);
-        if (embed_file.is_open()) {
-            embed_file.seekp(0, std::ios::end);
-            if (embed_file.tellp() == 0 && embedding_dimension_ > 0) {
-                uint64_t dim_to_write = embedding_dimension_;
-                embed_file.write(reinterpret_cast<const char*>(&dim_to_write), sizeof(dim_to_write));
-            }
-            slnode *curr = this->s->getFirst();
-            while (curr && curr->type != TAIL) {
-                if (this->embeddings.count(curr->key)) {
-                    const auto& vec_to_persist = this->embeddings[curr->key];
-                    bool is_del_marker = true;
-                    if(vec_to_persist.size() == embedding_dimension_ && embedding_dimension_ > 0){
-                        for(float v_val : vec_to_persist) if(v_val != std::numeric_limits<float>::max()){ is_del_marker=false; break;}
-                    } else if (vec_to_persist.empty() && embedding_dimension_ == 0) { 
-                        is_del_marker = false; 
-                    } else { 
-                        is_del_marker = true;
-                    }
-
-                    if (!is_del_marker) { // Persist if not a delete marker vector (or valid empty string for dim 0)
-                         uint64_t temp_key_to_write = curr->key; // Ensure correct key type/value
-                         embed_file.write(reinterpret_cast<const char*>(&temp_key_to_write), sizeof(temp_key_to_write));
-                         if (!vec_to_persist.empty()){ // Only write vector data if it's not an empty string for dim 0
-                            embed_file.write(reinterpret_cast<const char*>(vec_to_persist.data()), vec_to_persist.size() * sizeof(float));
-                         }
-                    }
-                }
-                curr = curr->nxt[0];
-            }
-            embed_file.close();
-        } else {
-            std::cerr << "[ERROR_KV_PUT] Failed to open embedding file for writing during flush: " << embedding_file_path << std::endl;
-        }
+        attach_memtable_vectors(ss_to_flush); // 向量随值一起写进 SSTable 的向量块
 
         this->s->reset(); 
         std::string level0_path = dir_ + "/level-0";
@@ -542,8 +446,10 @@ void KVStore::put(uint64_t key, const std::string &s_val) { // Renamed string pa
     this->s->insert(key, s_val); // MODIFIED: put -> insert
     // this->s->put(key, s_val); // This line was the duplicate, now removed/commented
     // std::cout << "[DEBUG_KV_PUT] Key " << key << " val_str: \\"" << s_val.substr(0, 20) << (s_val.length() > 20 ? "..." : "") << "\\" inserted/updated in memtable." << std::endl;
+}
 
-    // 4. HNSW Update/Insert
+// 按新向量更新向量索引 (HNSW 或 IVF)。删除标记 / 空向量只撤下旧节点
+void KVStore::index_embedding(uint64_t key, const std::vector<float>& emb_vec, bool is_update) {
     #ifndef DISABLE_EMBEDDING_FOR_TESTS
     if (embedding_dimension_ > 0) {
         bool new_emb_is_del_marker = false;
@@ -554,25 +460,22 @@ void KVStore::put(uint64_t key, const std::string &s_val) { // Renamed string pa
              new_emb_is_del_marker = true; 
         }
 
-        if (is_update) { 
-            if (key_to_label_.count(key)) { 
-                size_t old_label = key_to_label_[key];
-                if (hnsw_nodes_.count(old_label)) {
-                    hnsw_nodes_[old_label].deleted = true; // Mark old HNSW node as deleted
-                    // std::cout << "[DEBUG_KV_PUT_UPDATE] Marked old HNSW node (label " << old_label << ") as deleted for key " << key << std::endl;
-                }
+        if (vector_index_type_ == VectorIndexType::IVF) {
+            if (!new_emb_is_del_marker) {
+                ivf_insert(key, embeddings[key]);
+            } else {
+                ivf_index_.remove(key);
+            }
+        } else {
+            if (is_update && key_to_label_.count(key)) {
+                tombstone_hnsw_node(key_to_label_[key]); // Mark old HNSW node as deleted
+            }
+            if (!new_emb_is_del_marker) {
+                hnsw_insert(key, emb_vec); // hnsw_insert will handle making the node active
             }
-        }
-
-        if (!emb_vec.empty() && !new_emb_is_del_marker) {
-            hnsw_insert(key, emb_vec); // hnsw_insert will handle making the node active
-            // std::cout << "[DEBUG_KV_PUT] Called hnsw_insert for key " << key << (is_update ? " (update)" : " (new)") << std::endl;
-        } else if (key_to_label_.count(key) && (emb_vec.empty() || new_emb_is_del_marker)) {
-             // std::cout << "[DEBUG_KV_PUT] Key " << key << " updated/is empty/marker. No HNSW insert/update." << std::endl;
         }
     }
     #endif
-    // --------- End of Reconstructed Put Method ---------
 }
 
 /**
@@ -629,39 +532,31 @@ std::string KVStore::get(uint64_t key) //
  * Returns false iff the key is not found.
  */
 bool KVStore::del(uint64_t key) {
-    // 首先直接从 s 获取值，避免递归调用 get
+    // 先查 memtable；不在其中时到 SSTable 里找 (已刷盘的 key 同样可以删除)
     std::string value = s->search(key);
-    bool in_memtable = !value.empty();
-    
-    // 如果不在 memtable 中，尝试从 sstable 获取
-    if (!in_memtable) {
-        // 这里复制 get 方法中查找 sstable 的逻辑，不要递归调用 get
-        // ...查找 sstable 的逻辑...
-        
+    if (value.empty()) {
+        value = get(key);
         // 如果在 sstable 中也没找到，返回 false
         if (value.empty()) return false;
     }
     
     // HNSW 删除逻辑
+    apply_ready_embeddings();
+    pending_embedding_keys_.erase(key);
+    ivf_index_.remove(key);
     auto it_label = key_to_label_.find(key);
     if (it_label != key_to_label_.end()) {
-        size_t label = it_label->second;
-        if (hnsw_nodes_.count(label) && !hnsw_nodes_[label].deleted) {
-            hnsw_nodes_[label].deleted = true;
-            
-            // 添加到持久化列表
-            auto it_emb = embeddings.find(key);
-            if (it_emb != embeddings.end()) {
-                const std::vector<float>& original_vec = it_emb->second;
-                std::cout << "[DEBUG_KV_DEL] Key " << key << ": Adding vector to persistence list. Current count: " 
-                          << hnsw_vectors_to_persist_as_deleted_.size() << std::endl;
-                hnsw_vectors_to_persist_as_deleted_.push_back(original_vec);
-            }
-        }
+        tombstone_hnsw_node(it_label->second);
     }
     
     // 最后在 memtable 中标记为删除
     s->insert(key, DEL);
+
+    // 墓碑过多会拖慢搜索 (仍被遍历、占用 ef)，超过阈值时在后台整理，del 本身不等待
+    if (hnsw_consolidate_ratio_ > 0 && !hnsw_deleted_labels_.empty() &&
+        hnsw_deleted_labels_.count() >= hnsw_consolidate_ratio_ * static_cast<double>(hnsw_nodes_.size())) {
+        start_hnsw_consolidation();
+    }
     return true;
 }
 
@@ -670,6 +565,10 @@ bool KVStore::del(uint64_t key) {
  * including memtable and all sstables files.
  */
 void KVStore::reset() {
+    sync_embeddings();
+    finish_hnsw_consolidation();
+    pending_embedding_keys_.clear();
+
     // --- LSM 重置 ---
     s->reset();
     for (int level = 0; level <= totalLevel; ++level) {
@@ -699,15 +598,21 @@ void KVStore::reset() {
     hnsw_nodes_.clear();
     key_to_label_.clear();
     label_to_key_.clear();
+    hnsw_label_vectors_.clear();
     next_label_ = 0;
     entry_point_label_ = 0;
     current_max_level_ = -1;
     // embedding_dimension_ 通常不需要重置
+    visited_list_pool_.clear();
+    clear_hnsw_dirty();
+    hnsw_free_labels_.clear();
+    hnsw_deleted_labels_.clear();
+    hnsw_checkpoint_root_.clear();
+    hnsw_checkpoint_id_ = 0;
+    ivf_index_.reset(embedding_dimension_);
+    ivf_trained_count_ = 0;
 
     // --- Phase 4 HNSW delete persistence cleanup ---
-    // keys_marked_for_hnsw_deletion_.clear();
-    hnsw_vectors_to_persist_as_deleted_.clear(); // Clear here as well
-    loaded_deleted_vectors_.clear();
     std::string hnsw_data_dir = "./hnsw_data"; // Assuming default path for now, or use a member if configurable
     std::string deleted_nodes_file = hnsw_data_dir + "/deleted_nodes.bin";
     if (utils::fileExists(deleted_nodes_file.c_str())) {
@@ -720,6 +625,12 @@ void KVStore::reset() {
     if (utils::fileExists(global_header_file.c_str())) {
         utils::rmfile(global_header_file.data());
     }
+    for (const char* index_file_name : {HNSW_INDEX_FILE_NAME, HNSW_DELTA_FILE_NAME}) {
+        std::string index_file = hnsw_data_dir + "/" + index_file_name;
+        if (utils::fileExists(index_file.c_str())) {
+            utils::rmfile(index_file.data());
+        }
+    }
     std::string hnsw_nodes_dir = hnsw_data_dir + "/nodes";
     if (utils::dirExists(hnsw_nodes_dir)) {
         // This requires recursive directory removal or iterating and deleting files/subdirs
@@ -738,14 +649,6 @@ void KVStore::reset() {
     }
     // --------------------
     #endif
-
-    // 找到现有代码中清理HNSW相关状态的部分
-    
-    // 添加下面这行代码确保清理持久化列表
-    hnsw_vectors_to_persist_as_deleted_.clear();
-    std::cout << "[INFO] KVStore::reset - Cleared hnsw_vectors_to_persist_as_deleted_ list" << std::endl;
-    
-    // 其余部分保持不变...
 }
 
 /**
@@ -843,7 +746,7 @@ void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, s
 
 
 void KVStore::compaction() {
-    // 从 Level 0 开始尝试合并
+    // 从 Level 0 开始逐层检查，某层合并后下一层可能随之超限，由循环继续处理
     for (int level = 0; level <= totalLevel; ++level) {
         // 检查当前层的文件数量是否超过限制
         // Level 0 的限制通常较小，例如 4 个文件
@@ -854,273 +757,229 @@ void KVStore::compaction() {
             continue; // 如果没有超过限制，继续检查下一层
         }
         
-        // 如果是 Level 0，需要合并所有文件
+        // 1. 选出本层参与合并的表：Level 0 的表之间可能重叠，全部合并 (新的在前)；
+        //    其他层的表互不重叠，选时间戳最小的若干个
+        std::vector<sstablehead> upperTables = sstableIndex[level];
         if (level == 0) {
-            // 1. 统计 Level 0 层中所有 SSTable 所覆盖的键的区间
-            uint64_t minKey = std::numeric_limits<uint64_t>::max();
-            uint64_t maxKey = 0;
-            
-            // 检查是否有文件需要合并
-            if (sstableIndex[level].empty()) {
+            std::sort(upperTables.begin(), upperTables.end(),
+                [](const sstablehead& a, const sstablehead& b) {
+                    return a.getTime() > b.getTime();
+                });
+        } else {
+            std::sort(upperTables.begin(), upperTables.end(),
+                [](const sstablehead& a, const sstablehead& b) {
+                    return a.getTime() < b.getTime();
+                });
+            upperTables.resize(sstableIndex[level].size() - maxFiles);
+        }
+        
+        uint64_t minKey = std::numeric_limits<uint64_t>::max();
+        uint64_t maxKey = 0;
+        for (const auto& head : upperTables) {
+            minKey = std::min(minKey, head.getMinV());
+            maxKey = std::max(maxKey, head.getMaxV());
+        }
+        
+        // 2. 在下一层中找到与此键范围有交集的所有 SSTable，排在本层的表之后 (同一个 key 以上层为准)
+        std::vector<std::string> inputs;
+        for (const auto& head : upperTables) {
+            inputs.push_back(head.getFilename());
+        }
+        if (level + 1 <= totalLevel) {
+            for (const auto& head : sstableIndex[level + 1]) {
+                if (!(head.getMaxV() < minKey || head.getMinV() > maxKey)) {
+                    inputs.push_back(head.getFilename());
+                }
+            }
+        }
+        
+        // 3. 更深的层没有数据时，删除标记已经没有可以遮挡的旧版本，可以和被删除的值一起丢弃
+        bool bottom = true;
+        for (int deeper = level + 2; deeper <= totalLevel; ++deeper) {
+            if (!sstableIndex[deeper].empty()) {
+                bottom = false;
+                break;
+            }
+        }
+        
+        if (!merge_sstables(inputs, level + 1, bottom)) {
+            return;
+        }
+    }
+}
+
+// 多路归并 inputs (按优先级从高到低排列：同一个 key 取排在前面的表中的值)，结果按 MAXSIZE 切分写入 target_level，
+// 然后删除输入表。输入表带向量块时输出也带，向量跟随各 key 的最新值，按当前的 vector_precision_ 写出
+// (旧精度的表在合并时逐步转换)；被覆盖或删除的值的向量随之丢弃。drop_deleted 为 true 时不保留删除标记
+bool KVStore::merge_sstables(const std::vector<std::string>& inputs, int target_level, bool drop_deleted) {
+    std::priority_queue<poi, std::vector<poi>, cmpPoi> pq;
+    std::vector<sstable> tables;
+    std::vector<std::string> filesToDelete;
+    
+    try {
+        // 加载所有输入表，poi::time 记录优先级 (越大越新)
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            // 检查文件是否存在 (使用 stat 而不是 utils::fileExists)
+            struct stat buffer;
+            if (stat(inputs[i].c_str(), &buffer) != 0) {
                 continue;
             }
             
-            for (const auto& head : sstableIndex[level]) {
-                minKey = std::min(minKey, head.getMinV());
-                maxKey = std::max(maxKey, head.getMaxV());
+            sstable ss;
+            std::string filename = inputs[i];
+            ss.loadFile(filename.data());
+            tables.push_back(ss);
+            filesToDelete.push_back(filename);
+            
+            // 将每个 SSTable 的第一个键值对加入优先队列
+            if (ss.getCnt() > 0) {
+                poi p;
+                p.sstableId = tables.size() - 1;
+                p.pos = 0;
+                p.time = inputs.size() - i;
+                p.index = ss.getIndexById(0);
+                pq.push(p);
+            }
+        }
+        
+        // 如果没有有效的键值对，跳过合并
+        if (pq.empty()) {
+            return false;
+        }
+        
+        // 输出表的向量维度：取输入表向量块的维度；输入表都是在维度确定之前刷盘的 (没有向量块) 时，
+        // 用内存中的向量维度，使下面能从 embeddings 补上这些表中 key 的向量
+        uint32_t vecDim = 0;
+        for (const auto& table : tables) {
+            vecDim = std::max(vecDim, table.getVectorDim());
+        }
+        if (vecDim == 0 && !embeddings.empty()) {
+            vecDim = embedding_dimension_;
+        }
+        sstable newTable;
+        newTable.reset();
+        TIME++; // 增加时间戳
+        newTable.setTime(TIME);
+        newTable.setVectorDim(vecDim, vector_precision_);
+        
+        std::string path = dir_ + "/level-" + std::to_string(target_level);
+        auto flush_table = [&]() {
+            // 创建目标层目录（如果不存在）
+            if (!utils::dirExists(path)) {
+                utils::mkdir(path.data());
+            }
+            if (totalLevel < target_level) {
+                totalLevel = target_level;
             }
             
-            // 2. 在 Level 1 层中找到与此键范围有交集的所有 SSTable
-            std::vector<sstablehead> overlappingTables;
+            // 设置文件名并写入磁盘，加入缓存
+            std::string filename = path + "/" + std::to_string(TIME) + ".sst";
+            newTable.setFilename(filename);
+            newTable.putFile(filename.data());
+            addsstable(newTable, target_level);
+        };
+        
+        // 使用多路归并排序合并所有 SSTable
+        struct MergedValue {
+            std::string value;
+            uint64_t time;
+            int sstableId;
+        };
+        std::map<uint64_t, MergedValue> latestValues; // 键 -> (值, 优先级, 来源表)
+        
+        while (!pq.empty()) {
+            // 取出优先队列中最小的键值对
+            poi p = pq.top();
+            pq.pop();
             
-            if (level + 1 <= totalLevel) {
-                for (const auto& head : sstableIndex[level + 1]) {
-                    if (!(head.getMaxV() < minKey || head.getMinV() > maxKey)) {
-                        overlappingTables.push_back(head);
-                    }
-                }
+            uint64_t key = p.index.key;
+            std::string value = tables[p.sstableId].getData(p.pos);
+            
+            // 将下一个键值对加入优先队列
+            if (p.pos + 1 < tables[p.sstableId].getCnt()) {
+                p.pos++;
+                p.index = tables[p.sstableId].getIndexById(p.pos);
+                pq.push(p);
             }
             
-            // 3. 使用优先队列进行多路归并排序
-            std::priority_queue<poi, std::vector<poi>, cmpPoi> pq;
-            std::vector<sstable> tables;
-            std::vector<std::string> filesToDelete;
+            // 更新最新值
+            auto it = latestValues.find(key);
+            if (it == latestValues.end() || p.time > it->second.time) {
+                latestValues[key] = {value, p.time, p.sstableId};
+            }
+        }
+        
+        // 将最新值写入新的 SSTable
+        size_t recoveredVectors = 0;
+        size_t droppedVectors = 0;
+        for (const auto& entry : latestValues) {
+            uint64_t key = entry.first;
+            const std::string& value = entry.second.value;
             
-            try {
-                // 加载所有 Level 0 的 SSTable
-                for (int i = 0; i < sstableIndex[level].size(); ++i) {
-                    sstable ss;
-                    // 使用复制而不是引用
-                    std::string filename = sstableIndex[level][i].getFilename(); // This should be full path now
-                    
-                    // 检查文件是否存在 (使用 stat 而不是 utils::fileExists)
-                    struct stat buffer;
-                    if (stat(filename.c_str(), &buffer) != 0) {
-                        continue;
-                    }
-                    
-                    ss.loadFile(filename.data());
-                    tables.push_back(ss);
-                    filesToDelete.push_back(filename);
-                    
-                    // 将每个 SSTable 的第一个键值对加入优先队列
-                    if (ss.getCnt() > 0) {
-                        poi p;
-                        p.sstableId = i;
-                        p.pos = 0;
-                        p.time = ss.getTime();
-                        p.index = ss.getIndexById(0);
-                        pq.push(p);
-                    }
-                }
-                
-                // 加载所有与 Level 0 有重叠的 Level 1 的 SSTable
-                int offset = tables.size();
-                for (int i = 0; i < overlappingTables.size(); ++i) {
-                    sstable ss;
-                    // 使用复制而不是引用
-                    std::string filename = overlappingTables[i].getFilename(); // This should be full path now
-                    
-                    // 检查文件是否存在 (使用 stat 而不是 utils::fileExists)
-                    struct stat buffer;
-                    if (stat(filename.c_str(), &buffer) != 0) {
-                        continue;
-                    }
-                    
-                    ss.loadFile(filename.data());
-                    tables.push_back(ss);
-                    filesToDelete.push_back(filename);
-                    
-                    // 将每个 SSTable 的第一个键值对加入优先队列
-                    if (ss.getCnt() > 0) {
-                        poi p;
-                        p.sstableId = i + offset;
-                        p.pos = 0;
-                        p.time = ss.getTime();
-                        p.index = ss.getIndexById(0);
-                        pq.push(p);
-                    }
-                }
-                
-                // 如果没有有效的键值对，跳过合并
-                if (pq.empty()) {
+            // 删除标记没有向量；已经没有更旧的版本时连同标记一起丢弃
+            if (value == DEL) {
+                if (drop_deleted) {
                     continue;
                 }
-                
-                // 4. 创建新的 SSTable 存储合并结果
-                sstable newTable;
-                newTable.reset();
-                TIME++; // 增加时间戳
-                newTable.setTime(TIME);
-                
-                // 5. 使用多路归并排序合并所有 SSTable
-                std::map<uint64_t, std::pair<std::string, uint64_t>> latestValues; // 键 -> (值, 时间戳)
-                
-                while (!pq.empty()) {
-                    // 取出优先队列中最小的键值对
-                    poi p = pq.top();
-                    pq.pop();
-                    
-                    uint64_t key = p.index.key;
-                    std::string value;
-                    
-                    // 获取值
-                    if (p.pos == 0) {
-                        value = tables[p.sstableId].getData(0);
-                    } else {
-                        uint32_t len;
-                        int offset = tables[p.sstableId].searchOffset(key, len);
-                        if (offset != -1) {
-                            // 使用 KVStore::fetchString 而不是 sstable::fetchString
-                            value = fetchString(tables[p.sstableId].getFilename(), 
-                                              offset + 32 + 10240 + 12 * tables[p.sstableId].getCnt(), 
-                                              len);
-                        }
-                    }
-                    
-                    // 将下一个键值对加入优先队列
-                    if (p.pos + 1 < tables[p.sstableId].getCnt()) {
-                        p.pos++;
-                        p.index = tables[p.sstableId].getIndexById(p.pos);
-                        pq.push(p);
-                    }
-                    
-                    // 更新最新值
-                    auto it = latestValues.find(key);
-                    if (it == latestValues.end() || p.time > it->second.second) {
-                        latestValues[key] = std::make_pair(value, p.time);
-                    }
-                }
-                
-                // 将最新值写入新的 SSTable
-                for (const auto& entry : latestValues) {
-                    uint64_t key = entry.first;
-                    std::string value = entry.second.first;
-                    
-                    // 如果值是删除标记，不写入新的 SSTable
-                    if (value == DEL) {
-                        continue;
-                    }
-                    
-                    // 将键值对写入新的 SSTable
-                    newTable.insert(key, value);
-                    
-                    // 如果新的 SSTable 达到大小限制，写入磁盘并创建新的 SSTable
-                    if (newTable.getBytes() >= MAXSIZE) {
-                        // 创建下一层目录（如果不存在）
-                        std::string path = dir_ + "/level-" + std::to_string(level + 1); // MODIFIED: use dir_
-                        if (!utils::dirExists(path)) {
-                            utils::mkdir(path.data());
-                            if (totalLevel < level + 1) {
-                                totalLevel = level + 1;
-                            }
-                        }
-                        
-                        // 设置文件名并写入磁盘
-                        std::string filename = path + "/" + std::to_string(TIME) + ".sst";
-                        newTable.setFilename(filename);
-                        newTable.putFile(filename.data());
-                        
-                        // 将新的 SSTable 添加到缓存
-                        addsstable(newTable, level + 1);
-                        
-                        // 创建新的 SSTable
-                        newTable.reset();
-                        TIME++; // 增加时间戳
-                        newTable.setTime(TIME);
-                    }
-                }
-                
-                // 如果最后一个 SSTable 不为空，写入磁盘
-                if (newTable.getCnt() > 0) {
-                    // 创建下一层目录（如果不存在）
-                    std::string path = dir_ + "/level-" + std::to_string(level + 1); // MODIFIED: use dir_
-                    if (!utils::dirExists(path)) {
-                        utils::mkdir(path.data());
-                        if (totalLevel < level + 1) {
-                            totalLevel = level + 1;
-                        }
+                newTable.insert(key, value);
+            } else {
+                // 将键值对写入新的 SSTable；旧版本的向量不再保留
+                newTable.insert(key, value);
+                const sstable& source = tables[entry.second.sstableId];
+                if (vecDim > 0 && source.getVectorDim() == vecDim) {
+                    if (const char* vec = source.findVector(key)) {
+                        newTable.insertVector(key, vec, source.getVectorPrecision());
                     }
-                    
-                    // 设置文件名并写入磁盘
-                    std::string filename = path + "/" + std::to_string(TIME) + ".sst";
-                    newTable.setFilename(filename);
-                    newTable.putFile(filename.data());
-                    
-                    // 将新的 SSTable 添加到缓存
-                    addsstable(newTable, level + 1);
-                }
-                
-                // 删除所有已合并的 SSTable
-                for (const auto& filename : filesToDelete) {
-                    // 检查文件是否存在 (使用 stat 而不是 utils::fileExists)
-                    struct stat buffer;
-                    if (stat(filename.c_str(), &buffer) == 0) {
-                        delsstable(filename);
+                } else if (vecDim > 0) {
+                    // 来源表没有可用的向量块 (维度确定前刷盘，或未迁移的旧表)：用内存中的向量补上
+                    auto emb = embeddings.find(key);
+                    if (emb != embeddings.end() && emb->second.size() == vecDim && !emb->second.is_deleted_marker()) {
+                        newTable.insertVector(key, emb->second.raw(), emb->second.precision());
+                        ++recoveredVectors;
+                    } else {
+                        ++droppedVectors;
                     }
                 }
-                
-                // 清空当前层的 SSTable 索引
-                sstableIndex[level].clear();
-                
-                // 检查下一层是否需要合并（使用迭代而不是递归）
-                bool needNextLevelCompaction = false;
-                if (level + 1 <= totalLevel && sstableIndex[level + 1].size() > (1 << (level + 2))) {
-                    needNextLevelCompaction = true;
-                }
-                
-                if (needNextLevelCompaction) {
-                    // 继续循环，处理下一层
-                    continue;
-                } else {
-                    // 完成合并
-                    return;
-                }
-            } catch (const std::exception& e) {
-                return;
-            } catch (...) {
-                return;
             }
-        } else {
-            // 如果不是 Level 0，选择时间戳最小的若干个文件进行合并
-            // 按时间戳排序
-            std::vector<sstablehead> sortedTables = sstableIndex[level];
-            std::sort(sortedTables.begin(), sortedTables.end(), 
-                [](const sstablehead& a, const sstablehead& b) {
-                    return a.getTime() < b.getTime();
-                });
             
-            // 选择时间戳最小的 filesToMerge 个文件
-            int filesToMerge = sstableIndex[level].size() - maxFiles;
-            std::vector<sstablehead> tablesToMerge(sortedTables.begin(), 
-                                                 sortedTables.begin() + filesToMerge);
-            
-            // 计算这些文件的键范围
-            uint64_t minKey = std::numeric_limits<uint64_t>::max();
-            uint64_t maxKey = 0;
-            
-            for (const auto& head : tablesToMerge) {
-                minKey = std::min(minKey, head.getMinV());
-                maxKey = std::max(maxKey, head.getMaxV());
+            // 如果新的 SSTable 达到大小限制，写入磁盘并创建新的 SSTable
+            if (newTable.getBytes() >= MAXSIZE) {
+                flush_table();
+                newTable.reset();
+                TIME++; // 增加时间戳
+                newTable.setTime(TIME);
+                newTable.setVectorDim(vecDim, vector_precision_);
             }
-            
-            // 在下一层中找到与此键范围有交集的所有 SSTable
-            std::vector<sstablehead> overlappingTables;
-            
-            if (level + 1 <= totalLevel) {
-                for (const auto& head : sstableIndex[level + 1]) {
-                    if (!(head.getMaxV() < minKey || head.getMinV() > maxKey)) {
-                        overlappingTables.push_back(head);
-                    }
-                }
+        }
+        
+        // 如果最后一个 SSTable 不为空，写入磁盘
+        if (newTable.getCnt() > 0) {
+            flush_table();
+        }
+        if (recoveredVectors > 0 || droppedVectors > 0) {
+            std::cerr << "[WARN] Compaction into level " << target_level << ": " << recoveredVectors
+                      << " vectors taken from memory and " << droppedVectors
+                      << " values left without a vector (source SSTable has no matching vector block)." << std::endl;
+        }
+        
+        // 删除所有已合并的 SSTable
+        for (const auto& filename : filesToDelete) {
+            delsstable(filename);
+        }
+        // 输入中已经不存在的文件也从缓存中去掉
+        for (const auto& filename : inputs) {
+            for (int level = 0; level <= totalLevel; ++level) {
+                auto& heads = sstableIndex[level];
+                heads.erase(std::remove_if(heads.begin(), heads.end(),
+                                           [&](const sstablehead& head) { return head.getFilename() == filename; }),
+                            heads.end());
             }
-            
-            // 使用与 Level 0 相同的多路归并排序逻辑
-            // ... (类似于 Level 0 的合并逻辑)
-            
-            // 避免无限递归
-            return;
         }
+        return true;
+    } catch (const std::exception& e) {
+        return false;
+    } catch (...) {
+        return false;
     }
 }
 
@@ -1239,8 +1098,14 @@ float KVStore::cosine_similarity(const std::vector<float> &a, const std::vector<
 // --- ADDED: Implementation for get_embedding ---
 std::vector<float> KVStore::get_embedding(const std::string& text) {
     #ifndef DISABLE_EMBEDDING_FOR_TESTS // Preserve the disable macro
-    // Assuming embedding_single is the function that calls the model
-    return embedding_single(text);
+    // 先查内容哈希缓存，未命中才调用模型
+    std::vector<float> cached;
+    if (embedding_cache_.lookup(text, cached)) {
+        return cached;
+    }
+    std::vector<float> result = embedding_single(text);
+    embedding_cache_.insert(text, result);
+    return result;
     #else
     // Return an empty vector or a zero vector of the correct dimension if testing without embeddings
     // std::vector<float> zero_vec(embedding_dimension_, 0.0f); 
@@ -1248,13 +1113,90 @@ std::vector<float> KVStore::get_embedding(const std::string& text) {
     return {}; 
     #endif
 }
+
+// 缓存未命中的文本合并成一次批量推理
+std::vector<std::vector<float>> KVStore::get_embeddings(const std::vector<std::string>& texts) {
+    std::vector<std::vector<float>> results(texts.size());
+    #ifndef DISABLE_EMBEDDING_FOR_TESTS
+    std::vector<std::string> misses;
+    std::vector<size_t> miss_positions;
+    for (size_t i = 0; i < texts.size(); ++i) {
+        if (!texts[i].empty() && !embedding_cache_.lookup(texts[i], results[i])) {
+            misses.push_back(texts[i]);
+            miss_positions.push_back(i);
+        }
+    }
+    if (!misses.empty()) {
+        std::vector<std::vector<float>> computed = embedding_texts(misses);
+        for (size_t i = 0; i < computed.size() && i < miss_positions.size(); ++i) {
+            embedding_cache_.insert(misses[i], computed[i]);
+            results[miss_positions[i]] = std::move(computed[i]);
+        }
+    }
+    #endif
+    return results;
+}
+
+// --- 异步 embedding ---
+size_t KVStore::apply_ready_embeddings() {
+    if (!embedding_pipeline_) {
+        return 0;
+    }
+    std::vector<EmbeddingPipeline::Result> ready = embedding_pipeline_->take_ready();
+    if (!ready.empty()) {
+        finish_hnsw_consolidation(); // 写入 embeddings 与图之前等待后台整理
+    }
+    size_t applied = 0;
+    for (auto& result : ready) {
+        auto it = pending_embedding_keys_.find(result.key);
+        if (it == pending_embedding_keys_.end() || it->second != result.seq) {
+            continue; // 之后又被写入或删除，这个结果已经过期
+        }
+        pending_embedding_keys_.erase(it);
+        std::vector<float>& emb_vec = result.embedding;
+        if (embedding_dimension_ == 0 && !emb_vec.empty()) {
+            embedding_dimension_ = emb_vec.size();
+            std::cout << "[INFO] Embedding dimension determined: " << embedding_dimension_ << " from key " << result.key << std::endl;
+        }
+        if (emb_vec.empty() && embedding_dimension_ > 0) {
+            std::cerr << "[WARN] Async embedding for key " << result.key << " is empty. Storing zero vector." << std::endl;
+            emb_vec.assign(embedding_dimension_, 0.0f);
+        } else if (emb_vec.size() != embedding_dimension_) {
+            std::cerr << "[ERROR] Async embedding dim mismatch for key " << result.key << "! Expected "
+                      << embedding_dimension_ << " got " << emb_vec.size() << ". Not storing." << std::endl;
+            continue;
+        }
+        bool is_update = embeddings.count(result.key);
+        embeddings[result.key].assign(emb_vec, vector_precision_);
+        index_embedding(result.key, emb_vec, is_update);
+        ++applied;
+    }
+    return applied;
+}
+
+void KVStore::sync_embeddings() {
+    if (embedding_pipeline_) {
+        embedding_pipeline_->wait_idle();
+        apply_ready_embeddings();
+    }
+}
+
+bool KVStore::is_vector_searchable(uint64_t key) {
+    apply_ready_embeddings();
+    return pending_embedding_keys_.count(key) == 0 && embeddings.count(key) > 0 && !get(key).empty();
+}
+
+size_t KVStore::pending_embeddings() const {
+    return pending_embedding_keys_.size();
+}
+
 // --- END ADDED ---
 
 // --- ADDED: Overloaded search_knn_hnsw (takes vector) ---
 // This function contains the core HNSW search logic, previously inside search_knn_hnsw(string, k)
-std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(const std::vector<float>& query_vec, int k, bool is_string_query, const std::string& query_text) {
-    // 记录原始查询向量用于后续处理
-    const std::vector<float> original_query_vec = query_vec;
+// ef <= 0 时使用默认的 max(efConstruction, k * 10)。只读访问共享状态，可被多个查询线程并发调用
+std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(const std::vector<float>& query_vec, int k, bool is_string_query, const std::string& query_text, int ef) {
+    // 记录原始查询文本用于后续处理
     std::string original_query_text = query_text;
     bool is_from_string_query = is_string_query;
     
@@ -1263,27 +1205,20 @@ std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(const std
         return {};
     }
 
-    size_t current_entry_point = entry_point_label_;
-    int top_level = current_max_level_;
-
     // Step 1: Search from top level down to level 1
-    for (int level = top_level; level >= 1; --level) {
-         // Use ef=1 for top levels, limited_search=true
-        auto nearest_pq = search_layer_internal(current_entry_point, query_vec, level, 1, true);
-        if (!nearest_pq.empty()) {
-            current_entry_point = nearest_pq.top().second;
-        } else {
-            // If search at a higher level returns empty, it might indicate an issue
-            // or the graph is very sparse at this level. Keep the current entry point.
-            // std::cerr << "[WARNING] HNSW search returned empty at level " << level << ". Keeping entry point: " << current_entry_point << std::endl;
-        }
-    }
+    size_t current_entry_point = hnsw_descend_to_base(query_vec);
 
     // Step 2: Search base layer (level 0)
     // Use a larger ef (efSearch) for the base layer search
-    // We need a parameter for efSearch. Let's use efConstruction for now, or define a new one.
-    const int efSearch = std::max(HNSW_efConstruction, k * 10); // 增加搜索范围，确保有足够的候选项
+    const int efSearch = hnsw_search_ef(k, ef);
     auto results_pq = search_base_layer(current_entry_point, query_vec, efSearch);
+    std::vector<HNSWHeapItem> base_hits;
+    base_hits.reserve(results_pq.size());
+    while (!results_pq.empty()) {
+        base_hits.push_back(results_pq.top());
+        results_pq.pop();
+    }
+    hnsw_rerank_full(query_vec, base_hits); // 使用前缀搜索时按完整维度重排
 
     // Step 3: Collect results and filter
     std::vector<std::pair<float, uint64_t>> final_candidates_temp; // Store {distance, key}
@@ -1292,62 +1227,19 @@ std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(const std
     // For simplicity, let's try to fill up to efSearch or a reasonable limit.
     int collected_count = 0;
     // 使用步骤2中定义的efSearch
-    while (!results_pq.empty() && collected_count < efSearch) { // Collect up to efSearch potential candidates
-        HNSWHeapItem item = results_pq.top();
-        results_pq.pop();
+    for (size_t h = 0; h < base_hits.size() && collected_count < efSearch; ++h) { // Collect up to efSearch potential candidates
+        const HNSWHeapItem& item = base_hits[h];
         
-        if (!label_to_key_.count(item.second)) continue;
-        uint64_t result_key = label_to_key_[item.second];
+        auto key_it = label_to_key_.find(item.second);
+        if (key_it == label_to_key_.end()) continue;
+        uint64_t result_key = key_it->second;
 
-        // Filter 1: Check HNSW internal deleted flag
-        if (!hnsw_nodes_.count(item.second) || hnsw_nodes_[item.second].deleted) {
-            // std::cout << "[DEBUG_SEARCH_FILTER] Key " << result_key << " filtered: marked as deleted in HNSW index" << std::endl;
+        // 过滤已删除 (墓碑) 节点
+        if (hnsw_deleted_labels_.test(item.second)) {
             continue;
         }
-
-        // Filter 2: Check against loaded_deleted_vectors_ (from deleted_nodes.bin)
-        bool is_in_deleted_bin = false;
-        if (!loaded_deleted_vectors_.empty() && embeddings.count(result_key)) {
-            const std::vector<float>& candidate_vec = embeddings[result_key];
-            if (candidate_vec.size() == embedding_dimension_) { // Ensure valid vector from map
-                for (int i = 0; i < loaded_deleted_vectors_.size(); i++) {
-                    const auto& deleted_vec = loaded_deleted_vectors_[i];
-                    if (compare_float_vectors(candidate_vec, deleted_vec, 0.001f)) { // 使用更小的epsilon增加精度
-                        // std::cout << "[DEBUG_SEARCH_FILTER] Key " << result_key << " filtered: matched with deleted vector at index " << i << std::endl;
-                        is_in_deleted_bin = true;
-                        break;
-                    }
-                }
-            }
-        }
-
-        if (!is_in_deleted_bin) {
-            final_candidates_temp.push_back({item.first, result_key});
-            collected_count++;
-        }
-    }
-
-    // 检查当前查询向量是否是某个已删除向量
-    bool query_is_deleted = false;
-    int best_match_deleted_index = -1;
-    float best_match_similarity = 0.0f;
-    
-    if (!loaded_deleted_vectors_.empty()) {
-        for (int i = 0; i < loaded_deleted_vectors_.size(); i++) {
-            const auto& deleted_vec = loaded_deleted_vectors_[i];
-            if (original_query_vec.size() == deleted_vec.size()) {
-                float similarity = cosine_similarity(original_query_vec, deleted_vec);
-                if (similarity > 0.999f) { // 相似度非常高，认为是同一个向量
-                    query_is_deleted = true;
-                    best_match_deleted_index = i;
-                    best_match_similarity = similarity;
-                    break;
-                } else if (similarity > best_match_similarity) {
-                    best_match_similarity = similarity;
-                    best_match_deleted_index = i;
-                }
-            }
-        }
+        final_candidates_temp.push_back({item.first, result_key});
+        collected_count++;
     }
 
     // final_candidates_temp now contains {distance, key} sorted by distance (closest first).
@@ -1406,29 +1298,361 @@ std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(const std
     return final_results;
 }
 
-// 增加一个重载版本，保持函数签名不变
-std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(const std::vector<float>& query_vec, int k) {
+// 增加一个重载版本，ef 可按单次查询调整召回率与延迟
+std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(const std::vector<float>& query_vec, int k, int ef) {
     // 默认调用完整版本，不是来自字符串查询
-    return search_knn_hnsw(query_vec, k, false, "");
+    return search_knn_hnsw(query_vec, k, false, "", ef);
 }
 
-// Original search_knn_hnsw (takes string)
-std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(std::string query, int k) {
-    std::vector<float> query_vec;
-    std::string original_query_text = query; // 保存原始查询文本
-    
-    #ifndef DISABLE_EMBEDDING_FOR_TESTS
-    query_vec = embedding_single(query);
-    #else
-    // Handle case where embedding is disabled for tests
-    // Maybe return empty results or use a dummy vector?
-    return {};
-    #endif
+// 批量查询：把查询分给 search_pool_ 中的线程并行执行，按输入顺序返回每个查询的结果。
+// 每个线程从 visited_list_pool_ 借出私有访问表，并使用 thread_local 的搜索暂存堆。
+// 查询期间不能有并发的 put/del/reset
+std::vector<std::vector<std::pair<uint64_t, std::string>>>
+KVStore::search_knn_hnsw_batch(const std::vector<std::vector<float>>& queries, int k, int ef) {
+    std::vector<std::vector<std::pair<uint64_t, std::string>>> batch_results(queries.size());
+    if (queries.empty()) {
+        return batch_results;
+    }
 
-    if (query_vec.empty()) {
-        std::cerr << "[ERROR] Failed to get embedding for query: " << query << std::endl;
-        // 特殊处理：如果我们无法生成查询向量但仍需要返回结果
-        // 这里可以返回包含查询文本本身的结果
+    size_t pool_threads = hnsw_search_threads_;
+    if (pool_threads == 0) {
+        pool_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t num_threads = std::min(pool_threads, queries.size());
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < queries.size(); ++i) {
+            batch_results[i] = search_knn_hnsw(queries[i], k, false, "", ef);
+        }
+        return batch_results;
+    }
+
+    std::call_once(search_pool_once_, [this, pool_threads]() {
+        search_pool_ = std::make_unique<ThreadPool>(pool_threads);
+    });
+
+    std::atomic<size_t> next_query(0);
+    std::latch finished(static_cast<std::ptrdiff_t>(num_threads));
+    for (size_t t = 0; t < num_threads; ++t) {
+        search_pool_->enqueue([this, &queries, &batch_results, &next_query, &finished, k, ef]() {
+            for (size_t i = next_query++; i < queries.size(); i = next_query++) {
+                batch_results[i] = search_knn_hnsw(queries[i], k, false, "", ef);
+            }
+            finished.count_down();
+        });
+    }
+    finished.wait();
+    return batch_results;
+}
+
+// 从最高层到第 1 层，每层用 ef=1 贪心找最近点，作为下一层的入口
+size_t KVStore::hnsw_descend_to_base(const std::vector<float>& query_vec) {
+    size_t current_entry_point = entry_point_label_;
+    for (int level = current_max_level_; level >= 1; --level) {
+        auto nearest_pq = search_layer_internal(current_entry_point, query_vec, level, 1, true);
+        if (!nearest_pq.empty()) {
+            current_entry_point = nearest_pq.top().second;
+        }
+        // 某层返回空时保留当前入口点
+    }
+    return current_entry_point;
+}
+
+int KVStore::hnsw_search_ef(int k, int ef) const {
+    if (ef <= 0) {
+        ef = HNSW_efSearch > 0 ? HNSW_efSearch : std::max(HNSW_efConstruction, k * 10);
+    }
+    return std::max(ef, k); // 候选数至少为 k
+}
+
+// 谓词按需调用：先在至多 HNSW_FILTER_SAMPLE 个均匀分布的 label 上估计满足条件的比例，比例足够高时
+// 带着谓词在第 0 层搜索，只对遍历到的节点调用谓词；估计的满足条件节点很少 (同 search_knn_hnsw_allowed
+// 的暴力计算条件)，或图搜索凑不满 k 个结果时，才对全部节点求值并暴力计算
+std::vector<std::pair<uint64_t, std::string>>
+KVStore::search_knn_hnsw_filtered(const std::vector<float>& query_vec, int k, const HNSWKeyFilter& filter, int ef) {
+    if (k <= 0 || current_max_level_ < 0 || hnsw_nodes_.empty()) {
+        return {};
+    }
+    const int efSearch = hnsw_search_ef(k, ef);
+
+    size_t sampled = 0;
+    size_t passed = 0;
+    const size_t step = std::max<size_t>(1, next_label_ / HNSW_FILTER_SAMPLE);
+    for (size_t label = step / 2; label < next_label_; label += step) {
+        auto key_it = label_to_key_.find(label);
+        if (key_it == label_to_key_.end() || hnsw_deleted_labels_.test(label)) {
+            continue;
+        }
+        ++sampled;
+        passed += filter(key_it->second) ? 1 : 0;
+    }
+    const double live = static_cast<double>(hnsw_nodes_.size() - hnsw_deleted_labels_.count());
+    const double ratio = sampled > 0 ? static_cast<double>(passed) / sampled : 0.0;
+    if (sampled > 0 && ratio * live > efSearch && ratio >= hnsw_filter_brute_force_ratio_) {
+        auto results_pq =
+            search_layer_internal(hnsw_descend_to_base(query_vec), query_vec, 0, efSearch, false, nullptr, &filter);
+        std::vector<HNSWHeapItem> hits; // {distance, label}
+        while (!results_pq.empty()) {
+            hits.push_back(results_pq.top());
+            results_pq.pop();
+        }
+        std::vector<std::pair<uint64_t, std::string>> results = hnsw_hits_to_results(query_vec, hits, k);
+        if (results.size() >= static_cast<size_t>(k)) {
+            return results;
+        }
+    }
+
+    LabelBitmap allowed;
+    for (const auto& pair : label_to_key_) {
+        if (!hnsw_deleted_labels_.test(pair.first) && filter(pair.second)) {
+            allowed.set(pair.first);
+        }
+    }
+    if (allowed.empty()) {
+        return {};
+    }
+    std::vector<HNSWHeapItem> hits = hnsw_brute_force_hits(query_vec, allowed, efSearch);
+    return hnsw_hits_to_results(query_vec, hits, k);
+}
+
+std::vector<std::pair<uint64_t, std::string>>
+KVStore::search_knn_hnsw_filtered(std::string query, int k, const HNSWKeyFilter& filter, int ef) {
+    std::vector<float> query_vec = get_embedding(query);
+    if (query_vec.empty()) {
+        std::cerr << "[ERROR] search_knn_hnsw_filtered(string): Failed to get embedding for query." << std::endl;
+        return {};
+    }
+    return search_knn_hnsw_filtered(query_vec, k, filter, ef);
+}
+
+// key 区间直接在有序的 key_to_label_ 上取范围，不需要逐个调用谓词
+std::vector<std::pair<uint64_t, std::string>>
+KVStore::search_knn_hnsw_filtered(const std::vector<float>& query_vec, int k, uint64_t key_min, uint64_t key_max, int ef) {
+    LabelBitmap allowed;
+    for (auto it = key_to_label_.lower_bound(key_min); it != key_to_label_.end() && it->first <= key_max; ++it) {
+        if (!hnsw_deleted_labels_.test(it->second)) {
+            allowed.set(it->second);
+        }
+    }
+    return search_knn_hnsw_allowed(query_vec, k, allowed, ef);
+}
+
+// allowed 中的节点很少时 (不多于 ef，或占比低于 filter_brute_force_ratio) 图遍历要走过大量不满足条件的节点，
+// 不如直接对候选集计算距离；否则在第 0 层带着 allowed 搜索，不满足条件的节点只用于导航
+std::vector<std::pair<uint64_t, std::string>>
+KVStore::search_knn_hnsw_allowed(const std::vector<float>& query_vec, int k, const LabelBitmap& allowed, int ef) {
+    if (k <= 0 || allowed.empty() || current_max_level_ < 0 || hnsw_nodes_.empty()) {
+        return {};
+    }
+    const int efSearch = hnsw_search_ef(k, ef);
+
+    std::vector<HNSWHeapItem> hits; // {distance, label}
+    if (allowed.count() <= static_cast<size_t>(efSearch) ||
+        allowed.count() < hnsw_filter_brute_force_ratio_ * static_cast<double>(hnsw_nodes_.size())) {
+        hits = hnsw_brute_force_hits(query_vec, allowed, efSearch);
+    } else {
+        auto results_pq = search_layer_internal(hnsw_descend_to_base(query_vec), query_vec, 0, efSearch, false, &allowed);
+        while (!results_pq.empty()) {
+            hits.push_back(results_pq.top());
+            results_pq.pop();
+        }
+    }
+    return hnsw_hits_to_results(query_vec, hits, k);
+}
+
+// 对 allowed 中的每个节点计算距离，返回最近的至多 ef 个 {distance, label}，按距离升序
+std::vector<HNSWHeapItem> KVStore::hnsw_brute_force_hits(const std::vector<float>& query_vec, const LabelBitmap& allowed,
+                                                         int ef) {
+    std::vector<HNSWHeapItem> hits;
+    for (size_t label : allowed.to_list<size_t>()) {
+        const StoredVector* vec = hnsw_vector_of(label);
+        if (vec != nullptr) {
+            hits.push_back({calculate_distance(query_vec, *vec), label});
+        }
+    }
+    size_t keep = std::min(hits.size(), static_cast<size_t>(ef));
+    std::partial_sort(hits.begin(), hits.begin() + keep, hits.end());
+    hits.resize(keep);
+    return hits;
+}
+
+// 按完整维度重排后取前 k 个仍然存在的 key；多取的候选用来跳过 LSM 中已删除 (get 返回空) 的 key
+std::vector<std::pair<uint64_t, std::string>>
+KVStore::hnsw_hits_to_results(const std::vector<float>& query_vec, std::vector<HNSWHeapItem>& hits, int k) {
+    hnsw_rerank_full(query_vec, hits);
+
+    std::vector<std::pair<uint64_t, std::string>> results;
+    for (const HNSWHeapItem& hit : hits) {
+        if (results.size() >= static_cast<size_t>(k)) {
+            break;
+        }
+        auto key_it = label_to_key_.find(hit.second);
+        if (key_it == label_to_key_.end()) {
+            continue;
+        }
+        std::string value = get(key_it->second);
+        if (!value.empty()) {
+            results.push_back({key_it->second, value});
+        }
+    }
+    return results;
+}
+
+// 范围查询：束搜索得到的 ef 个最近点作为种子，其中在半径内的放进边界堆；每次取出边界上最近的点，
+// 把它第 0 层的邻居中在半径内的加入结果与边界，直到边界为空或结果达到 max_results。
+// 相当于 ef 随半径内的点数增长，不需要用越来越大的 k 重复查询；只能经由半径外的点到达的点会被漏掉。
+// 达到 max_results 时提前停止，返回的是按距离优先扩展遇到的前几个，不保证恰好是半径内最近的 max_results 个。
+// 墓碑节点照常扩展但不进入结果
+std::vector<std::pair<uint64_t, std::string>>
+KVStore::search_radius(const std::vector<float>& query_vec, float radius, size_t max_results, int ef) {
+    if (query_vec.empty() || std::isnan(radius)) {
+        return {};
+    }
+    if (current_max_level_ < 0 || hnsw_nodes_.empty()) {
+        return search_radius_exact(query_vec, radius, max_results);
+    }
+    const size_t limit = max_results > 0 ? max_results : std::numeric_limits<size_t>::max();
+
+    auto seeds_pq = search_base_layer(hnsw_descend_to_base(query_vec), query_vec, hnsw_search_ef(1, ef));
+
+    // 是否在半径内、何时达到 max_results 都按完整维度的距离判断：Matryoshka 前缀上的距离只用于束搜索找种子，
+    // 它与完整距离之间没有大小关系，用它筛选会同时漏掉和多出半径边界附近的点
+    const bool prefix_search = hnsw_distance_dims(query_vec.size()) != query_vec.size();
+    auto full_distance = [&](const StoredVector& vec) { return metric_distance(query_vec, vec, vec.size()); };
+
+    VisitedListPool::Handle visited = visited_list_pool_.acquire(next_label_);
+    const MinHNSWHeapComparer frontier_cmp;
+    std::vector<HNSWHeapItem> frontier; // 待扩展的半径内节点 (最小堆)
+    std::vector<HNSWHeapItem> hits;     // {distance, label}
+    auto accept = [&](const HNSWHeapItem& item) {
+        frontier.push_back(item);
+        std::push_heap(frontier.begin(), frontier.end(), frontier_cmp);
+        if (!hnsw_deleted_labels_.test(item.second)) {
+            hits.push_back(item);
+        }
+    };
+    for (; !seeds_pq.empty(); seeds_pq.pop()) {
+        HNSWHeapItem seed = seeds_pq.top();
+        if (seed.second < visited->capacity()) {
+            visited->mark(seed.second);
+        }
+        if (prefix_search) {
+            const StoredVector* vec = hnsw_vector_of(seed.second);
+            seed.first = vec ? full_distance(*vec) : std::numeric_limits<float>::max();
+        }
+        if (seed.first <= radius) {
+            accept(seed);
+        }
+    }
+
+    std::vector<size_t> neighbors;
+    while (!frontier.empty() && hits.size() < limit) {
+        std::pop_heap(frontier.begin(), frontier.end(), frontier_cmp);
+        size_t label = frontier.back().second;
+        frontier.pop_back();
+        auto node_it = hnsw_nodes_.find(label);
+        if (node_it == hnsw_nodes_.end()) {
+            continue;
+        }
+        {
+            std::lock_guard<HNSWSpinLock> link_guard(node_it->second.link_lock);
+            if (node_it->second.connections.empty()) {
+                continue;
+            }
+            neighbors.assign(node_it->second.connections[0].begin(), node_it->second.connections[0].end());
+        }
+        for (size_t neighbor : neighbors) {
+            if (neighbor >= visited->capacity() || !visited->try_visit(neighbor)) {
+                continue;
+            }
+            const StoredVector* vec = hnsw_vector_of(neighbor);
+            if (vec == nullptr) {
+                continue;
+            }
+            float dist = prefix_search ? full_distance(*vec) : calculate_distance(query_vec, *vec);
+            if (dist <= radius) {
+                accept({dist, neighbor});
+            }
+        }
+    }
+    std::sort(hits.begin(), hits.end());
+
+    std::vector<std::pair<uint64_t, std::string>> results;
+    for (const HNSWHeapItem& hit : hits) {
+        if (hit.first > radius || results.size() >= limit) {
+            break;
+        }
+        auto key_it = label_to_key_.find(hit.second);
+        if (key_it == label_to_key_.end()) {
+            continue;
+        }
+        std::string value = get(key_it->second);
+        if (!value.empty()) {
+            results.push_back({key_it->second, value});
+        }
+    }
+    return results;
+}
+
+std::vector<std::pair<uint64_t, std::string>>
+KVStore::search_radius(std::string query, float radius, size_t max_results, int ef) {
+    std::vector<float> query_vec = get_embedding(query);
+    if (query_vec.empty()) {
+        std::cerr << "[ERROR] search_radius(string): Failed to get embedding for query." << std::endl;
+        return {};
+    }
+    return search_radius(query_vec, radius, max_results, ef);
+}
+
+// 精确范围查询：逐个计算 embeddings 中全部向量的距离 (完整维度)
+std::vector<std::pair<uint64_t, std::string>>
+KVStore::search_radius_exact(const std::vector<float>& query_vec, float radius, size_t max_results) {
+    if (query_vec.empty() || std::isnan(radius)) {
+        return {};
+    }
+    const size_t dim = query_vec.size();
+    std::vector<std::pair<float, uint64_t>> hits; // {distance, key}
+    for (const auto& pair : embeddings) {
+        if (pair.second.size() != dim) {
+            continue;
+        }
+        float dist = metric_distance(query_vec, pair.second, dim);
+        if (dist <= radius) { // 删除标记向量的距离不是有限值，这里自然被排除
+            hits.push_back({dist, pair.first});
+        }
+    }
+    std::sort(hits.begin(), hits.end());
+
+    const size_t limit = max_results > 0 ? max_results : std::numeric_limits<size_t>::max();
+    std::vector<std::pair<uint64_t, std::string>> results;
+    for (const auto& hit : hits) {
+        if (results.size() >= limit) {
+            break;
+        }
+        std::string value = get(hit.second); // get 对已删除的 key 返回空串
+        if (!value.empty()) {
+            results.push_back({hit.second, value});
+        }
+    }
+    return results;
+}
+
+// Original search_knn_hnsw (takes string)
+std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(std::string query, int k, int ef) {
+    std::vector<float> query_vec;
+    std::string original_query_text = query; // 保存原始查询文本
+    
+    #ifndef DISABLE_EMBEDDING_FOR_TESTS
+    query_vec = get_embedding(query);
+    #else
+    // Handle case where embedding is disabled for tests
+    // Maybe return empty results or use a dummy vector?
+    return {};
+    #endif
+
+    if (query_vec.empty()) {
+        std::cerr << "[ERROR] Failed to get embedding for query: " << query << std::endl;
+        // 特殊处理：如果我们无法生成查询向量但仍需要返回结果
+        // 这里可以返回包含查询文本本身的结果
         std::vector<std::pair<uint64_t, std::string>> fallback_results;
         fallback_results.push_back({static_cast<uint64_t>(-1), query});
         // 尝试添加其他非删除的文本以达到k个结果
@@ -1447,7 +1671,7 @@ std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(std::stri
     
     // 对于字符串查询，我们要处理特殊情况 - 查询文本被删除的情况
     // 修改：保存原始查询文本和标记，告知向量版本这是来自字符串的查询
-    auto results = search_knn_hnsw(query_vec, k, true, query);
+    auto results = search_knn_hnsw(query_vec, k, true, query, ef);
     
     // 确保结果集中包含查询文本本身
     bool has_query = std::any_of(results.begin(), results.end(), 
@@ -1471,10 +1695,54 @@ std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_hnsw(std::stri
 }
 
 float KVStore::calculate_distance(const std::vector<float>& v1, const std::vector<float>& v2) {
-    // 使用余弦距离 (1 - similarity)
-    // 注意：如果向量未归一化，计算相似度前需要先归一化，或者直接计算 L2 距离
-    float sim = cosine_similarity(v1, v2);
-    return 1.0f - sim;
+    if (v1.empty() || v1.size() != v2.size()) {
+        return std::numeric_limits<float>::max();
+    }
+    return select_distance_kernel(distance_metric_, VectorPrecision::Float32, v1.size())(v1.data(), v2.data(), v1.size());
+}
+
+float KVStore::calculate_distance(const std::vector<float>& query, const StoredVector& vec) {
+    return metric_distance(query, vec, hnsw_distance_dims(vec.size()));
+}
+
+// 每个线程各自计数，不需要原子操作
+static thread_local uint64_t distance_computation_count = 0;
+
+uint64_t KVStore::distance_computations() {
+    return distance_computation_count;
+}
+
+// 前 dims 维上按 distance_metric_ 计算的距离。常见情况 (精度与维度同建库时) 直接用预先选好的内核
+float KVStore::metric_distance(const std::vector<float>& query, const StoredVector& vec, size_t dims) const {
+    ++distance_computation_count;
+    if (query.empty() || query.size() != vec.size()) {
+        return std::numeric_limits<float>::max();
+    }
+    DistanceKernel kernel = distance_kernel_ != nullptr && dims == distance_kernel_dims_ && vec.precision() == vector_precision_
+                                ? distance_kernel_
+                                : select_distance_kernel(distance_metric_, vec.precision(), dims);
+    return kernel(query.data(), vec.raw(), dims);
+}
+
+void KVStore::refresh_distance_kernel() {
+    distance_kernel_dims_ = hnsw_distance_dims(static_cast<size_t>(std::max(0, embedding_dimension_)));
+    distance_kernel_ = select_distance_kernel(distance_metric_, vector_precision_, distance_kernel_dims_);
+}
+
+size_t KVStore::hnsw_distance_dims(size_t dim) const {
+    return hnsw_prefix_dim_ > 0 && hnsw_prefix_dim_ < dim ? hnsw_prefix_dim_ : dim;
+}
+
+// hits 为前缀距离下的候选 {distance, label}，改用完整维度的距离并重新排序
+void KVStore::hnsw_rerank_full(const std::vector<float>& query, std::vector<HNSWHeapItem>& hits) const {
+    if (hnsw_distance_dims(query.size()) == query.size()) {
+        return;
+    }
+    for (HNSWHeapItem& hit : hits) {
+        const StoredVector* vec = hnsw_vector_of(hit.second);
+        hit.first = vec ? metric_distance(query, *vec, vec->size()) : std::numeric_limits<float>::max();
+    }
+    std::sort(hits.begin(), hits.end());
 }
 
 int KVStore::get_random_level() {
@@ -1483,240 +1751,234 @@ int KVStore::get_random_level() {
     return level; // 返回层级 0, 1, 2...
 }
 
+// 每个线程复用的搜索暂存区：候选堆、结果堆和邻居快照，避免每次搜索重新分配
+namespace {
+struct HNSWSearchScratch {
+    std::vector<HNSWHeapItem> candidates; // 用 MinHNSWHeapComparer 维护的堆 (待探索)
+    std::vector<HNSWHeapItem> results;    // 用 MaxHNSWHeapComparer 维护的堆 (已找到的最近邻)
+    std::vector<size_t> neighbors;        // 邻居列表快照
+    std::vector<std::pair<size_t, const StoredVector*>> pending; // 待计算距离的邻居 (label, 向量)
+};
+thread_local HNSWSearchScratch hnsw_search_scratch;
+} // namespace
+
 // 内部搜索函数，可在指定层级搜索
+// 并行构建时其它线程可能正在修改邻居表：这里只用 find() 读共享的 map，
+// 并在节点自旋锁下拷贝邻居列表后再遍历
 std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer>
 KVStore::search_layer_internal(size_t entry_point_label,
                              const std::vector<float>& query_vec,
                              int target_level,
                              int ef,
-                             bool limited_search) {
-
-    std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer> candidates; // MinHeap: 距离小的优先 (待探索)
-    std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MaxHNSWHeapComparer> results;    // MaxHeap: 距离大的优先 (已找到的最近邻)
-    std::unordered_set<size_t> visited; // 访问过的节点 label
-
-    // --- BEGIN DEBUG LOG (Function Start) ---
-    // std::cerr << "[DEBUG_HNSW] search_layer_internal (Level " << target_level << ") Start:" << std::endl;
-    // std::cerr << "[DEBUG_HNSW]   Initial Entry Point Label: " << entry_point_label << std::endl;
-    // std::cerr << "[DEBUG_HNSW]   ef: " << ef << ", limited_search: " << (limited_search ? "true" : "false") << std::endl;
-    // --- END DEBUG LOG (Function Start) ---
+                             bool limited_search,
+                             const LabelBitmap* allowed,
+                             const HNSWKeyFilter* filter) {
 
+    std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer> final_results; // 返回值 (MinHeap)
 
     // 检查入口点有效性
-    if (hnsw_nodes_.find(entry_point_label) == hnsw_nodes_.end() || hnsw_nodes_[entry_point_label].deleted || hnsw_nodes_[entry_point_label].max_level < target_level) {
-         // --- BEGIN DEBUG LOG (Entry Point Invalid) ---
-         // std::cerr << "[DEBUG_HNSW]   Initial entry point " << entry_point_label << " invalid or level insufficient." << std::endl;
-         // --- END DEBUG LOG (Entry Point Invalid) ---
-
-         // --- Re-inserting Fallback Logic ---
-         bool found_new_entry = false; // Declare the variable
-         // Try label 0 as fallback first
-         if (hnsw_nodes_.count(0) && !hnsw_nodes_[0].deleted && hnsw_nodes_[0].max_level >= target_level) {
-             entry_point_label = 0; // Attempt to use label 0
-             found_new_entry = true;
-             // --- BEGIN DEBUG LOG (Using Fallback 0) ---
-             // std::cerr << "[DEBUG_HNSW]   Using fallback entry point: 0" << std::endl;
-             // --- END DEBUG LOG (Using Fallback 0) ---
-                } else {
-             // If label 0 doesn't work, search for any valid node at this level
-             // std::cerr << "[DEBUG_HNSW]   Fallback entry point 0 unsuitable. Searching for another..." << std::endl; // Added log
-             for(const auto& pair : hnsw_nodes_){
-                 if(!pair.second.deleted && pair.second.max_level >= target_level){
-                     entry_point_label = pair.first;
-                     found_new_entry = true;
-                     // --- BEGIN DEBUG LOG (Using Fallback Other) ---
-                     // std::cerr << "[DEBUG_HNSW]   Using fallback entry point: " << entry_point_label << std::endl;
-                     // --- END DEBUG LOG (Using Fallback Other) ---
-                     break;
-                 }
-             }
-         }
-        // --- End Re-inserting Fallback Logic ---
-
-
-         if(!found_new_entry) {
-              // --- BEGIN DEBUG LOG (No Valid Entry Found) ---
-              // std::cerr << "[DEBUG_HNSW]   Could not find any valid entry point for level " << target_level << ". Returning empty." << std::endl;
-              // --- END DEBUG LOG (No Valid Entry Found) -- -
-              return candidates; // 仍未找到则返回空 (candidates is MinHeap, use this one)
-         }
-         // Note: The 'else' block for found_new_entry logging was moved inside the fallback logic above
+    auto entry_it = hnsw_nodes_.find(entry_point_label);
+    if (entry_it == hnsw_nodes_.end() || hnsw_deleted_labels_.test(entry_point_label) || entry_it->second.max_level < target_level) {
+        // 入口点不可用：先尝试 label 0，再找任意一个在该层存在的有效节点
+        bool found_new_entry = false;
+        auto zero_it = hnsw_nodes_.find(0);
+        if (zero_it != hnsw_nodes_.end() && !hnsw_deleted_labels_.test(0) && zero_it->second.max_level >= target_level) {
+            entry_point_label = 0;
+            found_new_entry = true;
+        } else {
+            for (const auto& pair : hnsw_nodes_) {
+                if (!hnsw_deleted_labels_.test(pair.first) && pair.second.max_level >= target_level) {
+                    entry_point_label = pair.first;
+                    found_new_entry = true;
+                    break;
+                }
+            }
+        }
+        if (!found_new_entry) {
+            return final_results; // 仍未找到则返回空
+        }
     }
 
-
     // 初始化搜索
-    if (!label_to_key_.count(entry_point_label)) {
-         // Handle error or log - label MUST map to a key here
-         // std::cerr << "[DEBUG_HNSW]   Error: No key mapping for initial entry point label " << entry_point_label << "! Returning empty." << std::endl;
-         return candidates; // Return empty MinHeap
-    }
-    uint64_t entry_key = label_to_key_[entry_point_label];
-    if (!embeddings.count(entry_key)) {
-         // --- BEGIN DEBUG LOG (Entry Embedding Missing) ---
-         // std::cerr << "[DEBUG_HNSW]   Error: Embedding missing for initial entry point key " << entry_key << " (label " << entry_point_label << ")! Returning empty." << std::endl;
-         // --- END DEBUG LOG (Entry Embedding Missing) ---
-         return candidates; // Return empty MinHeap
-    }
-    float dist = calculate_distance(query_vec, embeddings[entry_key]);
-    candidates.push({dist, entry_point_label});
-    results.push({dist, entry_point_label});
-    visited.insert(entry_point_label);
-    // --- BEGIN DEBUG LOG (Initialization) ---
-    // std::cerr << "[DEBUG_HNSW]   Initialized with Entry Point: {" << dist << ", " << entry_point_label << "}" << std::endl;
-    // --- END DEBUG LOG (Initialization) ---
+    const StoredVector* entry_vec = hnsw_vector_of(entry_point_label);
+    if (entry_vec == nullptr) {
+        return final_results; // 入口点没有 key 映射或向量
+    }
+
+    // 从池中借出访问表，label 上界为 next_label_
+    VisitedListPool::Handle visited = visited_list_pool_.acquire(next_label_);
+
+    HNSWSearchScratch& scratch = hnsw_search_scratch;
+    std::vector<HNSWHeapItem>& candidates = scratch.candidates;
+    std::vector<HNSWHeapItem>& results = scratch.results;
+    std::vector<size_t>& neighbors = scratch.neighbors;
+    std::vector<std::pair<size_t, const StoredVector*>>& pending = scratch.pending;
+    const size_t prefetch = static_cast<size_t>(std::max(0, hnsw_prefetch_distance_));
+    const size_t prefetch_dims = hnsw_distance_dims(entry_vec->size());
+    candidates.clear();
+    results.clear();
+    const MinHNSWHeapComparer candidate_cmp;
+    const MaxHNSWHeapComparer result_cmp;
+
+    // 节点能否进入结果。谓词只在节点第一次被访问时判断 (访问表保证每个 label 至多一次)，
+    // 未访问到的节点不会调用谓词
+    const bool filtered = allowed != nullptr || filter != nullptr;
+    auto admits = [&](size_t label) {
+        if (allowed != nullptr) {
+            return allowed->test(label);
+        }
+        if (filter == nullptr) {
+            return true;
+        }
+        auto key_it = label_to_key_.find(label);
+        return key_it != label_to_key_.end() && (*filter)(key_it->second);
+    };
+
+    float dist = calculate_distance(query_vec, *entry_vec);
+    candidates.push_back({dist, entry_point_label});
+    if (admits(entry_point_label)) {
+        results.push_back({dist, entry_point_label});
+    }
+    visited->mark(entry_point_label);
 
     // 搜索循环
     while (!candidates.empty()) {
-        HNSWHeapItem current_candidate = candidates.top();
-        candidates.pop();
-
-        // 结果集里最远的距离
-        float furthest_result_dist = results.empty() ? std::numeric_limits<float>::max() : results.top().first;
+        std::pop_heap(candidates.begin(), candidates.end(), candidate_cmp);
+        HNSWHeapItem current_candidate = candidates.back();
+        candidates.pop_back();
 
-        // --- BEGIN DEBUG LOG (Loop Start) ---
-        // std::cerr << "[DEBUG_HNSW] Loop Iteration:" << std::endl;
-        // std::cerr << "[DEBUG_HNSW]   Candidates size: " << candidates.size() + 1 << ", Top popped: {" << current_candidate.first << ", " << current_candidate.second << "}" << std::endl;
-        // std::cerr << "[DEBUG_HNSW]   Results size: " << results.size() << ", Furthest distance in results: " << furthest_result_dist << std::endl;
-        // --- END DEBUG LOG (Loop Start) ---
+        // 结果集里最远的距离 (过滤搜索在结果集装满 ef 个之前不剪枝)
+        float furthest_result_dist = results.empty() || (filtered && results.size() < ef)
+            ? std::numeric_limits<float>::max() : results.front().first;
 
         // 优化: 如果当前候选比结果集里最远的点还远，就没必要继续探索了
         if (current_candidate.first > furthest_result_dist && (!limited_search || results.size() >= ef)) {
-             // 对于 limited_search，只要找到 ef 个就可以停止更远的探索
-             // 对于普通搜索 (efConstruction/efSearch)，也应用此优化
-             // --- BEGIN DEBUG LOG (Pruning Path) ---
-             // std::cerr << "[DEBUG_HNSW]   Pruning path: Current candidate distance (" << current_candidate.first
-             //           << ") > furthest in results (" << furthest_result_dist << ") and conditions met (limited_search=" << limited_search
-             //           << ", results.size=" << results.size() << ", ef=" << ef << "). Breaking loop." << std::endl;
-             // --- END DEBUG LOG (Pruning Path) ---
             break;
         }
 
         size_t current_label = current_candidate.second;
-        // --- BEGIN DEBUG LOG (Current Node Check) ---
-        if (!hnsw_nodes_.count(current_label)) {
-            // std::cerr << "[DEBUG_HNSW]   Error: Current node label " << current_label << " not found in hnsw_nodes_! Skipping." << std::endl;
+        auto current_it = hnsw_nodes_.find(current_label);
+        if (current_it == hnsw_nodes_.end()) {
             continue;
         }
-        // --- END DEBUG LOG (Current Node Check) ---
-        const HNSWNode& current_node = hnsw_nodes_[current_label];
-
-        // 检查当前节点是否有目标层级的连接
-        if (current_node.connections.size() > target_level) {
-             // --- BEGIN DEBUG LOG (Exploring Neighbors) ---
-            const auto& neighbors = current_node.connections[target_level];
-            // std::cerr << "[DEBUG_HNSW]   Exploring " << neighbors.size() << " neighbors of Node " << current_label << " at level " << target_level << ":" << std::endl;
-            // --- END DEBUG LOG (Exploring Neighbors) ---
-
-            // 遍历当前节点在目标层级的邻居
-            for (size_t neighbor_label : neighbors) {
-                // --- BEGIN DEBUG LOG (Neighbor ID) ---
-                // std::cerr << "[DEBUG_HNSW]     Neighbor Label: " << neighbor_label;
-                // --- END DEBUG LOG (Neighbor ID) ---
-
-                if (visited.find(neighbor_label) == visited.end()) {
-                    // --- BEGIN DEBUG LOG (Not Visited) ---
-                    // std::cerr << " (Not Visited)";
-                    // --- END DEBUG LOG (Not Visited) ---
-                    visited.insert(neighbor_label);
-                    // --- BEGIN DEBUG LOG (Marked Visited) ---
-                    // std::cerr << " -> Marked Visited. Visited size: " << visited.size() << std::endl;
-                    // --- END DEBUG LOG (Marked Visited) ---
-
-                    // 检查邻居有效性
-                    // --- BEGIN DEBUG LOG (Neighbor Validity Check) ---
-                    if (!hnsw_nodes_.count(neighbor_label)) {
-                        // std::cerr << "[DEBUG_HNSW]       Neighbor node " << neighbor_label << " not found! Skipping." << std::endl;
-                        continue;
-                    }
-                    if (hnsw_nodes_[neighbor_label].deleted) {
-                        // std::cerr << "[DEBUG_HNSW]       Neighbor node " << neighbor_label << " is marked deleted! Skipping." << std::endl;
-                         continue;
-                    }
-                     if (!label_to_key_.count(neighbor_label)) {
-                        // std::cerr << "[DEBUG_HNSW]       Error: No key mapping for neighbor label " << neighbor_label << "! Skipping." << std::endl;
-                        continue;
-                    }
-                     uint64_t neighbor_key = label_to_key_[neighbor_label];
-                     if(!embeddings.count(neighbor_key)){
-                         // std::cerr << "[DEBUG_HNSW]       Error: Embedding missing for neighbor key " << neighbor_key << " (label " << neighbor_label << ")! Skipping." << std::endl;
-                         continue;
-                     }
-                     // --- END DEBUG LOG (Neighbor Validity Check) ---
-
-                    //if (hnsw_nodes_.count(neighbor_label) && !hnsw_nodes_[neighbor_label].deleted && embeddings.count(label_to_key_[neighbor_label])) { // Original check (less verbose)
-                        float neighbor_dist = calculate_distance(query_vec, embeddings[neighbor_key]);
-                        // --- BEGIN DEBUG LOG (Calculated Distance) ---
-                        // std::cerr << "[DEBUG_HNSW]       Calculated Distance: " << neighbor_dist << std::endl;
-                        // --- END DEBUG LOG (Calculated Distance) ---
-
-                        // Re-check furthest distance in results as it might have changed
-                        float current_furthest_result_dist = results.empty() ? std::numeric_limits<float>::max() : results.top().first;
-
-                        // 如果结果集未满 ef，或者邻居比结果集中最远的点更近
-                        if (results.size() < ef || neighbor_dist < current_furthest_result_dist) {
-                            // --- BEGIN DEBUG LOG (Adding Candidate) ---
-                            // std::cerr << "[DEBUG_HNSW]       Neighbor is candidate: Adding {" << neighbor_dist << ", " << neighbor_label << "} to candidates and results." << std::endl;
-                            // --- END DEBUG LOG (Adding Candidate) ---
-                            candidates.push({neighbor_dist, neighbor_label});
-                            results.push({neighbor_dist, neighbor_label});
-                            // 如果结果集超过 ef，移除最远的点
-                            if (results.size() > ef) {
-                                // --- BEGIN DEBUG LOG (Result Set Exceeded) ---
-                                HNSWHeapItem removed_item = results.top();
-                                results.pop();
-                                // std::cerr << "[DEBUG_HNSW]       Results exceeded ef (" << ef << "). Removed furthest: {" << removed_item.first << ", " << removed_item.second << "}. New size: " << results.size() << std::endl;
-                                // --- END DEBUG LOG (Result Set Exceeded) ---
-                            }
-                             // --- BEGIN DEBUG LOG (Print Results Set) ---
-                             // std::cerr << "[DEBUG_HNSW]       Current Results (Top " << results.size() << " closest): {";
-                             // // Copy to print without modifying original
-                             // std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MaxHNSWHeapComparer> temp_q = results;
-                             // std::vector<HNSWHeapItem> temp_vec;
-                             // while(!temp_q.empty()) { temp_vec.push_back(temp_q.top()); temp_q.pop(); }
-                             // // Print sorted by distance (closer first)
-                             // std::sort(temp_vec.begin(), temp_vec.end(), [](const HNSWHeapItem& a, const HNSWHeapItem& b){ return a.first < b.first; });
-                             // for(const auto& elem : temp_vec) { std::cerr << " (" << elem.second << ", " << elem.first << ")"; }
-                             // std::cerr << " }" << std::endl;
-                             // --- END DEBUG LOG (Print Results Set) ---
+        const HNSWNode& current_node = current_it->second;
 
-                } else {
-                             // --- BEGIN DEBUG LOG (Skipping Add) ---
-                             // std::cerr << "[DEBUG_HNSW]       Neighbor not closer than furthest in full results set. Skipping add." << std::endl;
-                             // --- END DEBUG LOG (Skipping Add) ---
-                        }
-                    //} // End original validity check block
-                } else {
-                     // --- BEGIN DEBUG LOG (Visited) ---
-                    // std::cerr << " (Visited)" << std::endl;
-                     // --- END DEBUG LOG (Visited) ---
-                }
-            } // End neighbor loop
-            // --- BEGIN DEBUG LOG (Finished Neighbors) ---
-            // std::cerr << "[DEBUG_HNSW]   Finished exploring neighbors of Node " << current_label << std::endl;
-            // --- END DEBUG LOG (Finished Neighbors) ---
-        } else {
-             // --- BEGIN DEBUG LOG (No Connections at Level) ---
-             // std::cerr << "[DEBUG_HNSW]   Node " << current_label << " has no connections at level " << target_level << "." << std::endl;
-             // --- END DEBUG LOG (No Connections at Level) ---
+        // 在节点锁内拷贝目标层级的邻居
+        {
+            std::lock_guard<HNSWSpinLock> link_guard(current_node.link_lock);
+            if (current_node.connections.size() <= target_level) {
+                continue; // 当前节点在目标层级没有连接
+            }
+            const auto& level_links = current_node.connections[target_level];
+            neighbors.assign(level_links.begin(), level_links.end());
         }
-    } // End while loop
 
-    // --- BEGIN DEBUG LOG (Function End) ---
-    // std::cerr << "[DEBUG_HNSW] search_layer_internal (Level " << target_level << ") Finished. Returning MinHeap with " << results.size() << " potential candidates." << std::endl;
-    // --- END DEBUG LOG (Function End) ---
+        // 先收集未访问的有效邻居 (预取后面邻居的访问表 tag 与向量对象)，
+        // 再逐个计算距离，同时预取后面第 prefetch 个邻居的向量数据
+        pending.clear();
+        for (size_t i = 0; i < neighbors.size(); ++i) {
+            if (prefetch > 0 && i + prefetch < neighbors.size()) {
+                visited->prefetch(neighbors[i + prefetch]);
+            }
+            size_t neighbor_label = neighbors[i];
+            if (neighbor_label >= visited->capacity()) {
+                continue; // label 越界 (损坏的边)，跳过
+            }
+            if (!visited->try_visit(neighbor_label)) {
+                continue;
+            }
+
+            // 检查邻居有效性
+            if (hnsw_deleted_labels_.test(neighbor_label)) {
+                continue;
+            }
+            const StoredVector* neighbor_vec = hnsw_vector_of(neighbor_label);
+            if (neighbor_vec == nullptr) {
+                continue;
+            }
+            if (prefetch > 0) {
+                hnsw_prefetch(neighbor_vec);
+            }
+            pending.emplace_back(neighbor_label, neighbor_vec);
+        }
+        for (size_t i = 0; prefetch > 0 && i < std::min(prefetch, pending.size()); ++i) {
+            pending[i].second->prefetch(prefetch_dims);
+        }
 
-    // 将结果从 MaxHeap (results) 转为 MinHeap (final_results) 返回
-    std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer> final_results; // This is the correct return type (MinHeap)
-    while (!results.empty()) {
-        final_results.push(results.top());
-        results.pop();
+        for (size_t i = 0; i < pending.size(); ++i) {
+            if (prefetch > 0 && i + prefetch < pending.size()) {
+                pending[i + prefetch].second->prefetch(prefetch_dims);
+            }
+            size_t neighbor_label = pending[i].first;
+            float neighbor_dist = calculate_distance(query_vec, *pending[i].second);
+
+            // 如果结果集未满 ef，或者邻居比结果集中最远的点更近
+            if (results.size() < ef || neighbor_dist < results.front().first) {
+                candidates.push_back({neighbor_dist, neighbor_label});
+                std::push_heap(candidates.begin(), candidates.end(), candidate_cmp);
+                if (filtered && !admits(neighbor_label)) {
+                    continue; // 不满足过滤条件：只作为导航节点
+                }
+                results.push_back({neighbor_dist, neighbor_label});
+                std::push_heap(results.begin(), results.end(), result_cmp);
+                // 如果结果集超过 ef，移除最远的点
+                if (results.size() > ef) {
+                    std::pop_heap(results.begin(), results.end(), result_cmp);
+                    results.pop_back();
+                }
+            }
+        }
     }
-    // --- BEGIN DEBUG LOG (Final Return Size) ---
-    // std::cerr << "[DEBUG_HNSW]   Converted MaxHeap 'results' to MinHeap 'final_results'. Size: " << final_results.size() << std::endl;
-    // --- END DEBUG LOG (Final Return Size) ---
+
+    // 将结果转为 MinHeap 返回
+    final_results = std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer>(
+        candidate_cmp, std::vector<HNSWHeapItem>(results.begin(), results.end()));
     return final_results;
 }
 
+// 取 label 对应的向量 (label -> key -> embeddings)，找不到返回 nullptr。只读，可并发调用
+const StoredVector* KVStore::hnsw_vector_of(size_t label) const {
+    if (label < hnsw_label_vectors_.size() && hnsw_label_vectors_[label] != nullptr) {
+        return hnsw_label_vectors_[label]; // 连续数组，省去两次 map 查找
+    }
+    auto key_it = label_to_key_.find(label);
+    if (key_it == label_to_key_.end()) {
+        return nullptr;
+    }
+    auto emb_it = embeddings.find(key_it->second);
+    if (emb_it == embeddings.end()) {
+        return nullptr;
+    }
+    return &emb_it->second;
+}
+
+void KVStore::hnsw_update_label_vector(size_t label) {
+    const StoredVector* vec = nullptr;
+    auto key_it = label_to_key_.find(label);
+    if (key_it != label_to_key_.end()) {
+        auto emb_it = embeddings.find(key_it->second);
+        if (emb_it != embeddings.end()) {
+            vec = &emb_it->second;
+        }
+    }
+    if (label >= hnsw_label_vectors_.size()) {
+        if (vec == nullptr) {
+            return;
+        }
+        hnsw_label_vectors_.resize(std::max(label + 1, hnsw_label_vectors_.size() * 2), nullptr);
+    }
+    hnsw_label_vectors_[label] = vec;
+}
+
+void KVStore::hnsw_rebuild_label_vectors() {
+    hnsw_label_vectors_.assign(label_to_key_.empty() ? 0 : label_to_key_.rbegin()->first + 1, nullptr);
+    for (const auto& pair : label_to_key_) {
+        auto emb_it = embeddings.find(pair.second);
+        if (emb_it != embeddings.end()) {
+            hnsw_label_vectors_[pair.first] = &emb_it->second;
+        }
+    }
+}
 // search_base_layer 可以简单调用 search_layer_internal
 std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer>
 KVStore::search_base_layer(size_t entry_point_label, const std::vector<float>& query_vec, int efSearch) {
@@ -1727,14 +1989,87 @@ KVStore::search_base_layer(size_t entry_point_label, const std::vector<float>& q
 // 并且可能只需要返回有限数量（例如 1 个）最接近的邻居作为下一层的入口。
 
 // 从 MinHeap 中选出最多 M 个最近的邻居 label
+// HNSW 论文的邻居选择启发式 (Malkov & Yashunin, Algorithm 4)：候选 e 只有在到基准点的距离小于到
+// 每个已选邻居的距离时才被选中，否则它所在的方向已经有更近的邻居覆盖。已选邻居的向量各解码一次
 std::vector<size_t> KVStore::select_neighbors(
+        const std::vector<float>& base_vec,
         std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer>& candidates,
-        int M) {
-    std::vector<size_t> neighbors;
-    while (!candidates.empty() && neighbors.size() < M) {
-        neighbors.push_back(candidates.top().second);
+        int M, int level, bool extend, size_t exclude_label) {
+    std::vector<HNSWHeapItem> working; // 按距离升序
+    working.reserve(candidates.size());
+    while (!candidates.empty()) {
+        if (candidates.top().second != exclude_label) {
+            working.push_back(candidates.top());
+        }
         candidates.pop();
     }
+
+    std::vector<size_t> neighbors;
+    if (!hnsw_neighbor_heuristic_) {
+        for (size_t i = 0; i < working.size() && neighbors.size() < static_cast<size_t>(M); ++i) {
+            neighbors.push_back(working[i].second);
+        }
+        return neighbors;
+    }
+
+    if (extend) {
+        std::unordered_set<size_t> seen;
+        for (const HNSWHeapItem& item : working) {
+            seen.insert(item.second);
+        }
+        const size_t original_count = working.size();
+        std::vector<size_t> links;
+        for (size_t i = 0; i < original_count; ++i) {
+            auto node_it = hnsw_nodes_.find(working[i].second);
+            if (node_it == hnsw_nodes_.end()) {
+                continue;
+            }
+            {
+                std::lock_guard<HNSWSpinLock> link_guard(node_it->second.link_lock);
+                if (node_it->second.connections.size() <= static_cast<size_t>(level)) {
+                    continue;
+                }
+                links = node_it->second.connections[level];
+            }
+            for (size_t link : links) {
+                if (link == exclude_label || hnsw_deleted_labels_.test(link) || !seen.insert(link).second) {
+                    continue;
+                }
+                if (const StoredVector* vec = hnsw_vector_of(link)) {
+                    working.push_back({calculate_distance(base_vec, *vec), link});
+                }
+            }
+        }
+        std::sort(working.begin(), working.end());
+    }
+
+    std::vector<std::vector<float>> selected_vecs;
+    std::vector<size_t> discarded;
+    for (const HNSWHeapItem& item : working) {
+        if (neighbors.size() >= static_cast<size_t>(M)) {
+            break;
+        }
+        const StoredVector* vec = hnsw_vector_of(item.second);
+        if (vec == nullptr) {
+            continue;
+        }
+        bool diverse = true;
+        for (const std::vector<float>& selected : selected_vecs) {
+            if (calculate_distance(selected, *vec) < item.first) {
+                diverse = false;
+                break;
+            }
+        }
+        if (diverse) {
+            neighbors.push_back(item.second);
+            selected_vecs.push_back(vec->to_floats());
+        } else if (hnsw_keep_pruned_connections_) {
+            discarded.push_back(item.second);
+        }
+    }
+    for (size_t i = 0; i < discarded.size() && neighbors.size() < static_cast<size_t>(M); ++i) {
+        neighbors.push_back(discarded[i]);
+    }
     return neighbors;
 }
 
@@ -1743,321 +2078,876 @@ void KVStore::hnsw_insert(uint64_t key, const std::vector<float>& vec) {
         std::cerr << "Error: HNSW embedding dimension not set!" << std::endl;
         return; 
     }
+    size_t label = hnsw_prepare_node(key);
+    hnsw_connect_node(label, vec);
+}
 
+// 为 key 分配 (或复用) label，并为节点抽取新的随机层级、清空旧连接。
+// 只能串行调用：会修改 hnsw_nodes_ / key_to_label_ / label_to_key_ 的结构
+size_t KVStore::hnsw_prepare_node(uint64_t key) {
     size_t label;
     bool is_existing_node = key_to_label_.count(key); // 首先确定是否是已存在的节点
 
     if (is_existing_node) {
         label = key_to_label_[key];
-        // std::cerr << "[DEBUG_HNSW_INSERT] Re-inserting/Updating node for key " << key << ", existing label: " << label << std::endl;
-        
-        if (hnsw_nodes_.count(label)) {
-            HNSWNode& existing_node_to_clear = hnsw_nodes_[label];
-            // std::cerr << "[DEBUG_HNSW_INSERT]   Clearing old connections for existing label " << label 
-            //           << ". Old max_level was " << existing_node_to_clear.max_level 
-            //           << ". It had " << existing_node_to_clear.connections.size() << " connection levels." << std::endl;
-            for (auto& conn_level_list : existing_node_to_clear.connections) {
+        auto node_it = hnsw_nodes_.find(label);
+        if (node_it != hnsw_nodes_.end()) {
+            for (auto& conn_level_list : node_it->second.connections) {
                 conn_level_list.clear(); // 清空每个层级的连接列表
             }
         }
     } else {
-        label = next_label_++;
+        if (!hnsw_free_labels_.empty()) { // 优先复用整理时释放的 label
+            label = hnsw_free_labels_.back();
+            hnsw_free_labels_.pop_back();
+        } else {
+            label = next_label_++;
+        }
         key_to_label_[key] = label;
         label_to_key_[label] = key; // 确保新节点的反向映射也建立
-        // std::cerr << "[DEBUG_HNSW_INSERT] Inserting new node for key " << key << ", assigned label: " << label << std::endl;
     }
+    hnsw_update_label_vector(label);
 
     int node_level = get_random_level(); // 为节点（无论是新的还是更新的）获取新的随机层级
-    // std::cerr << "[DEBUG_HNSW_INSERT]   Node (label " << label << ") assigned new level: " << node_level << std::endl;
 
-    if (hnsw_nodes_.find(label) == hnsw_nodes_.end()) {
-         // This case should ideally only be true if is_existing_node was false.
-         // If is_existing_node was true, we expect to find the label.
-         hnsw_nodes_.emplace(label, HNSWNode(key, label, node_level)); 
-         // std::cerr << "[DEBUG_HNSW_INSERT]   Created new HNSWNode entry for label " << label << " with initial max_level " << node_level << std::endl;
+    auto node_it = hnsw_nodes_.find(label);
+    if (node_it == hnsw_nodes_.end()) {
+        node_it = hnsw_nodes_.emplace(label, HNSWNode(key, label, node_level)).first;
     }
-    
-    HNSWNode& current_node = hnsw_nodes_[label]; // 获取节点引用
 
+    HNSWNode& current_node = node_it->second;
     current_node.key = key; 
     current_node.max_level = node_level; 
-    current_node.deleted = false;      
-
+    hnsw_deleted_labels_.reset(label);
     current_node.connections.resize(node_level + 1);
-    // std::cerr << "[DEBUG_HNSW_INSERT]   Resized connections for node " << label 
-    //           << " (key " << current_node.key << ") to size " << current_node.connections.size() 
-    //           << " to accommodate new max_level " << current_node.max_level << std::endl;
-    
+    current_node.log_new = true;
+    mark_hnsw_dirty(current_node);
+    return label;
+}
 
+// 把已准备好的节点连入图中。可以由多个线程对不同 label 并发调用：
+// 邻居表的读写都在节点自旋锁内完成，只有可能成为新入口点的节点才持有全局锁直到结束
+void KVStore::hnsw_connect_node(size_t label, const std::vector<float>& vec) {
+    HNSWNode& current_node = hnsw_nodes_.find(label)->second;
+    const int node_level = current_node.max_level;
 
-    size_t current_entry_point;
+    std::unique_lock<std::mutex> global_lock(hnsw_global_mutex_);
     int current_top_level = current_max_level_;
-     // --- BEGIN DEBUG LOG (Initial State) ---
-     // std::cerr << "[DEBUG_HNSW_INSERT]   Before insert: current_max_level_ = " << current_top_level << ", entry_point_label_ = " << entry_point_label_ << std::endl;
-     // --- END DEBUG LOG (Initial State) ---
-
+    size_t current_entry_point = entry_point_label_;
 
     // 处理空图情况
-    if (current_top_level < 0) { // This means the graph was empty before this insert
+    if (current_top_level < 0) {
         entry_point_label_ = label;
-        current_max_level_ = current_node.max_level; // Use the new node's level
-        // --- FIX: Ensure label_to_key_ is updated for the first node ---
-        // This should have been handled when label was assigned if it was a new node.
-        // If it was an existing node (though unlikely for an empty graph scenario), label_to_key_ should already exist.
-        if (label_to_key_.find(label) == label_to_key_.end()) {
-             label_to_key_[label] = key; 
-             // std::cerr << "[DEBUG_HNSW_INSERT] First node (label " << label << ", key " << key << "): Set as entry point. Updated label_to_key_." << std::endl;
-        }
-        // --- END FIX ---
-        // std::cerr << "[DEBUG_HNSW_INSERT]   current_max_level_ set to " << current_max_level_ << " for first node." << std::endl;
+        current_max_level_ = node_level;
         return; // First node doesn't need connections yet
     }
+    if (node_level <= current_top_level) {
+        global_lock.unlock(); // 不会改变入口点，释放全局锁
+    }
+
+    // --- Step 1: Find Entry Points (Top -> node_level + 1) ---
+    for (int level = current_top_level; level > node_level; --level) {
+        auto nearest_pq = search_layer_internal(current_entry_point, vec, level, 1, true); // ef=1
+        if (!nearest_pq.empty()) {
+            current_entry_point = nearest_pq.top().second;
+        }
+    }
+
+    // --- Step 2: Connect (min(node_level, current_top_level) -> 0) ---
+    for (int level = std::min(node_level, current_top_level); level >= 0; --level) {
+        auto candidates_pq = search_layer_internal(current_entry_point, vec, level, HNSW_efConstruction, false);
+        std::optional<size_t> nearest; // 下一层从本层最近的点出发
+        if (!candidates_pq.empty()) {
+            nearest = candidates_pq.top().second;
+        }
 
+        // select_neighbors 会清空传入的 candidates_pq
+        std::vector<size_t> neighbors =
+            select_neighbors(vec, candidates_pq, HNSW_M, level, hnsw_extend_candidates_, label);
+
+        std::vector<size_t> linked; // 剪枝后实际保留的边，只为这些邻居加反向边
+        {
+            // 并行构建时，从上层找到本节点的其它线程可能已经把反向边加进了这一层，保留它们
+            std::lock_guard<HNSWSpinLock> link_guard(current_node.link_lock);
+            std::vector<size_t>& links = current_node.connections[level];
+            for (size_t existing : links) {
+                if (std::find(neighbors.begin(), neighbors.end(), existing) == neighbors.end()) {
+                    neighbors.push_back(existing);
+                }
+            }
+            links = neighbors;
+            prune_connections(label, level, HNSW_M_max);
+            linked = links;
+        }
 
-    current_entry_point = entry_point_label_;
+        for (size_t neighbor_label : linked) {
+            auto neighbor_it = hnsw_nodes_.find(neighbor_label);
+            if (neighbor_it == hnsw_nodes_.end() || hnsw_deleted_labels_.test(neighbor_label)) {
+                continue;
+            }
+            HNSWNode& neighbor_node = neighbor_it->second;
+            std::lock_guard<HNSWSpinLock> link_guard(neighbor_node.link_lock);
+            if (neighbor_node.connections.size() <= level) {
+                neighbor_node.connections.resize(level + 1);
+            }
+            auto& neighbor_links = neighbor_node.connections[level];
+            if (std::find(neighbor_links.begin(), neighbor_links.end(), label) == neighbor_links.end()) {
+                neighbor_links.push_back(label);
+                prune_connections(neighbor_label, level, HNSW_M_max);
+                mark_hnsw_dirty(neighbor_node);
+            }
+        }
+        if (nearest) {
+            current_entry_point = *nearest;
+        }
+    } 
 
+    // 更新全局最高层级和入口点 (此时仍持有全局锁)
+    if (node_level > current_top_level) {
+        current_max_level_ = node_level;
+        entry_point_label_ = label;
+    }
+}
 
-    // --- Step 1: Find Entry Points (Top -> current_node.max_level + 1) ---
-    std::vector<size_t> entry_points_for_search; 
-    if (current_top_level >= 0) { 
-        entry_points_for_search.resize(current_top_level + 1);
+// 并行批量构建：先串行为所有 key 分配 label 与层级，再由 hnsw_build_threads_ 个线程并发连边。
+// 调用方需保证 items 中的向量指针在构建期间有效，且构建期间没有其它读写 KVStore 的操作
+void KVStore::hnsw_build_parallel(const std::vector<std::pair<uint64_t, const StoredVector*>>& items) {
+    if (items.empty()) {
+        return;
+    }
+    if (embedding_dimension_ == 0) {
+        std::cerr << "Error: HNSW embedding dimension not set!" << std::endl;
+        return;
     }
-    
-    // std::cerr << "[DEBUG_HNSW_INSERT]   Step 1: Finding entry points from level " << current_top_level << " down to " << current_node.max_level + 1 << std::endl;
-    for (int level = current_top_level; level > current_node.max_level; --level) { // Iterate down to one level ABOVE current_node.max_level
-        if (level < 0) break; // Safety break
 
-        auto nearest_pq = search_layer_internal(current_entry_point, vec, level, 1, true); // ef=1
-        if (!nearest_pq.empty()) {
-            current_entry_point = nearest_pq.top().second;
+    // 同一批中重复的 key 只保留最后一次出现
+    std::map<uint64_t, const StoredVector*> latest;
+    for (const auto& item : items) {
+        latest[item.first] = item.second;
+    }
+    std::vector<std::pair<size_t, const StoredVector*>> pending;
+    pending.reserve(latest.size());
+    for (const auto& item : items) {
+        auto it = latest.find(item.first);
+        if (it == latest.end() || it->second != item.second) {
+            continue;
         }
-        // Store the entry point for this level if it's valid for the entry_points_for_search vector
-        if (level < entry_points_for_search.size()) {
-             entry_points_for_search[level] = current_entry_point; 
+        pending.emplace_back(hnsw_prepare_node(item.first), item.second);
+        latest.erase(it);
+    }
+
+    size_t num_threads = hnsw_build_threads_;
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min(num_threads, pending.size());
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    if (num_threads <= 1) {
+        for (const auto& item : pending) {
+            hnsw_connect_node(item.first, item.second->to_floats());
         }
+    } else {
+        std::atomic<size_t> next_item(0);
+        {
+            ThreadPool pool(num_threads);
+            for (size_t t = 0; t < num_threads; ++t) {
+                pool.enqueue([this, &pending, &next_item]() {
+                    for (size_t i = next_item++; i < pending.size(); i = next_item++) {
+                        hnsw_connect_node(pending[i].first, pending[i].second->to_floats());
+                    }
+                });
+            }
+        } // ThreadPool 析构时等待所有任务完成
     }
-     // std::cerr << "[DEBUG_HNSW_INSERT]   Finished Step 1. Entry for levels <= " << current_node.max_level << " search will be: " << current_entry_point << std::endl;
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::cout << "[INFO] HNSW build linked " << pending.size() << " nodes with " << num_threads << " thread(s) in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << " ms."
+              << std::endl;
+}
 
+void KVStore::set_hnsw_build_threads(size_t num_threads) {
+    hnsw_build_threads_ = num_threads;
+}
 
-    // --- Step 2: Connect (min(current_node.max_level, current_top_level) -> 0) ---
-    // std::cerr << "[DEBUG_HNSW_INSERT]   Step 2: Connecting node " << label << " (key " << current_node.key <<") from level " 
-    //           << std::min(current_node.max_level, current_top_level) << " down to 0" << std::endl;
-    for (int level = std::min(current_node.max_level, current_top_level); level >= 0; --level) {
-        size_t search_entry_for_this_level = current_entry_point; 
-        // If we stored specific entry points for levels during descent, and this 'level' is one of them, use it.
-        // This current_entry_point has been updated by the loop above to be the entry for current_node.max_level (or just below).
-        // So, for all levels <= current_node.max_level that we are connecting, this current_entry_point is a good start.
+// 整理已删除节点 D：对每个邻居表里含有 D 的存活节点 X，用 X 其余的邻居加上 D 在同层的邻居作为候选，
+// 按 select_neighbors 重新选出至多 M_max 个邻居；之后把 D 从图和映射中移除，label 放入空闲列表。
+// 邻居表的修复由多个线程并行完成 (每个线程只写自己负责的节点)。调用期间不能有其它读写操作
+size_t KVStore::consolidate_hnsw_deletions() {
+    size_t removed = finish_hnsw_consolidation();
+    if (hnsw_deleted_labels_.empty()) {
+        return removed;
+    }
+    hnsw_consolidate_start_ = std::chrono::high_resolution_clock::now();
+    const LabelBitmap dead = hnsw_deleted_labels_;
+    hnsw_consolidate_repaired_ = hnsw_repair_links(dead);
+    return removed + hnsw_remove_nodes(dead);
+}
 
-        auto candidates_pq = search_layer_internal(search_entry_for_this_level, vec, level, HNSW_efConstruction, false);
-        
-        // *** 新增日志 (修正前) ***
-        // std::cout << "[DEBUG_HNSW_INSERT_CONNECT] Key " << key << ", Label " << label << ", Level " << level 
-        //           << ": search_layer_internal returned " << candidates_pq.size() << " candidates (before select_neighbors)." << std::endl;
-        
-        // 创建一个临时副本用于打印/检查，但不用于修改原始candidates_pq给select_neighbors
-        // std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer> candidates_pq_for_logging = candidates_pq;
-        /*
-        std::cout << "[DEBUG_HNSW_INSERT_CONNECT] Key " << key << ", Label " << label << ", Level " << level 
-                  << ": search_layer_internal returned " << candidates_pq_for_logging.size() << " candidates." << std::endl;
-        */
-
-        // select_neighbors 会修改传入的 candidates_pq
-        std::vector<size_t> neighbors = select_neighbors(candidates_pq, HNSW_M); 
-        
-        /*
-        std::cout << "[DEBUG_HNSW_INSERT_CONNECT] Key " << key << ", Label " << label << ", Level " << level
-                  << ": selected " << neighbors.size() << " neighbors (HNSW_M=" << HNSW_M 
-                  << "). candidates_pq now has " << candidates_pq.size() << " elements remaining." << std::endl;
-        */
-
-        // current_node.connections should have been resized already to current_node.max_level + 1
-        if (level < current_node.connections.size()) { // Check bounds before assignment
-            current_node.connections[level] = neighbors; 
-        } else {
-            // This should not happen if resize was correct. Log error if it does.
-            // std::cerr << "[ERROR_HNSW_INSERT]   Connection level " << level << " out of bounds for node " << label 
-            //           << " (connections size: " << current_node.connections.size() << ", max_level: " << current_node.max_level << ")" << std::endl;
-            // To be safe, resize again, though this indicates a logic flaw earlier
-            // current_node.connections.resize(level + 1); 
-            // current_node.connections[level] = neighbors;
-            continue; // Skip this level if something is wrong with connection sizing
+// del 只在墓碑位图里置位、给节点标脏，不改动图的结构和映射，因此可以与修复邻居表并发；
+// 修复只读 dead 快照，之后新增的墓碑留给下一次整理
+void KVStore::start_hnsw_consolidation() {
+    if (hnsw_consolidate_thread_.joinable() || hnsw_deleted_labels_.empty()) {
+        return;
+    }
+    hnsw_consolidate_start_ = std::chrono::high_resolution_clock::now();
+    hnsw_consolidating_labels_ = hnsw_deleted_labels_;
+    hnsw_consolidate_thread_ = std::thread([this]() {
+        hnsw_consolidate_repaired_ = hnsw_repair_links(hnsw_consolidating_labels_);
+    });
+}
+
+size_t KVStore::finish_hnsw_consolidation() {
+    if (!hnsw_consolidate_thread_.joinable()) {
+        return 0;
+    }
+    hnsw_consolidate_thread_.join();
+    size_t removed = hnsw_remove_nodes(hnsw_consolidating_labels_);
+    hnsw_consolidating_labels_.clear();
+    return removed;
+}
+
+size_t KVStore::hnsw_repair_links(const LabelBitmap& dead_labels) {
+    std::vector<HNSWNode*> live_nodes;
+    live_nodes.reserve(hnsw_nodes_.size());
+    for (auto& pair : hnsw_nodes_) {
+        if (!dead_labels.test(pair.first)) {
+            live_nodes.push_back(&pair.second);
+        }
+    }
+    auto dead = [&dead_labels](size_t label) { return dead_labels.test(label); };
+
+    std::atomic<size_t> repaired_lists(0);
+    auto repair_range = [&](size_t begin, size_t end) {
+        std::vector<size_t> candidates;
+        for (size_t i = begin; i < end; ++i) {
+            HNSWNode& node = *live_nodes[i];
+            const StoredVector* node_stored = hnsw_vector_of(node.label);
+            const std::vector<float> node_vec = node_stored ? node_stored->to_floats() : std::vector<float>();
+            for (size_t level = 0; level < node.connections.size(); ++level) {
+                std::vector<size_t>& links = node.connections[level];
+                if (std::none_of(links.begin(), links.end(), dead)) {
+                    continue;
+                }
+                candidates.clear();
+                for (size_t link : links) {
+                    if (!dead(link)) {
+                        candidates.push_back(link);
+                        continue;
+                    }
+                    auto dead_it = hnsw_nodes_.find(link);
+                    if (dead_it != hnsw_nodes_.end() && level < dead_it->second.connections.size()) {
+                        for (size_t via : dead_it->second.connections[level]) {
+                            if (via != node.label && !dead(via)) {
+                                candidates.push_back(via);
+                            }
+                        }
+                    }
+                }
+                std::sort(candidates.begin(), candidates.end());
+                candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+                std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer> candidate_pq;
+                for (size_t candidate : candidates) {
+                    auto candidate_it = hnsw_nodes_.find(candidate);
+                    const StoredVector* candidate_vec = hnsw_vector_of(candidate);
+                    if (candidate_it == hnsw_nodes_.end() || !node_stored || !candidate_vec) {
+                        continue;
+                    }
+                    candidate_pq.push({calculate_distance(node_vec, *candidate_vec), candidate});
+                }
+                std::vector<size_t> repaired = select_neighbors(node_vec, candidate_pq, HNSW_M_max, static_cast<int>(level));
+                std::lock_guard<HNSWSpinLock> link_guard(node.link_lock);
+                links.swap(repaired);
+                mark_hnsw_dirty(node);
+                repaired_lists++;
+            }
         }
-        
-        for (size_t neighbor_label : neighbors) {
-            if (neighbor_label == label) {
-                 continue; 
+    };
+
+    size_t num_threads = hnsw_build_threads_;
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min<size_t>(num_threads, std::max<size_t>(1, live_nodes.size() / 1024));
+    if (num_threads <= 1) {
+        repair_range(0, live_nodes.size());
+    } else {
+        size_t chunk = (live_nodes.size() + num_threads - 1) / num_threads;
+        ThreadPool pool(num_threads);
+        for (size_t begin = 0; begin < live_nodes.size(); begin += chunk) {
+            size_t end = std::min(begin + chunk, live_nodes.size());
+            pool.enqueue([&repair_range, begin, end]() { repair_range(begin, end); });
+        }
+    } // ThreadPool 析构时等待所有任务完成
+    return repaired_lists.load();
+}
+
+size_t KVStore::hnsw_remove_nodes(const LabelBitmap& dead) {
+    std::vector<size_t> dead_labels = dead.to_list<size_t>();
+    if (dead_labels.empty()) {
+        return 0;
+    }
+    // 移除已删除节点并释放 label
+    for (size_t label : dead_labels) {
+        hnsw_deleted_labels_.reset(label);
+        auto node_it = hnsw_nodes_.find(label);
+        if (node_it == hnsw_nodes_.end()) {
+            continue;
+        }
+        mark_hnsw_dirty(node_it->second); // 写增量日志时节点已不存在，记为 DELETE
+        auto key_it = key_to_label_.find(node_it->second.key);
+        if (key_it != key_to_label_.end() && key_it->second == label) {
+            key_to_label_.erase(key_it);
+        }
+        label_to_key_.erase(label);
+        hnsw_update_label_vector(label);
+        hnsw_nodes_.erase(node_it);
+        hnsw_free_labels_.push_back(label);
+    }
+
+    // 入口点被删除时，改用层级最高的存活节点
+    if (hnsw_nodes_.empty()) {
+        entry_point_label_ = 0;
+        current_max_level_ = -1;
+    } else if (hnsw_nodes_.find(entry_point_label_) == hnsw_nodes_.end()) {
+        auto best = hnsw_nodes_.begin();
+        for (auto it = hnsw_nodes_.begin(); it != hnsw_nodes_.end(); ++it) {
+            if (it->second.max_level > best->second.max_level) {
+                best = it;
             }
+        }
+        entry_point_label_ = best->first;
+        current_max_level_ = best->second.max_level;
+    }
 
-            if (hnsw_nodes_.count(neighbor_label) && !hnsw_nodes_[neighbor_label].deleted) {
-                HNSWNode& neighbor_node = hnsw_nodes_[neighbor_label];
-                 if (neighbor_node.connections.size() <= level) {
-                     neighbor_node.connections.resize(level + 1);
-                 }
-                 bool already_connected = false;
-                 if (level < neighbor_node.connections.size()) { // Check bounds again
-                     for(size_t conn : neighbor_node.connections[level]){
-                         if(conn == label) {
-                             already_connected = true;
-                             break;
-                         }
-                     }
-                 }
-                 if(!already_connected){
-                      if (level < neighbor_node.connections.size()) { // Ensure bounds before push_back
-                         neighbor_node.connections[level].push_back(label);
-                         prune_connections(neighbor_label, level, HNSW_M_max);
-                      }
-                 }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::cout << "[INFO] Consolidated " << dead_labels.size() << " deleted HNSW nodes, repaired " << hnsw_consolidate_repaired_
+              << " neighbor lists in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - hnsw_consolidate_start_).count()
+              << " ms." << std::endl;
+    return dead_labels.size();
+}
+
+size_t KVStore::reorder_hnsw_graph() {
+    finish_hnsw_consolidation();
+    if (hnsw_nodes_.empty()) {
+        return 0;
+    }
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    // 1. 从入口点出发在第 0 层做 BFS (邻居表按距离由近到远排列)，不连通的部分按旧 label 顺序另起 BFS
+    std::vector<size_t> order; // 新 label -> 旧 label
+    order.reserve(hnsw_nodes_.size());
+    const size_t unassigned = std::numeric_limits<size_t>::max();
+    std::vector<size_t> new_label_of(hnsw_nodes_.rbegin()->first + 1, unassigned); // 旧 label -> 新 label
+    auto assign = [&](size_t old_label) {
+        if (old_label >= new_label_of.size() || new_label_of[old_label] != unassigned ||
+            hnsw_nodes_.find(old_label) == hnsw_nodes_.end()) {
+            return;
+        }
+        new_label_of[old_label] = order.size();
+        order.push_back(old_label);
+    };
+    auto bfs_from = [&](size_t root) {
+        assign(root);
+        for (size_t head = order.size() - 1; head < order.size(); ++head) {
+            const HNSWNode& node = hnsw_nodes_.find(order[head])->second;
+            if (node.connections.empty()) {
+                continue;
+            }
+            for (size_t neighbor : node.connections[0]) {
+                assign(neighbor);
             }
         }
-        prune_connections(label, level, HNSW_M); 
+    };
+    if (hnsw_nodes_.count(entry_point_label_)) {
+        bfs_from(entry_point_label_);
+    }
+    for (const auto& pair : hnsw_nodes_) {
+        if (new_label_of[pair.first] == unassigned) {
+            bfs_from(pair.first);
+        }
+    }
 
-        if (!candidates_pq.empty()) { 
-            current_entry_point = candidates_pq.top().second;
+    // 2. 按新顺序重建节点表：map 节点与邻居表依次分配，指向不存在节点的边直接丢弃
+    std::map<size_t, HNSWNode> reordered;
+    LabelBitmap deleted;
+    for (size_t label = 0; label < order.size(); ++label) {
+        const HNSWNode& old_node = hnsw_nodes_.find(order[label])->second;
+        HNSWNode node(old_node.key, label, old_node.max_level);
+        for (size_t level = 0; level < old_node.connections.size() && level < node.connections.size(); ++level) {
+            node.connections[level].reserve(old_node.connections[level].size());
+            for (size_t neighbor : old_node.connections[level]) {
+                if (neighbor < new_label_of.size() && new_label_of[neighbor] != unassigned) {
+                    node.connections[level].push_back(new_label_of[neighbor]);
+                }
+            }
         }
-    } 
+        if (hnsw_deleted_labels_.test(order[label])) {
+            deleted.set(label);
+        }
+        reordered.emplace_hint(reordered.end(), label, std::move(node));
+    }
+    entry_point_label_ = entry_point_label_ < new_label_of.size() && new_label_of[entry_point_label_] != unassigned
+                             ? new_label_of[entry_point_label_] : 0;
+    hnsw_nodes_.swap(reordered);
+    reordered.clear();
+    hnsw_deleted_labels_ = std::move(deleted);
+    hnsw_free_labels_.clear();
+    next_label_ = order.size();
 
+    key_to_label_.clear();
+    label_to_key_.clear();
+    for (const auto& pair : hnsw_nodes_) {
+        key_to_label_[pair.second.key] = pair.first;
+        label_to_key_.emplace_hint(label_to_key_.end(), pair.first, pair.second.key);
+    }
 
-    // 更新全局最高层级和入口点
-    if (current_node.max_level > current_max_level_) {
-        current_max_level_ = current_node.max_level;
-        entry_point_label_ = label;
-        // std::cerr << "[DEBUG_HNSW_INSERT]   Updated global current_max_level_ to " << current_max_level_ 
-        //           << " and entry_point_label_ to " << entry_point_label_ << std::endl;
+    // 3. 向量按新 label 顺序重新分配：先全部复制 (依次分配的缓冲区在堆上基本连续)，再移动回 embeddings
+    //    (StoredVector 对象本身在 map 节点里，地址不变；期间向量内存临时翻倍)
+    std::vector<std::pair<StoredVector*, StoredVector>> relocated;
+    relocated.reserve(order.size());
+    for (const auto& pair : label_to_key_) {
+        auto emb_it = embeddings.find(pair.second);
+        if (emb_it != embeddings.end()) {
+            relocated.emplace_back(&emb_it->second, emb_it->second);
+        }
+    }
+    for (auto& item : relocated) {
+        *item.first = std::move(item.second);
+    }
+    relocated.clear();
+    hnsw_rebuild_label_vectors();
+
+    // 4. label 全部改变：旧的检查点与增量日志不能再追加，下次保存写出完整索引
+    clear_hnsw_dirty();
+    hnsw_checkpoint_id_ = 0;
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::cout << "[INFO] Reordered " << order.size() << " HNSW nodes by level-0 BFS in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << " ms." << std::endl;
+    return order.size();
+}
+
+void KVStore::finalize_loaded_hnsw_graph() {
+    size_t dropped_links = 0;
+    for (auto& pair : hnsw_nodes_) {
+        for (auto& links : pair.second.connections) {
+            size_t before = links.size();
+            links.erase(std::remove_if(links.begin(), links.end(),
+                                       [this](size_t link) { return hnsw_nodes_.find(link) == hnsw_nodes_.end(); }),
+                        links.end());
+            dropped_links += before - links.size();
+        }
+    }
+    hnsw_free_labels_.clear();
+    for (size_t label = next_label_; label-- > 0;) {
+        if (hnsw_nodes_.find(label) == hnsw_nodes_.end()) {
+            hnsw_free_labels_.push_back(label);
+            hnsw_deleted_labels_.reset(label);
+        }
+    }
+    if (dropped_links > 0 || !hnsw_free_labels_.empty()) {
+        std::cout << "[INFO] Dropped " << dropped_links << " HNSW links to removed nodes; " << hnsw_free_labels_.size()
+                  << " labels available for reuse." << std::endl;
+    }
+}
+
+// 校验 HNSWOptions：不合法的值回退到默认值并打印警告
+void KVStore::apply_hnsw_options(const HNSWOptions& options) {
+    const HNSWOptions defaults;
+    HNSW_M = options.M;
+    if (HNSW_M < 2) {
+        std::cerr << "[WARN] Invalid HNSW M=" << options.M << ", using " << defaults.M << std::endl;
+        HNSW_M = defaults.M;
+    }
+    HNSW_M_max = options.M_max;
+    if (HNSW_M_max < HNSW_M) {
+        std::cerr << "[WARN] HNSW M_max=" << options.M_max << " is smaller than M=" << HNSW_M
+                  << ", using M_max=" << 2 * HNSW_M << std::endl;
+        HNSW_M_max = 2 * HNSW_M;
+    }
+    HNSW_efConstruction = options.ef_construction;
+    if (HNSW_efConstruction < HNSW_M) {
+        std::cerr << "[WARN] HNSW ef_construction=" << options.ef_construction << " is smaller than M=" << HNSW_M
+                  << ", using ef_construction=" << HNSW_M << std::endl;
+        HNSW_efConstruction = HNSW_M;
+    }
+    HNSW_efSearch = std::max(0, options.ef_search);
+    HNSW_m_L = 1.0 / std::log(static_cast<double>(HNSW_M));
+    hnsw_build_threads_ = options.build_threads;
+    hnsw_search_threads_ = options.search_threads;
+    hnsw_index_vectors_ = options.index_vectors;
+    hnsw_delta_checkpoint_ratio_ = options.delta_checkpoint_ratio > 0 ? options.delta_checkpoint_ratio : defaults.delta_checkpoint_ratio;
+    hnsw_consolidate_ratio_ = std::max(0.0, options.consolidate_ratio);
+    hnsw_filter_brute_force_ratio_ = std::max(0.0, options.filter_brute_force_ratio);
+    vector_index_type_ = options.index_type;
+    ivf_nlist_ = options.ivf_nlist;
+    ivf_nprobe_ = std::max<size_t>(1, options.ivf_nprobe);
+    ivf_train_size_ = std::max<size_t>(2, options.ivf_train_size);
+    embedding_cache_.set_capacity(options.embedding_cache_entries);
+    async_embedding_ = options.async_embedding;
+    embedding_batch_size_ = std::max<size_t>(1, options.embedding_batch_size);
+    embedding_batch_delay_ms_ = std::max(0, options.embedding_batch_delay_ms);
+    embedding_contexts_ = std::max<size_t>(1, options.embedding_contexts);
+    embedding_threads_ = std::max(0, options.embedding_threads);
+    vector_precision_ = options.vector_precision;
+    hnsw_prefix_dim_ = options.search_prefix_dim;
+    hnsw_neighbor_heuristic_ = options.neighbor_heuristic;
+    hnsw_extend_candidates_ = options.extend_candidates;
+    hnsw_keep_pruned_connections_ = options.keep_pruned_connections;
+    hnsw_prefetch_distance_ = std::max(0, options.prefetch_distance);
+    hnsw_reorder_on_save_ = options.reorder_on_save;
+    distance_metric_ = options.metric;
+    if (vector_index_type_ == VectorIndexType::IVF && distance_metric_ != DistanceMetric::Cosine) {
+        // 倒排表保存归一化后的向量，只能按余弦打分
+        std::cerr << "[WARN] IVF engine only supports the cosine metric, ignoring metric="
+                  << distance_metric_name(distance_metric_) << std::endl;
+        distance_metric_ = DistanceMetric::Cosine;
+    }
+    refresh_distance_kernel();
+}
+
+void KVStore::mark_hnsw_dirty(HNSWNode& node) {
+    if (node.log_dirty) {
+        return;
+    }
+    node.log_dirty = true;
+    std::lock_guard<std::mutex> lock(hnsw_dirty_mutex_);
+    hnsw_dirty_labels_.push_back(node.label);
+}
+
+// 只在删除位图中置位，节点与边暂时留在图中 (搜索与建图时跳过)，由 consolidate_hnsw_deletions 真正移除
+bool KVStore::tombstone_hnsw_node(size_t label) {
+    auto node_it = hnsw_nodes_.find(label);
+    if (node_it == hnsw_nodes_.end() || !hnsw_deleted_labels_.set(label)) {
+        return false;
+    }
+    std::lock_guard<HNSWSpinLock> link_guard(node_it->second.link_lock); // 后台整理可能同时给该节点标脏
+    mark_hnsw_dirty(node_it->second);
+    return true;
+}
+
+// 完整保存或加载之后，内存中的图与磁盘一致，清空所有待写入的增量
+void KVStore::clear_hnsw_dirty() {
+    for (auto& pair : hnsw_nodes_) {
+        pair.second.log_dirty = false;
+        pair.second.log_new = false;
     }
+    std::lock_guard<std::mutex> lock(hnsw_dirty_mutex_);
+    hnsw_dirty_labels_.clear();
 }
 
-// 辅助函数：对指定节点的指定层级进行连接剪枝，保留最多 max_conn 个最近的连接
+// 辅助函数：对指定节点的指定层级进行连接剪枝，按 select_neighbors 保留最多 max_conn 个连接
+// 调用方需持有该节点的 link_lock (因此不扩展候选)
 void KVStore::prune_connections(size_t node_label, int level, int max_conn) {
-    if (!hnsw_nodes_.count(node_label)) return;
-    HNSWNode& node = hnsw_nodes_[node_label];
+    auto node_it = hnsw_nodes_.find(node_label);
+    if (node_it == hnsw_nodes_.end()) return;
+    HNSWNode& node = node_it->second;
 
     if (node.connections.size() <= level || node.connections[level].size() <= max_conn) {
         return; // 层级无效或连接数未超限
     }
 
     // 计算当前节点到所有邻居的距离
+    const StoredVector* node_stored = hnsw_vector_of(node_label); // 获取当前节点向量
+    if (node_stored == nullptr) return;
+    const std::vector<float> node_vec = node_stored->to_floats();
     std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer> connections_pq;
-    const std::vector<float>& node_vec = embeddings[label_to_key_[node_label]]; // 获取当前节点向量
 
     for (size_t neighbor_label : node.connections[level]) {
-        if (hnsw_nodes_.count(neighbor_label) && !hnsw_nodes_[neighbor_label].deleted && embeddings.count(label_to_key_[neighbor_label])) {
-            float dist = calculate_distance(node_vec, embeddings[label_to_key_[neighbor_label]]);
-            connections_pq.push({dist, neighbor_label});
+        if (hnsw_deleted_labels_.test(neighbor_label)) {
+            continue;
+        }
+        const StoredVector* neighbor_vec = hnsw_vector_of(neighbor_label);
+        if (neighbor_vec != nullptr) {
+            connections_pq.push({calculate_distance(node_vec, *neighbor_vec), neighbor_label});
         }
     }
 
-    // 保留 max_conn 个最近的
-    std::vector<size_t> kept_connections;
-    while (connections_pq.size() > max_conn) {
-        connections_pq.pop(); // 丢弃距离最远的
-    }
-    while (!connections_pq.empty()) {
-        kept_connections.push_back(connections_pq.top().second);
-        connections_pq.pop();
-    }
-    node.connections[level] = kept_connections;
+    node.connections[level] = select_neighbors(node_vec, connections_pq, max_conn, level);
 }
 
 // --- ADDED: Baseline search_knn implementation (vector version) ---
+// 精确 kNN (召回率基准，也是 HNSW 结果不足时的后备)：把 embeddings 中的向量指针摊平后分段，
+// 由 scan_pool_ 的线程各自用 distance_metric_ 的内核扫描并维护大小为 m 的有界堆，最后合并。
+// memtable 中已删除的 key 事先排除；SSTable 中的删除由最后的 get 发现，不足 k 个时加大 m 重新扫描
 std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn(const std::vector<float>& query_vec, int k) {
     if (query_vec.empty()) {
          std::cerr << "[ERROR] Baseline search_knn received empty query vector." << std::endl;
         return {};
     }
+    if (k <= 0) {
+        return {};
+    }
 
-    std::vector<std::pair<uint64_t, float>> similarities; // pair: {key, similarity}
-    std::set<uint64_t> processed_keys; // Track keys processed to avoid duplicates from different levels/memtable
+    std::vector<uint64_t> memtable_deleted;
+    for (slnode *cur = s->getFirst(); cur && cur->type != TAIL; cur = cur->nxt[0]) {
+        if (cur->val == DEL) {
+            memtable_deleted.push_back(cur->key); // 跳表按 key 有序
+        }
+    }
+    const size_t dim = query_vec.size();
+    std::vector<std::pair<uint64_t, const StoredVector*>> items;
+    items.reserve(embeddings.size());
+    for (const auto& pair : embeddings) {
+        if (pair.second.size() == dim &&
+            !std::binary_search(memtable_deleted.begin(), memtable_deleted.end(), pair.first)) {
+            items.emplace_back(pair.first, &pair.second);
+        }
+    }
+    if (items.empty()) {
+        return {};
+    }
 
-    // 1. Scan Memtable (Skiplist 's')
-    slnode *cur = s->getFirst();
-    while (cur && cur->type != TAIL) {
-        uint64_t cur_key = cur->key;
-        std::string cur_val = cur->val;
+    // 与 HNSW 相同的度量，但始终使用完整维度
+    const DistanceKernel kernel = distance_kernel_ != nullptr && distance_kernel_dims_ == dim
+                                      ? distance_kernel_
+                                      : select_distance_kernel(distance_metric_, vector_precision_, dim);
+    using ScoredKey = std::pair<float, uint64_t>; // {distance, key}
+    // 距离小的在前，相同时 key 小的在前
+    auto better = [](const ScoredKey& a, const ScoredKey& b) {
+        return a.first < b.first || (a.first == b.first && a.second < b.second);
+    };
 
-        if (cur_val != DEL) { // Only consider non-deleted entries
-            if (embeddings.count(cur_key)) { // Check if embedding exists (should from put)
-                float sim = cosine_similarity(query_vec, embeddings[cur_key]);
-                similarities.push_back({cur_key, sim});
-            } else {
-                // This indicates an issue: embedding wasn't stored during put
-                 std::cerr << "[WARN] Baseline search_knn: Embedding not found for key " << cur_key << " in memtable." << std::endl;
+    size_t pool_threads = hnsw_search_threads_;
+    if (pool_threads == 0) {
+        pool_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t num_threads = std::min<size_t>(pool_threads, std::max<size_t>(1, items.size() / 4096)); // 每段至少 4096 个向量
+    if (num_threads > 1) {
+        std::call_once(scan_pool_once_, [this, pool_threads]() {
+            scan_pool_ = std::make_unique<ThreadPool>(pool_threads);
+        });
+    }
+
+    std::vector<std::pair<uint64_t, std::string>> results;
+    for (size_t m = std::min<size_t>(2 * static_cast<size_t>(k), items.size());; m = std::min(2 * m, items.size())) {
+        // 每段维护前 m 个：堆顶是其中最差的一个
+        std::vector<std::vector<ScoredKey>> heaps(num_threads);
+        auto scan_range = [&](size_t part, size_t begin, size_t end) {
+            std::vector<ScoredKey>& heap = heaps[part];
+            heap.reserve(m + 1);
+            for (size_t i = begin; i < end; ++i) {
+                const StoredVector& vec = *items[i].second;
+                float dist = vec.precision() == vector_precision_
+                                 ? kernel(query_vec.data(), vec.raw(), dim)
+                                 : select_distance_kernel(distance_metric_, vec.precision(), dim)(query_vec.data(), vec.raw(), dim);
+                if (!std::isfinite(dist)) {
+                    continue; // 删除标记向量 (全为 float max)
+                }
+                ScoredKey scored{dist, items[i].first};
+                if (heap.size() < m) {
+                    heap.push_back(scored);
+                    std::push_heap(heap.begin(), heap.end(), better);
+                } else if (better(scored, heap.front())) {
+                    std::pop_heap(heap.begin(), heap.end(), better);
+                    heap.back() = scored;
+                    std::push_heap(heap.begin(), heap.end(), better);
+                }
             }
+        };
+        if (num_threads <= 1) {
+            scan_range(0, 0, items.size());
+        } else {
+            size_t chunk = (items.size() + num_threads - 1) / num_threads;
+            std::latch finished(static_cast<std::ptrdiff_t>(num_threads));
+            for (size_t t = 0; t < num_threads; ++t) {
+                size_t begin = std::min(t * chunk, items.size());
+                size_t end = std::min(begin + chunk, items.size());
+                scan_pool_->enqueue([&scan_range, &finished, t, begin, end]() {
+                    scan_range(t, begin, end);
+                    finished.count_down();
+                });
+            }
+            finished.wait();
         }
-        processed_keys.insert(cur_key); // Mark key as seen (latest version is in memtable)
-        cur = cur->nxt[0];
-    }
 
-    // 2. Scan SSTables (Level by Level)
-    for (int level = 0; level <= totalLevel; ++level) {
-        for (const auto& sst_head : sstableIndex[level]) {
-            // Iterate through all keys in this SSTable's index
-            // Note: This might be inefficient if SSTables are large. Phase 2 code was complex here.
-            // A simpler (but potentially slower for large SSTables) approach: Iterate keys via head.
-            for(uint64_t idx = 0; idx < sst_head.getCnt(); ++idx) {
-                uint64_t cur_key = sst_head.getKey(idx);
-
-                // Skip if key was already processed (found newer version in memtable or upper level)
-                if (processed_keys.count(cur_key)) {
-                    continue;
+        std::vector<ScoredKey> merged;
+        for (const auto& heap : heaps) {
+            merged.insert(merged.end(), heap.begin(), heap.end());
+        }
+        size_t keep = std::min(m, merged.size());
+        std::partial_sort(merged.begin(), merged.begin() + keep, merged.end(), better);
+        merged.resize(keep);
+
+        results.clear();
+        for (const ScoredKey& scored : merged) {
+            std::string value = get(scored.second); // get 对已删除的 key 返回空串
+            if (!value.empty()) {
+                results.push_back({scored.second, value});
+                if (results.size() >= static_cast<size_t>(k)) {
+                    return results;
                 }
+            }
+        }
+        if (m >= items.size()) {
+            return results;
+        }
+    }
+}
+std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn(std::string query, int k) {
+    std::vector<float> query_vec = get_embedding(query); // Use the embedding helper
+    if (query_vec.empty()) {
+         std::cerr << "[ERROR] search_knn(string): Failed to get embedding for query." << std::endl;
+        return {};
+    }
+    return search_knn(query_vec, k); // Call the vector version
+}
+
+// --- IVF 引擎 ---
+void KVStore::ivf_insert(uint64_t key, const StoredVector& vec) {
+    if (ivf_index_.dim() == 0) {
+        ivf_index_.reset(vec.size());
+    }
+    if (vec.size() != ivf_index_.dim()) {
+        std::cerr << "[ERROR] IVF insert: dimension mismatch for key " << key << ". Expected " << ivf_index_.dim()
+                  << " got " << vec.size() << std::endl;
+        return;
+    }
+    ivf_index_.add(key, &vec);
+    // 未训练时达到 ivf_train_size_ 个向量训练一次；之后数据量每涨到 4 倍重新训练，让表长保持在 sqrt(N) 量级
+    size_t size = ivf_index_.size();
+    if ((ivf_trained_count_ == 0 && size >= ivf_train_size_) ||
+        (ivf_trained_count_ > 0 && size >= 4 * ivf_trained_count_)) {
+        train_ivf_index();
+    }
+}
 
-                // Check if embedding exists
-                if (embeddings.count(cur_key)) {
-                     // Fetch the value to ensure it's not a deleted tombstone *at this specific level*
-                     // This requires reading the value, which adds overhead compared to just using embeddings map.
-                     // A potentially better way: Trust the embedding map *if* the `del` function correctly removes embeddings.
-                     // Let's trust the embeddings map for now, assuming `del` cleans it up.
-                     // If a key is in embeddings map, assume it's not deleted for similarity calculation.
+void KVStore::train_ivf_index(size_t nlist) {
+    if (vector_index_type_ != VectorIndexType::IVF) {
+        std::cerr << "[WARN] train_ivf_index called but the store uses the HNSW engine." << std::endl;
+        return;
+    }
+    size_t size = ivf_index_.size();
+    if (nlist == 0) {
+        nlist = ivf_nlist_ > 0 ? ivf_nlist_ : static_cast<size_t>(std::sqrt(static_cast<double>(size)));
+    }
+    ivf_index_.train(nlist, static_cast<uint32_t>(rng_()));
+    ivf_trained_count_ = std::max<size_t>(1, size);
+}
 
-                    float sim = cosine_similarity(query_vec, embeddings[cur_key]);
-                    similarities.push_back({cur_key, sim});
-                } else {
-                    // Should not happen if 'put' always stores embedding and 'del' removes it.
-                     // std::cerr << "[WARN] Baseline search_knn: Embedding not found for key " << cur_key << " in SSTable " << sst_head.getFilename() << std::endl;
-                     // We might need to fetch value and compute embedding on the fly IF the put logic failed.
-                     // However, stick to the assumption that embeddings map is the source of truth for existing vectors.
+// 扫描最近的 nprobe 个倒排表取前 m = 2k 个候选，再用 get 过滤已删除的 key；不足 k 个时加大 m 重查
+std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_ivf(const std::vector<float>& query_vec, int k, int nprobe) {
+    if (vector_index_type_ != VectorIndexType::IVF) {
+        std::cerr << "[WARN] search_knn_ivf called but the store uses the HNSW engine." << std::endl;
+        return {};
+    }
+    if (k <= 0 || ivf_index_.size() == 0) {
+        return {};
+    }
+    if (query_vec.size() != ivf_index_.dim()) {
+        std::cerr << "[ERROR] search_knn_ivf: query dimension " << query_vec.size() << " does not match index dimension "
+                  << ivf_index_.dim() << std::endl;
+        return {};
+    }
+    size_t probes = nprobe > 0 ? static_cast<size_t>(nprobe) : ivf_nprobe_;
+
+    std::vector<std::pair<uint64_t, std::string>> results;
+    for (size_t m = 2 * static_cast<size_t>(k);; m *= 2) {
+        std::vector<IVFIndex::ScoredKey> candidates = ivf_index_.search(query_vec.data(), m, probes);
+        results.clear();
+        for (const auto& scored : candidates) {
+            std::string value = get(scored.second);
+            if (!value.empty()) {
+                results.push_back({scored.second, value});
+                if (results.size() >= static_cast<size_t>(k)) {
+                    return results;
                 }
-                 processed_keys.insert(cur_key); // Mark key as processed at this point
             }
         }
+        if (candidates.size() < m) {
+            return results; // 探测的表已经取完
+        }
     }
+}
 
-    // 3. Sort by Similarity (Descending)
-    std::sort(similarities.begin(), similarities.end(), 
-              [](const auto& a, const auto& b) {
-                  if (std::abs(a.second - b.second) > 1e-7) { // Tolerance for float comparison
-                      return a.second > b.second; // Higher similarity first
-                  }
-                  return a.first < b.first; // Use key as tie-breaker
-              });
+std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_ivf(std::string query, int k, int nprobe) {
+    std::vector<float> query_vec = get_embedding(query);
+    if (query_vec.empty()) {
+        std::cerr << "[ERROR] search_knn_ivf(string): Failed to get embedding for query." << std::endl;
+        return {};
+    }
+    return search_knn_ivf(query_vec, k, nprobe);
+}
+
+// --- 磁盘 Vamana 索引 ---
+bool KVStore::build_disk_index(const std::string& path, const VamanaOptions& options) {
+    std::vector<uint64_t> keys;
+    std::vector<float> vectors;
+    keys.reserve(embeddings.size());
+    vectors.reserve(embeddings.size() * embedding_dimension_);
+    for (const auto& pair : embeddings) {
+        if (pair.second.size() != embedding_dimension_ || !std::isfinite(pair.second.at(0)) ||
+            pair.second.at(0) == std::numeric_limits<float>::max()) {
+            continue; // 删除标记或维度不符
+        }
+        keys.push_back(pair.first);
+        vectors.resize(vectors.size() + embedding_dimension_);
+        pair.second.decode(vectors.data() + vectors.size() - embedding_dimension_);
+    }
+    disk_index_.close();
+    if (!vamana_build_index(path, keys, std::move(vectors), embedding_dimension_, options)) {
+        return false;
+    }
+    return open_disk_index(path, options);
+}
+
+bool KVStore::open_disk_index(const std::string& path, const VamanaOptions& options) {
+    if (!disk_index_.open(path)) {
+        std::cerr << "[ERROR] Failed to open Vamana disk index: " << path << std::endl;
+        return false;
+    }
+    disk_index_options_ = options;
+    std::cout << "[INFO] Opened Vamana disk index " << path << " with " << disk_index_.size() << " nodes ("
+              << disk_index_.memory_bytes() / 1024 << " KiB resident)." << std::endl;
+    return true;
+}
+
+// 取前 m = 2k 个候选，用 get 过滤已删除的 key；不足 k 个时加大 m (及搜索列表长度) 重查
+std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_disk(const std::vector<float>& query_vec, int k, int search_L) {
+    if (!disk_index_.is_open()) {
+        std::cerr << "[WARN] search_knn_disk called without an open disk index." << std::endl;
+        return {};
+    }
+    if (k <= 0) {
+        return {};
+    }
+    if (query_vec.size() != disk_index_.dim()) {
+        std::cerr << "[ERROR] search_knn_disk: query dimension " << query_vec.size() << " does not match index dimension "
+                  << disk_index_.dim() << std::endl;
+        return {};
+    }
+    size_t L = search_L > 0 ? static_cast<size_t>(search_L) : disk_index_options_.search_L;
 
-    // 4. Get Top K results (Key and Value)
     std::vector<std::pair<uint64_t, std::string>> results;
-    for (int i = 0; i < std::min((int)similarities.size(), k); ++i) {
-        uint64_t key = similarities[i].first;
-        // Retrieve the value using the standard get function, which handles deletions correctly.
-        std::string value = get(key);
-        if (!value.empty()) { // get() returns empty string if not found or deleted
-            results.push_back({key, value});
-        } else if (results.size() < k) {
-             // If get fails for a top similarity key, we might need to look further down
-             // the similarities list to ensure we return k results if possible.
-             // This simple loop doesn't handle that replacement. For simplicity, we stick to top-k similarity keys first.
+    for (size_t m = 2 * static_cast<size_t>(k);; m *= 2) {
+        std::vector<VamanaIndex::ScoredKey> candidates =
+            disk_index_.search(query_vec.data(), m, std::max(L, m), disk_index_options_.beam_width);
+        results.clear();
+        for (const auto& scored : candidates) {
+            std::string value = get(scored.second);
+            if (!value.empty()) {
+                results.push_back({scored.second, value});
+                if (results.size() >= static_cast<size_t>(k)) {
+                    return results;
+                }
+            }
+        }
+        if (candidates.size() < m || m >= disk_index_.size()) {
+            return results;
         }
     }
-    
-    return results;
 }
 
-// --- ADDED: Original search_knn (string version) calling the vector version ---
-std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn(std::string query, int k) {
-    std::vector<float> query_vec = get_embedding(query); // Use the embedding helper
+std::vector<std::pair<uint64_t, std::string>> KVStore::search_knn_disk(std::string query, int k, int search_L) {
+    std::vector<float> query_vec = get_embedding(query);
     if (query_vec.empty()) {
-         std::cerr << "[ERROR] search_knn(string): Failed to get embedding for query." << std::endl;
+        std::cerr << "[ERROR] search_knn_disk(string): Failed to get embedding for query." << std::endl;
         return {};
     }
-    return search_knn(query_vec, k); // Call the vector version
+    return search_knn_disk(query_vec, k, search_L);
 }
 // ---------------------------------------------------------------------------
 
@@ -2069,26 +2959,83 @@ int KVStore::get_hnsw_m() const {
 int KVStore::get_hnsw_ef_construction() const {
     return HNSW_efConstruction;
 }
+
+HNSWOptions KVStore::get_hnsw_options() const {
+    HNSWOptions options;
+    options.M = HNSW_M;
+    options.M_max = HNSW_M_max;
+    options.ef_construction = HNSW_efConstruction;
+    options.ef_search = HNSW_efSearch;
+    options.build_threads = hnsw_build_threads_;
+    options.search_threads = hnsw_search_threads_;
+    options.index_vectors = hnsw_index_vectors_;
+    options.delta_checkpoint_ratio = hnsw_delta_checkpoint_ratio_;
+    options.consolidate_ratio = hnsw_consolidate_ratio_;
+    options.filter_brute_force_ratio = hnsw_filter_brute_force_ratio_;
+    options.index_type = vector_index_type_;
+    options.ivf_nlist = ivf_nlist_;
+    options.ivf_nprobe = ivf_nprobe_;
+    options.ivf_train_size = ivf_train_size_;
+    options.embedding_cache_entries = embedding_cache_.capacity();
+    options.async_embedding = async_embedding_;
+    options.embedding_batch_size = embedding_batch_size_;
+    options.embedding_batch_delay_ms = embedding_batch_delay_ms_;
+    options.embedding_contexts = embedding_contexts_;
+    options.embedding_threads = embedding_threads_;
+    options.vector_precision = vector_precision_;
+    options.search_prefix_dim = hnsw_prefix_dim_;
+    options.neighbor_heuristic = hnsw_neighbor_heuristic_;
+    options.extend_candidates = hnsw_extend_candidates_;
+    options.keep_pruned_connections = hnsw_keep_pruned_connections_;
+    options.prefetch_distance = hnsw_prefetch_distance_;
+    options.reorder_on_save = hnsw_reorder_on_save_;
+    options.metric = distance_metric_;
+    return options;
+}
 // --- END ADDED ---
 
-// --- 修改：函数定义 --- (修改函数签名)
+// 映射中的一条向量记录：地址 (不保证对齐) 与其所在文件的存储精度
+struct MappedVector {
+    const char* data;
+    VectorPrecision precision;
+};
+
+// 把映射中胜出的向量 (按 key 升序) 拷进 embeddings，转换为 precision：
+// 先串行建好 map 节点，再并行拷贝 / 转换向量，每个向量只从 page cache 复制一次
+static void materialize_mapped_embeddings(const std::vector<std::pair<uint64_t, MappedVector>>& items, size_t dim,
+                                          VectorPrecision precision, std::map<uint64_t, StoredVector>& out) {
+    std::vector<StoredVector*> targets;
+    targets.reserve(items.size());
+    for (const auto& item : items) {
+        targets.push_back(&out.emplace_hint(out.end(), item.first, StoredVector())->second);
+    }
+    parallel_for(items.size(), 1024, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            targets[i]->assign_raw(items[i].second.data, items[i].second.precision, dim, precision);
+        }
+    });
+}
+
+// 旧格式 embeddings.bin：{uint64 dim} 之后是不断追加的 {key, float[dim]}，同一 key 以最后一条为准。
+// 文件只读映射后分段并行找出每段中各 key 最后出现的位置，合并时后面的段覆盖前面的
 void KVStore::load_embedding_from_disk(const std::string &data_dir) {
     std::string embedding_file_path = data_dir + "/embeddings.bin";
-    std::ifstream embed_file(embedding_file_path, std::ios::binary);
-
-    if (!embed_file.is_open()) {
-        std::cout << "[INFO] Embedding file not found (" << embedding_file_path << "). Skipping load. Will be created on first flush." << std::endl;
+    MappedFile embed_file;
+    if (!embed_file.open(embedding_file_path)) {
+        std::cout << "[INFO] Embedding file not found (" << embedding_file_path << "). Skipping load." << std::endl;
         return;
     }
+    hnsw_label_vectors_.clear(); // 下面会清空 embeddings，缓存的向量地址随之失效 (之后回退到查表)
+    ivf_index_.reset(embedding_dimension_); // IVF 倒排表同样指向 embeddings，只在打开时重建
+    ivf_trained_count_ = 0;
 
     // 1. 读取维度
     uint64_t file_dim = 0;
-    embed_file.read(reinterpret_cast<char*>(&file_dim), sizeof(file_dim));
-    if (embed_file.gcount() != sizeof(file_dim)) {
+    if (embed_file.size() < sizeof(file_dim)) {
         std::cerr << "[ERROR] Failed to read embedding dimension from file: " << embedding_file_path << std::endl;
-        embed_file.close();
         return;
     }
+    std::memcpy(&file_dim, embed_file.data(), sizeof(file_dim));
 
     // 验证或设置维度
     if (embedding_dimension_ == 0) {
@@ -2097,297 +3044,398 @@ void KVStore::load_embedding_from_disk(const std::string &data_dir) {
     } else if (embedding_dimension_ != static_cast<int>(file_dim)) {
         std::cerr << "[ERROR] Embedding dimension mismatch! File has " << file_dim
                   << ", but KVStore expected " << embedding_dimension_ << std::endl;
-        embed_file.close();
-        // 可能是严重错误，可以选择抛出异常或清空现有 embeddings
         embeddings.clear(); // 清空以避免使用错误维度的数据
         return;
     }
     if (embedding_dimension_ <= 0) {
          std::cerr << "[ERROR] Invalid embedding dimension loaded: " << embedding_dimension_ << std::endl;
-         embed_file.close();
          return;
     }
 
     // 2. 计算块大小和数量
-    size_t block_size = sizeof(uint64_t) + embedding_dimension_ * sizeof(float); // key + vector
-    embed_file.seekg(0, std::ios::end);
-    long long file_size = embed_file.tellg();
-    long long data_bytes = file_size - sizeof(uint64_t); // 减去维度头
-
-    if (data_bytes < 0 || data_bytes % block_size != 0) {
+    const size_t dim = embedding_dimension_;
+    const size_t block_size = sizeof(uint64_t) + dim * sizeof(float); // key + vector
+    const size_t data_bytes = embed_file.size() - sizeof(uint64_t); // 减去维度头
+    if (data_bytes % block_size != 0) {
         std::cerr << "[ERROR] Invalid embedding file size or block structure."
-                  << " Total size: " << file_size << ", Data bytes: " << data_bytes
+                  << " Total size: " << embed_file.size() << ", Data bytes: " << data_bytes
                   << ", Expected block size: " << block_size << std::endl;
-        embed_file.close();
         embeddings.clear(); // 可能文件损坏，清空
         return;
     }
-    long long num_blocks = data_bytes / block_size;
+    const size_t num_blocks = data_bytes / block_size;
+    const char* blocks = embed_file.data() + sizeof(uint64_t);
+
+    std::cout << "[INFO] Loading embeddings from " << embedding_file_path << (embed_file.is_mapped() ? " (mmap)" : "")
+              << ". Dimension: " << dim << ", Blocks: " << num_blocks << std::endl;
+
+    // 3. 并行去重：key -> 最后一条记录的下标
+    std::mutex chunks_mutex;
+    std::vector<std::pair<size_t, std::unordered_map<uint64_t, size_t>>> chunks; // (段起点, 段内结果)
+    parallel_for(num_blocks, 4096, [&](size_t begin, size_t end) {
+        std::unordered_map<uint64_t, size_t> latest;
+        latest.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t key;
+            std::memcpy(&key, blocks + i * block_size, sizeof(key));
+            latest[key] = i;
+        }
+        std::lock_guard<std::mutex> lock(chunks_mutex);
+        chunks.emplace_back(begin, std::move(latest));
+    });
+    std::sort(chunks.begin(), chunks.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    std::unordered_map<uint64_t, size_t> latest = std::move(chunks.front().second);
+    for (size_t c = 1; c < chunks.size(); ++c) {
+        for (const auto& pair : chunks[c].second) {
+            latest[pair.first] = pair.second;
+        }
+    }
+
+    // 4. 删除标记 (全 FLT_MAX) 表示该 key 已被删除
+    std::vector<std::pair<uint64_t, MappedVector>> items;
+    items.reserve(latest.size());
+    for (const auto& pair : latest) {
+        const char* vec = blocks + pair.second * block_size + sizeof(uint64_t);
+        float first;
+        std::memcpy(&first, vec, sizeof(first));
+        bool is_deleted_marker = first == std::numeric_limits<float>::max();
+        for (size_t d = 1; is_deleted_marker && d < dim; ++d) {
+            std::memcpy(&first, vec + d * sizeof(float), sizeof(first));
+            is_deleted_marker = first == std::numeric_limits<float>::max();
+        }
+        if (!is_deleted_marker) {
+            items.push_back({pair.first, {vec, VectorPrecision::Float32}});
+        }
+    }
+    std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
 
-    std::cout << "[INFO] Loading embeddings from " << embedding_file_path
-              << ". Dimension: " << embedding_dimension_ << ", Blocks: " << num_blocks << std::endl;
-
-    // 3. 从后往前读取
     embeddings.clear(); // 清空内存中的旧数据，确保只加载最新的
-    std::set<uint64_t> loaded_keys; // 记录已加载最新版本的 key
-    std::vector<float> temp_vec(embedding_dimension_); // 复用读取缓冲区
-    std::vector<float> deleted_marker(embedding_dimension_, std::numeric_limits<float>::max()); // 删除标记
+    materialize_mapped_embeddings(items, dim, vector_precision_, embeddings);
+    std::cout << "[INFO] Finished loading embeddings. Loaded " << embeddings.size() << " unique keys." << std::endl;
+}
 
-    for (long long i = num_blocks - 1; i >= 0; --i) {
-        long long offset = sizeof(uint64_t) + i * block_size;
-        embed_file.seekg(offset, std::ios::beg);
+// 刷盘时 memtable 中的 key 都可能带向量 (删除标记除外)，按全部都有估计，使 SSTable 文件不超过 MAXSIZE
+uint32_t KVStore::memtable_vector_bytes(uint64_t count) const {
+    if (embedding_dimension_ == 0) {
+        return 0;
+    }
+    return static_cast<uint32_t>(count * (8 + embedding_dimension_ * vector_element_bytes(vector_precision_)) +
+                                 sizeof(VectorBlockFooter));
+}
 
-        uint64_t current_key;
-        embed_file.read(reinterpret_cast<char*>(&current_key), sizeof(current_key));
-        if (embed_file.gcount() != sizeof(current_key)) {
-             std::cerr << "[ERROR] Failed to read key at block " << i << std::endl; continue;
+void KVStore::attach_memtable_vectors(sstable &ss) {
+    if (!pending_embedding_keys_.empty()) {
+        sync_embeddings(); // 排队中的向量必须和它们的值落进同一个 SSTable
+    }
+    if (embedding_dimension_ == 0) {
+        return;
+    }
+    ss.setVectorDim(embedding_dimension_, vector_precision_);
+    for (slnode *cur = s->getFirst(); cur && cur->type != TAIL; cur = cur->nxt[0]) {
+        if (cur->val == DEL) {
+            continue;
+        }
+        auto it = embeddings.find(cur->key);
+        if (it != embeddings.end() && it->second.size() == embedding_dimension_ && !it->second.is_deleted_marker()) {
+            ss.insertVector(cur->key, it->second.raw(), it->second.precision());
         }
+    }
+}
 
-        // 如果这个 key 的最新版本已经被加载，跳过
-        if (loaded_keys.count(current_key)) {
-            continue;
+// 各 SSTable 的向量块只读映射，按时间戳从旧到新解析出每个 key 最终所在的记录 (较新的表覆盖旧版本；
+// 表中存在但没有向量的 key 视为删除)，最后只把胜出的向量拷进 embeddings。没有向量块的旧表跳过
+void KVStore::load_sstable_embeddings() {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    std::vector<sstablehead> heads;
+    for (int level = 0; level <= totalLevel; ++level) {
+        heads.insert(heads.end(), sstableIndex[level].begin(), sstableIndex[level].end());
+    }
+    std::sort(heads.begin(), heads.end(),
+              [](const sstablehead& a, const sstablehead& b) { return a.getTime() < b.getTime(); });
+
+    // 1. 映射并在各表内把表的 key 对应到向量记录 (并行，只读 key)，nullptr 表示没有向量
+    const size_t dim = embedding_dimension_;
+    std::vector<MappedFile> files(heads.size());
+    std::vector<std::vector<const char*>> located(heads.size());
+    std::vector<VectorPrecision> precisions(heads.size(), VectorPrecision::Float32);
+    std::vector<char> has_block(heads.size(), 0);
+    parallel_for(heads.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            VectorBlockFooter footer{};
+            const char* entries = files[t].open(heads[t].getFilename())
+                                      ? sstable::findVectorBlock(files[t].data(), files[t].size(), footer)
+                                      : nullptr;
+            if (!entries) {
+                continue;
+            }
+            if (footer.dim != dim) {
+                std::cerr << "[ERROR] Vector block dimension " << footer.dim << " in " << heads[t].getFilename()
+                          << " does not match " << dim << ". Skipping." << std::endl;
+                continue;
+            }
+            has_block[t] = 1;
+            precisions[t] = static_cast<VectorPrecision>(footer.precision);
+            const size_t entry_bytes = sizeof(uint64_t) + dim * vector_element_bytes(precisions[t]);
+            located[t].assign(heads[t].getCnt(), nullptr);
+            uint64_t j = 0;
+            uint64_t block_key = 0;
+            for (uint64_t i = 0; i < heads[t].getCnt(); ++i) {
+                uint64_t key = heads[t].getKey(i);
+                for (; j < footer.count; ++j) {
+                    std::memcpy(&block_key, entries + j * entry_bytes, sizeof(block_key));
+                    if (block_key >= key) {
+                        break;
+                    }
+                }
+                if (j < footer.count && block_key == key) {
+                    located[t][i] = entries + j * entry_bytes + sizeof(uint64_t);
+                }
+            }
         }
+    });
 
-        embed_file.read(reinterpret_cast<char*>(temp_vec.data()), embedding_dimension_ * sizeof(float));
-         if (embed_file.gcount() != embedding_dimension_ * sizeof(float)) {
-             std::cerr << "[ERROR] Failed to read vector for key " << current_key << " at block " << i << std::endl; continue;
-         }
+    // 2. 从旧到新合并出 key -> 最新记录
+    std::unordered_map<uint64_t, MappedVector> latest;
+    size_t tables_with_vectors = 0;
+    for (size_t t = 0; t < heads.size(); ++t) {
+        if (!has_block[t]) {
+            continue;
+        }
+        ++tables_with_vectors;
+        for (uint64_t i = 0; i < heads[t].getCnt(); ++i) {
+            latest[heads[t].getKey(i)] = {located[t][i], precisions[t]};
+        }
+    }
 
-        // 检查是否是删除标记
-        if (temp_vec == deleted_marker) {
-            // 是删除标记，记录该 key 已处理（被删除），然后跳过
-            loaded_keys.insert(current_key);
-            // std::cout << "[DEBUG] Skipped deleted key: " << current_key << std::endl;
-        } else {
-            // 是有效向量，存入内存 map，并记录 key 已处理
-            embeddings[current_key] = temp_vec; // 使用 vector 的赋值操作符
-            loaded_keys.insert(current_key);
-             // std::cout << "[DEBUG] Loaded key: " << current_key << std::endl;
+    // 3. 拷贝胜出的向量 (按 vector_precision_ 转换)
+    std::vector<std::pair<uint64_t, MappedVector>> items;
+    items.reserve(latest.size());
+    for (const auto& pair : latest) {
+        if (pair.second.data) {
+            items.push_back(pair);
         }
     }
+    std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    embeddings.clear();
+    materialize_mapped_embeddings(items, dim, vector_precision_, embeddings);
 
-    embed_file.close();
-    std::cout << "[INFO] Finished loading embeddings. Loaded " << embeddings.size() << " unique keys." << std::endl;
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::cout << "[INFO] Loaded " << embeddings.size() << " " << vector_precision_name(vector_precision_)
+              << " embeddings from " << tables_with_vectors << " of " << heads.size() << " SSTables in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << " ms."
+              << std::endl;
+}
+
+// 旧版本把向量追加到 embeddings.bin：读入后给还没有向量块的 SSTable 补写一份，然后删除该文件
+void KVStore::migrate_legacy_embeddings() {
+    std::string embedding_file_path = dir_ + "/embeddings.bin";
+    if (!utils::fileExists(embedding_file_path.c_str())) {
+        return;
+    }
+    load_embedding_from_disk(dir_);
+    if (embeddings.empty()) {
+        std::cerr << "[WARN] No usable embeddings in " << embedding_file_path << ", leaving it in place." << std::endl;
+        return;
+    }
+    size_t migrated = 0;
+    for (int level = 0; level <= totalLevel; ++level) {
+        for (sstablehead& head : sstableIndex[level]) {
+            uint32_t dim = 0;
+            VectorPrecision precision;
+            std::vector<uint64_t> keys;
+            std::vector<char> vecs;
+            if (sstable::loadVectorBlock(head.getFilename().data(), dim, precision, keys, vecs)) {
+                continue;
+            }
+            sstable ss;
+            ss.loadFile(head.getFilename().data());
+            ss.setVectorDim(embedding_dimension_, vector_precision_);
+            for (uint64_t i = 0; i < ss.getCnt(); ++i) {
+                auto it = embeddings.find(ss.getKey(i));
+                if (ss.getData(i) != DEL && it != embeddings.end() && it->second.size() == embedding_dimension_) {
+                    ss.insertVector(it->first, it->second.raw(), it->second.precision());
+                }
+            }
+            ss.putFile(head.getFilename().data());
+            ++migrated;
+        }
+    }
+    utils::rmfile(embedding_file_path.data());
+    embeddings.clear(); // 由 load_sstable_embeddings 按表的新旧重新得到
+    std::cout << "[INFO] Migrated embeddings.bin into vector blocks of " << migrated << " SSTables." << std::endl;
 }
 
 // --- 新增：实现 HNSW 索引保存 ---
-void KVStore::save_hnsw_index_to_disk(const std::string &hnsw_data_root, bool force_serial /*= false*/) { // Added force_serial parameter
+// 写出单文件索引 <root>/hnsw_index.bin (格式见 hnsw_index_file.h)，已删除的节点连同删除 label 列表一起保存。
+// force_serial 为 false 时邻居块由线程池并行编码，文件本身始终顺序写出一次
+void KVStore::save_hnsw_index_to_disk(const std::string &hnsw_data_root, bool force_serial /*= false*/) {
+    finish_hnsw_consolidation();
     std::cout << "[INFO] Attempting HNSW index save to disk: " << hnsw_data_root << (force_serial ? " (SERIAL)" : " (PARALLEL)") << std::endl;
-    std::atomic<int> saved_node_count_atomic(0); 
+    if (hnsw_reorder_on_save_) {
+        reorder_hnsw_graph();
+    }
+    auto start_time = std::chrono::high_resolution_clock::now();
 
     try {
-        // 1. 创建根目录和 nodes 子目录 (Sequential Part, common to both)
         std::filesystem::create_directories(hnsw_data_root);
-        std::string nodes_path = hnsw_data_root + "/nodes"; // Common base for nodes
-        std::filesystem::create_directories(nodes_path);
-
-        // 2. 准备并写入全局头文件 (Sequential Part, common to both)
-        HNSWGlobalHeader global_header;
-        global_header.M = static_cast<uint32_t>(HNSW_M);
-        global_header.M_max = static_cast<uint32_t>(HNSW_M_max);
-        global_header.efConstruction = static_cast<uint32_t>(HNSW_efConstruction);
-        global_header.max_level = static_cast<uint32_t>(current_max_level_);
-        global_header.entry_point_label = entry_point_label_;
-        
-        uint64_t active_node_count = 0;
-        for (const auto& pair : hnsw_nodes_) {
-            if (!pair.second.deleted) {
-                active_node_count++;
-            }
-        }
-        global_header.num_nodes = active_node_count;
-        global_header.dim = static_cast<uint32_t>(embedding_dimension_);
 
-        std::string global_header_path = hnsw_data_root + "/global_header.bin";
-        std::ofstream header_file(global_header_path, std::ios::binary | std::ios::trunc);
-        if (!header_file.is_open()) {
-            std::cerr << "[ERROR] Failed to open global header file for writing: " << global_header_path << std::endl;
-        } else {
-            header_file.write(reinterpret_cast<const char*>(&global_header), sizeof(HNSWGlobalHeader));
-            header_file.close();
-            std::cout << "[INFO] Saved global header. Expected active nodes: " << global_header.num_nodes << " to " << global_header_path << std::endl;
+        // 1. 准备头部与 label 表，为每个节点的高层邻居块分配序号
+        HNSWIndexFileHeader header{};
+        std::memcpy(header.magic, HNSW_INDEX_MAGIC, sizeof(header.magic));
+        header.version = HNSW_INDEX_VERSION;
+        header.flags = hnsw_index_vectors_ ? HNSW_INDEX_FLAG_VECTORS : 0;
+        header.flags |= static_cast<uint32_t>(distance_metric_) << HNSW_INDEX_METRIC_SHIFT;
+        header.dim = static_cast<uint32_t>(embedding_dimension_);
+        header.M = static_cast<uint32_t>(HNSW_M);
+        header.M_max = static_cast<uint32_t>(HNSW_M_max);
+        header.efConstruction = static_cast<uint32_t>(HNSW_efConstruction);
+        header.max_level = current_max_level_;
+        header.stride = static_cast<uint32_t>(HNSW_M_max) + 1;
+        header.entry_point_label = entry_point_label_;
+        header.num_labels = next_label_;
+        header.checkpoint_id = (static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()) ^ rng_()) | 1;
+
+        if (next_label_ > std::numeric_limits<uint32_t>::max()) {
+            std::cerr << "[ERROR] HNSW label " << next_label_ << " exceeds uint32_t max, cannot save index." << std::endl;
+            return;
         }
 
-        // 3. 保存 HNSW 节点数据 (Conditional: Serial or Parallel)
-        if (force_serial) {
-            std::cout << "[INFO] Saving HNSW nodes SERIALLY to " << nodes_path << "..." << std::endl;
-            uint64_t serial_saved_node_count = 0; 
-
-            for (const auto& pair : hnsw_nodes_) {
-                const size_t label = pair.first;
-                const HNSWNode& node_ref = pair.second;
-
-                if (node_ref.deleted) {
+        std::vector<HNSWIndexLabelEntry> label_table(next_label_, HNSWIndexLabelEntry{0, -1, 0, 0});
+        std::vector<const HNSWNode*> nodes_by_label(next_label_, nullptr);
+        for (const auto& pair : hnsw_nodes_) {
+            const HNSWNode& node = pair.second;
+            if (pair.first >= next_label_) {
+                continue;
+            }
+            HNSWIndexLabelEntry& entry = label_table[pair.first];
+            entry.key = node.key;
+            entry.max_level = node.max_level;
+            entry.upper_offset = header.upper_blocks;
+            header.upper_blocks += static_cast<uint64_t>(node.max_level);
+            header.num_nodes++;
+            nodes_by_label[pair.first] = &node;
+        }
+        const std::vector<uint32_t> deleted_labels = hnsw_deleted_labels_.to_list<uint32_t>();
+        header.num_deleted = deleted_labels.size();
+        hnsw_index_layout(header);
+
+        // 2. 把邻居表编码成定长块 {count, labels...}
+        const size_t stride = header.stride;
+        std::vector<uint32_t> level0_blocks(header.num_labels * stride, 0);
+        std::vector<uint32_t> upper_blocks(header.upper_blocks * stride, 0);
+        std::atomic<uint64_t> truncated_lists(0);
+        auto encode_range = [&](size_t begin, size_t end) {
+            for (size_t label = begin; label < end; ++label) {
+                const HNSWNode* node = nodes_by_label[label];
+                if (!node) {
                     continue;
                 }
-                
-                HNSWNode node_copy = node_ref; 
-                std::string node_specific_base_path = nodes_path + "/" + std::to_string(label);
-
-                try {
-                    std::filesystem::create_directories(node_specific_base_path);
-
-                    std::string disk_node_header_path = node_specific_base_path + "/header.bin";
-                    std::ofstream node_header_ostream(disk_node_header_path, std::ios::binary | std::ios::trunc);
-                    if (!node_header_ostream.is_open()) {
-                        std::cerr << "[ERROR] SERIAL: Failed to open node header file for writing: " << disk_node_header_path << std::endl;
-                        continue; 
+                for (int level = 0; level <= node->max_level && level < static_cast<int>(node->connections.size()); ++level) {
+                    uint32_t* block = level == 0
+                        ? &level0_blocks[label * stride]
+                        : &upper_blocks[(label_table[label].upper_offset + level - 1) * stride];
+                    const std::vector<size_t>& links = node->connections[level];
+                    size_t count = std::min(links.size(), stride - 1);
+                    if (count < links.size()) {
+                        truncated_lists++;
                     }
-                    NodeHeader disk_node_header_data;
-                    disk_node_header_data.max_level = static_cast<uint32_t>(node_copy.max_level);
-                    disk_node_header_data.key = node_copy.key;
-                    node_header_ostream.write(reinterpret_cast<const char*>(&disk_node_header_data), sizeof(NodeHeader));
-                    node_header_ostream.close();
-
-                    std::string edges_dir_path = node_specific_base_path + "/edges";
-                    std::filesystem::create_directories(edges_dir_path);
-
-                    for (int level = 0; level <= node_copy.max_level; ++level) {
-                        if (level < node_copy.connections.size() && !node_copy.connections[level].empty()) {
-                            std::string edge_file_path = edges_dir_path + "/" + std::to_string(level) + ".bin";
-                            std::ofstream edge_file(edge_file_path, std::ios::binary | std::ios::trunc);
-                            if (!edge_file.is_open()) {
-                                std::cerr << "[ERROR] SERIAL: Failed to open edge file for writing: " << edge_file_path << std::endl;
-                                continue; 
-                            }
-                            uint32_t num_edges = static_cast<uint32_t>(node_copy.connections[level].size());
-                            edge_file.write(reinterpret_cast<const char*>(&num_edges), sizeof(uint32_t));
-                            for (size_t neighbor_label_size_t : node_copy.connections[level]) {
-                                if (neighbor_label_size_t > std::numeric_limits<uint32_t>::max()) {
-                                    std::cerr << "[WARN] SERIAL: Neighbor label " << neighbor_label_size_t << " exceeds uint32_t max! Saving truncated for node " << label << ", level " << level << "." << std::endl;
-                                }
-                                uint32_t neighbor_label_u32 = static_cast<uint32_t>(neighbor_label_size_t);
-                                edge_file.write(reinterpret_cast<const char*>(&neighbor_label_u32), sizeof(uint32_t));
-                            }
-                            edge_file.close();
-                        }
+                    block[0] = static_cast<uint32_t>(count);
+                    for (size_t i = 0; i < count; ++i) {
+                        block[1 + i] = static_cast<uint32_t>(links[i]);
                     }
-                    serial_saved_node_count++;
-                } catch (const std::filesystem::filesystem_error& fs_err) {
-                    std::cerr << "[ERROR] SERIAL: Filesystem error while saving node " << label << " to " << node_specific_base_path << ": " << fs_err.what() << std::endl;
-                } catch (const std::exception& e) {
-                    std::cerr << "[ERROR] SERIAL: Std exception while saving node " << label << " to " << node_specific_base_path << ": " << e.what() << std::endl;
-                } catch (...) {
-                    std::cerr << "[ERROR] SERIAL: Unknown exception while saving node " << label << " to " << node_specific_base_path << std::endl;
                 }
             }
-            saved_node_count_atomic.store(serial_saved_node_count);
-            std::cout << "[INFO] Finished processing HNSW node data SERIALLY. Nodes processed: " << serial_saved_node_count << "." << std::endl;
-
-        } else { // Parallel saving
-            std::cout << "[INFO] Saving HNSW nodes PARALLELLY to " << nodes_path << "..." << std::endl;
-            // saved_node_count_atomic is already initialized to 0 at the function start.
-            { 
-                unsigned int num_threads = std::thread::hardware_concurrency();
-                if (num_threads == 0) num_threads = std::max(1u, 2u); 
-                ThreadPool pool(num_threads);
-                std::mutex cerr_mutex; 
-
-                for (const auto& pair : hnsw_nodes_) {
-                    const size_t label = pair.first;
-                    const HNSWNode& node_ref = pair.second; 
-
-                    if (node_ref.deleted) {
-                        continue;
-                    }
-                    
-                    HNSWNode node_copy = node_ref; 
-                    std::string node_specific_base_path = nodes_path + "/" + std::to_string(label); // Use common nodes_path
-
-                    pool.enqueue([label, node_copy, node_specific_base_path, &saved_node_count_atomic, &cerr_mutex]() {
-                        try {
-                            std::filesystem::create_directories(node_specific_base_path);
-
-                            std::string disk_node_header_path = node_specific_base_path + "/header.bin"; 
-                            std::ofstream node_header_ostream(disk_node_header_path, std::ios::binary | std::ios::trunc); 
-                            if (!node_header_ostream.is_open()) {
-                                std::unique_lock<std::mutex> lock(cerr_mutex);
-                                std::cerr << "[ERROR] Thread " << std::this_thread::get_id() 
-                                          << ": Failed to open node header file for writing: " << disk_node_header_path << std::endl;
-                                return; 
-                            }
-                            NodeHeader disk_node_header_data; 
-                            disk_node_header_data.max_level = static_cast<uint32_t>(node_copy.max_level);
-                            disk_node_header_data.key = node_copy.key;
-                            node_header_ostream.write(reinterpret_cast<const char*>(&disk_node_header_data), sizeof(NodeHeader));
-                            node_header_ostream.close();
-
-                            std::string edges_dir_path = node_specific_base_path + "/edges";
-                            std::filesystem::create_directories(edges_dir_path);
-
-                            for (int level = 0; level <= node_copy.max_level; ++level) {
-                                if (level < node_copy.connections.size() && !node_copy.connections[level].empty()) {
-                                    std::string edge_file_path = edges_dir_path + "/" + std::to_string(level) + ".bin";
-                                    std::ofstream edge_file(edge_file_path, std::ios::binary | std::ios::trunc);
-                                    if (!edge_file.is_open()) {
-                                        std::unique_lock<std::mutex> lock(cerr_mutex);
-                                        std::cerr << "[ERROR] Thread " << std::this_thread::get_id() 
-                                                  << ": Failed to open edge file for writing: " << edge_file_path << std::endl;
-                                        continue; 
-                                    }
-                                    uint32_t num_edges = static_cast<uint32_t>(node_copy.connections[level].size());
-                                    edge_file.write(reinterpret_cast<const char*>(&num_edges), sizeof(uint32_t));
-                                    for (size_t neighbor_label_size_t : node_copy.connections[level]) {
-                                        if (neighbor_label_size_t > std::numeric_limits<uint32_t>::max()) {
-                                            std::unique_lock<std::mutex> lock(cerr_mutex);
-                                            std::cerr << "[WARN] Thread " << std::this_thread::get_id() 
-                                                      << ": Neighbor label " << neighbor_label_size_t 
-                                                      << " exceeds uint32_t max! Saving truncated for node " << label << ", level " << level << "." << std::endl;
-                                        }
-                                        uint32_t neighbor_label_u32 = static_cast<uint32_t>(neighbor_label_size_t);
-                                        edge_file.write(reinterpret_cast<const char*>(&neighbor_label_u32), sizeof(uint32_t));
-                                    }
-                                    edge_file.close();
-                                }
-                            }
-                            saved_node_count_atomic++; 
-                        } catch (const std::filesystem::filesystem_error& fs_err) {
-                            std::unique_lock<std::mutex> lock(cerr_mutex);
-                            std::cerr << "[ERROR] Thread " << std::this_thread::get_id() 
-                                      << ": Filesystem error while saving node " << label << " to " << node_specific_base_path << ": " << fs_err.what() << std::endl;
-                        } catch (const std::exception& e) {
-                            std::unique_lock<std::mutex> lock(cerr_mutex);
-                            std::cerr << "[ERROR] Thread " << std::this_thread::get_id() 
-                                      << ": Std exception while saving node " << label << " to " << node_specific_base_path << ": " << e.what() << std::endl;
-                        } catch (...) {
-                            std::unique_lock<std::mutex> lock(cerr_mutex);
-                            std::cerr << "[ERROR] Thread " << std::this_thread::get_id() 
-                                      << ": Unknown exception while saving node " << label << " to " << node_specific_base_path << std::endl;
-                        }
-                    });
-                }
-            } 
-            std::cout << "[INFO] Finished processing HNSW node data PARALLELLY. Nodes processed by threads: " 
-                      << saved_node_count_atomic.load() << "." << std::endl;
-        }
+        };
 
-        // --- Common Post-Node-Saving Logic ---
-        if (global_header.num_nodes != static_cast<uint64_t>(saved_node_count_atomic.load())) {
-            std::cout << "[WARN] Mismatch! Expected active nodes for header: " << global_header.num_nodes
-                      << ", but actual saved node count: " << saved_node_count_atomic.load() << "." << std::endl;
+        size_t num_threads = force_serial ? 1 : std::max(1u, std::thread::hardware_concurrency());
+        num_threads = std::min<size_t>(num_threads, std::max<size_t>(1, header.num_labels / 1024));
+        if (num_threads <= 1) {
+            encode_range(0, header.num_labels);
+        } else {
+            size_t chunk = (header.num_labels + num_threads - 1) / num_threads;
+            ThreadPool pool(num_threads);
+            for (size_t begin = 0; begin < header.num_labels; begin += chunk) {
+                size_t end = std::min<size_t>(begin + chunk, header.num_labels);
+                pool.enqueue([&encode_range, begin, end]() { encode_range(begin, end); });
+            }
+        } // ThreadPool 析构时等待所有任务完成
+        if (truncated_lists.load() > 0) {
+            std::cout << "[WARN] " << truncated_lists.load() << " neighbor lists exceeded M_max=" << HNSW_M_max
+                      << " and were truncated when saving." << std::endl;
+        }
+
+        // 3. 顺序写入临时文件，成功后再替换正式文件
+        std::string index_path = hnsw_data_root + "/" + HNSW_INDEX_FILE_NAME;
+        std::string tmp_path = index_path + ".tmp";
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            std::cerr << "[ERROR] Failed to open HNSW index file for writing: " << tmp_path << std::endl;
+            return;
         }
-
-        std::string deleted_nodes_path = hnsw_data_root + "/deleted_nodes.bin";
-        std::ofstream del_file(deleted_nodes_path, std::ios::binary | std::ios::trunc); 
-        if (del_file.is_open()) {
-            std::cout << "[DEBUG_SAVE_HNSW] Saving " << hnsw_vectors_to_persist_as_deleted_.size() 
-                      << " deleted vectors to " << deleted_nodes_path << std::endl;
-            
-            for (const auto& vec_to_persist : hnsw_vectors_to_persist_as_deleted_) { 
-                if (vec_to_persist.size() == embedding_dimension_) {
-                    del_file.write(reinterpret_cast<const char*>(vec_to_persist.data()), vec_to_persist.size() * sizeof(float));
+        uint64_t written = 0;
+        auto write_bytes = [&](const void* data, uint64_t len) {
+            out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(len));
+            written += len;
+        };
+        auto pad_to = [&](uint64_t offset) {
+            static const char zeros[HNSW_INDEX_ALIGNMENT] = {};
+            while (written < offset) {
+                write_bytes(zeros, std::min<uint64_t>(offset - written, sizeof(zeros)));
+            }
+        };
+
+        write_bytes(&header, sizeof(header));
+        pad_to(header.label_table_offset);
+        write_bytes(label_table.data(), label_table.size() * sizeof(HNSWIndexLabelEntry));
+        pad_to(header.level0_offset);
+        write_bytes(level0_blocks.data(), level0_blocks.size() * sizeof(uint32_t));
+        pad_to(header.upper_offset);
+        write_bytes(upper_blocks.data(), upper_blocks.size() * sizeof(uint32_t));
+        if (header.flags & HNSW_INDEX_FLAG_VECTORS) {
+            pad_to(header.vector_offset);
+            std::vector<float> decoded(header.dim, 0.0f);
+            for (size_t label = 0; label < header.num_labels; ++label) {
+                const StoredVector* vec = nodes_by_label[label] ? hnsw_vector_of(label) : nullptr;
+                if (vec && vec->size() == header.dim) {
+                    vec->decode(decoded.data());
                 } else {
-                     std::cerr << "[ERROR_SAVE_HNSW_DELETED_VEC] Vector dimension mismatch for a vector in hnsw_vectors_to_persist_as_deleted_."
-                               << " Expected dim: " << embedding_dimension_ << ", actual: " << vec_to_persist.size()
-                               << ". Skipping this vector." << std::endl;
+                    std::fill(decoded.begin(), decoded.end(), 0.0f);
                 }
+                write_bytes(decoded.data(), header.dim * sizeof(float));
             }
-            del_file.close();
-            std::cout << "[INFO] Saved " << hnsw_vectors_to_persist_as_deleted_.size() 
-                      << " vectors to " << deleted_nodes_path << std::endl;
-        } else {
-            std::cerr << "[ERROR] Failed to open file for writing: " << deleted_nodes_path << std::endl;
         }
+        pad_to(header.deleted_offset);
+        write_bytes(deleted_labels.data(), deleted_labels.size() * sizeof(uint32_t));
+        pad_to(header.file_size);
+        out.close();
+        if (!out) {
+            std::cerr << "[ERROR] Failed to write HNSW index file: " << tmp_path << std::endl;
+            std::filesystem::remove(tmp_path);
+            return;
+        }
+        std::filesystem::rename(tmp_path, index_path);
+
+        // 新检查点已包含全部变更，旧的增量日志作废
+        std::filesystem::remove(hnsw_data_root + "/" + HNSW_DELTA_FILE_NAME);
+        clear_hnsw_dirty();
+        hnsw_checkpoint_root_ = hnsw_data_root;
+        hnsw_checkpoint_id_ = header.checkpoint_id;
+
+        // 单文件索引已经包含全部图结构，清理同一目录下旧格式的文件，避免加载到过期数据
+        if (std::filesystem::exists(hnsw_data_root + "/global_header.bin")) {
+            std::filesystem::remove(hnsw_data_root + "/global_header.bin");
+            std::filesystem::remove_all(hnsw_data_root + "/nodes");
+            std::cout << "[INFO] Removed legacy HNSW directory layout under " << hnsw_data_root << std::endl;
+        }
+        std::filesystem::remove(hnsw_data_root + "/deleted_nodes.bin"); // 删除信息已在索引文件中
+
+        auto end_time = std::chrono::high_resolution_clock::now();
+        std::cout << "[INFO] Saved HNSW index with " << header.num_nodes << " nodes (" << header.num_deleted
+                  << " deleted, " << header.file_size << " bytes) to "
+                  << index_path << " in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << " ms." << std::endl;
+
         std::cout << "[INFO] Completed HNSW index saving process to disk: " << hnsw_data_root << std::endl;
 
     } catch (const std::filesystem::filesystem_error& e) {
@@ -2401,45 +3449,343 @@ void KVStore::save_hnsw_index_to_disk(const std::string &hnsw_data_root, bool fo
 // --- HNSW 索引保存结束 ---
 
 // --- 新增：实现 HNSW 索引加载 ---
+// 优先读取单文件索引 hnsw_index.bin；不存在时按旧的目录格式 (global_header.bin + nodes/) 导入
 void KVStore::load_hnsw_index_from_disk(const std::string &hnsw_data_root) {
+    finish_hnsw_consolidation();
     std::cout << "[INFO] Attempting to load HNSW index from disk: " << hnsw_data_root << std::endl;
 
-    std::string global_header_path = hnsw_data_root + "/global_header.bin";
-    if (!std::filesystem::exists(global_header_path)) {
-        std::cout << "[INFO] HNSW global header not found. Skipping HNSW load (assuming first run or no save)." << std::endl;
+    std::string index_path = hnsw_data_root + "/" + HNSW_INDEX_FILE_NAME;
+    bool loaded = false;
+    hnsw_checkpoint_root_.clear();
+    hnsw_checkpoint_id_ = 0; // 旧格式没有检查点，第一次 save_hnsw_delta 会写出完整索引
+    if (std::filesystem::exists(index_path)) {
+        loaded = load_hnsw_index_file(index_path);
+        if (loaded) {
+            replay_hnsw_delta_log(hnsw_data_root);
+        }
+    } else if (std::filesystem::exists(hnsw_data_root + "/global_header.bin")) {
+        std::cout << "[INFO] Single-file HNSW index not found, importing legacy directory layout." << std::endl;
+        loaded = load_hnsw_index_legacy(hnsw_data_root);
+    } else {
+        std::cout << "[INFO] HNSW index not found. Skipping HNSW load (assuming first run or no save)." << std::endl;
+        return;
+    }
+    if (loaded) {
+        if (hnsw_checkpoint_id_ != 0) {
+            hnsw_checkpoint_root_ = hnsw_data_root;
+        }
+        finalize_loaded_hnsw_graph();
+        clear_hnsw_dirty();
+    }
+}
+
+// 在 hnsw_index.bin 之上回放 hnsw_delta.log 中已提交的批次，并截掉损坏的尾部
+void KVStore::replay_hnsw_delta_log(const std::string &hnsw_data_root) {
+    std::string log_path = hnsw_data_root + "/" + HNSW_DELTA_FILE_NAME;
+    std::vector<HNSWDeltaRecord> records;
+    uint64_t valid_size = 0;
+    bool checkpoint_matches = false;
+    if (!read_hnsw_delta_log(log_path, hnsw_checkpoint_id_, records, valid_size, checkpoint_matches)) {
+        return; // 没有增量日志
+    }
+    if (!checkpoint_matches) {
+        std::cout << "[WARN] HNSW delta log " << log_path << " does not match the loaded checkpoint. Discarding it." << std::endl;
+        std::filesystem::remove(log_path);
+        return;
+    }
+    if (valid_size < std::filesystem::file_size(log_path)) {
+        std::cout << "[WARN] Truncating incomplete tail of HNSW delta log " << log_path << " at " << valid_size << " bytes." << std::endl;
+        std::filesystem::resize_file(log_path, valid_size);
+    }
+
+    for (const HNSWDeltaRecord& record : records) {
+        switch (record.type) {
+        case HNSWDeltaType::NODE: {
+            auto label_it = label_to_key_.find(record.label);
+            if (label_it != label_to_key_.end() && label_it->second != record.key) {
+                auto key_it = key_to_label_.find(label_it->second);
+                if (key_it != key_to_label_.end() && key_it->second == record.label) {
+                    key_to_label_.erase(key_it);
+                }
+            }
+            HNSWNode& node = hnsw_nodes_[record.label];
+            node.key = record.key;
+            node.label = record.label;
+            node.max_level = record.level;
+            node.connections.assign(record.level + 1, {});
+            hnsw_deleted_labels_.reset(record.label);
+            key_to_label_[record.key] = record.label;
+            label_to_key_[record.label] = record.key;
+            hnsw_update_label_vector(record.label);
+            break;
+        }
+        case HNSWDeltaType::LINKS: {
+            auto node_it = hnsw_nodes_.find(record.label);
+            if (node_it == hnsw_nodes_.end() || record.level < 0 || record.level > node_it->second.max_level) {
+                break;
+            }
+            node_it->second.connections[record.level].assign(record.links.begin(), record.links.end());
+            break;
+        }
+        case HNSWDeltaType::DELETE: {
+            auto label_it = label_to_key_.find(record.label);
+            if (label_it != label_to_key_.end()) {
+                auto key_it = key_to_label_.find(label_it->second);
+                if (key_it != key_to_label_.end() && key_it->second == record.label) {
+                    key_to_label_.erase(key_it);
+                }
+                label_to_key_.erase(label_it);
+                hnsw_update_label_vector(record.label);
+            }
+            hnsw_nodes_.erase(record.label);
+            hnsw_deleted_labels_.reset(record.label);
+            break;
+        }
+        case HNSWDeltaType::TOMBSTONE:
+            if (hnsw_nodes_.find(record.label) != hnsw_nodes_.end()) {
+                hnsw_deleted_labels_.set(record.label);
+            }
+            break;
+        case HNSWDeltaType::ENTRY:
+            entry_point_label_ = record.label;
+            current_max_level_ = record.level;
+            next_label_ = std::max<size_t>(next_label_, record.next_label);
+            break;
+        }
+    }
+    if (hnsw_nodes_.empty()) {
+        current_max_level_ = -1;
+        entry_point_label_ = 0;
+    }
+    std::cout << "[INFO] Replayed " << records.size() << " HNSW delta log records from " << log_path << "." << std::endl;
+}
+
+void KVStore::save_hnsw_delta(const std::string &hnsw_data_root) {
+    finish_hnsw_consolidation();
+    std::string index_path = hnsw_data_root + "/" + HNSW_INDEX_FILE_NAME;
+    if (hnsw_checkpoint_id_ == 0 || hnsw_checkpoint_root_ != hnsw_data_root || !std::filesystem::exists(index_path)) {
+        std::cout << "[INFO] No HNSW checkpoint at " << hnsw_data_root << ", writing a full index instead of a delta." << std::endl;
+        save_hnsw_index_to_disk(hnsw_data_root);
+        return;
+    }
+
+    std::vector<size_t> dirty;
+    {
+        std::lock_guard<std::mutex> lock(hnsw_dirty_mutex_);
+        dirty.swap(hnsw_dirty_labels_);
+    }
+    if (dirty.empty()) {
+        std::cout << "[INFO] No HNSW changes since the last save." << std::endl;
         return;
     }
 
+    try {
+        std::string log_path = hnsw_data_root + "/" + HNSW_DELTA_FILE_NAME;
+        HNSWDeltaLogWriter writer;
+        if (!writer.open(log_path, hnsw_checkpoint_id_)) {
+            std::lock_guard<std::mutex> lock(hnsw_dirty_mutex_);
+            hnsw_dirty_labels_.insert(hnsw_dirty_labels_.end(), dirty.begin(), dirty.end());
+            return;
+        }
+        uint64_t size_before = writer.size();
+        uint64_t changed_nodes = 0, removed_nodes = 0, tombstoned_nodes = 0;
+        for (size_t label : dirty) {
+            auto node_it = hnsw_nodes_.find(label);
+            if (node_it == hnsw_nodes_.end()) {
+                writer.append_delete(label);
+                removed_nodes++;
+                continue;
+            }
+            HNSWNode& node = node_it->second;
+            if (node.log_new) {
+                writer.append_node(label, node.key, node.max_level);
+            }
+            for (int level = 0; level <= node.max_level && level < static_cast<int>(node.connections.size()); ++level) {
+                writer.append_links(label, level, node.connections[level]);
+            }
+            if (hnsw_deleted_labels_.test(label)) {
+                writer.append_tombstone(label); // 在 NODE 之后，重新分配后又被删除的 label 也能正确回放
+                tombstoned_nodes++;
+            }
+            node.log_dirty = false;
+            node.log_new = false;
+            changed_nodes++;
+        }
+        writer.append_entry(entry_point_label_, current_max_level_, next_label_);
+        if (!writer.close()) {
+            std::cerr << "[ERROR] Failed to append to HNSW delta log: " << log_path << std::endl;
+            for (size_t label : dirty) {
+                auto node_it = hnsw_nodes_.find(label);
+                if (node_it != hnsw_nodes_.end()) {
+                    mark_hnsw_dirty(node_it->second);
+                }
+            }
+            return;
+        }
+
+        std::cout << "[INFO] Appended " << (writer.size() - size_before) << " bytes to HNSW delta log ("
+                  << changed_nodes << " changed, " << tombstoned_nodes << " deleted, " << removed_nodes
+                  << " removed nodes)." << std::endl;
+
+        // 日志相对检查点过大时折叠成新的检查点
+        uint64_t index_size = std::filesystem::file_size(index_path);
+        if (writer.size() > hnsw_delta_checkpoint_ratio_ * static_cast<double>(index_size)) {
+            std::cout << "[INFO] HNSW delta log exceeds " << hnsw_delta_checkpoint_ratio_
+                      << " of the index size, writing a new checkpoint." << std::endl;
+            save_hnsw_index_to_disk(hnsw_data_root);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] Exception during HNSW delta save: " << e.what() << std::endl;
+    }
+}
+
+// 校验保存时的参数：维度不一致或参数非法时返回 false；M / M_max 以保存的值为准
+bool KVStore::adopt_saved_hnsw_params(uint32_t dim, uint32_t M, uint32_t M_max, uint32_t efConstruction) {
+    // 维度不一致时索引不可用，放弃加载 (构造函数会根据 embeddings 重建)
+    if (static_cast<uint32_t>(embedding_dimension_) != dim) {
+        std::cerr << "[ERROR] HNSW index dimension mismatch: saved dim=" << dim
+                  << ", current dim=" << embedding_dimension_ << ". Skipping HNSW load." << std::endl;
+        return false;
+    }
+    if (M < 2 || M_max < M) {
+        std::cerr << "[ERROR] Invalid HNSW parameters in saved index: M=" << M
+                  << ", M_max=" << M_max << ". Skipping HNSW load." << std::endl;
+        return false;
+    }
+    // 图的度数由保存时的 M / M_max 决定，加载后沿用保存的值，保证后续插入与已有图一致
+    if (static_cast<uint32_t>(HNSW_M) != M ||
+        static_cast<uint32_t>(HNSW_M_max) != M_max) {
+        std::cout << "[WARN] HNSW options differ from saved index (M=" << HNSW_M << "/" << M
+                  << ", M_max=" << HNSW_M_max << "/" << M_max
+                  << "). Using the saved values." << std::endl;
+        HNSW_M = static_cast<int>(M);
+        HNSW_M_max = static_cast<int>(M_max);
+        HNSW_m_L = 1.0 / std::log(static_cast<double>(HNSW_M));
+    }
+    // efConstruction 只影响之后的插入，保留当前配置
+    if (static_cast<uint32_t>(HNSW_efConstruction) != efConstruction) {
+        std::cout << "[INFO] HNSW efConstruction changed from saved " << efConstruction
+                  << " to " << HNSW_efConstruction << " for new insertions." << std::endl;
+    }
+    return true;
+}
+
+// 加载单文件索引：文件经 mmap 映射后按 label 顺序直接读取各段，不再逐个打开小文件
+bool KVStore::load_hnsw_index_file(const std::string &index_path) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    HNSWIndexFile index;
+    if (!index.open(index_path)) {
+        return false;
+    }
+    const HNSWIndexFileHeader& header = index.header();
+    if (!adopt_saved_hnsw_params(header.dim, header.M, header.M_max, header.efConstruction)) {
+        return false;
+    }
+    // 图是按保存时的度量建立的，沿用文件中的度量
+    const uint32_t saved_metric = (header.flags & HNSW_INDEX_METRIC_MASK) >> HNSW_INDEX_METRIC_SHIFT;
+    if (saved_metric > static_cast<uint32_t>(DistanceMetric::InnerProduct)) {
+        std::cerr << "[ERROR] Unknown distance metric " << saved_metric << " in HNSW index file: " << index_path << std::endl;
+        return false;
+    }
+    if (static_cast<DistanceMetric>(saved_metric) != distance_metric_) {
+        std::cout << "[WARN] HNSW metric differs from saved index (" << distance_metric_name(distance_metric_) << "/"
+                  << distance_metric_name(static_cast<DistanceMetric>(saved_metric)) << "). Using the saved metric."
+                  << std::endl;
+        distance_metric_ = static_cast<DistanceMetric>(saved_metric);
+        refresh_distance_kernel();
+    }
+    if (header.stride != header.M_max + 1 ||
+        (header.num_nodes > 0 && !index.has_node(header.entry_point_label))) {
+        std::cerr << "[ERROR] Corrupted HNSW index file (stride or entry point invalid): " << index_path << std::endl;
+        return false;
+    }
+
+    hnsw_nodes_.clear();
+    key_to_label_.clear();
+    label_to_key_.clear();
+    hnsw_label_vectors_.clear();
+
+    // 数据目录中没有持久化的向量时，使用索引自带的向量段
+    const bool use_index_vectors = embeddings.empty() && index.vector(0) != nullptr;
+    uint64_t loaded_node_count = 0;
+    uint64_t dropped_links = 0;
+    for (size_t label = 0; label < header.num_labels; ++label) {
+        if (!index.has_node(label)) {
+            continue;
+        }
+        const HNSWIndexLabelEntry& entry = index.entry(label);
+        auto node_it = hnsw_nodes_.emplace_hint(hnsw_nodes_.end(), std::piecewise_construct,
+                                                std::forward_as_tuple(label),
+                                                std::forward_as_tuple(entry.key, label, entry.max_level));
+        HNSWNode& node = node_it->second;
+        for (int level = 0; level <= entry.max_level; ++level) {
+            uint32_t count = 0;
+            const uint32_t* links = index.neighbors(label, level, count);
+            std::vector<size_t>& conn = node.connections[level];
+            conn.reserve(count);
+            for (uint32_t i = 0; i < count; ++i) {
+                // 越界的 label 直接丢弃；指向未保存节点的边由 finalize_loaded_hnsw_graph 统一去掉
+                if (links[i] < header.num_labels) {
+                    conn.push_back(links[i]);
+                } else {
+                    dropped_links++;
+                }
+            }
+        }
+        key_to_label_[entry.key] = label;
+        label_to_key_.emplace_hint(label_to_key_.end(), label, entry.key);
+        if (use_index_vectors) {
+            const float* vec = index.vector(label);
+            embeddings[entry.key].assign(vec, header.dim, vector_precision_);
+        }
+        loaded_node_count++;
+    }
+    if (dropped_links > 0) {
+        std::cout << "[WARN] Dropped " << dropped_links << " HNSW links with out-of-range labels." << std::endl;
+    }
+    hnsw_deleted_labels_.clear();
+    const uint32_t* deleted_labels = index.deleted_labels();
+    for (uint64_t i = 0; i < header.num_deleted; ++i) {
+        if (index.has_node(deleted_labels[i])) {
+            hnsw_deleted_labels_.set(deleted_labels[i]);
+        }
+    }
+
+    current_max_level_ = loaded_node_count > 0 ? header.max_level : -1;
+    entry_point_label_ = loaded_node_count > 0 ? header.entry_point_label : 0;
+    next_label_ = header.num_labels;
+    hnsw_checkpoint_id_ = header.checkpoint_id;
+    hnsw_rebuild_label_vectors();
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::cout << "[INFO] Finished loading HNSW index " << (index.is_mapped() ? "(mmap)" : "(buffered)") << ". Loaded "
+              << loaded_node_count << " nodes (" << hnsw_deleted_labels_.count() << " deleted) in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count()
+              << " ms. Next label will be " << next_label_ << "." << std::endl;
+    return true;
+}
+
+// 导入旧的目录格式：global_header.bin + nodes/<label>/{header.bin, edges/<level>.bin}
+bool KVStore::load_hnsw_index_legacy(const std::string &hnsw_data_root) {
+    std::string global_header_path = hnsw_data_root + "/global_header.bin";
     try {
         // 1. 加载全局头文件
         std::ifstream header_file(global_header_path, std::ios::binary);
         if (!header_file.is_open()) {
             std::cerr << "[ERROR] Failed to open global header file for reading: " << global_header_path << std::endl;
-            return;
+            return false;
         }
         HNSWGlobalHeader global_header;
         header_file.read(reinterpret_cast<char*>(&global_header), sizeof(HNSWGlobalHeader));
         if (!header_file) {
              std::cerr << "[ERROR] Failed to read global header from: " << global_header_path << std::endl;
              header_file.close();
-             return;
+             return false;
         }
         header_file.close();
 
-        // 2. 恢复/验证参数
-        // 对于 const 成员，我们验证；对于非 const 成员，我们恢复
-        if (static_cast<uint32_t>(HNSW_M) != global_header.M ||
-            static_cast<uint32_t>(HNSW_M_max) != global_header.M_max ||
-            static_cast<uint32_t>(HNSW_efConstruction) != global_header.efConstruction ||
-            static_cast<uint32_t>(embedding_dimension_) != global_header.dim) {
-            std::cerr << "[ERROR] HNSW parameter mismatch between saved index and current configuration!" << std::endl;
-            // 可以选择报错退出，或者继续加载但可能行为不确定
-            // return;
-             std::cout << "[WARN] Saved M=" << global_header.M << ", Current M=" << HNSW_M << std::endl;
-             std::cout << "[WARN] Saved M_max=" << global_header.M_max << ", Current M_max=" << HNSW_M_max << std::endl;
-             std::cout << "[WARN] Saved efC=" << global_header.efConstruction << ", Current efC=" << HNSW_efConstruction << std::endl;
-             std::cout << "[WARN] Saved dim=" << global_header.dim << ", Current dim=" << embedding_dimension_ << std::endl;
-             // 如果允许不匹配，需要决定是使用加载的参数还是当前的参数
+        if (!adopt_saved_hnsw_params(global_header.dim, global_header.M, global_header.M_max, global_header.efConstruction)) {
+            return false;
         }
         current_max_level_ = static_cast<int>(global_header.max_level);
         entry_point_label_ = global_header.entry_point_label;
@@ -2455,14 +3801,16 @@ void KVStore::load_hnsw_index_from_disk(const std::string &hnsw_data_root) {
 
         // 3. 清空当前内存中的 HNSW 结构
         hnsw_nodes_.clear();
+        hnsw_deleted_labels_.clear(); // 旧格式不保存已删除节点，deleted_nodes.bin 中的向量不再使用
         key_to_label_.clear();
         label_to_key_.clear();
+        hnsw_label_vectors_.clear();
 
         // 4. 加载节点数据
         std::string nodes_path = hnsw_data_root + "/nodes";
         if (!std::filesystem::exists(nodes_path)) {
             std::cerr << "[ERROR] HNSW nodes directory not found: " << nodes_path << std::endl;
-            return;
+            return false;
         }
 
         // 遍历 nodes 目录下的子目录 (假设子目录名是 label)
@@ -2501,9 +3849,8 @@ void KVStore::load_hnsw_index_from_disk(const std::string &hnsw_data_root) {
                 node_header_file.close();
 
                 // 创建 HNSWNode 对象 (暂时不设置 connections)
-                // 方案2核心：加载的节点默认为 active (deleted = false)
+                // 方案2核心：加载的节点默认为 active
                 HNSWNode node(node_header.key, label, static_cast<int>(node_header.max_level));
-                node.deleted = false; // Explicitly set to false as per Scheme 2
                 node.connections.resize(node.max_level + 1); // 预分配空间
 
                 // 加载边的文件
@@ -2565,129 +3912,87 @@ void KVStore::load_hnsw_index_from_disk(const std::string &hnsw_data_root) {
 
         // 更新 next_label_
         next_label_ = max_loaded_label + 1; // 确保下一个分配的 label 是唯一的
+        hnsw_rebuild_label_vectors();
          std::cout << "[INFO] Finished loading HNSW index. Loaded " << loaded_node_count << " nodes. Next label will be " << next_label_ << "." << std::endl;
-
-    // --- Phase 4: 加载 deleted_nodes.bin --- (这部分逻辑保留，用于搜索时的过滤)
-    loaded_deleted_vectors_.clear();
-    std::string deleted_nodes_path = hnsw_data_root + "/deleted_nodes.bin";
-    if (std::filesystem::exists(deleted_nodes_path)) {
-        std::ifstream dn_file(deleted_nodes_path, std::ios::binary);
-        if (!dn_file.is_open()) {
-            std::cerr << "[ERROR] Failed to open " << deleted_nodes_path << " for reading." << std::endl;
-        } else {
-            if (embedding_dimension_ > 0) {
-                std::vector<float> temp_vec(embedding_dimension_);
-                while (dn_file.read(reinterpret_cast<char*>(temp_vec.data()), embedding_dimension_ * sizeof(float))) {
-                    if (dn_file.gcount() == embedding_dimension_ * sizeof(float)) {
-                        loaded_deleted_vectors_.push_back(temp_vec);
-                    } else {
-                        std::cerr << "[ERROR] Incomplete vector read from deleted_nodes.bin." << std::endl;
-                        break; 
-                    }
-                }
-                dn_file.close();
-                std::cout << "[INFO] Loaded " << loaded_deleted_vectors_.size() << " vectors from deleted_nodes.bin." << std::endl;
-
-                // --- THIS IS THE BLOCK TO BE COMMENTED OUT ---
-                /*
-                int marked_deleted_count = 0;
-                if (!loaded_deleted_vectors_.empty()) {
-                    for (auto& pair : hnsw_nodes_) { 
-                        HNSWNode& node = pair.second;
-                        if (node.deleted) continue; 
-                        if (embeddings.count(node.key)) {
-                            const std::vector<float>& node_vec = embeddings[node.key];
-                            if (node_vec.size() == embedding_dimension_) {
-                                for (const auto& deleted_vec : loaded_deleted_vectors_) {
-                                    if (compare_float_vectors(node_vec, deleted_vec)) { // Using compare_float_vectors
-                                        node.deleted = true;
-                                        marked_deleted_count++;
-                                        break; 
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    if (marked_deleted_count > 0) {
-                         std::cout << "[INFO] Marked " << marked_deleted_count << " HNSW nodes as deleted based on loaded_deleted_vectors." << std::endl;
-                    }
-                }
-                */
-                // --- END OF BLOCK TO BE COMMENTED OUT ---
-
-            } else {
-                std::cerr << "[WARN] Embedding dimension is 0, cannot process deleted_nodes.bin." << std::endl;
-                dn_file.close();
-            }
-        }
-    } else {
-        std::cout << "[INFO] " << deleted_nodes_path << " not found. No deleted HNSW vectors loaded." << std::endl;
-    }
-    // --- End Phase 4 deleted_nodes.bin load ---
-
+        return true;
     } catch (const std::filesystem::filesystem_error& e) {
         std::cerr << "[ERROR] Filesystem error during HNSW load: " << e.what() << std::endl;
         // 清空状态以避免使用部分加载的数据
-        hnsw_nodes_.clear(); key_to_label_.clear(); label_to_key_.clear(); current_max_level_ = -1;
+        hnsw_nodes_.clear(); key_to_label_.clear(); label_to_key_.clear(); hnsw_label_vectors_.clear(); current_max_level_ = -1;
+        return false;
     } catch (const std::exception& e) {
         std::cerr << "[ERROR] Exception during HNSW load: " << e.what() << std::endl;
-        hnsw_nodes_.clear(); key_to_label_.clear(); label_to_key_.clear(); current_max_level_ = -1;
+        hnsw_nodes_.clear(); key_to_label_.clear(); label_to_key_.clear(); hnsw_label_vectors_.clear(); current_max_level_ = -1;
+        return false;
     } catch (...) {
         std::cerr << "[ERROR] Unknown exception during HNSW load." << std::endl;
-        hnsw_nodes_.clear(); key_to_label_.clear(); label_to_key_.clear(); current_max_level_ = -1;
+        hnsw_nodes_.clear(); key_to_label_.clear(); label_to_key_.clear(); hnsw_label_vectors_.clear(); current_max_level_ = -1;
+        return false;
     }
 }
+
 // --- HNSW 索引加载结束 ---
 
 // --- ADDED: Implementation for put_with_precomputed_embedding ---
 void KVStore::put_with_precomputed_embedding(uint64_t key, const std::string &val, const std::vector<float>& precomputed_emb) {
+    finish_hnsw_consolidation();
+    if (stage_precomputed_embedding(key, val, precomputed_emb)) {
+        if (vector_index_type_ == VectorIndexType::IVF) {
+            ivf_insert(key, embeddings[key]);
+        } else {
+            hnsw_insert(key, precomputed_emb); // Insert/update in HNSW graph
+        }
+    }
+}
+
+void KVStore::put_batch_with_precomputed_embedding(const std::vector<uint64_t> &keys,
+                                                   const std::vector<std::string> &values,
+                                                   const std::vector<std::vector<float>> &precomputed_embs) {
+    finish_hnsw_consolidation();
+    if (keys.size() != values.size() || keys.size() != precomputed_embs.size()) {
+        std::cerr << "[ERROR] KVStore::put_batch_with_precomputed_embedding - Size mismatch: " << keys.size()
+                  << " keys, " << values.size() << " values, " << precomputed_embs.size() << " embeddings." << std::endl;
+        return;
+    }
+
+    std::vector<std::pair<uint64_t, const StoredVector*>> to_index;
+    to_index.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (stage_precomputed_embedding(keys[i], values[i], precomputed_embs[i])) {
+            to_index.emplace_back(keys[i], nullptr);
+        }
+    }
+    if (vector_index_type_ == VectorIndexType::IVF) {
+        for (const auto& item : to_index) {
+            ivf_insert(item.first, embeddings[item.first]);
+        }
+        return;
+    }
+    // embeddings 在本批写入结束后不再变化，此时取到的向量地址在构建期间保持有效
+    for (auto& item : to_index) {
+        item.second = &embeddings[item.first];
+    }
+    hnsw_build_parallel(to_index);
+}
+
+// LSM 写入 + embeddings map 更新，不触碰 HNSW 图的连边。返回 true 表示该 key 需要(重新)建索引
+bool KVStore::stage_precomputed_embedding(uint64_t key, const std::string &val, const std::vector<float>& precomputed_emb) {
     // --- LSM Put Logic (similar to original put) ---
     uint32_t nxtsize = s->getBytes();
+    uint64_t nxtcnt = s->getCnt();
     std::string res = s->search(key);
     if (!res.length()) {
         nxtsize += 12 + val.length();
+        nxtcnt++;
     } else {
         nxtsize = nxtsize - res.length() + val.length();
     }
 
-    if (nxtsize + 10240 + 32 <= MAXSIZE) {
+    if (nxtsize + 10240 + 32 + memtable_vector_bytes(nxtcnt) <= MAXSIZE) {
         s->insert(key, val);
     } else {
         sstable ss(s);
-        const std::string embedding_file_path = dir_ + "/embeddings.bin"; // NEW
-        std::ofstream embed_file(embedding_file_path, std::ios::binary | std::ios::app);
-        if (embed_file.is_open()) {
-            embed_file.seekp(0, std::ios::end);
-            if (embed_file.tellp() == 0) {
-                 uint64_t dim_to_write = embedding_dimension_;
-                 if (dim_to_write == 0 && !precomputed_emb.empty()) dim_to_write = precomputed_emb.size(); // Get dim from first precomputed if not set
-                 if (dim_to_write > 0) {
-                    embed_file.write(reinterpret_cast<const char*>(&dim_to_write), sizeof(dim_to_write));
-                 } else {
-                    std::cerr << "[WARN] KVStore::put_with_precomputed_embedding - Dimension is 0, cannot write embedding header." << std::endl;
-                 }
-            }
-            slnode *cur = s->getFirst();
-            while (cur && cur->type != TAIL) {
-                uint64_t current_key = cur->key;
-                if (embeddings.count(current_key)) { // embeddings map should be populated by this function or original put
-                    const std::vector<float>& vec_to_save = embeddings[current_key];
-                    if (vec_to_save.size() == embedding_dimension_ || (embedding_dimension_ == 0 && !vec_to_save.empty())) {
-                         if (embedding_dimension_ == 0) embedding_dimension_ = vec_to_save.size(); // Set if first time
-                        embed_file.write(reinterpret_cast<const char*>(&current_key), sizeof(current_key));
-                        embed_file.write(reinterpret_cast<const char*>(vec_to_save.data()), vec_to_save.size() * sizeof(float));
-                    } else {
-                         std::cerr << "[WARN] KVStore::put_with_precomputed_embedding - Dimension mismatch for key " << current_key << " during SSTable flush. Skipping save." << std::endl;
-                    }
-                } else {
-                     std::cerr << "[WARN] KVStore::put_with_precomputed_embedding - Embedding not found for key " << current_key << " in embeddings map during SSTable flush. Skipping save." << std::endl;
-                }
-                cur = cur->nxt[0];
-            }
-            embed_file.close();
-        } else {
-            std::cerr << "[ERROR] KVStore::put_with_precomputed_embedding - Failed to open embedding file for writing: " << embedding_file_path << std::endl;
-        }
+        attach_memtable_vectors(ss);
 
         s->reset();
         std::string level0_path = dir_ + "/level-0"; // MODIFIED: Use dir_
@@ -2715,22 +4020,22 @@ void KVStore::put_with_precomputed_embedding(uint64_t key, const std::string &va
         } else if (embedding_dimension_ != precomputed_emb.size()) {
             std::cerr << "[ERROR] KVStore::put_with_precomputed_embedding - Precomputed embedding dimension mismatch for key " << key 
                       << ". Expected " << embedding_dimension_ << " got " << precomputed_emb.size() << std::endl;
-            return; 
+            return false;
         }
 
         if (key_to_label_.count(key)) {
             size_t old_label = key_to_label_[key];
-            if (hnsw_nodes_.count(old_label)) {
-                hnsw_nodes_[old_label].deleted = true;
-            }
+            tombstone_hnsw_node(old_label);
         }
+        pending_embedding_keys_.erase(key);
 
-        embeddings[key] = precomputed_emb; // Store/update in the main embeddings map
-        hnsw_insert(key, precomputed_emb); // Insert/update in HNSW graph
+        embeddings[key].assign(precomputed_emb, vector_precision_); // Store/update in the main embeddings map
+        return true;
 
     } else {
         std::cerr << "[WARN] KVStore::put_with_precomputed_embedding - Called with empty precomputed_emb for key " << key << std::endl;
     }
+    return false;
 }
 // --- END ADDED ---
 
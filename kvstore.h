@@ -4,6 +4,13 @@
 #include "skiplist.h"
 #include "sstable.h"
 #include "sstablehead.h"
+#include "hnsw_visited.h"
+#include "label_bitmap.h"
+#include "stored_vector.h"
+#include "embedding_cache.h"
+#include "embedding_pipeline.h"
+#include "ivf_index.h"
+#include "vamana_index.h"
 
 #include <map>
 #include <set>
@@ -11,19 +18,45 @@
 #include <cmath>       // For std::sqrt, std::log
 #include <random>      // For level generation
 #include <queue>       // For priority_queue in search
-#include <unordered_set> // For visited nodes in search
 #include <limits>      // For std::numeric_limits
 #include <algorithm>   // For std::max, std::min, std::sort
 #include <chrono>      // For timing
 #include <memory>      // For std::unique_ptr if needed elsewhere, though not for HNSW now
+#include <atomic>      // For HNSWSpinLock
+#include <mutex>       // For hnsw_global_mutex_
+#include <thread>      // For std::this_thread::yield
+#include <functional>  // For HNSWKeyFilter
+#include <unordered_map> // For pending_embedding_keys_
 
 // --- Phase 3: HNSW 自定义实现所需结构 ---
+
+// 保护单个节点邻居表的自旋锁 (并行构建时使用)。拷贝节点时不拷贝锁状态
+struct HNSWSpinLock {
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+
+    HNSWSpinLock() = default;
+    HNSWSpinLock(const HNSWSpinLock &) {}
+    HNSWSpinLock &operator=(const HNSWSpinLock &) { return *this; }
+
+    void lock() {
+        while (flag.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    void unlock() {
+        flag.clear(std::memory_order_release);
+    }
+};
+
 struct HNSWNode {
     uint64_t key;                    // 对应的 KVStore key
     size_t label;                    // 在 HNSW 图中的唯一标识符
     int max_level;                   // 该节点存在的最高层级 (从 0 开始)
     std::vector<std::vector<size_t>> connections; // connections[i] 存储第 i 层邻居的 label
-    bool deleted = false;            // 懒删除标记
+    bool log_dirty = false;          // 自上次持久化后有变更，等待写入增量日志
+    bool log_new = false;            // 自上次持久化后新建 (或 label 被重新分配)
+    mutable HNSWSpinLock link_lock;  // 保护 connections 的读写
 
     // 构造函数 (示例)
     HNSWNode(uint64_t k, size_t l, int lvl) : key(k), label(l), max_level(lvl) {
@@ -46,8 +79,86 @@ struct MaxHNSWHeapComparer {
     }
 };
 
+// 向量索引引擎：HNSW 图，或插入更便宜、内存更省的 IVF-Flat 倒排索引
+enum class VectorIndexType {
+    HNSW,
+    IVF,
+};
+
+// HNSW 运行时参数，构造 KVStore 时传入。加载已保存的索引时 M / M_max 以索引文件为准
+struct HNSWOptions {
+    int M = 10;                // 每层连接数
+    int M_max = 20;            // 每层最大连接数 (通常是 M 的 2 倍左右)
+    int ef_construction = 100; // 构建时候选列表大小
+    int ef_search = 0;         // 默认搜索宽度，0 表示 max(ef_construction, k * 10)；可被单次查询的 ef 覆盖
+    size_t build_threads = 0;  // 并行构建线程数，0 表示 hardware_concurrency
+    size_t search_threads = 0; // 批量查询线程数，0 表示 hardware_concurrency
+    bool index_vectors = false; // 保存单文件索引时附带向量段，使索引文件可脱离数据目录中的向量使用
+    double delta_checkpoint_ratio = 0.5; // 增量日志超过索引文件大小的该比例时，save_hnsw_delta 改为完整保存
+    double consolidate_ratio = 0.1;      // del 之后墓碑节点占比超过该值时在后台整理图，0 表示只在显式调用时整理
+    double filter_brute_force_ratio = 0.05; // 过滤搜索中满足条件的节点占比低于该值 (或不多于 ef) 时直接暴力计算
+
+    // 邻居选择 (插入、超出 M_max 时的剪枝、整理删除节点时共用)。启发式按距离从近到远考察候选，
+    // 只保留到基准点比到所有已选邻居都近的候选，使邻居分布在不同方向上；关闭时直接取最近的 M 个。
+    // extend_candidates：插入时把候选的邻居也加入候选集 (适合聚簇明显的数据，建图更慢)；
+    // keep_pruned_connections：启发式选不满 M 个时用被淘汰的最近候选补足
+    bool neighbor_heuristic = true;
+    bool extend_candidates = false;
+    bool keep_pruned_connections = false;
+
+    // 向量索引引擎。选 IVF 时不维护 HNSW 图，近似查询使用 search_knn_ivf。IVF 索引不落盘，
+    // 每次打开时用 SSTable 向量块中的向量重建
+    VectorIndexType index_type = VectorIndexType::HNSW;
+    size_t ivf_nlist = 0;        // 倒排表个数，0 表示训练时取 sqrt(向量数)
+    size_t ivf_nprobe = 8;       // 默认每次查询扫描的倒排表个数，可被单次查询覆盖
+    size_t ivf_train_size = 4096; // 向量数达到该值时自动训练；之后每增长到上次训练时的 4 倍重新训练
+
+    // 文本 -> embedding 缓存的条目上限 (768 维约 3 KiB 一条)，0 表示禁用。缓存保存在数据目录的 embedding_cache.bin
+    size_t embedding_cache_entries = 16384;
+
+    // 异步 embedding：put 只写 LSM 并把文本放进队列，后台线程凑够 embedding_batch_size 条或等满
+    // embedding_batch_delay_ms 后批量推理，向量在之后的 put / del / sync_embeddings 中写入向量表与索引
+    bool async_embedding = false;
+    size_t embedding_batch_size = 32;
+    int embedding_batch_delay_ms = 5;
+
+    // 推理上下文池：embedding_contexts 个 llama_context 共享同一份模型权重并行推理 (每个上下文另占一份
+    // KV cache / 计算缓冲)，每个使用 embedding_threads 个线程，0 表示 llama.cpp 默认值。
+    // 异步模式下后台推理线程数与上下文数相同
+    size_t embedding_contexts = 1;
+    int embedding_threads = 0;
+
+    // 向量在内存与 SSTable 向量块中的存储精度。fp16 / bf16 内存和扫描带宽减半，召回率略有下降；
+    // 查询向量保持 float，距离计算时再转换。已有数据按原精度读入后转换，之后合并写出的表使用新精度
+    VectorPrecision vector_precision = VectorPrecision::Float32;
+
+    // Matryoshka 截断搜索：大于 0 且小于向量维度时，HNSW 图的构建与遍历只用前 search_prefix_dim 维
+    // (余弦距离在前缀上计算，相当于对截断后的前缀重新归一化)，搜索得到的 ef 个候选再用完整维度重排。
+    // 只适用于按 Matryoshka 方式训练的模型 (如 nomic-embed-text-v1.5 的 256 / 128 维前缀)。
+    // 精确的 search_knn 始终使用完整维度
+    size_t search_prefix_dim = 0;
+
+    // 搜索扩展一个节点时，先收集未访问的邻居，再在计算第 i 个邻居的距离时预取第 i + prefetch_distance 个
+    // 邻居的向量 (以及访问表中的 tag)，让内存访问与距离计算重叠。0 表示不预取
+    int prefetch_distance = 4;
+
+    // 完整保存索引 (save_hnsw_index_to_disk，包括 save_hnsw_delta 退化成的完整保存) 之前先调用 reorder_hnsw_graph，
+    // 让索引文件与内存中的节点按图的邻近关系排列
+    bool reorder_on_save = false;
+
+    // 距离度量 (HNSW 建图与搜索、精确 search_knn 共用)。保存在索引文件中，加载已有索引时以文件为准；
+    // 更换度量需要重建索引。IVF 与磁盘 Vamana 索引始终使用余弦：选择 IVF 引擎时其它度量被忽略 (打印警告)，
+    // 整个 store (包括精确的 search_knn) 按余弦计算
+    DistanceMetric metric = DistanceMetric::Cosine;
+};
+
+// 过滤搜索的谓词：返回 true 表示 key 可以出现在结果中
+using HNSWKeyFilter = std::function<bool(uint64_t key)>;
+
 // --------------------------------------------
 
+class ThreadPool; // 定义在 kvstore.cc
+
 class KVStore : public KVStoreAPI {
     // You can add your implementation here
 private:
@@ -60,7 +171,8 @@ private:
     int totalLevel = -1; // 层数
 
     // 添加嵌入向量存储
-    std::map<uint64_t, std::vector<float>> embeddings; // 存储key对应的value的向量表示
+    std::map<uint64_t, StoredVector> embeddings; // 存储key对应的value的向量表示 (按 vector_precision_ 保存)
+    VectorPrecision vector_precision_ = VectorPrecision::Float32;
 
     // --- Phase 3: HNSW 自定义实现所需成员 ---
     std::map<size_t, HNSWNode> hnsw_nodes_; // 存储所有 HNSW 节点 (label -> Node)
@@ -70,45 +182,140 @@ private:
     size_t entry_point_label_ = 0; // HNSW 图的入口点 label
     int current_max_level_ = -1;   // 当前 HNSW 图的最高层级 (初始化为 -1 表示空图)
     int embedding_dimension_ = 0;  // 向量维度
-
-    // --- Phase 4: HNSW 删除持久化所需成员 ---
-    // std::set<uint64_t> keys_marked_for_hnsw_deletion_; // 存储被del标记的HNSW key，用于写入deleted_nodes.bin
-    std::vector<std::vector<float>> hnsw_vectors_to_persist_as_deleted_; // Stores actual vectors of HNSW nodes that were deleted
-    std::vector<std::vector<float>> loaded_deleted_vectors_; // 从deleted_nodes.bin加载的向量，用于查询时过滤
-    // ------------------------------------------
-
-    // HNSW 参数 (根据 README-phase3.md 推荐值或自行调整)
-    const int HNSW_M = 10;             // 每层连接数
-    const int HNSW_M_max = 20;         // 每层最大连接数 (通常是 M 的 2 倍左右)
-    const int HNSW_efConstruction = 100; // 构建时候选列表大小 (原为 40)
-    const double HNSW_m_L = 1.0 / std::log(static_cast<double>(HNSW_M)); // 层数选择参数
+    VisitedListPool visited_list_pool_; // 搜索用访问表池 (按 label 的 epoch 标记)
+    std::mutex hnsw_global_mutex_;      // 保护 entry_point_label_ / current_max_level_ 的变更
+    size_t hnsw_build_threads_ = 0;     // 并行构建线程数，0 表示 hardware_concurrency
+    size_t hnsw_search_threads_ = 0;    // 批量查询线程数，0 表示 hardware_concurrency
+    bool hnsw_index_vectors_ = false;   // 保存索引时是否写入向量段
+    double hnsw_delta_checkpoint_ratio_ = 0.5;
+    double hnsw_consolidate_ratio_ = 0.1;
+    double hnsw_filter_brute_force_ratio_ = 0.05;
+    bool hnsw_neighbor_heuristic_ = true;
+    bool hnsw_extend_candidates_ = false;
+    bool hnsw_keep_pruned_connections_ = false;
+    size_t hnsw_prefix_dim_ = 0;        // Matryoshka 前缀维度，0 表示使用完整维度
+    int hnsw_prefetch_distance_ = 4;    // 搜索时提前预取的邻居数，0 表示不预取
+    bool hnsw_reorder_on_save_ = false;
+    DistanceMetric distance_metric_ = DistanceMetric::Cosine;
+    DistanceKernel distance_kernel_ = nullptr; // 按 (度量, vector_precision_, HNSW 距离维度) 预先选好的内核
+    size_t distance_kernel_dims_ = 0;
+    std::vector<const StoredVector*> hnsw_label_vectors_; // label -> embeddings 中的向量 (map 节点地址稳定)，空指针时回退查表
+
+    // --- IVF 引擎 (HNSWOptions::index_type == IVF 时使用) ---
+    VectorIndexType vector_index_type_ = VectorIndexType::HNSW;
+    IVFIndex ivf_index_;
+    size_t ivf_nlist_ = 0;
+    size_t ivf_nprobe_ = 8;
+    size_t ivf_train_size_ = 4096;
+    size_t ivf_trained_count_ = 0; // 上次训练时的向量数，0 表示未训练
+
+    EmbeddingCache embedding_cache_;
+    bool async_embedding_ = false;
+    size_t embedding_batch_size_ = 32;
+    int embedding_batch_delay_ms_ = 5;
+    size_t embedding_contexts_ = 1;
+    int embedding_threads_ = 0;
+    std::unique_ptr<EmbeddingPipeline> embedding_pipeline_; // async_embedding 时创建
+    uint64_t embedding_seq_ = 0;
+    std::unordered_map<uint64_t, uint64_t> pending_embedding_keys_; // 向量尚未应用的 key -> 最近一次提交的序号
+
+    // --- 磁盘 Vamana 索引 (build_disk_index 生成的静态快照) ---
+    VamanaIndex disk_index_;
+    VamanaOptions disk_index_options_;
+    LabelBitmap hnsw_deleted_labels_;         // del 标记、尚未从图中移除的节点 (墓碑)
+    std::vector<size_t> hnsw_free_labels_;    // 已移除节点释放的 label，新节点优先复用
+    // del 触发的后台整理：线程只修复邻居表 (与搜索、del 并发，节点锁保护邻居表)，
+    // 把节点移出图由下一次写入 / 保存前的 finish_hnsw_consolidation 在调用线程完成
+    std::thread hnsw_consolidate_thread_;
+    LabelBitmap hnsw_consolidating_labels_;   // 后台整理开始时的墓碑快照
+    size_t hnsw_consolidate_repaired_ = 0;    // 后台线程修复的邻居表数
+    std::chrono::high_resolution_clock::time_point hnsw_consolidate_start_;
+
+    // --- HNSW 增量持久化 (hnsw_delta.log) ---
+    std::string hnsw_checkpoint_root_;  // 最近一次完整保存/加载的索引目录
+    uint64_t hnsw_checkpoint_id_ = 0;   // 该目录下 hnsw_index.bin 的 checkpoint_id，0 表示没有可追加的检查点
+    std::vector<size_t> hnsw_dirty_labels_; // log_dirty 被置位的节点
+    std::mutex hnsw_dirty_mutex_;
+    std::unique_ptr<ThreadPool> search_pool_; // 批量查询的工作线程池 (首次使用时创建)
+    std::once_flag search_pool_once_;
+    std::unique_ptr<ThreadPool> scan_pool_;   // 精确 kNN 分段扫描的线程池 (首次使用时创建)。
+    std::once_flag scan_pool_once_;           // 与 search_pool_ 分开：批量查询线程里也会调用 search_knn
+
+    // HNSW 参数 (由构造时的 HNSWOptions 设置，默认值见 HNSWOptions)
+    int HNSW_M = 10;             // 每层连接数
+    int HNSW_M_max = 20;         // 每层最大连接数
+    int HNSW_efConstruction = 100; // 构建时候选列表大小
+    int HNSW_efSearch = 0;       // 默认搜索宽度，0 表示 max(efConstruction, k * 10)
+    double HNSW_m_L = 1.0 / std::log(static_cast<double>(HNSW_M)); // 层数选择参数
 
     // 随机数生成器 (用于层级选择)
     std::mt19937 rng_{std::random_device{}()};
 
     // --- Phase 3: HNSW 内部辅助函数声明 ---
     float calculate_distance(const std::vector<float>& v1, const std::vector<float>& v2);
+    float calculate_distance(const std::vector<float>& query, const StoredVector& vec); // HNSW 距离 (可能只用前缀)
+    float metric_distance(const std::vector<float>& query, const StoredVector& vec, size_t dims) const; // 前 dims 维上的距离
+    void refresh_distance_kernel(); // 度量、精度或维度变化后重新选择 distance_kernel_
+    size_t hnsw_distance_dims(size_t dim) const; // HNSW 距离实际使用的维度
+    void hnsw_rerank_full(const std::vector<float>& query, std::vector<HNSWHeapItem>& hits) const; // 前缀搜索后按完整维度重排
     int get_random_level();
     std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer>
         search_layer_internal(size_t entry_point_label,
                               const std::vector<float>& query_vec,
                               int target_level,
                               int ef, // ef 控制搜索范围/返回数量
-                              bool limited_search = false); // true表示只找最近的1个(用于高层)
+                              bool limited_search = false, // true表示只找最近的1个(用于高层)
+                              const LabelBitmap* allowed = nullptr, // 非空时只有其中的 label 进入结果，其余节点仍可经过
+                              const HNSWKeyFilter* filter = nullptr); // 同上，按需对遍历到的节点调用谓词
     std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer>
         search_base_layer(size_t entry_point_label, const std::vector<float>& query_vec, int efSearch);
+    size_t hnsw_descend_to_base(const std::vector<float>& query_vec); // 高层贪心下降，返回第 0 层入口
+    int hnsw_search_ef(int k, int ef) const; // ef <= 0 时取默认搜索宽度，且不小于 k
+    std::vector<std::pair<uint64_t, std::string>>
+        search_knn_hnsw_allowed(const std::vector<float>& query_vec, int k, const LabelBitmap& allowed, int ef);
+    std::vector<HNSWHeapItem> hnsw_brute_force_hits(const std::vector<float>& query_vec, const LabelBitmap& allowed, int ef);
+    std::vector<std::pair<uint64_t, std::string>>
+        hnsw_hits_to_results(const std::vector<float>& query_vec, std::vector<HNSWHeapItem>& hits, int k);
+    // candidates 为到 base_vec 的距离 {distance, label}，调用后被清空。extend 时在 level 层扩展候选，
+    // 需读取候选的邻居表 (会获取它们的 link_lock，调用方不能持有任何节点锁)。exclude_label 不会被选中
     std::vector<size_t> select_neighbors(
+            const std::vector<float>& base_vec,
             std::priority_queue<HNSWHeapItem, std::vector<HNSWHeapItem>, MinHNSWHeapComparer>& candidates,
-            int M);
+            int M, int level = 0, bool extend = false,
+            size_t exclude_label = std::numeric_limits<size_t>::max());
     void hnsw_insert(uint64_t key, const std::vector<float>& vec);
+    size_t hnsw_prepare_node(uint64_t key);                            // 分配 label/层级 (串行)
+    void hnsw_connect_node(size_t label, const std::vector<float>& vec); // 连边 (可并发)
+    void hnsw_build_parallel(const std::vector<std::pair<uint64_t, const StoredVector*>>& items);
+    const StoredVector* hnsw_vector_of(size_t label) const;
+    void hnsw_update_label_vector(size_t label); // label_to_key_ 中该 label 变化后刷新 hnsw_label_vectors_
+    void hnsw_rebuild_label_vectors();           // 按 label_to_key_ 整体重建 hnsw_label_vectors_
+    bool stage_precomputed_embedding(uint64_t key, const std::string &val, const std::vector<float>& precomputed_emb);
+    void memtable_put(uint64_t key, const std::string &s_val);
+    void attach_memtable_vectors(sstable &ss); // 刷盘前把 memtable 中各 key 的向量放进 SSTable 的向量块
+    uint32_t memtable_vector_bytes(uint64_t count) const; // count 个 key 刷盘时向量块的大小上限
+    void load_sstable_embeddings();            // 由各 SSTable 的向量块恢复 embeddings
+    void migrate_legacy_embeddings();          // 把旧的 embeddings.bin 写进向量块后删除
+    void index_embedding(uint64_t key, const std::vector<float>& emb_vec, bool is_update);
+    std::vector<std::vector<float>> get_embeddings(const std::vector<std::string>& texts); // 批量版 get_embedding (可在后台线程调用)
     void prune_connections(size_t node_label, int level, int max_conn); // Helper for M_max pruning
-
-    // --- ADDED: Custom float vector comparison with tolerance ---
-    static bool compare_float_vectors(const std::vector<float>& v1, const std::vector<float>& v2, float epsilon = 1e-1f);
-    // --- END ADDED ---
+    void apply_hnsw_options(const HNSWOptions& options); // 校验并设置 HNSW 参数
+    bool adopt_saved_hnsw_params(uint32_t dim, uint32_t M, uint32_t M_max, uint32_t efConstruction);
+    bool load_hnsw_index_file(const std::string &index_path);       // 单文件格式 (hnsw_index.bin)
+    bool load_hnsw_index_legacy(const std::string &hnsw_data_root); // 旧的每节点一个目录的格式
+    void replay_hnsw_delta_log(const std::string &hnsw_data_root);
+    void mark_hnsw_dirty(HNSWNode& node); // 并发构建时调用方需持有 node.link_lock
+    bool tombstone_hnsw_node(size_t label); // 标记删除，节点已是墓碑或不存在时返回 false
+    void clear_hnsw_dirty();
+    void finalize_loaded_hnsw_graph(); // 加载后去掉指向不存在节点的边，并收集空闲 label
+    size_t hnsw_repair_links(const LabelBitmap& dead); // 绕开 dead 中的节点重选邻居，返回修复的邻居表数
+    size_t hnsw_remove_nodes(const LabelBitmap& dead); // 把 dead 中的节点移出图并释放 label，返回移除数
+    void start_hnsw_consolidation();   // 对当前墓碑启动后台整理 (已有整理在进行时不做任何事)
+    size_t finish_hnsw_consolidation(); // 等待后台整理并移除节点；插入、加载、保存和重排之前调用
+    void ivf_insert(uint64_t key, const StoredVector& vec); // 插入 IVF (vec 为 embeddings 中的向量)，必要时自动 (重新) 训练
 
 public:
-    KVStore(const std::string &dir, const std::string &hnsw_index_path = "");
+    KVStore(const std::string &dir, const std::string &hnsw_index_path = "", const HNSWOptions &hnsw_options = HNSWOptions());
 
     ~KVStore();
 
@@ -127,23 +334,83 @@ public:
     std::vector<std::pair<uint64_t, std::string>> search_knn(const std::vector<float>& query_vec, int k);
 
     // 增加search_knn_hnsw函数声明
-    std::vector<std::pair<uint64_t, std::string>> search_knn_hnsw(std::string query, int k);
-    std::vector<std::pair<uint64_t, std::string>> search_knn_hnsw(const std::vector<float>& query_vec, int k);
-    std::vector<std::pair<uint64_t, std::string>> search_knn_hnsw(const std::vector<float>& query_vec, int k, bool is_string_query, const std::string& query_text);
+    // ef <= 0 表示使用 HNSWOptions::ef_search (或其默认值)
+    std::vector<std::pair<uint64_t, std::string>> search_knn_hnsw(std::string query, int k, int ef = 0);
+    std::vector<std::pair<uint64_t, std::string>> search_knn_hnsw(const std::vector<float>& query_vec, int k, int ef = 0);
+    std::vector<std::pair<uint64_t, std::string>> search_knn_hnsw(const std::vector<float>& query_vec, int k, bool is_string_query, const std::string& query_text, int ef = 0);
+    // 批量查询，在内部线程池上并行执行；ef <= 0 表示使用默认搜索宽度
+    std::vector<std::vector<std::pair<uint64_t, std::string>>>
+        search_knn_hnsw_batch(const std::vector<std::vector<float>>& queries, int k, int ef = 0);
+    // 过滤搜索：只返回满足 filter 的 key，过滤在图遍历时进行，filter 只对遍历到的节点 (以及少量用于估计
+    // 选择率的抽样节点) 调用；满足条件的节点很少时改为对全部节点求值并直接暴力计算。
+    // 结果按距离升序，不足 k 个时不补齐
+    std::vector<std::pair<uint64_t, std::string>>
+        search_knn_hnsw_filtered(const std::vector<float>& query_vec, int k, const HNSWKeyFilter& filter, int ef = 0);
+    std::vector<std::pair<uint64_t, std::string>>
+        search_knn_hnsw_filtered(std::string query, int k, const HNSWKeyFilter& filter, int ef = 0);
+    // 只在 key 属于 [key_min, key_max] 的节点中搜索
+    std::vector<std::pair<uint64_t, std::string>>
+        search_knn_hnsw_filtered(const std::vector<float>& query_vec, int k, uint64_t key_min, uint64_t key_max, int ef = 0);
+
+    // 范围查询：返回与 query 的距离 (按 HNSWOptions::metric，余弦为 1 - cos) 不超过 radius 的 key，按距离升序，
+    // 最多 max_results 个 (0 表示不限)。先用 ef 宽度的束搜索找到种子，再从半径内的点按距离优先向外扩展，
+    // 结果数随半径自适应；ef <= 0 表示默认搜索宽度。search_radius_exact 扫描全部向量，结果完整
+    std::vector<std::pair<uint64_t, std::string>>
+        search_radius(const std::vector<float>& query_vec, float radius, size_t max_results = 0, int ef = 0);
+    std::vector<std::pair<uint64_t, std::string>>
+        search_radius(std::string query, float radius, size_t max_results = 0, int ef = 0);
+    std::vector<std::pair<uint64_t, std::string>>
+        search_radius_exact(const std::vector<float>& query_vec, float radius, size_t max_results = 0);
+
+    // IVF 引擎的近似查询；nprobe <= 0 表示使用 HNSWOptions::ivf_nprobe。未选 IVF 引擎时返回空
+    std::vector<std::pair<uint64_t, std::string>> search_knn_ivf(const std::vector<float>& query_vec, int k, int nprobe = 0);
+    std::vector<std::pair<uint64_t, std::string>> search_knn_ivf(std::string query, int k, int nprobe = 0);
+    // 用当前全部向量重新训练 IVF 质心 (nlist 为 0 时按 HNSWOptions::ivf_nlist / sqrt(向量数) 选取)
+    void train_ivf_index(size_t nlist = 0);
+
+    // 用当前全部向量构建磁盘 Vamana 索引 (DiskANN) 并打开。索引是构建时刻的快照，之后写入的向量要重新构建才能查到
+    bool build_disk_index(const std::string& path, const VamanaOptions& options = VamanaOptions());
+    // 打开已有的磁盘索引；options 中只使用 search_L / beam_width
+    bool open_disk_index(const std::string& path, const VamanaOptions& options = VamanaOptions());
+    // 磁盘索引上的近似查询；search_L <= 0 表示使用 options.search_L。未打开磁盘索引时返回空
+    std::vector<std::pair<uint64_t, std::string>> search_knn_disk(const std::vector<float>& query_vec, int k, int search_L = 0);
+    std::vector<std::pair<uint64_t, std::string>> search_knn_disk(std::string query, int k, int search_L = 0);
     
     // 向量处理函数
     std::vector<float> get_embedding(const std::string& text);
 
+    // 异步 embedding (HNSWOptions::async_embedding)。搜索不会顺带应用新向量 (搜索可能并发执行)，
+    // 需要读到自己写入的向量时调用 sync_embeddings 或用 is_vector_searchable 轮询
+    size_t apply_ready_embeddings();         // 把已算好的向量写入向量表与索引，返回条数；put / del 会自动调用
+    void sync_embeddings();                  // 等待排队的文本全部算完并应用
+    bool is_vector_searchable(uint64_t key); // key 存在且最近一次写入的向量已进入索引
+    size_t pending_embeddings() const;       // 已写入 LSM、向量还未进入索引的 key 数
+
     // HNSW参数获取函数
     int get_hnsw_m() const;
     int get_hnsw_ef_construction() const;
+    HNSWOptions get_hnsw_options() const; // 当前生效的参数 (加载索引后可能与构造时传入的不同)
+    void set_hnsw_build_threads(size_t num_threads); // 0 表示使用 hardware_concurrency
+    // 把已删除节点真正移出图：修复指向它们的邻居表，释放 label 供复用。先等待 del 触发的后台整理完成，
+    // 返回两者共移除的节点数
+    size_t consolidate_hnsw_deletions();
+    // 按第 0 层图的 BFS 顺序重新分配 label (0..节点数-1)，并按新顺序重新分配节点、邻居表和向量的内存，
+    // 使图上相邻的节点在内存中也相邻，减少查询时的缓存与 TLB 缺失；空闲 label 随之回收。
+    // label 全部改变，下一次 save_hnsw_delta 会写出完整索引。调用期间不能有其它读写操作，返回重排的节点数
+    size_t reorder_hnsw_graph();
+    // 调用线程累计的向量索引距离计算次数 (HNSW 遍历、建图与重排)，基准测试用两次读数之差得到每次查询的次数
+    static uint64_t distance_computations();
 
     // 持久化函数
-    void load_embedding_from_disk(const std::string &data_dir);
+    void load_embedding_from_disk(const std::string &data_dir); // 读取旧格式的 embeddings.bin (仅用于迁移)
     void save_hnsw_index_to_disk(const std::string &hnsw_data_root, bool force_serial = false);
     void load_hnsw_index_from_disk(const std::string &hnsw_data_root);
+    // 只把上次保存以来的变更追加到 hnsw_delta.log；没有对应的检查点或日志过大时退化为完整保存
+    void save_hnsw_delta(const std::string &hnsw_data_root);
 
     void compaction();
+    // 合并 inputs (优先级从高到低) 写入 target_level 并删除输入表，没有可合并的数据时返回 false
+    bool merge_sstables(const std::vector<std::string>& inputs, int target_level, bool drop_deleted);
 
     void delsstable(std::string filename);  // 从缓存中删除filename.sst， 并物理删除
     void addsstable(sstable ss, int level); // 将ss加入缓存
@@ -154,4 +421,8 @@ public:
 
     // 添加用于大规模预计算嵌入的功能
     void put_with_precomputed_embedding(uint64_t key, const std::string &s, const std::vector<float>& precomputed_emb);
+    // 批量导入：LSM 写入与向量落盘逐条进行，HNSW 图由多个线程并行构建
+    void put_batch_with_precomputed_embedding(const std::vector<uint64_t> &keys,
+                                              const std::vector<std::string> &values,
+                                              const std::vector<std::vector<float>> &precomputed_embs);
 };
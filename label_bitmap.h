@@ -0,0 +1,75 @@
+#ifndef LSM_KV_LABEL_BITMAP_H
+#define LSM_KV_LABEL_BITMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 按 label 寻址的位图，用来标记 HNSW 中已删除 (墓碑) 的节点，test 为 O(1)。
+// 只有 set 会扩容；并发读取期间不能调用 set / clear
+class LabelBitmap {
+public:
+    // 新置位返回 true
+    bool set(size_t label) {
+        size_t word = label / 64;
+        if (word >= words.size()) {
+            words.resize(word + 1, 0);
+        }
+        uint64_t mask = uint64_t(1) << (label % 64);
+        if (words[word] & mask)
+            return false;
+        words[word] |= mask;
+        ++bits;
+        return true;
+    }
+
+    // 原来已置位返回 true
+    bool reset(size_t label) {
+        size_t word = label / 64;
+        uint64_t mask = uint64_t(1) << (label % 64);
+        if (word >= words.size() || !(words[word] & mask))
+            return false;
+        words[word] &= ~mask;
+        --bits;
+        return true;
+    }
+
+    bool test(size_t label) const {
+        size_t word = label / 64;
+        return word < words.size() && (words[word] >> (label % 64)) & 1;
+    }
+
+    size_t count() const {
+        return bits;
+    }
+
+    bool empty() const {
+        return bits == 0;
+    }
+
+    void clear() {
+        words.clear();
+        bits = 0;
+    }
+
+    // 按 label 升序列出所有置位的 label
+    template <typename T>
+    std::vector<T> to_list() const {
+        std::vector<T> labels;
+        labels.reserve(bits);
+        for (size_t word = 0; word < words.size(); ++word) {
+            uint64_t w = words[word];
+            for (size_t bit = 0; w != 0; ++bit, w >>= 1) {
+                if (w & 1)
+                    labels.push_back(static_cast<T>(word * 64 + bit));
+            }
+        }
+        return labels;
+    }
+
+private:
+    std::vector<uint64_t> words;
+    size_t bits = 0;
+};
+
+#endif // LSM_KV_LABEL_BITMAP_H
@@ -0,0 +1,72 @@
+#include "mapped_file.h"
+
+#include <fstream>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LSM_KV_HAVE_MMAP 1
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string &path) {
+    close();
+
+#ifdef LSM_KV_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size_t file_size = static_cast<size_t>(st.st_size);
+    if (file_size > 0) {
+        void *addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            ::close(fd); // 映射建立后即可关闭 fd
+            data_   = static_cast<const char *>(addr);
+            size_   = file_size;
+            mapped_ = true;
+            return true;
+        }
+    }
+    ::close(fd);
+#endif
+
+    // 退化路径：整文件读入
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+        return false;
+    std::streamsize len = in.tellg();
+    if (len <= 0)
+        return false;
+    buffer_.resize(static_cast<size_t>(len));
+    in.seekg(0, std::ios::beg);
+    if (!in.read(buffer_.data(), len)) {
+        buffer_.clear();
+        return false;
+    }
+    data_   = buffer_.data();
+    size_   = buffer_.size();
+    mapped_ = false;
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef LSM_KV_HAVE_MMAP
+    if (mapped_ && data_)
+        munmap(const_cast<char *>(data_), size_);
+#endif
+    buffer_.clear();
+    buffer_.shrink_to_fit();
+    data_   = nullptr;
+    size_   = 0;
+    mapped_ = false;
+}
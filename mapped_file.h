@@ -0,0 +1,44 @@
+#ifndef LSM_KV_MAPPED_FILE_H
+#define LSM_KV_MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 只读文件映射：POSIX 下使用 mmap，映射失败或不支持 mmap 的平台 (Windows) 退化为整文件读入内存
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &)            = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+
+    bool is_open() const {
+        return data_ != nullptr;
+    }
+
+    bool is_mapped() const {
+        return mapped_;
+    }
+
+    const char *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_      = 0;
+    bool mapped_      = false;
+    std::vector<char> buffer_; // 退化路径下的文件内容
+};
+
+#endif // LSM_KV_MAPPED_FILE_H
@@ -0,0 +1,27 @@
+#ifndef LSM_KV_PARALLEL_FOR_H
+#define LSM_KV_PARALLEL_FOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// 把 [0, n) 分段交给多个线程执行 fn(begin, end)，每段至少 min_chunk 个元素。
+// 用于索引构建这类一次性的重计算；查询路径使用 KVStore 的线程池
+template <typename Fn>
+void parallel_for(size_t n, size_t min_chunk, Fn fn) {
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads        = std::min(num_threads, std::max<size_t>(1, n / std::max<size_t>(1, min_chunk)));
+    if (num_threads <= 1) {
+        fn(size_t(0), n);
+        return;
+    }
+    size_t chunk = (n + num_threads - 1) / num_threads;
+    std::vector<std::thread> threads;
+    for (size_t begin = 0; begin < n; begin += chunk)
+        threads.emplace_back(fn, begin, std::min(begin + chunk, n));
+    for (auto &thread : threads)
+        thread.join();
+}
+
+#endif // LSM_KV_PARALLEL_FOR_H
@@ -183,7 +183,7 @@ int main(int argc, char* argv[]) {
               << std::fixed << std::setprecision(4) << parallel_save_duration.count() << " seconds." << std::endl;
     std::cout << "Parallel Index saved to: " << hnsw_index_save_path_parallel << std::endl;
     std::cout << "-----------------------------------------------------" << std::endl;
-    std::cout << "KVStore data (SSTables, embeddings.bin) in: " << data_dir << std::endl;
+    std::cout << "KVStore data (SSTables with vector blocks) in: " << data_dir << std::endl;
 
     std::cout << "\nTest finished." << std::endl;
 
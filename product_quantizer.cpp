@@ -0,0 +1,124 @@
+#include "product_quantizer.h"
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+
+namespace {
+
+constexpr size_t PQ_KMEANS_ITERATIONS = 8;
+constexpr size_t PQ_MAX_TRAIN_SAMPLES = 256 * 64;
+
+float l2_sq(const float *a, const float *b, size_t dim) {
+    float dist = 0.0f;
+    for (size_t i = 0; i < dim; ++i) {
+        float diff = a[i] - b[i];
+        dist += diff * diff;
+    }
+    return dist;
+}
+
+} // namespace
+
+bool ProductQuantizer::train(const float *data, size_t n, size_t dim, size_t num_subspaces, uint32_t seed) {
+    if (n == 0 || dim == 0 || num_subspaces == 0 || dim % num_subspaces != 0) {
+        std::cerr << "[ERROR] ProductQuantizer: invalid training setup (n=" << n << ", dim=" << dim
+                  << ", subspaces=" << num_subspaces << ")." << std::endl;
+        return false;
+    }
+    dim_           = dim;
+    num_subspaces_ = num_subspaces;
+    sub_dim_       = dim / num_subspaces;
+    codebook_.assign(num_subspaces_ * NUM_CENTROIDS * sub_dim_, 0.0f);
+
+    std::mt19937 rng(seed);
+    std::vector<size_t> sample(n);
+    std::iota(sample.begin(), sample.end(), 0);
+    std::shuffle(sample.begin(), sample.end(), rng);
+    sample.resize(std::min(n, PQ_MAX_TRAIN_SAMPLES));
+    const size_t k = std::min(NUM_CENTROIDS, sample.size());
+
+    // 各段互不相关，按段并行
+    parallel_for(num_subspaces_, 1, [&](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; ++s) {
+            const size_t offset = s * sub_dim_;
+            float *centroids    = codebook_.data() + s * NUM_CENTROIDS * sub_dim_;
+            for (size_t c = 0; c < k; ++c)
+                std::copy_n(data + sample[c] * dim_ + offset, sub_dim_, centroids + c * sub_dim_);
+
+            for (size_t iter = 0; iter < PQ_KMEANS_ITERATIONS; ++iter) {
+                std::vector<double> sums(k * sub_dim_, 0.0);
+                std::vector<size_t> counts(k, 0);
+                for (size_t i = 0; i < sample.size(); ++i) {
+                    const float *sub = data + sample[i] * dim_ + offset;
+                    uint32_t best    = 0;
+                    float best_dist  = std::numeric_limits<float>::max();
+                    for (size_t c = 0; c < k; ++c) {
+                        float dist = l2_sq(sub, centroids + c * sub_dim_, sub_dim_);
+                        if (dist < best_dist) {
+                            best_dist = dist;
+                            best      = static_cast<uint32_t>(c);
+                        }
+                    }
+                    counts[best]++;
+                    for (size_t d = 0; d < sub_dim_; ++d)
+                        sums[best * sub_dim_ + d] += sub[d];
+                }
+                for (size_t c = 0; c < k; ++c) {
+                    if (counts[c] == 0) {
+                        // 空簇：随机取一个样本重新开始
+                        std::copy_n(data + sample[(c * 7919 + iter) % sample.size()] * dim_ + offset, sub_dim_,
+                                    centroids + c * sub_dim_);
+                        continue;
+                    }
+                    for (size_t d = 0; d < sub_dim_; ++d)
+                        centroids[c * sub_dim_ + d] = static_cast<float>(sums[c * sub_dim_ + d] / counts[c]);
+                }
+            }
+            // 样本不足 256 个时，多余的质心与第一个相同，不影响编码结果
+            for (size_t c = k; c < NUM_CENTROIDS; ++c)
+                std::copy_n(centroids, sub_dim_, centroids + c * sub_dim_);
+        }
+    });
+    return true;
+}
+
+bool ProductQuantizer::load(size_t dim, size_t num_subspaces, std::vector<float> codebook) {
+    if (dim == 0 || num_subspaces == 0 || dim % num_subspaces != 0 || codebook.size() != NUM_CENTROIDS * dim) {
+        return false;
+    }
+    dim_           = dim;
+    num_subspaces_ = num_subspaces;
+    sub_dim_       = dim / num_subspaces;
+    codebook_      = std::move(codebook);
+    return true;
+}
+
+void ProductQuantizer::encode(const float *vec, uint8_t *code) const {
+    for (size_t s = 0; s < num_subspaces_; ++s) {
+        const float *sub       = vec + s * sub_dim_;
+        const float *centroids = codebook_.data() + s * NUM_CENTROIDS * sub_dim_;
+        size_t best            = 0;
+        float best_dist        = std::numeric_limits<float>::max();
+        for (size_t c = 0; c < NUM_CENTROIDS; ++c) {
+            float dist = l2_sq(sub, centroids + c * sub_dim_, sub_dim_);
+            if (dist < best_dist) {
+                best_dist = dist;
+                best      = c;
+            }
+        }
+        code[s] = static_cast<uint8_t>(best);
+    }
+}
+
+void ProductQuantizer::distance_table(const float *query, float *table) const {
+    for (size_t s = 0; s < num_subspaces_; ++s) {
+        const float *sub       = query + s * sub_dim_;
+        const float *centroids = codebook_.data() + s * NUM_CENTROIDS * sub_dim_;
+        for (size_t c = 0; c < NUM_CENTROIDS; ++c)
+            table[s * NUM_CENTROIDS + c] = l2_sq(sub, centroids + c * sub_dim_, sub_dim_);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef LSM_KV_PRODUCT_QUANTIZER_H
+#define LSM_KV_PRODUCT_QUANTIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 乘积量化 (PQ)：把 dim 维向量切成 num_subspaces 段，每段用 256 个质心之一的下标 (1 字节) 表示。
+// 查询时先算出查询向量每段到各质心的平方 L2 距离表，某个编码的近似距离就是查表求和
+class ProductQuantizer {
+public:
+    static constexpr size_t NUM_CENTROIDS = 256;
+
+    // 用 n 个向量 (连续存放) 训练每段的 k-means 质心；dim 必须能被 num_subspaces 整除
+    bool train(const float *data, size_t n, size_t dim, size_t num_subspaces, uint32_t seed);
+
+    // 从已保存的码本恢复 (codebook 长度为 num_subspaces * 256 * (dim / num_subspaces))
+    bool load(size_t dim, size_t num_subspaces, std::vector<float> codebook);
+
+    // 把 vec 编码为 num_subspaces 个字节
+    void encode(const float *vec, uint8_t *code) const;
+
+    // 查询向量的距离表，num_subspaces * 256 个 float
+    void distance_table(const float *query, float *table) const;
+
+    float distance(const float *table, const uint8_t *code) const {
+        float dist = 0.0f;
+        for (size_t s = 0; s < num_subspaces_; ++s)
+            dist += table[s * NUM_CENTROIDS + code[s]];
+        return dist;
+    }
+
+    size_t dim() const {
+        return dim_;
+    }
+
+    size_t num_subspaces() const {
+        return num_subspaces_;
+    }
+
+    const std::vector<float> &codebook() const {
+        return codebook_;
+    }
+
+private:
+    size_t dim_           = 0;
+    size_t num_subspaces_ = 0;
+    size_t sub_dim_       = 0;
+    std::vector<float> codebook_; // [subspace][centroid][sub_dim]
+};
+
+#endif // LSM_KV_PRODUCT_QUANTIZER_H
@@ -1,8 +1,11 @@
 #include "sstable.h"
 
+#include "mapped_file.h"
 #include "sstablehead.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 const uint32_t MAXSIZE = 2 * 1024 * 1024; // 2MB
 
@@ -35,6 +38,16 @@ void sstable::putFile(const char *path) { // 将内存中的输出到二进制
     for (int i = 0; i < size; ++i) { // datas
         fwrite(data[i].data(), 1, data[i].length(), file);
     }
+    if (vecDim > 0) { // vectors
+        const size_t vecBytes = vector_element_bytes(vecPrecision) * vecDim;
+        for (size_t i = 0; i < vecKeys.size(); ++i) {
+            fwrite(&vecKeys[i], 8, 1, file);
+            fwrite(vecData.data() + i * vecBytes, 1, vecBytes, file);
+        }
+        VectorBlockFooter footer{vecKeys.size(), vecDim, VECTOR_BLOCK_VERSION, static_cast<uint16_t>(vecPrecision),
+                                 VECTOR_BLOCK_MAGIC};
+        fwrite(&footer, sizeof(footer), 1, file);
+    }
     fflush(file); // 清空缓冲区
     fclose(file);
 }
@@ -94,6 +107,62 @@ void sstable::loadFile(const char *path) { // load file from the path
     }
     fflush(file);
     fclose(file);
+    if (loadVectorBlock(path, vecDim, vecPrecision, vecKeys, vecData)) {
+        bytes += vecKeys.size() * 8 + vecData.size() + sizeof(VectorBlockFooter);
+    } else {
+        vecDim       = 0;
+        vecPrecision = VectorPrecision::Float32;
+    }
+}
+
+void sstable::insertVector(uint64_t key, const void *vec, VectorPrecision from) {
+    const size_t vecBytes = vector_element_bytes(vecPrecision) * vecDim;
+    vecKeys.push_back(key);
+    bytes += 8 + vecBytes;
+    vecData.resize(vecData.size() + vecBytes);
+    convert_vector(vec, from, vecData.data() + vecData.size() - vecBytes, vecPrecision, vecDim);
+}
+
+const char *sstable::findVector(uint64_t key) const {
+    auto it = std::lower_bound(vecKeys.begin(), vecKeys.end(), key);
+    if (it == vecKeys.end() || *it != key)
+        return nullptr;
+    return vecData.data() + (it - vecKeys.begin()) * vector_element_bytes(vecPrecision) * vecDim;
+}
+
+const char *sstable::findVectorBlock(const char *file, size_t size, VectorBlockFooter &footer) {
+    if (!file || size < sizeof(footer))
+        return nullptr;
+    std::memcpy(&footer, file + size - sizeof(footer), sizeof(footer));
+    if (footer.magic != VECTOR_BLOCK_MAGIC || footer.version != VECTOR_BLOCK_VERSION || footer.dim == 0 ||
+        footer.precision > static_cast<uint16_t>(VectorPrecision::BFloat16))
+        return nullptr;
+    uint64_t entryBytes =
+        8 + vector_element_bytes(static_cast<VectorPrecision>(footer.precision)) * static_cast<uint64_t>(footer.dim);
+    if (footer.count > (size - sizeof(footer)) / entryBytes)
+        return nullptr;
+    return file + size - sizeof(footer) - footer.count * entryBytes;
+}
+
+bool sstable::loadVectorBlock(const char *path, uint32_t &dim, VectorPrecision &precision,
+                              std::vector<uint64_t> &keys, std::vector<char> &vecs) {
+    keys.clear();
+    vecs.clear();
+    MappedFile file;
+    VectorBlockFooter footer{};
+    const char *entries = file.open(path) ? findVectorBlock(file.data(), file.size(), footer) : nullptr;
+    if (!entries)
+        return false;
+    dim       = footer.dim;
+    precision = static_cast<VectorPrecision>(footer.precision);
+    const size_t vecBytes = vector_element_bytes(precision) * dim;
+    keys.resize(footer.count);
+    vecs.resize(footer.count * vecBytes);
+    for (uint64_t i = 0; i < footer.count; ++i, entries += 8 + vecBytes) {
+        std::memcpy(&keys[i], entries, 8);
+        std::memcpy(vecs.data() + i * vecBytes, entries + 8, vecBytes);
+    }
+    return true;
 }
 
 bloom sstable::copyFilter() {
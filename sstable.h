@@ -5,6 +5,7 @@
 #include "bloom.h"
 #include "skiplist.h"
 #include "sstablehead.h"
+#include "stored_vector.h"
 
 #include <cstdint>
 #include <vector>
@@ -12,9 +13,27 @@
 static uint64_t TIME = 0;                     // 全局时间戳
 const uint64_t INF   = std::numeric_limits<uint64_t>::max();
 
+// 向量块：紧跟在数据区之后，保存本表中各 key 对应的 embedding，随 SSTable 一起写出、合并和删除。
+//   count 条 {uint64 key, 分量[dim]} (按 key 升序，分量按 precision 为 float / fp16 / bf16)，然后是 VectorBlockFooter
+// 只有部分 key 有向量 (删除标记等没有)；没有向量块的旧文件照常读取
+const uint64_t VECTOR_BLOCK_MAGIC   = 0x4B434F4C42434556ull; // "VECBLOCK"
+const uint16_t VECTOR_BLOCK_VERSION = 1;
+
+struct VectorBlockFooter {
+    uint64_t count;
+    uint32_t dim;
+    uint16_t version;
+    uint16_t precision; // VectorPrecision；早期文件此处为 0 (fp32)
+    uint64_t magic;
+};
+
 class sstable : public sstablehead { // 储存sstable的软数据结构
 private:
     std::vector<std::string> data;
+    uint32_t vecDim = 0;         // 0 表示没有向量块
+    std::vector<uint64_t> vecKeys;
+    VectorPrecision vecPrecision = VectorPrecision::Float32;
+    std::vector<char> vecData; // vecKeys.size() * vecDim 个分量的原始字节
 
 public:
     void reset() { // 这里不reset time, namesuf
@@ -26,6 +45,10 @@ public:
         filter.reset();
         index.clear();
         data.clear();
+        vecDim       = 0;
+        vecPrecision = VectorPrecision::Float32;
+        vecKeys.clear();
+        vecData.clear();
     }
 
     sstable() {
@@ -76,6 +99,35 @@ public:
         return data[p];
     }
 
+    // 打开向量块 (即使之后没有任何向量也会写出空块，表示本表的向量是完整的)。须在 insertVector 之前调用
+    void setVectorDim(uint32_t dim, VectorPrecision precision = VectorPrecision::Float32) {
+        if ((vecDim > 0) != (dim > 0)) { // 空块也要写出 footer
+            bytes = dim > 0 ? bytes + sizeof(VectorBlockFooter) : bytes - sizeof(VectorBlockFooter);
+        }
+        vecDim       = dim;
+        vecPrecision = precision;
+    }
+
+    uint32_t getVectorDim() const {
+        return vecDim;
+    }
+
+    VectorPrecision getVectorPrecision() const {
+        return vecPrecision;
+    }
+
+    // 按 key 升序追加；vec 为 from 格式，与本表精度不同时转换
+    void insertVector(uint64_t key, const void *vec, VectorPrecision from);
+    const char *findVector(uint64_t key) const; // 本表精度的原始字节，没有时返回 nullptr
+
+    // 在整个文件的内容 (通常是 mmap 映射) 中定位向量块，返回第一条记录的地址，没有时返回 nullptr。
+    // 记录按 8 + 分量字节数 * dim 紧密排列，不保证对齐，读取时用 memcpy
+    static const char *findVectorBlock(const char *file, size_t size, VectorBlockFooter &footer);
+
+    // 只读取文件末尾的向量块 (vecs 为原始字节)，没有向量块或格式不符时返回 false
+    static bool loadVectorBlock(const char *path, uint32_t &dim, VectorPrecision &precision,
+                                std::vector<uint64_t> &keys, std::vector<char> &vecs);
+
     sstablehead getHead(); // 取出头部
 };
 
@@ -28,7 +28,7 @@ class sstablehead {
 protected:
     std::string filename; // filename表示该sstable的名字，含路径前缀和后缀
     uint64_t time, cnt, minV, maxV;
-    uint32_t bytes;          // 理论上的sstable转换成文件的大小
+    uint32_t bytes;          // 理论上的sstable转换成文件的大小 (含向量块)
     uint32_t curpos;         // 当前offset的位置
     uint32_t nameSuffix = 0; // 区分同一时间戳，不同文件的姓名后缀
     bloom filter;
@@ -89,7 +89,7 @@ public:
         this->index = index;
     } // 使用深复制
 
-    std::string getFilename() {
+    std::string getFilename() const {
         return filename;
     }
 
@@ -0,0 +1,184 @@
+#ifndef LSM_KV_STORED_VECTOR_H
+#define LSM_KV_STORED_VECTOR_H
+
+#include "vector_distance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+// VectorPrecision (定义在 vector_distance.h) 是向量在内存和 SSTable 向量块中的存储精度。fp16 / bf16 内存与
+// 扫描带宽减半；fp16 精度更高但范围小 (|x| > 65504 变为 inf)，bf16 与 fp32 范围相同、尾数只有 8 位
+
+inline size_t vector_element_bytes(VectorPrecision precision) {
+    return precision == VectorPrecision::Float32 ? 4 : 2;
+}
+
+inline const char *vector_precision_name(VectorPrecision precision) {
+    switch (precision) {
+    case VectorPrecision::Float16:
+        return "fp16";
+    case VectorPrecision::BFloat16:
+        return "bf16";
+    default:
+        return "fp32";
+    }
+}
+
+// 把 n 个分量从一种存储格式转换到另一种 (src / dst 为原始字节，不要求对齐)
+inline void convert_vector(const void *src, VectorPrecision from, void *dst, VectorPrecision to, size_t n) {
+    if (from == to) {
+        std::memcpy(dst, src, n * vector_element_bytes(from));
+        return;
+    }
+    std::vector<float> floats(n);
+    switch (from) {
+    case VectorPrecision::Float16:
+        fp16_to_fp32(static_cast<const uint16_t *>(src), floats.data(), n);
+        break;
+    case VectorPrecision::BFloat16:
+        bf16_to_fp32(static_cast<const uint16_t *>(src), floats.data(), n);
+        break;
+    default:
+        std::memcpy(floats.data(), src, n * sizeof(float));
+        break;
+    }
+    switch (to) {
+    case VectorPrecision::Float16:
+        fp32_to_fp16(floats.data(), static_cast<uint16_t *>(dst), n);
+        break;
+    case VectorPrecision::BFloat16:
+        fp32_to_bf16(floats.data(), static_cast<uint16_t *>(dst), n);
+        break;
+    default:
+        std::memcpy(dst, floats.data(), n * sizeof(float));
+        break;
+    }
+}
+
+// embeddings 表中的一条向量：按 precision 保存原始位，计算距离时由 SIMD 内核在读入寄存器时转换。
+// fp32 存在 floats_ 中，fp16 / bf16 存在 halves_ 中，另一个为空，读取时总是通过实际的元素类型访问
+class StoredVector {
+public:
+    StoredVector() = default;
+
+    void assign(const float *data, size_t dim, VectorPrecision precision) {
+        assign_raw(data, VectorPrecision::Float32, dim, precision);
+    }
+    void assign(const std::vector<float> &vec, VectorPrecision precision) {
+        assign(vec.data(), vec.size(), precision);
+    }
+    // raw 为 from 格式的 dim 个分量，按 to 格式保存
+    void assign_raw(const void *raw, VectorPrecision from, size_t dim, VectorPrecision to) {
+        precision_ = to;
+        dim_       = static_cast<uint32_t>(dim);
+        if (to == VectorPrecision::Float32) {
+            halves_.clear();
+            halves_.shrink_to_fit();
+            floats_.resize(dim);
+            convert_vector(raw, from, floats_.data(), to, dim);
+        } else {
+            floats_.clear();
+            floats_.shrink_to_fit();
+            halves_.resize(dim);
+            convert_vector(raw, from, halves_.data(), to, dim);
+        }
+    }
+
+    size_t size() const {
+        return dim_;
+    }
+    bool empty() const {
+        return dim_ == 0;
+    }
+    VectorPrecision precision() const {
+        return precision_;
+    }
+    const char *raw() const {
+        return precision_ == VectorPrecision::Float32 ? reinterpret_cast<const char *>(floats_.data())
+                                                      : reinterpret_cast<const char *>(halves_.data());
+    }
+    size_t raw_bytes() const {
+        return floats_.size() * sizeof(float) + halves_.size() * sizeof(uint16_t);
+    }
+
+    float at(size_t i) const {
+        float value;
+        decode_range(i, 1, &value);
+        return value;
+    }
+    void decode(float *out) const {
+        decode_range(0, dim_, out);
+    }
+    std::vector<float> to_floats() const {
+        std::vector<float> out(dim_);
+        decode(out.data());
+        return out;
+    }
+
+    // 全部分量为 FLT_MAX 的删除标记 (16 位格式下 FLT_MAX 舍入为 inf)
+    bool is_deleted_marker() const {
+        if (dim_ == 0 || at(0) < std::numeric_limits<float>::max())
+            return false;
+        std::vector<float> values = to_floats();
+        for (float v : values) {
+            if (!(v >= std::numeric_limits<float>::max()))
+                return false;
+        }
+        return true;
+    }
+
+    // 同 vec_dot_and_norm：query 为 float，本向量作为 b
+    void dot_and_norm(const float *query, float &dot, float &norm) const {
+        dot_and_norm(query, dot, norm, dim_);
+    }
+    // 只计算前 dims 个分量 (截断前缀)
+    void dot_and_norm(const float *query, float &dot, float &norm, size_t dims) const {
+        switch (precision_) {
+        case VectorPrecision::Float16:
+            vec_dot_and_norm_fp16(query, halves_.data(), dims, dot, norm);
+            break;
+        case VectorPrecision::BFloat16:
+            vec_dot_and_norm_bf16(query, halves_.data(), dims, dot, norm);
+            break;
+        default:
+            vec_dot_and_norm(query, floats_.data(), dims, dot, norm);
+            break;
+        }
+    }
+
+    // 把前 dims 个分量所在的缓存行预取到 L1 (不阻塞)，供随后的 dot_and_norm 使用
+    void prefetch(size_t dims) const {
+        const char *data   = raw();
+        const size_t bytes = std::min<size_t>(dims, dim_) * vector_element_bytes(precision_);
+        for (size_t offset = 0; offset < bytes; offset += 64) {
+            hnsw_prefetch(data + offset);
+        }
+    }
+
+private:
+    void decode_range(size_t begin, size_t count, float *out) const {
+        switch (precision_) {
+        case VectorPrecision::Float16:
+            fp16_to_fp32(halves_.data() + begin, out, count);
+            break;
+        case VectorPrecision::BFloat16:
+            bf16_to_fp32(halves_.data() + begin, out, count);
+            break;
+        default:
+            std::memcpy(out, floats_.data() + begin, count * sizeof(float));
+            break;
+        }
+    }
+
+    std::vector<float> floats_;    // precision_ 为 Float32 时的分量
+    std::vector<uint16_t> halves_; // precision_ 为 Float16 / BFloat16 时的分量
+    uint32_t dim_               = 0;
+    VectorPrecision precision_  = VectorPrecision::Float32;
+};
+
+#endif // LSM_KV_STORED_VECTOR_H
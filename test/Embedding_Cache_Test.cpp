@@ -0,0 +1,121 @@
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "embedding_cache.h"
+
+// 检查文本 -> embedding 缓存的命中、LRU 淘汰与跨重启的保存 / 加载 (不需要模型)
+
+const std::string CACHE_PATH = "./embedding_cache_test.bin";
+
+std::vector<float> fake_embedding(float seed, size_t dim = 4) {
+  std::vector<float> vec(dim);
+  for (size_t i = 0; i < dim; i++) {
+    vec[i] = seed + static_cast<float>(i);
+  }
+  return vec;
+}
+
+bool has(EmbeddingCache &cache, const std::string &text, float seed) {
+  std::vector<float> out;
+  return cache.lookup(text, out) && out == fake_embedding(seed);
+}
+
+// 命中返回插入的向量，计数准确；容量为 0 时不缓存
+int lookups() {
+  int passed_count = 0;
+  EmbeddingCache cache(8);
+  std::vector<float> out;
+  bool missed = !cache.lookup("hello", out);
+  cache.insert("hello", fake_embedding(1));
+  cache.insert("empty", {});
+  if (missed && has(cache, "hello", 1) && !cache.lookup("hello ", out) && !cache.lookup("empty", out) &&
+      cache.hits() == 1 && cache.misses() == 3 && cache.size() == 1) {
+    passed_count++;
+  }
+
+  EmbeddingCache disabled(0);
+  disabled.insert("hello", fake_embedding(1));
+  if (disabled.size() == 0 && !disabled.lookup("hello", out)) {
+    passed_count++;
+  }
+  return passed_count;
+}
+
+// 超出容量时淘汰最久未使用的条目，lookup 会刷新条目；缩小容量同样从最旧的开始淘汰
+int eviction() {
+  int passed_count = 0;
+  EmbeddingCache cache(3);
+  cache.insert("a", fake_embedding(1));
+  cache.insert("b", fake_embedding(2));
+  cache.insert("c", fake_embedding(3));
+  has(cache, "a", 1);
+  cache.insert("d", fake_embedding(4));
+  if (cache.size() == 3 && !has(cache, "b", 2) && has(cache, "a", 1) && has(cache, "c", 3) && has(cache, "d", 4)) {
+    passed_count++;
+  }
+  cache.set_capacity(1); // 最近使用的是 d
+  if (cache.size() == 1 && has(cache, "d", 4) && !has(cache, "a", 1)) {
+    passed_count++;
+  }
+  return passed_count;
+}
+
+// 保存后重新加载：条目与 LRU 顺序保留；容量不足时保留最近使用的；维度不符或文件损坏时不加载错误的数据
+int persistence() {
+  int passed_count = 0;
+  std::filesystem::remove(CACHE_PATH);
+  {
+    EmbeddingCache cache(16);
+    for (int i = 0; i < 10; i++) {
+      cache.insert("text " + std::to_string(i), fake_embedding(static_cast<float>(i)));
+    }
+    has(cache, "text 0", 0); // text 0 变为最近使用
+    if (cache.save(CACHE_PATH)) {
+      passed_count++;
+    }
+  }
+
+  EmbeddingCache reloaded(16);
+  bool all = reloaded.load(CACHE_PATH, 4) && reloaded.size() == 10;
+  for (int i = 0; i < 10; i++) {
+    all = all && has(reloaded, "text " + std::to_string(i), static_cast<float>(i));
+  }
+  if (all) {
+    passed_count++;
+  }
+
+  EmbeddingCache small(2);
+  if (small.load(CACHE_PATH, 0) && small.size() == 2 && has(small, "text 0", 0) && has(small, "text 9", 9)) {
+    passed_count++;
+  }
+
+  EmbeddingCache wrong_dim(16);
+  if (!wrong_dim.load(CACHE_PATH, 8) && wrong_dim.size() == 0) {
+    passed_count++;
+  }
+
+  // 截掉最后一条的一部分：只加载完整的条目
+  std::filesystem::resize_file(CACHE_PATH, std::filesystem::file_size(CACHE_PATH) - 3);
+  EmbeddingCache truncated(16);
+  if (truncated.load(CACHE_PATH, 4) && truncated.size() == 9 && !has(truncated, "text 0", 0) &&
+      has(truncated, "text 9", 9)) {
+    passed_count++;
+  }
+  std::filesystem::remove(CACHE_PATH);
+  return passed_count;
+}
+
+int main() {
+  int passed = lookups() + eviction() + persistence();
+  const int total = 9;
+  std::cout << "Passed " << passed << "/" << total << std::endl;
+  if (passed != total) {
+    std::cout << "Test failed" << std::endl;
+    return 1;
+  }
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
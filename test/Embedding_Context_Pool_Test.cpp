@@ -0,0 +1,151 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "embedding.h"
+
+// 多个线程共享上下文池推理：不同上下文的 decode 确实同时进行，结果必须与单个上下文逐条计算的一致
+// (上下文没有被两个线程同时使用)，推理过程中缩小 / 扩大池、最后释放模型都不能死锁。需要 embedding 模型
+
+const std::vector<std::string> TEXTS = {
+    "The quick brown fox jumps over the lazy dog.",
+    "A log-structured merge tree buffers writes in memory.",
+    "Compaction merges sorted runs into larger ones.",
+    "HNSW builds a hierarchy of proximity graphs.",
+    "Bananas are rich in potassium.",
+    "The train to the airport leaves every ten minutes.",
+    "Vector search finds the nearest neighbours of a query.",
+    "She played the violin at the concert last night.",
+    "Bloom filters answer membership queries with false positives.",
+    "The mountain trail was covered in fresh snow.",
+    "Quantization trades accuracy for memory bandwidth.",
+    "He forgot his umbrella and got soaked in the rain.",
+};
+
+float cosine(const std::vector<float> &a, const std::vector<float> &b) {
+  if (a.size() != b.size() || a.empty()) {
+    return 0.0f;
+  }
+  double dot = 0, na = 0, nb = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    dot += a[i] * b[i];
+    na += a[i] * a[i];
+    nb += b[i] * b[i];
+  }
+  return static_cast<float>(dot / std::sqrt(na * nb));
+}
+
+// num_threads 个线程各自反复推理一段文本，返回与参考结果不一致的条数
+int run_concurrently(const std::vector<std::vector<float>> &reference, int num_threads, int rounds,
+                     std::atomic<int> &done) {
+  std::atomic<int> mismatches(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int r = 0; r < rounds; r++) {
+        std::vector<std::string> batch;
+        std::vector<size_t> ids;
+        for (size_t i = (t + r) % 3; i < TEXTS.size(); i += 3) {
+          batch.push_back(TEXTS[i]);
+          ids.push_back(i);
+        }
+        std::vector<std::vector<float>> result = embedding_texts(batch);
+        for (size_t j = 0; j < ids.size(); j++) {
+          if (j >= result.size() || cosine(result[j], reference[ids[j]]) < 0.999f) {
+            mismatches++;
+          }
+        }
+        done++;
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  return mismatches.load();
+}
+
+int main() {
+  // 卡死时直接判为失败
+  std::atomic<bool> finished(false);
+  std::thread watchdog([&finished]() {
+    for (int i = 0; i < 600 && !finished.load(); i++) {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    if (!finished.load()) {
+      std::cout << "Error: context pool deadlocked" << std::endl;
+      std::cout << "Test failed" << std::endl;
+      std::_Exit(1);
+    }
+  });
+
+  bool pass = true;
+
+  // 1. 参考结果：一个上下文，逐条推理
+  embedding_configure(1, 0);
+  std::vector<std::vector<float>> reference;
+  for (const std::string &text : TEXTS) {
+    reference.push_back(embedding_single(text));
+    if (reference.back().empty()) {
+      std::cout << "Error: failed to embed \"" << text << "\"" << std::endl;
+      pass = false;
+    }
+  }
+
+  // 2. 4 个上下文、8 个线程
+  std::atomic<int> done(0);
+  embedding_configure(4, 1);
+  int mismatches = run_concurrently(reference, 8, 4, done);
+  if (mismatches > 0) {
+    std::cout << "Error: " << mismatches << " embeddings differ with 4 contexts" << std::endl;
+    pass = false;
+  }
+  size_t peak = embedding_peak_concurrent_decodes();
+  std::cout << "peak concurrent decodes with 4 contexts: " << peak << std::endl;
+  if (peak < 2 || peak > 4) {
+    std::cout << "Error: decodes did not overlap or exceeded the pool size" << std::endl;
+    pass = false;
+  }
+
+  // 3. 推理进行中缩小到 1 个上下文再扩大，借出中的上下文在归还时释放
+  done = 0;
+  std::thread resizer([&done]() {
+    while (done.load() < 4) {
+      std::this_thread::yield();
+    }
+    embedding_configure(1, 1);
+    while (done.load() < 12) {
+      std::this_thread::yield();
+    }
+    embedding_configure(3, 1);
+  });
+  mismatches = run_concurrently(reference, 6, 4, done);
+  resizer.join();
+  if (mismatches > 0) {
+    std::cout << "Error: " << mismatches << " embeddings differ while resizing the pool" << std::endl;
+    pass = false;
+  }
+
+  // 4. 释放模型后可以重新加载
+  embedding_cleanup();
+  if (cosine(embedding_single(TEXTS[0]), reference[0]) < 0.999f) {
+    std::cout << "Error: embedding after cleanup differs" << std::endl;
+    pass = false;
+  }
+  embedding_cleanup();
+
+  finished = true;
+  watchdog.join();
+
+  if (pass) {
+    std::cout << "Test passed" << std::endl;
+  } else {
+    std::cout << "Test failed" << std::endl;
+  }
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "embedding_pipeline.h"
+
+// 用桩函数代替模型推理，检查后台线程的取批、结果交付与异常处理
+
+// 向量的第一个分量是文本本身的数值，便于核对结果与 key 的对应关系
+std::vector<std::vector<float>> fake_embed(const std::vector<std::string> &texts) {
+  std::vector<std::vector<float>> out;
+  for (const std::string &text : texts) {
+    out.push_back({std::stof(text), 1.0f});
+  }
+  return out;
+}
+
+// 每个结果恰好交付一次且与提交的文本对应
+bool check_results(const std::vector<EmbeddingPipeline::Result> &results, uint64_t count, bool expect_empty) {
+  std::map<uint64_t, int> seen;
+  for (const auto &result : results) {
+    seen[result.key]++;
+    if (expect_empty != result.embedding.empty()) {
+      return false;
+    }
+    if (!expect_empty && result.embedding[0] != static_cast<float>(result.key)) {
+      return false;
+    }
+  }
+  if (seen.size() != count) {
+    return false;
+  }
+  for (const auto &pair : seen) {
+    if (pair.second != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int batching() {
+  int passed_count = 0;
+  std::atomic<size_t> max_batch(0);
+  std::atomic<int> running(0);
+  std::atomic<int> max_running(0);
+  EmbeddingPipeline pipeline(
+      16, std::chrono::milliseconds(5),
+      [&](const std::vector<std::string> &texts) {
+        int now = ++running;
+        int seen = max_running.load();
+        while (now > seen && !max_running.compare_exchange_weak(seen, now)) {
+        }
+        size_t batch = max_batch.load();
+        while (texts.size() > batch && !max_batch.compare_exchange_weak(batch, texts.size())) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        --running;
+        return fake_embed(texts);
+      },
+      4);
+
+  const uint64_t total = 1000;
+  for (uint64_t i = 0; i < total; i++) {
+    pipeline.submit(i, i + 1, std::to_string(i));
+  }
+  pipeline.wait_idle();
+  if (pipeline.pending() == total) {
+    passed_count++;
+  }
+  std::vector<EmbeddingPipeline::Result> results = pipeline.take_ready();
+  if (check_results(results, total, false)) {
+    passed_count++;
+  }
+  if (pipeline.pending() == 0 && max_batch.load() <= 16 && max_batch.load() > 1) {
+    passed_count++;
+  }
+  // 4 个工作线程应当同时推理不同的批次
+  if (max_running.load() > 1) {
+    passed_count++;
+  }
+  return passed_count;
+}
+
+int failing_batches() {
+  int passed_count = 0;
+  std::atomic<int> calls(0);
+  EmbeddingPipeline pipeline(
+      8, std::chrono::milliseconds(1),
+      [&](const std::vector<std::string> &texts) -> std::vector<std::vector<float>> {
+        if (++calls % 2 == 0) {
+          throw std::runtime_error("llama_decode failed");
+        }
+        throw 42;
+      },
+      2);
+
+  const uint64_t total = 100;
+  for (uint64_t i = 0; i < total; i++) {
+    pipeline.submit(i, i + 1, std::to_string(i));
+  }
+  // 推理失败时 wait_idle 也必须返回，每条文本得到一个空向量
+  pipeline.wait_idle();
+  if (check_results(pipeline.take_ready(), total, true)) {
+    passed_count++;
+  }
+  return passed_count;
+}
+
+// 析构时处理完剩余的文本再退出
+int drain_on_destroy() {
+  std::atomic<uint64_t> embedded(0);
+  {
+    EmbeddingPipeline pipeline(
+        32, std::chrono::milliseconds(50),
+        [&](const std::vector<std::string> &texts) {
+          embedded += texts.size();
+          return fake_embed(texts);
+        },
+        2);
+    for (uint64_t i = 0; i < 500; i++) {
+      pipeline.submit(i, i + 1, std::to_string(i));
+    }
+  }
+  return embedded.load() == 500 ? 1 : 0;
+}
+
+int main() {
+  int passed = batching() + failing_batches() + drain_on_destroy();
+  const int total = 6;
+  std::cout << "Passed " << passed << "/" << total << std::endl;
+  if (passed != total) {
+    std::cout << "Test failed" << std::endl;
+    return 1;
+  }
+  std::cout << "Test passed" << std::endl;
+  return 0;
+}
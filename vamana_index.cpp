@@ -0,0 +1,544 @@
+#include "vamana_index.h"
+#include "parallel_for.h"
+#include "vector_distance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <unordered_set>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define LSM_KV_HAVE_PREAD 1
+#endif
+
+namespace {
+
+constexpr size_t BUILD_MIN_CHUNK    = 256;
+constexpr size_t MAX_ENTRY_POINTS   = 1024;
+
+struct Candidate {
+    float dist;
+    uint32_t id;
+    bool expanded;
+};
+
+bool closer(const Candidate &a, const Candidate &b) {
+    return a.dist < b.dist || (a.dist == b.dist && a.id < b.id);
+}
+
+// 插入按距离有序、长度不超过 L 的候选列表。列表已满且不比最后一个近时不插入
+void insert_candidate(std::vector<Candidate> &list, size_t L, Candidate cand) {
+    if (list.size() >= L && !closer(cand, list.back()))
+        return;
+    list.insert(std::upper_bound(list.begin(), list.end(), cand, closer), cand);
+    if (list.size() > L)
+        list.pop_back();
+}
+
+uint64_t align_sector(uint64_t offset) {
+    return (offset + VAMANA_SECTOR_SIZE - 1) / VAMANA_SECTOR_SIZE * VAMANA_SECTOR_SIZE;
+}
+
+// 构建期的内存图
+class VamanaBuilder {
+public:
+    // 接管 vectors (n * dim 个分量) 并就地归一化
+    VamanaBuilder(std::vector<float> vectors, size_t n, size_t dim, const VamanaOptions &options)
+        : n_(n), dim_(dim), options_(options), data_(std::move(vectors)), graph_(n),
+          locks_(std::make_unique<std::mutex[]>(n)) {
+        for (size_t i = 0; i < n_; ++i) {
+            float *vec = data_.data() + i * dim_;
+            float norm = std::sqrt(vec_dot(vec, vec, dim_));
+            if (norm > 1e-12f) {
+                for (size_t d = 0; d < dim_; ++d)
+                    vec[d] /= norm;
+            }
+        }
+    }
+
+    void build(uint32_t seed) {
+        std::mt19937 rng(seed);
+        // 入口点：medoid + 约 4 * sqrt(n) 个均匀抽样的点
+        entry_points_.push_back(find_medoid());
+        size_t num_entries = std::min({n_, MAX_ENTRY_POINTS, static_cast<size_t>(4 * std::sqrt(double(n_))) + 1});
+        std::vector<uint32_t> shuffled(n_);
+        std::iota(shuffled.begin(), shuffled.end(), 0);
+        std::shuffle(shuffled.begin(), shuffled.end(), rng);
+        for (size_t i = 0; i < n_ && entry_points_.size() < num_entries; ++i) {
+            if (shuffled[i] != entry_points_[0])
+                entry_points_.push_back(shuffled[i]);
+        }
+
+        // 随机初始图，之后两遍 (alpha = 1, alpha) 逐点搜索 + 剪枝
+        size_t init_degree = std::min<size_t>(options_.R, n_ - 1);
+        for (size_t i = 0; i < n_; ++i) {
+            std::unordered_set<uint32_t> picked;
+            while (picked.size() < init_degree) {
+                uint32_t j = static_cast<uint32_t>(rng() % n_);
+                if (j != i)
+                    picked.insert(j);
+            }
+            graph_[i].assign(picked.begin(), picked.end());
+        }
+        std::vector<uint32_t> order(n_);
+        std::iota(order.begin(), order.end(), 0);
+        for (float alpha : {1.0f, options_.alpha}) {
+            std::shuffle(order.begin(), order.end(), rng);
+            parallel_for(n_, BUILD_MIN_CHUNK, [&](size_t begin, size_t end) {
+                std::vector<uint32_t> visit_tag(n_, 0);
+                uint32_t epoch = 0;
+                for (size_t i = begin; i < end; ++i)
+                    insert_point(order[i], alpha, visit_tag, ++epoch);
+            });
+        }
+    }
+
+    const float *vector(size_t id) const {
+        return data_.data() + id * dim_;
+    }
+
+    // 全部 n * dim 个归一化后的分量，连续存放
+    const float *data() const {
+        return data_.data();
+    }
+
+    const std::vector<uint32_t> &neighbors(size_t id) const {
+        return graph_[id];
+    }
+
+    const std::vector<uint32_t> &entry_points() const {
+        return entry_points_;
+    }
+
+private:
+    float distance(const float *a, const float *b) const {
+        return std::max(0.0f, 2.0f - 2.0f * vec_dot(a, b, dim_));
+    }
+
+    // 离均值方向最近的点
+    uint32_t find_medoid() const {
+        std::vector<float> mean(dim_, 0.0f);
+        for (size_t i = 0; i < n_; ++i)
+            for (size_t d = 0; d < dim_; ++d)
+                mean[d] += data_[i * dim_ + d];
+        uint32_t best  = 0;
+        float best_dot = -std::numeric_limits<float>::max();
+        for (size_t i = 0; i < n_; ++i) {
+            float dot = vec_dot(mean.data(), vector(i), dim_);
+            if (dot > best_dot) {
+                best_dot = dot;
+                best     = static_cast<uint32_t>(i);
+            }
+        }
+        return best;
+    }
+
+    std::vector<uint32_t> copy_neighbors(uint32_t id) {
+        std::lock_guard<std::mutex> lock(locks_[id]);
+        return graph_[id];
+    }
+
+    // 从最近的若干入口点出发的贪心搜索，返回所有被扩展过的点及其距离
+    std::vector<Candidate> greedy_search(const float *query, std::vector<uint32_t> &visit_tag, uint32_t epoch) {
+        std::vector<Candidate> list;
+        std::vector<Candidate> expanded;
+        for (uint32_t entry : entry_points_) {
+            visit_tag[entry] = epoch;
+            insert_candidate(list, options_.build_L, {distance(query, vector(entry)), entry, false});
+        }
+        while (true) {
+            auto it = std::find_if(list.begin(), list.end(), [](const Candidate &c) { return !c.expanded; });
+            if (it == list.end())
+                break;
+            it->expanded = true;
+            expanded.push_back(*it);
+            uint32_t current = it->id;
+            for (uint32_t nb : copy_neighbors(current)) {
+                if (visit_tag[nb] == epoch)
+                    continue;
+                visit_tag[nb] = epoch;
+                insert_candidate(list, options_.build_L, {distance(query, vector(nb)), nb, false});
+            }
+        }
+        return expanded;
+    }
+
+    // RobustPrune：按距离从近到远选邻居，已被某个选中邻居 "覆盖" (alpha * d(选中, c) <= d(p, c)) 的候选不再考虑
+    std::vector<uint32_t> robust_prune(uint32_t p, std::vector<Candidate> candidates, float alpha) const {
+        std::sort(candidates.begin(), candidates.end(), closer);
+        candidates.erase(std::unique(candidates.begin(), candidates.end(),
+                                     [](const Candidate &a, const Candidate &b) { return a.id == b.id; }),
+                         candidates.end());
+        std::vector<uint32_t> result;
+        std::vector<bool> removed(candidates.size(), false);
+        for (size_t i = 0; i < candidates.size() && result.size() < options_.R; ++i) {
+            if (removed[i] || candidates[i].id == p)
+                continue;
+            uint32_t chosen = candidates[i].id;
+            result.push_back(chosen);
+            for (size_t j = i + 1; j < candidates.size(); ++j) {
+                if (!removed[j] && alpha * distance(vector(chosen), vector(candidates[j].id)) <= candidates[j].dist)
+                    removed[j] = true;
+            }
+        }
+        return result;
+    }
+
+    std::vector<Candidate> with_distances(uint32_t p, const std::vector<uint32_t> &ids) const {
+        std::vector<Candidate> candidates;
+        candidates.reserve(ids.size());
+        for (uint32_t id : ids)
+            candidates.push_back({distance(vector(p), vector(id)), id, false});
+        return candidates;
+    }
+
+    void insert_point(uint32_t p, float alpha, std::vector<uint32_t> &visit_tag, uint32_t epoch) {
+        std::vector<Candidate> candidates = greedy_search(vector(p), visit_tag, epoch);
+        std::vector<Candidate> current    = with_distances(p, copy_neighbors(p));
+        candidates.insert(candidates.end(), current.begin(), current.end());
+        std::vector<uint32_t> pruned = robust_prune(p, std::move(candidates), alpha);
+        {
+            std::lock_guard<std::mutex> lock(locks_[p]);
+            graph_[p] = pruned;
+        }
+        // 反向边，超出 R 时对邻居重新剪枝
+        for (uint32_t nb : pruned) {
+            std::lock_guard<std::mutex> lock(locks_[nb]);
+            std::vector<uint32_t> &list = graph_[nb];
+            if (std::find(list.begin(), list.end(), p) != list.end())
+                continue;
+            if (list.size() < options_.R) {
+                list.push_back(p);
+            } else {
+                std::vector<uint32_t> ids = list;
+                ids.push_back(p);
+                list = robust_prune(nb, with_distances(nb, ids), alpha);
+            }
+        }
+    }
+
+    size_t n_;
+    size_t dim_;
+    VamanaOptions options_;
+    std::vector<float> data_;
+    std::vector<std::vector<uint32_t>> graph_;
+    std::unique_ptr<std::mutex[]> locks_;
+    std::vector<uint32_t> entry_points_;
+};
+
+} // namespace
+
+bool vamana_build_index(const std::string &path, const std::vector<uint64_t> &keys, std::vector<float> vectors,
+                        size_t dim, const VamanaOptions &options) {
+    const size_t n = keys.size();
+    if (n == 0 || dim == 0 || options.R == 0) {
+        std::cerr << "[ERROR] Vamana build: nothing to index (n=" << n << ", dim=" << dim << ")." << std::endl;
+        return false;
+    }
+    if (n > std::numeric_limits<uint32_t>::max()) {
+        std::cerr << "[ERROR] Vamana build: too many vectors (" << n << ")." << std::endl;
+        return false;
+    }
+    size_t subspaces = options.pq_subspaces > 0 ? options.pq_subspaces : std::max<size_t>(1, dim / 8);
+    if (dim % subspaces != 0) {
+        std::cerr << "[ERROR] Vamana build: pq_subspaces=" << subspaces << " does not divide dim=" << dim << std::endl;
+        return false;
+    }
+
+    if (vectors.size() != n * dim) {
+        std::cerr << "[ERROR] Vamana build: " << vectors.size() << " components for " << n << " vectors of dim " << dim
+                  << std::endl;
+        return false;
+    }
+
+    VamanaBuilder builder(std::move(vectors), n, dim, options);
+    builder.build(static_cast<uint32_t>(n * 2654435761u));
+
+    // PQ 直接在构建器中归一化后的向量上训练
+    ProductQuantizer pq;
+    if (!pq.train(builder.data(), n, dim, subspaces, 42))
+        return false;
+    std::vector<uint8_t> codes(n * subspaces);
+    parallel_for(n, BUILD_MIN_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            pq.encode(builder.vector(i), codes.data() + i * subspaces);
+    });
+
+    VamanaIndexHeader header{};
+    std::memcpy(header.magic, VAMANA_INDEX_MAGIC, sizeof(header.magic));
+    header.version          = VAMANA_INDEX_VERSION;
+    header.dim              = static_cast<uint32_t>(dim);
+    header.R                = options.R;
+    header.record_size      = static_cast<uint32_t>(sizeof(uint64_t) + dim * sizeof(float) + sizeof(uint32_t) +
+                                                    options.R * sizeof(uint32_t));
+    header.nodes_per_sector = static_cast<uint32_t>(VAMANA_SECTOR_SIZE / header.record_size);
+    header.sectors_per_node =
+        header.nodes_per_sector > 0 ? 1
+                                    : static_cast<uint32_t>(align_sector(header.record_size) / VAMANA_SECTOR_SIZE);
+    header.pq_subspaces     = static_cast<uint32_t>(subspaces);
+    header.num_entry_points = static_cast<uint32_t>(builder.entry_points().size());
+    header.num_nodes        = n;
+    header.medoid           = builder.entry_points()[0];
+    header.node_offset  = VAMANA_SECTOR_SIZE;
+    uint64_t node_sectors = header.nodes_per_sector > 0 ? (n + header.nodes_per_sector - 1) / header.nodes_per_sector
+                                                        : n * header.sectors_per_node;
+    header.pq_offset    = header.node_offset + node_sectors * VAMANA_SECTOR_SIZE;
+    header.codes_offset = header.pq_offset + pq.codebook().size() * sizeof(float);
+    header.entry_offset = header.codes_offset + codes.size();
+    header.file_size    = header.entry_offset + header.num_entry_points * sizeof(uint32_t);
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "[ERROR] Vamana build: cannot open " << tmp_path << " for writing." << std::endl;
+        return false;
+    }
+    std::vector<char> sector(VAMANA_SECTOR_SIZE, 0);
+    std::memcpy(sector.data(), &header, sizeof(header));
+    out.write(sector.data(), sector.size());
+
+    // 逐扇区写节点记录
+    const size_t per_write = header.nodes_per_sector > 0 ? header.nodes_per_sector : 1;
+    const size_t chunk     = header.nodes_per_sector > 0 ? VAMANA_SECTOR_SIZE
+                                                         : header.sectors_per_node * VAMANA_SECTOR_SIZE;
+    std::vector<char> block(chunk);
+    for (size_t first = 0; first < n; first += per_write) {
+        std::fill(block.begin(), block.end(), 0);
+        for (size_t i = first; i < std::min(n, first + per_write); ++i) {
+            char *rec = block.data() + (i - first) * header.record_size;
+            uint64_t key = keys[i];
+            std::memcpy(rec, &key, sizeof(key));
+            rec += sizeof(key);
+            std::memcpy(rec, builder.vector(i), dim * sizeof(float));
+            rec += dim * sizeof(float);
+            const std::vector<uint32_t> &nbrs = builder.neighbors(i);
+            uint32_t count = static_cast<uint32_t>(std::min<size_t>(nbrs.size(), options.R));
+            std::memcpy(rec, &count, sizeof(count));
+            rec += sizeof(count);
+            std::memcpy(rec, nbrs.data(), count * sizeof(uint32_t));
+        }
+        out.write(block.data(), block.size());
+    }
+    out.write(reinterpret_cast<const char *>(pq.codebook().data()), pq.codebook().size() * sizeof(float));
+    out.write(reinterpret_cast<const char *>(codes.data()), codes.size());
+    out.write(reinterpret_cast<const char *>(builder.entry_points().data()),
+              builder.entry_points().size() * sizeof(uint32_t));
+    out.close();
+    if (!out) {
+        std::cerr << "[ERROR] Vamana build: failed writing " << tmp_path << std::endl;
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "[ERROR] Vamana build: cannot rename " << tmp_path << " to " << path << ": " << ec.message()
+                  << std::endl;
+        return false;
+    }
+    std::cout << "[INFO] Built Vamana disk index " << path << ": " << n << " nodes, R=" << options.R
+              << ", PQ " << subspaces << " bytes/vector, " << header.file_size / (1024 * 1024) << " MiB on disk."
+              << std::endl;
+    return true;
+}
+
+VamanaIndex::~VamanaIndex() {
+    close();
+}
+
+void VamanaIndex::close() {
+#ifdef LSM_KV_HAVE_PREAD
+    if (fd_ >= 0)
+        ::close(fd_);
+#endif
+    fd_ = -1;
+    if (stream_.is_open())
+        stream_.close();
+    header_ = VamanaIndexHeader{};
+    pq_     = ProductQuantizer();
+    codes_.clear();
+    codes_.shrink_to_fit();
+    entry_points_.clear();
+    path_.clear();
+}
+
+bool VamanaIndex::read_at(uint64_t offset, char *dst, size_t len) const {
+#ifdef LSM_KV_HAVE_PREAD
+    if (fd_ >= 0) {
+        while (len > 0) {
+            ssize_t got = ::pread(fd_, dst, len, static_cast<off_t>(offset));
+            if (got <= 0)
+                return false;
+            dst += got;
+            offset += static_cast<uint64_t>(got);
+            len -= static_cast<size_t>(got);
+        }
+        return true;
+    }
+#endif
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    stream_.clear();
+    stream_.seekg(static_cast<std::streamoff>(offset));
+    return static_cast<bool>(stream_.read(dst, static_cast<std::streamsize>(len)));
+}
+
+bool VamanaIndex::open(const std::string &path) {
+    close();
+#ifdef LSM_KV_HAVE_PREAD
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0)
+        return false;
+#else
+    stream_.open(path, std::ios::binary);
+    if (!stream_.is_open())
+        return false;
+#endif
+    VamanaIndexHeader header{};
+    if (!read_at(0, reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, VAMANA_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != VAMANA_INDEX_VERSION || header.dim == 0 || header.num_nodes == 0 ||
+        header.medoid >= header.num_nodes || header.pq_subspaces == 0 || header.dim % header.pq_subspaces != 0 ||
+        header.num_entry_points == 0 || header.entry_offset != header.codes_offset + header.num_nodes * header.pq_subspaces ||
+        header.entry_offset + header.num_entry_points * sizeof(uint32_t) != header.file_size) {
+        std::cerr << "[ERROR] Invalid Vamana index file: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    std::vector<float> codebook(ProductQuantizer::NUM_CENTROIDS * header.dim);
+    codes_.resize(header.num_nodes * header.pq_subspaces);
+    entry_points_.resize(header.num_entry_points);
+    if (!read_at(header.pq_offset, reinterpret_cast<char *>(codebook.data()), codebook.size() * sizeof(float)) ||
+        !read_at(header.codes_offset, reinterpret_cast<char *>(codes_.data()), codes_.size()) ||
+        !read_at(header.entry_offset, reinterpret_cast<char *>(entry_points_.data()),
+                 entry_points_.size() * sizeof(uint32_t)) ||
+        !pq_.load(header.dim, header.pq_subspaces, std::move(codebook))) {
+        std::cerr << "[ERROR] Failed to read PQ data from Vamana index file: " << path << std::endl;
+        close();
+        return false;
+    }
+    header_ = header;
+    path_   = path;
+    return true;
+}
+
+bool VamanaIndex::read_nodes(const std::vector<uint32_t> &ids, std::vector<char> &buffer, size_t &reads) const {
+    const size_t spn = header_.nodes_per_sector > 0 ? 1 : header_.sectors_per_node;
+    // 需要的扇区去重排序，连续的扇区合并成一次读
+    std::vector<uint64_t> sectors;
+    for (uint32_t id : ids)
+        sectors.push_back(sector_of(id));
+    std::sort(sectors.begin(), sectors.end());
+    sectors.erase(std::unique(sectors.begin(), sectors.end()), sectors.end());
+
+    std::vector<char> raw(sectors.size() * spn * VAMANA_SECTOR_SIZE);
+    for (size_t i = 0; i < sectors.size();) {
+        size_t j = i + 1;
+        while (j < sectors.size() && sectors[j] == sectors[j - 1] + spn)
+            ++j;
+        if (!read_at(header_.node_offset + sectors[i] * VAMANA_SECTOR_SIZE, raw.data() + i * spn * VAMANA_SECTOR_SIZE,
+                     (j - i) * spn * VAMANA_SECTOR_SIZE))
+            return false;
+        ++reads;
+        i = j;
+    }
+
+    buffer.resize(ids.size() * header_.record_size);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        size_t slot = std::lower_bound(sectors.begin(), sectors.end(), sector_of(ids[i])) - sectors.begin();
+        size_t in_sector =
+            header_.nodes_per_sector > 0 ? (ids[i] % header_.nodes_per_sector) * header_.record_size : 0;
+        std::memcpy(buffer.data() + i * header_.record_size, raw.data() + slot * spn * VAMANA_SECTOR_SIZE + in_sector,
+                    header_.record_size);
+    }
+    return true;
+}
+
+std::vector<VamanaIndex::ScoredKey> VamanaIndex::search(const float *query, size_t m, size_t L, size_t beam_width,
+                                                        SearchStats *stats) const {
+    std::vector<ScoredKey> results;
+    if (!is_open() || m == 0)
+        return results;
+    const size_t dim = header_.dim;
+    L                = std::max(L, m);
+    beam_width       = std::max<size_t>(1, beam_width);
+
+    std::vector<float> q(query, query + dim);
+    float norm = std::sqrt(vec_dot(q.data(), q.data(), dim));
+    if (norm > 1e-12f) {
+        for (float &v : q)
+            v /= norm;
+    }
+    std::vector<float> table(header_.pq_subspaces * ProductQuantizer::NUM_CENTROIDS);
+    pq_.distance_table(q.data(), table.data());
+    auto pq_distance = [&](uint32_t id) {
+        return pq_.distance(table.data(), codes_.data() + static_cast<size_t>(id) * header_.pq_subspaces);
+    };
+
+    // 候选列表按 PQ 距离导航；扩展过的节点用读到的全精度向量算出精确距离
+    std::vector<Candidate> list;
+    std::unordered_set<uint32_t> visited;
+    std::vector<std::pair<float, uint64_t>> exact; // {精确距离, key}
+    for (uint32_t entry : entry_points_) {
+        if (entry < header_.num_nodes && visited.insert(entry).second)
+            insert_candidate(list, L, {pq_distance(entry), entry, false});
+    }
+
+    SearchStats local;
+    std::vector<uint32_t> beam;
+    std::vector<char> records;
+    while (true) {
+        beam.clear();
+        for (Candidate &cand : list) {
+            if (!cand.expanded) {
+                cand.expanded = true;
+                beam.push_back(cand.id);
+                if (beam.size() >= beam_width)
+                    break;
+            }
+        }
+        if (beam.empty())
+            break;
+        if (!read_nodes(beam, records, local.sector_reads)) {
+            std::cerr << "[ERROR] Failed to read nodes from Vamana index file: " << path_ << std::endl;
+            break;
+        }
+        local.hops++;
+        local.nodes_read += beam.size();
+        for (size_t i = 0; i < beam.size(); ++i) {
+            const char *rec = records.data() + i * header_.record_size;
+            uint64_t key;
+            std::memcpy(&key, rec, sizeof(key));
+            const float *vec = reinterpret_cast<const float *>(rec + sizeof(key));
+            exact.emplace_back(std::max(0.0f, 2.0f - 2.0f * vec_dot(q.data(), vec, dim)), key);
+
+            uint32_t count;
+            std::memcpy(&count, rec + sizeof(key) + dim * sizeof(float), sizeof(count));
+            count = std::min(count, header_.R);
+            const char *nbr_ptr = rec + sizeof(key) + dim * sizeof(float) + sizeof(count);
+            for (uint32_t j = 0; j < count; ++j) {
+                uint32_t nb;
+                std::memcpy(&nb, nbr_ptr + j * sizeof(uint32_t), sizeof(nb));
+                if (nb >= header_.num_nodes || !visited.insert(nb).second)
+                    continue;
+                insert_candidate(list, L, {pq_distance(nb), nb, false});
+            }
+        }
+    }
+    if (stats)
+        *stats = local;
+
+    size_t keep = std::min(m, exact.size());
+    std::partial_sort(exact.begin(), exact.begin() + keep, exact.end());
+    results.reserve(keep);
+    for (size_t i = 0; i < keep; ++i)
+        results.emplace_back(1.0f - exact[i].first / 2.0f, exact[i].second);
+    return results;
+}
@@ -0,0 +1,125 @@
+#ifndef LSM_KV_VAMANA_INDEX_H
+#define LSM_KV_VAMANA_INDEX_H
+
+#include "product_quantizer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 磁盘常驻的 Vamana 图索引 (DiskANN)。图和全精度向量按 4 KiB 扇区存放在文件里，内存中只保留 PQ 编码，
+// 查询用 PQ 距离导航，每轮把 beam_width 个待扩展节点的扇区合并读出，再用读到的全精度向量重排:
+//
+//   [VamanaIndexHeader]  占第一个扇区
+//   [节点段]   每个节点一条记录 {key, 归一化向量 float[dim], 邻居数, 邻居 uint32[R]}，
+//              记录不跨扇区：一个扇区放 nodes_per_sector 条，或一条记录占 sectors_per_node 个扇区
+//   [PQ 段]    码本 float[pq_subspaces * 256 * (dim / pq_subspaces)]，之后是 num_nodes * pq_subspaces 字节的编码
+//   [入口段]   num_entry_points 个 uint32 节点号，第一个是 medoid
+//
+// 只从 medoid 出发时，簇结构明显的数据上图可能在簇之间几乎不连通 (每个点的 R 条边都给了同簇的近邻)。
+// 因此另存一组均匀抽样的入口点，查询开始时用 PQ 距离从中挑出最近的若干个作为起点，不需要额外读盘
+// 距离是归一化向量的平方 L2 (= 2 - 2 * 余弦相似度)，排序与余弦一致
+
+constexpr char VAMANA_INDEX_MAGIC[8]    = {'L', 'S', 'M', 'V', 'A', 'M', 'A', '\0'};
+constexpr uint32_t VAMANA_INDEX_VERSION = 1;
+constexpr uint64_t VAMANA_SECTOR_SIZE   = 4096;
+
+struct VamanaOptions {
+    uint32_t R             = 64;   // 最大出度
+    uint32_t build_L       = 100;  // 构建时的搜索列表长度
+    float alpha            = 1.2f; // 第二遍剪枝的放宽系数，越大长边越多
+    uint32_t pq_subspaces  = 0;    // PQ 段数，0 表示取 dim / 8 (须整除 dim)
+    uint32_t search_L      = 64;   // 默认查询列表长度
+    uint32_t beam_width    = 4;    // 每轮一起读取的节点数
+};
+
+struct VamanaIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t R;
+    uint32_t record_size;      // 每条节点记录的字节数
+    uint32_t nodes_per_sector; // 0 表示一条记录占多个扇区
+    uint32_t sectors_per_node;
+    uint32_t pq_subspaces;
+    uint32_t num_entry_points;
+    uint64_t num_nodes;
+    uint64_t medoid;
+    uint64_t node_offset;
+    uint64_t pq_offset;
+    uint64_t codes_offset;
+    uint64_t entry_offset;
+    uint64_t file_size;
+};
+
+// 用 n 个向量 (keys.size() * dim 个分量连续存放，与 keys 一一对应) 在内存中构建 Vamana 图并写入 path。
+// vectors 在构建中被就地归一化，调用方不再需要时可 std::move 进来，避免再复制一份
+bool vamana_build_index(const std::string &path, const std::vector<uint64_t> &keys, std::vector<float> vectors,
+                        size_t dim, const VamanaOptions &options);
+
+// 只读的磁盘索引。open 只把头和 PQ 段读进内存；search 为 const，可并发调用
+class VamanaIndex {
+public:
+    using ScoredKey = std::pair<float, uint64_t>; // {similarity, key}
+
+    struct SearchStats {
+        size_t hops         = 0; // 读取轮数
+        size_t nodes_read   = 0;
+        size_t sector_reads = 0; // 合并后的读请求数
+    };
+
+    VamanaIndex() = default;
+    ~VamanaIndex();
+
+    VamanaIndex(const VamanaIndex &)            = delete;
+    VamanaIndex &operator=(const VamanaIndex &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+
+    bool is_open() const {
+        return header_.num_nodes > 0;
+    }
+
+    size_t size() const {
+        return header_.num_nodes;
+    }
+
+    size_t dim() const {
+        return header_.dim;
+    }
+
+    // 常驻内存的字节数 (PQ 码本 + 编码 + 入口点)
+    size_t memory_bytes() const {
+        return codes_.size() + pq_.codebook().size() * sizeof(float) + entry_points_.size() * sizeof(uint32_t);
+    }
+
+    // 返回相似度最高的至多 m 个 {similarity, key}，按相似度降序。L 为搜索列表长度 (不小于 m)
+    std::vector<ScoredKey> search(const float *query, size_t m, size_t L, size_t beam_width,
+                                  SearchStats *stats = nullptr) const;
+
+private:
+    // 读出 ids 对应的节点记录到 buffer (每条 record_size 字节)，相邻扇区合并为一次读取
+    bool read_nodes(const std::vector<uint32_t> &ids, std::vector<char> &buffer, size_t &reads) const;
+    bool read_at(uint64_t offset, char *dst, size_t len) const;
+
+    uint64_t sector_of(uint32_t id) const {
+        return header_.nodes_per_sector > 0 ? id / header_.nodes_per_sector
+                                            : static_cast<uint64_t>(id) * header_.sectors_per_node;
+    }
+
+    VamanaIndexHeader header_{};
+    ProductQuantizer pq_;
+    std::vector<uint8_t> codes_;
+    std::vector<uint32_t> entry_points_;
+    std::string path_;
+    int fd_ = -1;                   // POSIX 下用 pread，可并发读取
+    mutable std::ifstream stream_;  // 其它平台的退化路径，由 read_mutex_ 保护
+    mutable std::mutex read_mutex_;
+};
+
+#endif // LSM_KV_VAMANA_INDEX_H
@@ -0,0 +1,518 @@
+#include "vector_distance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define LSM_KV_VEC_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LSM_KV_VEC_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define LSM_KV_VEC_NEON 1
+#endif
+
+#if defined(LSM_KV_VEC_AVX2) && defined(__F16C__)
+#define LSM_KV_VEC_F16C 1
+#endif
+#if defined(LSM_KV_VEC_AVX2) && defined(__AVX512BF16__) && defined(__AVX512F__)
+#define LSM_KV_VEC_AVX512_BF16 1
+#endif
+
+namespace {
+
+#if defined(LSM_KV_VEC_AVX2)
+inline float hsum(__m256 v) {
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo        = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo        = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+#elif defined(LSM_KV_VEC_SSE2)
+inline float hsum(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+#endif
+
+// 标量转换 (F. Giesen 的 float_to_half_fast3_rtne / half_to_float)
+inline uint16_t fp16_from_fp32_scalar(float value) {
+    const uint32_t f32_infty = 255u << 23;
+    const uint32_t f16_max   = (127u + 16u) << 23;
+    const uint32_t denorm_magic_bits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+    uint32_t f;
+    std::memcpy(&f, &value, 4);
+    const uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+    uint16_t o;
+    if (f >= f16_max) {
+        o = f > f32_infty ? 0x7e00 : 0x7c00; // NaN / inf
+    } else if (f < (113u << 23)) {
+        float fv, magic;
+        std::memcpy(&fv, &f, 4);
+        std::memcpy(&magic, &denorm_magic_bits, 4);
+        fv += magic; // 非规格数：借助浮点加法完成舍入
+        uint32_t r;
+        std::memcpy(&r, &fv, 4);
+        o = static_cast<uint16_t>(r - denorm_magic_bits);
+    } else {
+        const uint32_t mant_odd = (f >> 13) & 1;
+        f += ((15u - 127u) << 23) + 0xfffu;
+        f += mant_odd;
+        o = static_cast<uint16_t>(f >> 13);
+    }
+    return static_cast<uint16_t>(o | (sign >> 16));
+}
+
+inline float fp16_to_fp32_scalar(uint16_t h) {
+    const uint32_t shifted_exp = 0x7c00u << 13;
+    uint32_t o         = (h & 0x7fffu) << 13;
+    const uint32_t exp = shifted_exp & o;
+    o += (127u - 15u) << 23;
+    if (exp == shifted_exp) {
+        o += (128u - 16u) << 23; // inf / NaN
+    } else if (exp == 0) {
+        o += 1u << 23; // 非规格数
+        const uint32_t magic_bits = 113u << 23;
+        float fo, magic;
+        std::memcpy(&fo, &o, 4);
+        std::memcpy(&magic, &magic_bits, 4);
+        fo -= magic;
+        std::memcpy(&o, &fo, 4);
+    }
+    o |= static_cast<uint32_t>(h & 0x8000u) << 16;
+    float result;
+    std::memcpy(&result, &o, 4);
+    return result;
+}
+
+inline uint16_t bf16_from_fp32_scalar(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, 4);
+    if ((x & 0x7fffffffu) > 0x7f800000u)
+        return static_cast<uint16_t>((x >> 16) | 0x40); // 保持 NaN
+    x += 0x7fffu + ((x >> 16) & 1);
+    return static_cast<uint16_t>(x >> 16);
+}
+
+inline float bf16_to_fp32_scalar(uint16_t h) {
+    uint32_t x = static_cast<uint32_t>(h) << 16;
+    float result;
+    std::memcpy(&result, &x, 4);
+    return result;
+}
+
+#if defined(LSM_KV_VEC_AVX2)
+inline __m256 load_bf16x8(const uint16_t *p) {
+    __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+}
+#endif
+
+} // namespace
+
+float vec_dot(const float *a, const float *b, size_t dim) {
+    size_t i = 0;
+    float dot = 0.0f;
+#if defined(LSM_KV_VEC_AVX2)
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    dot = hsum(_mm256_add_ps(acc0, acc1));
+#elif defined(LSM_KV_VEC_SSE2)
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    dot = hsum(_mm_add_ps(acc0, acc1));
+#elif defined(LSM_KV_VEC_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    dot = vaddvq_f32(vaddq_f32(acc0, acc1));
+#else
+    float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (; i + 4 <= dim; i += 4) {
+        acc[0] += a[i] * b[i];
+        acc[1] += a[i + 1] * b[i + 1];
+        acc[2] += a[i + 2] * b[i + 2];
+        acc[3] += a[i + 3] * b[i + 3];
+    }
+    dot = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+    for (; i < dim; ++i) {
+        dot += a[i] * b[i];
+    }
+    return dot;
+}
+
+void vec_dot_and_norm(const float *a, const float *b, size_t dim, float &dot, float &norm_b) {
+    size_t i = 0;
+    dot    = 0.0f;
+    norm_b = 0.0f;
+#if defined(LSM_KV_VEC_AVX2)
+    __m256 acc_dot = _mm256_setzero_ps(), acc_norm = _mm256_setzero_ps();
+    for (; i + 8 <= dim; i += 8) {
+        __m256 vb = _mm256_loadu_ps(b + i);
+        acc_dot   = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), vb, acc_dot);
+        acc_norm  = _mm256_fmadd_ps(vb, vb, acc_norm);
+    }
+    dot    = hsum(acc_dot);
+    norm_b = hsum(acc_norm);
+#elif defined(LSM_KV_VEC_SSE2)
+    __m128 acc_dot = _mm_setzero_ps(), acc_norm = _mm_setzero_ps();
+    for (; i + 4 <= dim; i += 4) {
+        __m128 vb = _mm_loadu_ps(b + i);
+        acc_dot   = _mm_add_ps(acc_dot, _mm_mul_ps(_mm_loadu_ps(a + i), vb));
+        acc_norm  = _mm_add_ps(acc_norm, _mm_mul_ps(vb, vb));
+    }
+    dot    = hsum(acc_dot);
+    norm_b = hsum(acc_norm);
+#elif defined(LSM_KV_VEC_NEON)
+    float32x4_t acc_dot = vdupq_n_f32(0.0f), acc_norm = vdupq_n_f32(0.0f);
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t vb = vld1q_f32(b + i);
+        acc_dot        = vfmaq_f32(acc_dot, vld1q_f32(a + i), vb);
+        acc_norm       = vfmaq_f32(acc_norm, vb, vb);
+    }
+    dot    = vaddvq_f32(acc_dot);
+    norm_b = vaddvq_f32(acc_norm);
+#else
+    float acc_dot[2] = {0.0f, 0.0f}, acc_norm[2] = {0.0f, 0.0f};
+    for (; i + 2 <= dim; i += 2) {
+        acc_dot[0] += a[i] * b[i];
+        acc_dot[1] += a[i + 1] * b[i + 1];
+        acc_norm[0] += b[i] * b[i];
+        acc_norm[1] += b[i + 1] * b[i + 1];
+    }
+    dot    = acc_dot[0] + acc_dot[1];
+    norm_b = acc_norm[0] + acc_norm[1];
+#endif
+    for (; i < dim; ++i) {
+        dot += a[i] * b[i];
+        norm_b += b[i] * b[i];
+    }
+}
+
+void fp32_to_fp16(const float *src, uint16_t *dst, size_t n) {
+    size_t i = 0;
+#if defined(LSM_KV_VEC_F16C)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), h);
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] = fp16_from_fp32_scalar(src[i]);
+}
+
+void fp16_to_fp32(const uint16_t *src, float *dst, size_t n) {
+    size_t i = 0;
+#if defined(LSM_KV_VEC_F16C)
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i))));
+#endif
+    for (; i < n; ++i)
+        dst[i] = fp16_to_fp32_scalar(src[i]);
+}
+
+void fp32_to_bf16(const float *src, uint16_t *dst, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = bf16_from_fp32_scalar(src[i]);
+}
+
+void bf16_to_fp32(const uint16_t *src, float *dst, size_t n) {
+    size_t i = 0;
+#if defined(LSM_KV_VEC_AVX2)
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, load_bf16x8(src + i));
+#endif
+    for (; i < n; ++i)
+        dst[i] = bf16_to_fp32_scalar(src[i]);
+}
+
+void vec_dot_and_norm_fp16(const float *a, const uint16_t *b, size_t dim, float &dot, float &norm_b) {
+    size_t i = 0;
+    dot    = 0.0f;
+    norm_b = 0.0f;
+#if defined(LSM_KV_VEC_F16C)
+    __m256 acc_dot = _mm256_setzero_ps(), acc_norm = _mm256_setzero_ps();
+    for (; i + 8 <= dim; i += 8) {
+        __m256 vb = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+        acc_dot   = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), vb, acc_dot);
+        acc_norm  = _mm256_fmadd_ps(vb, vb, acc_norm);
+    }
+    dot    = hsum(acc_dot);
+    norm_b = hsum(acc_norm);
+#endif
+    for (; i < dim; ++i) {
+        float vb = fp16_to_fp32_scalar(b[i]);
+        dot += a[i] * vb;
+        norm_b += vb * vb;
+    }
+}
+
+void vec_dot_and_norm_bf16(const float *a, const uint16_t *b, size_t dim, float &dot, float &norm_b) {
+    size_t i = 0;
+    dot    = 0.0f;
+    norm_b = 0.0f;
+#if defined(LSM_KV_VEC_AVX512_BF16)
+    // 每次 32 个分量：a 舍入成 bf16 对，b 直接按 bf16 对读入，dpbf16 把相邻两对的乘积累加到 float
+    __m512 acc_dot = _mm512_setzero_ps(), acc_norm = _mm512_setzero_ps();
+    for (; i + 32 <= dim; i += 32) {
+        __m512bh va = _mm512_cvtne2ps_pbh(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(a + i));
+        __m512bh vb = (__m512bh)_mm512_loadu_si512(b + i);
+        acc_dot     = _mm512_dpbf16_ps(acc_dot, va, vb);
+        acc_norm    = _mm512_dpbf16_ps(acc_norm, vb, vb);
+    }
+    dot    = _mm512_reduce_add_ps(acc_dot);
+    norm_b = _mm512_reduce_add_ps(acc_norm);
+#elif defined(LSM_KV_VEC_AVX2)
+    __m256 acc_dot = _mm256_setzero_ps(), acc_norm = _mm256_setzero_ps();
+    for (; i + 8 <= dim; i += 8) {
+        __m256 vb = load_bf16x8(b + i);
+        acc_dot   = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), vb, acc_dot);
+        acc_norm  = _mm256_fmadd_ps(vb, vb, acc_norm);
+    }
+    dot    = hsum(acc_dot);
+    norm_b = hsum(acc_norm);
+#endif
+    for (; i < dim; ++i) {
+        float vb = bf16_to_fp32_scalar(b[i]);
+        dot += a[i] * vb;
+        norm_b += vb * vb;
+    }
+}
+
+namespace {
+
+// 各存储精度的读取方式：scalar 读一个分量，load8 (有 simd 时) 把 8 个分量读成 __m256
+template <VectorPrecision P>
+struct StorageTraits;
+
+template <>
+struct StorageTraits<VectorPrecision::Float32> {
+    using word = float;
+    static float scalar(const word *b, size_t i) {
+        return b[i];
+    }
+#if defined(LSM_KV_VEC_AVX2)
+    static constexpr bool simd = true;
+    static __m256 load8(const word *b) {
+        return _mm256_loadu_ps(b);
+    }
+#endif
+};
+
+template <>
+struct StorageTraits<VectorPrecision::Float16> {
+    using word = uint16_t;
+    static float scalar(const word *b, size_t i) {
+        return fp16_to_fp32_scalar(b[i]);
+    }
+#if defined(LSM_KV_VEC_F16C)
+    static constexpr bool simd = true;
+    static __m256 load8(const word *b) {
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b)));
+    }
+#elif defined(LSM_KV_VEC_AVX2)
+    static constexpr bool simd = false;
+    static __m256 load8(const word *) {
+        return _mm256_setzero_ps();
+    }
+#endif
+};
+
+template <>
+struct StorageTraits<VectorPrecision::BFloat16> {
+    using word = uint16_t;
+    static float scalar(const word *b, size_t i) {
+        return bf16_to_fp32_scalar(b[i]);
+    }
+#if defined(LSM_KV_VEC_AVX2)
+    static constexpr bool simd = true;
+    static __m256 load8(const word *b) {
+        return load_bf16x8(b);
+    }
+#endif
+};
+
+template <DistanceMetric Metric>
+inline float finish_distance(float dot, float qq, float bb, float l2) {
+    if constexpr (Metric == DistanceMetric::L2) {
+        return l2;
+    } else if constexpr (Metric == DistanceMetric::InnerProduct) {
+        return 1.0f - dot;
+    } else {
+        if (qq < 1e-10f || bb < 1e-10f)
+            return 1.0f;
+        float sim = dot / (std::sqrt(qq) * std::sqrt(bb));
+        return 1.0f - std::clamp(sim, -1.0f, 1.0f);
+    }
+}
+
+// 非 AVX2 的编译目标 (以及 AVX-512 BF16 的 bf16 内积) 沿用上面按精度分派的运行时内核
+template <VectorPrecision P>
+inline void runtime_dot_and_norm(const float *q, const void *b, size_t n, float &dot, float &bb) {
+    if constexpr (P == VectorPrecision::Float16)
+        vec_dot_and_norm_fp16(q, static_cast<const uint16_t *>(b), n, dot, bb);
+    else if constexpr (P == VectorPrecision::BFloat16)
+        vec_dot_and_norm_bf16(q, static_cast<const uint16_t *>(b), n, dot, bb);
+    else
+        vec_dot_and_norm(q, static_cast<const float *>(b), n, dot, bb);
+}
+
+// Dim 为 0 时使用运行时的 dims；否则循环次数是编译期常量
+template <DistanceMetric Metric, VectorPrecision P, size_t Dim>
+float metric_distance(const float *q, const void *raw, size_t dims) {
+    using Traits      = StorageTraits<P>;
+    using word        = typename Traits::word;
+    const word *b     = static_cast<const word *>(raw);
+    const size_t n    = Dim != 0 ? Dim : dims;
+    float dot = 0.0f, qq = 0.0f, bb = 0.0f, l2 = 0.0f;
+    size_t i = 0;
+#if defined(LSM_KV_VEC_AVX512_BF16)
+    if constexpr (P == VectorPrecision::BFloat16 && Metric != DistanceMetric::L2) {
+        runtime_dot_and_norm<P>(q, raw, dims, dot, bb); // dpbf16 比逐个展开成 float 更快
+        if constexpr (Metric == DistanceMetric::Cosine)
+            qq = vec_dot(q, q, dims);
+        return finish_distance<Metric>(dot, qq, bb, l2);
+    }
+#endif
+#if defined(LSM_KV_VEC_AVX2)
+    if constexpr (Traits::simd) {
+        // 两组累加器交替使用，隐藏 FMA 延迟
+        __m256 acc_a[2] = {_mm256_setzero_ps(), _mm256_setzero_ps()}; // q·b 或 |q-b|²
+        __m256 acc_q[2] = {_mm256_setzero_ps(), _mm256_setzero_ps()}; // |q|² (Cosine)
+        __m256 acc_b[2] = {_mm256_setzero_ps(), _mm256_setzero_ps()}; // |b|² (Cosine)
+        auto step = [&](size_t at, int lane) {
+            __m256 vq = _mm256_loadu_ps(q + at);
+            __m256 vb = Traits::load8(b + at);
+            if constexpr (Metric == DistanceMetric::L2) {
+                __m256 diff = _mm256_sub_ps(vq, vb);
+                acc_a[lane] = _mm256_fmadd_ps(diff, diff, acc_a[lane]);
+            } else {
+                acc_a[lane] = _mm256_fmadd_ps(vq, vb, acc_a[lane]);
+                if constexpr (Metric == DistanceMetric::Cosine) {
+                    acc_q[lane] = _mm256_fmadd_ps(vq, vq, acc_q[lane]);
+                    acc_b[lane] = _mm256_fmadd_ps(vb, vb, acc_b[lane]);
+                }
+            }
+        };
+        for (; i + 16 <= n; i += 16) {
+            step(i, 0);
+            step(i + 8, 1);
+        }
+        for (; i + 8 <= n; i += 8)
+            step(i, 0);
+        float acc = hsum(_mm256_add_ps(acc_a[0], acc_a[1]));
+        if constexpr (Metric == DistanceMetric::L2) {
+            l2 = acc;
+        } else {
+            dot = acc;
+        }
+        if constexpr (Metric == DistanceMetric::Cosine) {
+            qq = hsum(_mm256_add_ps(acc_q[0], acc_q[1]));
+            bb = hsum(_mm256_add_ps(acc_b[0], acc_b[1]));
+        }
+    }
+#else
+    if constexpr (Metric != DistanceMetric::L2) {
+        runtime_dot_and_norm<P>(q, raw, dims, dot, bb);
+        if constexpr (Metric == DistanceMetric::Cosine)
+            qq = vec_dot(q, q, dims);
+        return finish_distance<Metric>(dot, qq, bb, l2);
+    }
+#endif
+    for (; i < n; ++i) {
+        float vb = Traits::scalar(b, i);
+        if constexpr (Metric == DistanceMetric::L2) {
+            float diff = q[i] - vb;
+            l2 += diff * diff;
+        } else {
+            dot += q[i] * vb;
+            if constexpr (Metric == DistanceMetric::Cosine) {
+                qq += q[i] * q[i];
+                bb += vb * vb;
+            }
+        }
+    }
+    return finish_distance<Metric>(dot, qq, bb, l2);
+}
+
+template <DistanceMetric Metric, VectorPrecision P>
+DistanceKernel kernel_for_dims(size_t dims) {
+    switch (dims) {
+    case 256:
+        return &metric_distance<Metric, P, 256>;
+    case 384:
+        return &metric_distance<Metric, P, 384>;
+    case 768:
+        return &metric_distance<Metric, P, 768>;
+    case 1024:
+        return &metric_distance<Metric, P, 1024>;
+    default:
+        return &metric_distance<Metric, P, 0>;
+    }
+}
+
+template <DistanceMetric Metric>
+DistanceKernel kernel_for_precision(VectorPrecision precision, size_t dims) {
+    switch (precision) {
+    case VectorPrecision::Float16:
+        return kernel_for_dims<Metric, VectorPrecision::Float16>(dims);
+    case VectorPrecision::BFloat16:
+        return kernel_for_dims<Metric, VectorPrecision::BFloat16>(dims);
+    default:
+        return kernel_for_dims<Metric, VectorPrecision::Float32>(dims);
+    }
+}
+
+} // namespace
+
+const char *distance_metric_name(DistanceMetric metric) {
+    switch (metric) {
+    case DistanceMetric::L2:
+        return "l2";
+    case DistanceMetric::InnerProduct:
+        return "ip";
+    default:
+        return "cosine";
+    }
+}
+
+DistanceKernel select_distance_kernel(DistanceMetric metric, VectorPrecision precision, size_t dims) {
+    switch (metric) {
+    case DistanceMetric::L2:
+        return kernel_for_precision<DistanceMetric::L2>(precision, dims);
+    case DistanceMetric::InnerProduct:
+        return kernel_for_precision<DistanceMetric::InnerProduct>(precision, dims);
+    default:
+        return kernel_for_precision<DistanceMetric::Cosine>(precision, dims);
+    }
+}
+
+const char *vec_kernel_name() {
+#if defined(LSM_KV_VEC_AVX512_BF16)
+    return "avx2+f16c+avx512bf16";
+#elif defined(LSM_KV_VEC_F16C)
+    return "avx2+f16c";
+#elif defined(LSM_KV_VEC_AVX2)
+    return "avx2";
+#elif defined(LSM_KV_VEC_SSE2)
+    return "sse2";
+#elif defined(LSM_KV_VEC_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
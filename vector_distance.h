@@ -0,0 +1,73 @@
+#ifndef LSM_KV_VECTOR_DISTANCE_H
+#define LSM_KV_VECTOR_DISTANCE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+// 向量内积内核。按编译目标选择 AVX2+FMA / SSE2 / NEON 实现，否则使用多累加器的标量循环。
+// 累加使用 float，精度对 768 维左右的余弦相似度足够
+
+// 返回 a·b
+float vec_dot(const float *a, const float *b, size_t dim);
+
+// 一次遍历同时求 a·b 与 b·b：查询向量的范数预先算好后，余弦相似度只需扫一遍候选向量
+void vec_dot_and_norm(const float *a, const float *b, size_t dim, float &dot, float &norm_b);
+
+// 16 位存储格式 (保存原始位)。fp32 -> 16 位采用就近舍入 (ties to even)，溢出得到 inf。
+// fp16 在有 F16C 时用硬件指令转换；bf16 即 fp32 的高 16 位
+void fp32_to_fp16(const float *src, uint16_t *dst, size_t n);
+void fp16_to_fp32(const uint16_t *src, float *dst, size_t n);
+void fp32_to_bf16(const float *src, uint16_t *dst, size_t n);
+void bf16_to_fp32(const uint16_t *src, float *dst, size_t n);
+
+// 同 vec_dot_and_norm，b 以 16 位保存，读入寄存器时转换。
+// bf16 在有 AVX-512 BF16 时把 a 也舍入到 bf16 后用 dpbf16 指令累加 (float 累加器)
+void vec_dot_and_norm_fp16(const float *a, const uint16_t *b, size_t dim, float &dot, float &norm_b);
+void vec_dot_and_norm_bf16(const float *a, const uint16_t *b, size_t dim, float &dot, float &norm_b);
+
+// 向量的存储精度 (StoredVector / SSTable 向量块)。fp16 / bf16 每个分量 2 字节
+enum class VectorPrecision : uint8_t {
+    Float32  = 0,
+    Float16  = 1,
+    BFloat16 = 2,
+};
+
+// 距离度量，距离越小越相近 (建库时选定，见 HNSWOptions::metric)：
+//   Cosine        1 - cos(q, b)，不要求向量归一化，一次遍历同时求 q·b、|q|²、|b|²
+//   L2            平方欧氏距离 |q - b|²
+//   InnerProduct  1 - q·b，适合按内积训练的模型；向量已归一化时与 Cosine 相同且省去范数计算
+enum class DistanceMetric : uint8_t {
+    Cosine       = 0,
+    L2           = 1,
+    InnerProduct = 2,
+};
+
+const char *distance_metric_name(DistanceMetric metric);
+
+// 距离内核：query 为 float，b 为按存储精度保存的原始分量，计算前 dims 维
+using DistanceKernel = float (*)(const float *query, const void *b, size_t dims);
+
+// 选出 (度量, 存储精度, 维度) 对应的内核，每个组合都是单独的模板实例。dims 为 256 / 384 / 768 / 1024 时
+// 返回按该维度编译的版本 (循环次数是常量，可完全展开)，调用时必须传入同一个 dims；其它维度返回通用版本
+DistanceKernel select_distance_kernel(DistanceMetric metric, VectorPrecision precision, size_t dims);
+
+// 把 p 所在的缓存行预取到各级缓存 (不阻塞)。GCC / Clang 用 __builtin_prefetch，MSVC x86 用 _mm_prefetch，
+// 其它编译器什么也不做
+inline void hnsw_prefetch(const void *p) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(static_cast<const char *>(p), _MM_HINT_T0);
+#else
+    (void)p;
+#endif
+}
+
+// 当前编译使用的实现名 ("avx2" / "avx2+f16c" / "sse2" / "neon" / "scalar" 等)，用于日志
+const char *vec_kernel_name();
+
+#endif // LSM_KV_VECTOR_DISTANCE_H